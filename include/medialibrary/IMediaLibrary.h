@@ -30,6 +30,7 @@
 #include "Types.h"
 #include "IQuery.h"
 #include "IMedia.h"
+#include "ISearchSession.h"
 
 namespace medialibrary
 {
@@ -47,6 +48,16 @@ struct SearchAggregate
     Query<IPlaylist> playlists;
 };
 
+struct SearchResults
+{
+    std::vector<AlbumPtr> albums;
+    std::vector<ArtistPtr> artists;
+    std::vector<GenrePtr> genres;
+    std::vector<MediaPtr> media;
+    std::vector<ShowPtr> shows;
+    std::vector<PlaylistPtr> playlists;
+};
+
 enum class SortingCriteria
 {
     /*
@@ -70,6 +81,9 @@ enum class SortingCriteria
     NbVideo,
     NbAudio,
     NbMedia,
+    // Valid for searches only. The best matches, as ranked by the full text
+    // search engine, come first unless the order is descending
+    Relevance,
 };
 
 
@@ -79,6 +93,117 @@ struct QueryParameters
     bool desc;
 };
 
+/*
+ * Durations are expressed in microseconds. The percentiles are approximated
+ * to the next power of 2.
+ */
+struct DurationStatistics
+{
+    uint64_t count;
+    uint64_t total;
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t max;
+};
+
+struct RequestStatistics
+{
+    // The SQL request, as it was compiled, without the bound parameters
+    std::string request;
+    DurationStatistics duration;
+    uint64_t nbRows;
+};
+
+struct ContentionStatistics
+{
+    // The number of times a request found the database locked by another
+    // connection
+    uint64_t nbBusy;
+    // The number of requests which failed after waiting for busyTimeout
+    uint64_t nbTimeouts;
+    // The number of times a group of requests was run again after failing
+    // because of a lock
+    uint64_t nbRetries;
+    // The time spent sleeping before trying to acquire a lock again
+    DurationStatistics busyWait;
+};
+
+struct DatabaseStatistics
+{
+    std::vector<RequestStatistics> requests;
+    // The time spent waiting for another writer to complete
+    DurationStatistics writeLockWait;
+    ContentionStatistics contention;
+};
+
+enum class SynchronousMode : uint8_t
+{
+    // Don't wait for the data to reach the disk. A power loss can corrupt
+    // the database.
+    Off,
+    // Only sync at critical points. In WAL mode, a power loss can roll back
+    // the last committed transactions, but the database stays consistent.
+    Normal,
+    // Sync before every commit. This is SQLite's default
+    Full,
+    Extra,
+};
+
+enum class TempStore : uint8_t
+{
+    // Use SQLite's compile time default
+    Default,
+    File,
+    Memory,
+};
+
+/**
+ * @brief The DatabaseTuning struct describes how the database connections
+ *        are configured.
+ *
+ * The default values are a reasonable profile for a desktop or mobile
+ * device, but a host with plenty of memory, or a very constrained one, should
+ * provide its own.
+ */
+struct DatabaseTuning
+{
+    // The maximum size of the page cache of each per-thread connection, which
+    // are used for writing, in KiB. 0 keeps SQLite's default
+    uint32_t cacheSize = 0;
+    // The maximum amount of the database file which can be memory mapped by
+    // each per-thread connection, in bytes. 0 keeps SQLite's default
+    uint64_t mmapSize = 0;
+    // The same settings for the read-only connections, which serve the most
+    // frequent requests and therefore benefit from larger values
+    uint32_t readCacheSize = 16 * 1024;
+    uint64_t readMmapSize = 256 * 1024 * 1024;
+    SynchronousMode synchronous = SynchronousMode::Full;
+#ifdef __ANDROID__
+    // https://github.com/mozilla/mentat/issues/505
+    // Should solve `Failed to run request <DELETE FROM File WHERE id_file = ?>: disk I/O error(6410)`
+    TempStore tempStore = TempStore::Memory;
+#else
+    TempStore tempStore = TempStore::Default;
+#endif
+    // How long a request waits for a lock to be released before failing, in
+    // milliseconds. The lock is polled with an increasing delay in the
+    // meantime, the library's background threads backing off longer than the
+    // other threads.
+    uint32_t busyTimeout = 500;
+    // The database page size, in bytes. This is only used when creating a
+    // database. 0 keeps SQLite's default
+    uint32_t pageSize = 0;
+    // The maximum number of read-only connections used to run queries
+    uint32_t nbReadConnections = 4;
+    // The number of entities allocated at once when listing records. An
+    // allocation is only released when none of its entities is used anymore.
+    // 0 allocates each entity separately
+    uint32_t entityPageSize = 64;
+    // The number of records converted by each transaction of a database
+    // model migration, which is also how often its progress gets saved
+    uint32_t migrationChunkSize = 1000;
+};
+
 enum class InitializeResult
 {
     //< Everything worked out fine
@@ -208,6 +333,16 @@ public:
      * @param success true if the thumbnail was generated, false if the generation failed
      */
     virtual void onMediaThumbnailReady( MediaPtr media, bool success ) = 0;
+    /**
+     * @brief onMigrationProgress Called while the database model gets
+     *        upgraded, from IMediaLibrary::initialize
+     *
+     * An interrupted migration resumes from its last checkpoint, and reports
+     * its progress from there.
+     * @param modelVersion The model version being migrated to
+     * @param percent The progress of this model version migration [0,100]
+     */
+    virtual void onMigrationProgress( uint32_t modelVersion, uint32_t percent ) = 0;
 };
 
 class IMediaLibrary
@@ -225,6 +360,7 @@ public:
      *                      created if required.
      * \param mlCallback    A pointer to an IMediaLibraryCb that will be invoked with various
      *                      events during the medialibrary lifetime.
+     * \param tuning        The settings to apply to all the database connections
      * \return true in case of success, false otherwise
      * If initialize returns Fail, this medialibrary must not be used
      * anymore, and should be disposed off.
@@ -232,7 +368,8 @@ public:
      * In case DbReset is returned, it is up to application to decide what
      * to do to repopulate the database.
      */
-    virtual InitializeResult initialize( const std::string& dbPath, const std::string& thumbnailPath, IMediaLibraryCb* mlCallback ) = 0;
+    virtual InitializeResult initialize( const std::string& dbPath, const std::string& thumbnailPath, IMediaLibraryCb* mlCallback,
+                                         const DatabaseTuning& tuning = DatabaseTuning{} ) = 0;
 
     /**
      * @brief start Starts the background thread and reload the medialibrary content
@@ -371,8 +508,60 @@ public:
                                        const QueryParameters* params = nullptr ) const = 0;
     virtual Query<IArtist> searchArtists( const std::string& name, bool includeAll,
                                           const QueryParameters* params = nullptr  ) const = 0;
+    /**
+     * @brief fuzzySearchMedia, fuzzySearchAlbums and fuzzySearchArtists are
+     *        typo tolerant versions of searchMedia, searchAlbums and
+     *        searchArtists
+     * @param pattern A 3 character or more pattern
+     * @param params Some query parameters, with the same valid sorting
+     *               criteria as the non fuzzy versions.
+     *
+     * Rather than matching the pattern words, the entities sharing enough
+     * groups of 3 consecutive characters (trigrams) with the pattern are
+     * returned, so "beatels" matches "The Beatles".
+     * The entities sharing the most trigrams come first, and the sorting
+     * criteria only order the entities sharing as many trigrams.
+     * Media are only matched by their title, albums by their title, and
+     * artists by their name.
+     */
+    virtual Query<IMedia> fuzzySearchMedia( const std::string& pattern,
+                                            const QueryParameters* params = nullptr ) const = 0;
+    virtual Query<IAlbum> fuzzySearchAlbums( const std::string& pattern,
+                                             const QueryParameters* params = nullptr ) const = 0;
+    virtual Query<IArtist> fuzzySearchArtists( const std::string& name, bool includeAll,
+                                               const QueryParameters* params = nullptr ) const = 0;
     virtual SearchAggregate search( const std::string& pattern,
                                     const QueryParameters* params = nullptr ) const = 0;
+    /**
+     * @brief searchBestMatches returns the most relevant entities of each kind
+     *        matching a pattern
+     * @param pattern A 3 character or more pattern, matched like search() does
+     * @param nbItems The maximum number of entities returned for each kind
+     *
+     * Unlike search(), all the requests are run by this call, on the same
+     * database connection, and each list is sorted by relevance (bm25) rather
+     * than by a sorting criteria. This is meant for a global search screen,
+     * which only displays the first few results of each category.
+     */
+    virtual SearchResults searchBestMatches( const std::string& pattern,
+                                             uint32_t nbItems ) const = 0;
+    /**
+     * @brief searchBestMatchesAsync runs searchBestMatches() on a media
+     *        library thread
+     * @param callback The function to call with the results, from the media
+     *                 library thread.
+     * @param tag When non 0, a later asynchronous request with the same tag
+     *            supersedes this one, as with IQuery::itemsAsync
+     */
+    virtual void searchBestMatchesAsync( const std::string& pattern,
+                                         uint32_t nbItems,
+                                         std::function<void(SearchResults)> callback,
+                                         uint64_t tag = 0 ) const = 0;
+    /**
+     * @brief createSearchSession Returns a session meant to run the searches
+     *        of a search as you type field, see ISearchSession
+     */
+    virtual std::unique_ptr<ISearchSession> createSearchSession() const = 0;
 
     /**
      * @brief discover Launch a discovery on the provided entry point.
@@ -469,6 +658,45 @@ public:
      * interrupted by pauseBackgroundOperations().
      */
     virtual void resumeBackgroundOperations() = 0;
+    /**
+     * @brief setWriteCoalescingDelay Commits small user-triggered modifications
+     *        together, instead of one by one.
+     * @param delayMs The maximum delay, in milliseconds, before a modification
+     *                gets committed to the database. 0 disables the coalescing,
+     *                which is the default.
+     *
+     * This applies to modifications such as the play count, the favorite
+     * state, a media metadata, or a media position in a playlist. The
+     * corresponding entity is updated immediately, but the change won't be
+     * visible to other requests until it gets committed.
+     * Since the modifying call already returned true, a deferred modification
+     * which fails to be committed is only logged, and the in-memory entity
+     * keeps its modified value until it gets reloaded. Playlist modification
+     * notifications are only sent once the move has been committed.
+     * This must be called after initialize()
+     */
+    virtual void setWriteCoalescingDelay( uint32_t delayMs ) = 0;
+    /**
+     * @brief flushPendingWrites Commits all the modifications that were
+     *        deferred because of setWriteCoalescingDelay()
+     *
+     * This is a no-op when write coalescing is disabled.
+     */
+    virtual void flushPendingWrites() = 0;
+    /**
+     * @brief databaseStatistics Returns the execution statistics of all the
+     *        requests run since the media library was initialized, or since
+     *        the last call to resetDatabaseStatistics()
+     */
+    virtual DatabaseStatistics databaseStatistics() const = 0;
+    virtual void resetDatabaseStatistics() = 0;
+    /**
+     * @brief setSlowRequestThreshold Logs the requests running for longer
+     *        than the provided threshold, along with their parameters.
+     * @param thresholdMs The threshold, in milliseconds, or 0 to disable the
+     *                    slow request log, which is the default.
+     */
+    virtual void setSlowRequestThreshold( uint32_t thresholdMs ) = 0;
     virtual void reload() = 0;
     virtual void reload( const std::string& entryPoint ) = 0;
     /**
@@ -24,6 +24,8 @@
 
 #include <vector>
 #include <memory>
+#include <cstdint>
+#include <functional>
 
 namespace medialibrary
 {
@@ -33,6 +35,9 @@ class IQuery
 {
 public:
     using Result = std::vector<std::shared_ptr<T>>;
+    using Callback = std::function<bool(std::shared_ptr<T>)>;
+    using ItemsCallback = std::function<void(Result)>;
+    using CountCallback = std::function<void(size_t)>;
 
     virtual ~IQuery() = default;
     /**
@@ -53,7 +58,65 @@ public:
      * the SQL query that will be generated to compute the result.
      */
     virtual Result items( uint32_t nbItems,  uint32_t offset ) = 0;
+    /**
+     * @brief itemsAfter returns the items following a given item
+     * @param cursor The id of the last item the caller already knows about, or
+     *               0 to start from the first item.
+     * @param nbItems The number of items requested, or 0 for all of them
+     * @return A vector of shared pointer for the requested type.
+     *
+     * Unlike items(), the cost of this call doesn't depend on the position of
+     * the cursor in the result, which makes it better suited for going through
+     * a large result page by page.
+     * Items are sorted like the other methods would, with their id being used
+     * to sort items which would otherwise be equal.
+     * If the cursor isn't part of the query result, an empty vector is returned.
+     */
+    virtual Result itemsAfter( int64_t cursor, uint32_t nbItems ) = 0;
+    /**
+     * @brief itemsBefore returns the items preceding a given item
+     * @param cursor The id of the first item the caller already knows about,
+     *               or 0 to start from the last item.
+     * @param nbItems The number of items requested, or 0 for all of them
+     *
+     * The returned items are in the same order as with itemsAfter(), meaning
+     * the last returned item is the one directly preceding the cursor.
+     */
+    virtual Result itemsBefore( int64_t cursor, uint32_t nbItems ) = 0;
     virtual Result all() = 0;
+    /**
+     * @brief forEach invokes a callback for each item returned by all()
+     * @param callback The function to call with each item. Returning false
+     *                 from the callback stops the iteration.
+     * @return The number of items passed to the callback
+     *
+     * Items are created one at a time while the result is being read, so
+     * unlike all(), the memory usage doesn't depend on the number of items.
+     * The request is kept running until this function returns, so the
+     * callback shouldn't block for long periods of time.
+     */
+    virtual size_t forEach( const Callback& callback ) = 0;
+    /**
+     * @brief itemsAsync runs items() on a media library thread
+     * @param callback The function to call with the result, from the media
+     *                 library thread.
+     * @param tag When non 0, a later asynchronous request with the same tag
+     *            supersedes this one: if it didn't complete yet, it is
+     *            cancelled and its callback won't be invoked.
+     *
+     * The query can be destroyed as soon as this function returns.
+     * In case of failure, the callback is invoked with an empty result.
+     * Tagging the requests of a search-as-you-type field with the same value
+     * ensures only the result for the latest pattern is computed.
+     */
+    virtual void itemsAsync( uint32_t nbItems, uint32_t offset,
+                             ItemsCallback callback, uint64_t tag = 0 ) = 0;
+    /**
+     * @brief countAsync runs count() on a media library thread
+     *
+     * \sa itemsAsync
+     */
+    virtual void countAsync( CountCallback callback, uint64_t tag = 0 ) = 0;
 };
 
 template <typename T>
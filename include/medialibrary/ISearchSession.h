@@ -0,0 +1,58 @@
+/*****************************************************************************
+ * Media Library
+ *****************************************************************************
+ * Copyright (C) 2019 Hugo Beauzée-Luyssen, Videolabs, VideoLAN
+ *
+ * Authors: Hugo Beauzée-Luyssen<hugo@beauzee.fr>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#pragma once
+
+#include <string>
+
+#include "Types.h"
+#include "IQuery.h"
+
+namespace medialibrary
+{
+
+struct QueryParameters;
+
+/**
+ * @brief The ISearchSession class runs the successive searches of a search
+ *        as you type field.
+ *
+ * When a pattern extends the previous one, as it does while typing, its
+ * matches are a subset of the previous ones, and are found among them instead
+ * of querying the full text index again. The matches are forgotten whenever
+ * the index gets modified.
+ * A session isn't meant to be shared between threads.
+ */
+class ISearchSession
+{
+public:
+    virtual ~ISearchSession() = default;
+    /**
+     * @brief searchMedia Returns the same media as IMediaLibrary::searchMedia
+     * @param pattern A 3 character or more pattern
+     * @param params Some query parameters, as for IMediaLibrary::searchMedia
+     */
+    virtual Query<IMedia> searchMedia( const std::string& pattern,
+                                       const QueryParameters* params = nullptr ) = 0;
+};
+
+}
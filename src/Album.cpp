@@ -29,6 +29,7 @@
 #include "Album.h"
 #include "AlbumTrack.h"
 #include "Artist.h"
+#include "Counters.h"
 #include "Genre.h"
 #include "Media.h"
 #include "Thumbnail.h"
@@ -232,17 +233,17 @@ std::string Album::orderBy( const QueryParameters* params )
     {
     case SortingCriteria::ReleaseDate:
         if ( desc == true )
-            req += "release_year DESC, title";
+            req += "alb.release_year DESC, alb.title";
         else
-            req += "release_year, title";
+            req += "alb.release_year, alb.title";
         break;
     case SortingCriteria::Duration:
-        req += "duration";
+        req += "alb.duration";
         if ( desc == true )
             req += " DESC";
         break;
     case SortingCriteria::TrackNumber:
-        req += "nb_tracks";
+        req += "alb.nb_tracks";
         if ( desc == false )
             req += " DESC";
         break;
@@ -251,7 +252,7 @@ std::string Album::orderBy( const QueryParameters* params )
         /* fall-through */
     case SortingCriteria::Default:
     case SortingCriteria::Alpha:
-        req += "title";
+        req += "alb.title";
         if ( desc == true )
             req += " DESC";
         break;
@@ -394,9 +395,6 @@ bool Album::setAlbumArtist( std::shared_ptr<Artist> artist )
     m_artistId = artist->id();
     m_albumArtist = artist;
     artist->updateNbAlbum( 1 );
-    static const std::string ftsReq = "UPDATE " + Table::Name + "Fts SET "
-            " artist = ? WHERE rowid = ?";
-    sqlite::Tools::executeUpdate( m_ml->getConn(), ftsReq, artist->name(), m_id );
     return true;
 }
 
@@ -416,7 +414,7 @@ Query<IArtist> Album::artists( const QueryParameters* params ) const
                                         std::move( orderBy ), m_id );
 }
 
-void Album::createTable( sqlite::Connection* dbConnection )
+void Album::createTable( sqlite::Connection* dbConnection, uint32_t dbModelVersion )
 {
     const std::string req = "CREATE TABLE IF NOT EXISTS " +
             Table::Name +
@@ -436,17 +434,44 @@ void Album::createTable( sqlite::Connection* dbConnection )
                 "FOREIGN KEY(thumbnail_id) REFERENCES " + Thumbnail::Table::Name
                 + "(id_thumbnail)"
             ")";
+    // The album artists are matched through the ArtistFts table
     const std::string vtableReq = "CREATE VIRTUAL TABLE IF NOT EXISTS "
+                + Table::Name + "Fts USING FTS5("
+                "title,"
+                "content=" + Table::Name + ","
+                "content_rowid=id_album,"
+                "prefix='2 3 4',"
+                "tokenize='unicode61 remove_diacritics 2'"
+            ")";
+    const std::string vtableReqV17 = "CREATE VIRTUAL TABLE IF NOT EXISTS "
                 + Table::Name + "Fts USING FTS3("
                 "title,"
                 "artist"
             ")";
 
+    const std::string trigramReq = "CREATE VIRTUAL TABLE IF NOT EXISTS "
+                + Table::Name + "TrigramFts USING FTS5("
+                "title,"
+                "content=" + Table::Name + ","
+                "content_rowid=id_album,"
+                "tokenize='trigram',"
+                "detail='column'"
+            ")";
+    const std::string trigramVocabReq = "CREATE VIRTUAL TABLE IF NOT EXISTS "
+                + Table::Name + "TrigramVocab USING fts5vocab("
+                + Table::Name + "TrigramFts, instance)";
+
     sqlite::Tools::executeRequest( dbConnection, req );
-    sqlite::Tools::executeRequest( dbConnection, vtableReq );
+    sqlite::Tools::executeRequest( dbConnection, dbModelVersion >= 18 ?
+                                       vtableReq : vtableReqV17 );
+    if ( dbModelVersion >= 19 )
+    {
+        sqlite::Tools::executeRequest( dbConnection, trigramReq );
+        sqlite::Tools::executeRequest( dbConnection, trigramVocabReq );
+    }
 }
 
-void Album::createTriggers( sqlite::Connection* dbConnection )
+void Album::createTriggers( sqlite::Connection* dbConnection, uint32_t dbModelVersion )
 {
     const std::string indexReq = "CREATE INDEX IF NOT EXISTS album_artist_id_idx ON " +
             Table::Name + "(artist_id)";
@@ -495,14 +520,41 @@ void Album::createTriggers( sqlite::Connection* dbConnection )
             // Unknown album probably won't be deleted, but better safe than sorry
             " WHEN old.title IS NOT NULL"
             " BEGIN"
+            " INSERT INTO " + Table::Name + "Fts(" + Table::Name + "Fts, rowid, title)"
+                " VALUES('delete', old.id_album, old.title);"
+            " END";
+    static const std::string vtriggerDeleteV17 = "CREATE TRIGGER IF NOT EXISTS delete_album_fts BEFORE DELETE ON "
+            + Table::Name +
+            " WHEN old.title IS NOT NULL"
+            " BEGIN"
             " DELETE FROM " + Table::Name + "Fts WHERE rowid = old.id_album;"
             " END";
     sqlite::Tools::executeRequest( dbConnection, indexReq );
     sqlite::Tools::executeRequest( dbConnection, triggerReq );
     sqlite::Tools::executeRequest( dbConnection, deleteTriggerReq );
     sqlite::Tools::executeRequest( dbConnection, updateAddTrackTriggerReq );
+    static const std::string trigramInsertTrigger = "CREATE TRIGGER IF NOT EXISTS "
+            "insert_album_trigram AFTER INSERT ON " + Table::Name +
+            " WHEN new.title IS NOT NULL"
+            " BEGIN"
+            " INSERT INTO " + Table::Name + "TrigramFts(rowid, title)"
+                " VALUES(new.id_album, new.title);"
+            " END";
+    static const std::string trigramDeleteTrigger = "CREATE TRIGGER IF NOT EXISTS "
+            "delete_album_trigram BEFORE DELETE ON " + Table::Name +
+            " WHEN old.title IS NOT NULL"
+            " BEGIN"
+            " INSERT INTO " + Table::Name + "TrigramFts(" + Table::Name +
+                "TrigramFts, rowid, title) VALUES('delete', old.id_album, old.title);"
+            " END";
     sqlite::Tools::executeRequest( dbConnection, vtriggerInsert );
-    sqlite::Tools::executeRequest( dbConnection, vtriggerDelete );
+    sqlite::Tools::executeRequest( dbConnection, dbModelVersion >= 18 ?
+                                       vtriggerDelete : vtriggerDeleteV17 );
+    if ( dbModelVersion >= 19 )
+    {
+        sqlite::Tools::executeRequest( dbConnection, trigramInsertTrigger );
+        sqlite::Tools::executeRequest( dbConnection, trigramDeleteTrigger );
+    }
 }
 
 std::shared_ptr<Album> Album::create( MediaLibraryPtr ml, const std::string& title, int64_t thumbnailId )
@@ -525,29 +577,67 @@ std::shared_ptr<Album> Album::createUnknownAlbum( MediaLibraryPtr ml, const Arti
     return album;
 }
 
+std::string Album::searchRequest( const std::string& joins, bool byRelevance )
+{
+    if ( byRelevance == true )
+    {
+        // An album matched both by its title and its artist name keeps its
+        // best score, which is the lowest one
+        return "FROM (SELECT id, MIN(score) AS score FROM ("
+                    "SELECT rowid AS id, rank AS score FROM " + Table::Name + "Fts "
+                    "WHERE " + Table::Name + "Fts MATCH ? "
+                    "UNION ALL "
+                    "SELECT a.id_album, " + Artist::Table::Name + "Fts.rank "
+                    "FROM " + Artist::Table::Name + "Fts "
+                    "CROSS JOIN " + Table::Name + " a "
+                    "ON a.artist_id = " + Artist::Table::Name + "Fts.rowid "
+                    "WHERE " + Artist::Table::Name + "Fts MATCH ? "
+                    "AND a.title IS NOT NULL"
+                ") GROUP BY id) s "
+               "CROSS JOIN " + Table::Name + " alb " + joins +
+               " WHERE alb.id_album = s.id";
+    }
+    return "FROM " + Table::Name + " alb " + joins +
+           " WHERE alb.id_album IN (SELECT rowid FROM " + Table::Name + "Fts WHERE " +
+                Table::Name + "Fts MATCH ? "
+            "UNION "
+            // Unknown albums were never matched by their artist name. The
+            // matching artists must be looked up first, so that the album
+            // artist index is used
+            "SELECT a.id_album FROM " + Artist::Table::Name + "Fts "
+                "CROSS JOIN " + Table::Name + " a "
+                "ON a.artist_id = " + Artist::Table::Name + "Fts.rowid "
+                "WHERE " + Artist::Table::Name + "Fts MATCH ? "
+                "AND a.title IS NOT NULL)";
+}
+
+std::string Album::searchOrderBy( const QueryParameters* params )
+{
+    if ( sqlite::Tools::sortByRelevance( params ) == true )
+        return sqlite::Tools::relevanceOrderBy( "s.score", params );
+    return orderBy( params );
+}
+
 Query<IAlbum> Album::search( MediaLibraryPtr ml, const std::string& pattern,
                              const QueryParameters* params )
 {
-    std::string req = "FROM " + Table::Name + " alb "
-            "WHERE id_album IN "
-            "(SELECT rowid FROM " + Table::Name + "Fts WHERE " +
-            Table::Name + "Fts MATCH '*' || ? || '*')"
-            "AND is_present != 0";
-    return make_query<Album, IAlbum>( ml, "*", std::move( req ),
-                                      orderBy( params ), pattern );
+    std::string req = searchRequest( "", sqlite::Tools::sortByRelevance( params ) ) +
+            " AND alb.is_present != 0";
+    auto ftsPattern = sqlite::Tools::ftsPattern( pattern );
+    return make_query<Album, IAlbum>( ml, "alb.*", std::move( req ),
+                                      searchOrderBy( params ), ftsPattern, ftsPattern );
 }
 
 Query<IAlbum> Album::searchFromArtist( MediaLibraryPtr ml, const std::string& pattern,
                                        int64_t artistId, const QueryParameters* params )
 {
-    std::string req = "FROM " + Table::Name + " alb "
-            "WHERE id_album IN "
-            "(SELECT rowid FROM " + Table::Name + "Fts WHERE " +
-            Table::Name + "Fts MATCH '*' || ? || '*')"
-            "AND is_present != 0 "
-            "AND artist_id = ?";
-    return make_query<Album, IAlbum>( ml, "*", std::move( req ),
-                                      orderBy( params ), pattern, artistId );
+    std::string req = searchRequest( "", sqlite::Tools::sortByRelevance( params ) ) +
+            " AND alb.is_present != 0"
+            " AND alb.artist_id = ?";
+    auto ftsPattern = sqlite::Tools::ftsPattern( pattern );
+    return make_query<Album, IAlbum>( ml, "alb.*", std::move( req ),
+                                      searchOrderBy( params ), ftsPattern, ftsPattern,
+                                      artistId );
 }
 
 Query<IAlbum> Album::fromArtist( MediaLibraryPtr ml, int64_t artistId, const QueryParameters* params )
@@ -565,7 +655,7 @@ Query<IAlbum> Album::fromArtist( MediaLibraryPtr ml, int64_t artistId, const Que
     switch ( sort )
     {
     case SortingCriteria::Alpha:
-        groupAndOrder += "title";
+        groupAndOrder += "alb.title";
         if ( desc == true )
             groupAndOrder += " DESC";
         break;
@@ -579,9 +669,9 @@ Query<IAlbum> Album::fromArtist( MediaLibraryPtr ml, int64_t artistId, const Que
         // discrimination in case 2+ albums went out the same year)
         // This leads to DESC being used for "non-desc" case
         if ( desc == true )
-            groupAndOrder += "release_year, title";
+            groupAndOrder += "alb.release_year, alb.title";
         else
-            groupAndOrder += "release_year DESC, title";
+            groupAndOrder += "alb.release_year DESC, alb.title";
         break;
     }
 
@@ -603,24 +693,65 @@ Query<IAlbum> Album::fromGenre( MediaLibraryPtr ml, int64_t genreId, const Query
 Query<IAlbum> Album::searchFromGenre( MediaLibraryPtr ml, const std::string& pattern,
                                       int64_t genreId, const QueryParameters* params )
 {
-    std::string req = "FROM " + Table::Name + " alb "
-            "INNER JOIN " + AlbumTrack::Table::Name + " att ON att.album_id = alb.id_album "
-            "WHERE id_album IN "
-            "(SELECT rowid FROM " + Table::Name + "Fts WHERE " +
-            Table::Name + "Fts MATCH '*' || ? || '*')"
-            "AND att.genre_id = ?";
-    std::string groupAndOrderBy = "GROUP BY att.album_id" + orderBy( params );
+    std::string req = searchRequest( "INNER JOIN " + AlbumTrack::Table::Name +
+                                        " att ON att.album_id = alb.id_album",
+                                     sqlite::Tools::sortByRelevance( params ) ) +
+            " AND att.genre_id = ?";
+    std::string groupAndOrderBy = "GROUP BY att.album_id" + searchOrderBy( params );
+    auto ftsPattern = sqlite::Tools::ftsPattern( pattern );
+    return make_query<Album, IAlbum>( ml, "alb.*", std::move( req ),
+                                      std::move( groupAndOrderBy ), ftsPattern,
+                                      ftsPattern, genreId );
+}
+
+Query<IAlbum> Album::fuzzySearch( MediaLibraryPtr ml, const std::string& pattern,
+                                  const QueryParameters* params )
+{
+    auto trigrams = sqlite::Tools::trigrams( pattern );
+    if ( trigrams.empty() == true )
+        return {};
+    std::string req = "FROM (" +
+            sqlite::Tools::trigramRequest( Table::Name + "TrigramVocab",
+                                           trigrams.size() ) + ") t "
+            "CROSS JOIN " + Table::Name + " alb ON alb.id_album = t.id "
+            "WHERE alb.is_present != 0";
+    auto minOverlap = sqlite::Tools::minTrigramOverlap( trigrams.size() );
     return make_query<Album, IAlbum>( ml, "alb.*", std::move( req ),
-                                      std::move( groupAndOrderBy ), pattern,
-                                      genreId );
+                                      sqlite::Tools::prependSortKey( "t.overlap DESC",
+                                                                     orderBy( params ) ),
+                                      std::move( trigrams ), minOverlap );
+}
+
+std::vector<AlbumPtr> Album::searchBestMatches( MediaLibraryPtr ml,
+                                                const std::string& ftsPattern,
+                                                uint32_t nbItems )
+{
+    // An album matched both by its title and its artist keeps its best bm25
+    // score, which is the lowest one
+    static const std::string req = "SELECT alb.* FROM ("
+                "SELECT rowid AS id, bm25(" + Table::Name + "Fts) AS score "
+                "FROM " + Table::Name + "Fts "
+                "WHERE " + Table::Name + "Fts MATCH ? "
+                "UNION ALL "
+                "SELECT a.id_album, bm25(" + Artist::Table::Name + "Fts) "
+                "FROM " + Artist::Table::Name + "Fts "
+                "CROSS JOIN " + Table::Name + " a "
+                "ON a.artist_id = " + Artist::Table::Name + "Fts.rowid "
+                "WHERE " + Artist::Table::Name + "Fts MATCH ? "
+                "AND a.title IS NOT NULL"
+            ") s "
+            "CROSS JOIN " + Table::Name + " alb ON alb.id_album = s.id "
+            "WHERE alb.is_present != 0 "
+            "GROUP BY alb.id_album "
+            "ORDER BY MIN(s.score) LIMIT ?";
+    return fetchAll<IAlbum>( ml, req, ftsPattern, ftsPattern, nbItems );
 }
 
 Query<IAlbum> Album::listAll( MediaLibraryPtr ml, const QueryParameters* params )
 {
     auto sort = params != nullptr ? params->sort : SortingCriteria::Default;
     auto desc = params != nullptr ? params->desc : false;
-    std::string countReq = "SELECT COUNT(*) FROM " + Table::Name + " WHERE "
-            "is_present != 0";
+    auto countReq = Counters::countRequest( Counters::Albums );
     std::string req = "SELECT alb.* FROM " + Table::Name + " alb ";
     if ( sort == SortingCriteria::Artist )
     {
@@ -101,8 +101,8 @@ class Album : public IAlbum, public DatabaseHelpers<Album>
         virtual Query<IMedia> searchTracks( const std::string& pattern,
                                             const QueryParameters* params = nullptr ) const override;
 
-        static void createTable( sqlite::Connection* dbConnection );
-        static void createTriggers( sqlite::Connection* dbConnection );
+        static void createTable( sqlite::Connection* dbConnection, uint32_t dbModelVersion );
+        static void createTriggers( sqlite::Connection* dbConnection, uint32_t dbModelVersion );
         static std::shared_ptr<Album> create( MediaLibraryPtr ml, const std::string& title, int64_t thumbnailId );
         static std::shared_ptr<Album> createUnknownAlbum( MediaLibraryPtr ml, const Artist* artist );
         ///
@@ -119,10 +119,25 @@ class Album : public IAlbum, public DatabaseHelpers<Album>
         static Query<IAlbum> searchFromGenre( MediaLibraryPtr ml, const std::string& pattern,
                                               int64_t genreId, const QueryParameters* params );
         static Query<IAlbum> listAll( MediaLibraryPtr ml, const QueryParameters* params );
+        static Query<IAlbum> fuzzySearch( MediaLibraryPtr ml, const std::string& pattern,
+                                          const QueryParameters* params );
+        static std::vector<AlbumPtr> searchBestMatches( MediaLibraryPtr ml,
+                                                        const std::string& ftsPattern,
+                                                        uint32_t nbItems );
 
     private:
         static std::string orderTracksBy( const QueryParameters* params );
         static std::string orderBy( const QueryParameters* params );
+        /**
+         * @brief searchRequest Returns the FROM & WHERE clauses of a request
+         *        listing the albums whose title or artist name match a FTS
+         *        pattern, which must be bound twice, before any other
+         *        parameter. When sorting by relevance, the matches are
+         *        exposed as 's', along with their best score, as 's.score'
+         * @param joins Some joins inserted before the WHERE clause
+         */
+        static std::string searchRequest( const std::string& joins, bool byRelevance );
+        static std::string searchOrderBy( const QueryParameters* params );
     protected:
         MediaLibraryPtr m_ml;
         int64_t m_id;
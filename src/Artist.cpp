@@ -27,6 +27,7 @@
 #include "Artist.h"
 #include "Album.h"
 #include "AlbumTrack.h"
+#include "Counters.h"
 #include "Media.h"
 
 #include "database/SqliteTools.h"
@@ -298,7 +299,7 @@ unsigned int Artist::nbTracks() const
     return m_nbTracks;
 }
 
-void Artist::createTable( sqlite::Connection* dbConnection )
+void Artist::createTable( sqlite::Connection* dbConnection, uint32_t dbModelVersion )
 {
     const std::string req = "CREATE TABLE IF NOT EXISTS " +
             Artist::Table::Name +
@@ -324,12 +325,37 @@ void Artist::createTable( sqlite::Connection* dbConnection )
                     + Artist::Table::PrimaryKeyColumn + ") ON DELETE CASCADE"
             ")";
     const std::string reqFts = "CREATE VIRTUAL TABLE IF NOT EXISTS " +
+                Artist::Table::Name + "Fts USING FTS5("
+                "name,"
+                "content=" + Artist::Table::Name + ","
+                "content_rowid=id_artist,"
+                "prefix='2 3 4',"
+                "tokenize='unicode61 remove_diacritics 2'"
+            ")";
+    const std::string reqFtsV17 = "CREATE VIRTUAL TABLE IF NOT EXISTS " +
                 Artist::Table::Name + "Fts USING FTS3("
                 "name"
             ")";
+    const std::string reqTrigram = "CREATE VIRTUAL TABLE IF NOT EXISTS " +
+                Artist::Table::Name + "TrigramFts USING FTS5("
+                "name,"
+                "content=" + Artist::Table::Name + ","
+                "content_rowid=id_artist,"
+                "tokenize='trigram',"
+                "detail='column'"
+            ")";
+    const std::string reqTrigramVocab = "CREATE VIRTUAL TABLE IF NOT EXISTS " +
+                Artist::Table::Name + "TrigramVocab USING fts5vocab(" +
+                Artist::Table::Name + "TrigramFts, instance)";
     sqlite::Tools::executeRequest( dbConnection, req );
     sqlite::Tools::executeRequest( dbConnection, reqRel );
-    sqlite::Tools::executeRequest( dbConnection, reqFts );
+    sqlite::Tools::executeRequest( dbConnection, dbModelVersion >= 18 ?
+                                       reqFts : reqFtsV17 );
+    if ( dbModelVersion >= 19 )
+    {
+        sqlite::Tools::executeRequest( dbConnection, reqTrigram );
+        sqlite::Tools::executeRequest( dbConnection, reqTrigramVocab );
+    }
 }
 
 void Artist::createTriggers( sqlite::Connection* dbConnection, uint32_t dbModelVersion )
@@ -383,6 +409,13 @@ void Artist::createTriggers( sqlite::Connection* dbConnection, uint32_t dbModelV
             " INSERT INTO " + Artist::Table::Name + "Fts(rowid,name) VALUES(new.id_artist, new.name);"
             " END";
     static const std::string ftsDeleteTrigger = "CREATE TRIGGER IF NOT EXISTS delete_artist_fts"
+            " BEFORE DELETE ON " + Artist::Table::Name +
+            " WHEN old.name IS NOT NULL"
+            " BEGIN"
+            " INSERT INTO " + Artist::Table::Name + "Fts(" + Artist::Table::Name + "Fts,rowid,name)"
+                " VALUES('delete', old.id_artist, old.name);"
+            " END";
+    static const std::string ftsDeleteTriggerV17 = "CREATE TRIGGER IF NOT EXISTS delete_artist_fts"
             " BEFORE DELETE ON " + Artist::Table::Name +
             " WHEN old.name IS NOT NULL"
             " BEGIN"
@@ -401,8 +434,29 @@ void Artist::createTriggers( sqlite::Connection* dbConnection, uint32_t dbModelV
     {
         sqlite::Tools::executeRequest( dbConnection, autoDeleteTrackTriggerReq );
     }
+    static const std::string trigramInsertTrigger = "CREATE TRIGGER IF NOT EXISTS insert_artist_trigram"
+            " AFTER INSERT ON " + Artist::Table::Name +
+            " WHEN new.name IS NOT NULL"
+            " BEGIN"
+            " INSERT INTO " + Artist::Table::Name + "TrigramFts(rowid,name)"
+                " VALUES(new.id_artist, new.name);"
+            " END";
+    static const std::string trigramDeleteTrigger = "CREATE TRIGGER IF NOT EXISTS delete_artist_trigram"
+            " BEFORE DELETE ON " + Artist::Table::Name +
+            " WHEN old.name IS NOT NULL"
+            " BEGIN"
+            " INSERT INTO " + Artist::Table::Name + "TrigramFts(" +
+                Artist::Table::Name + "TrigramFts,rowid,name)"
+                " VALUES('delete', old.id_artist, old.name);"
+            " END";
     sqlite::Tools::executeRequest( dbConnection, ftsInsertTrigger );
-    sqlite::Tools::executeRequest( dbConnection, ftsDeleteTrigger );
+    sqlite::Tools::executeRequest( dbConnection, dbModelVersion >= 18 ?
+                                       ftsDeleteTrigger : ftsDeleteTriggerV17 );
+    if ( dbModelVersion >= 19 )
+    {
+        sqlite::Tools::executeRequest( dbConnection, trigramInsertTrigger );
+        sqlite::Tools::executeRequest( dbConnection, trigramDeleteTrigger );
+    }
 }
 
 bool Artist::createDefaultArtists( sqlite::Connection* dbConnection )
@@ -431,16 +485,56 @@ std::shared_ptr<Artist> Artist::create( MediaLibraryPtr ml, const std::string& n
 Query<IArtist> Artist::search( MediaLibraryPtr ml, const std::string& name,
                                bool includeAll, const QueryParameters* params )
 {
-    std::string req = "FROM " + Artist::Table::Name + " WHERE id_artist IN "
-            "(SELECT rowid FROM " + Artist::Table::Name + "Fts WHERE name MATCH '*' || ? || '*')"
-            "AND is_present != 0";
+    auto byRelevance = sqlite::Tools::sortByRelevance( params );
+    std::string req = sqlite::Tools::ftsSearchRequest( Artist::Table::Name, "a",
+                                                       Artist::Table::PrimaryKeyColumn,
+                                                       "", byRelevance ) +
+            " AND a.is_present != 0";
     // We are searching based on the name, so we're ignoring unknown/various artist
     // This means all artist we find has at least one track associated with it, so
     // we can simply filter out based on the number of associated albums
     if ( includeAll == false )
-        req += " AND nb_albums > 0";
-    return make_query<Artist, IArtist>( ml, "*", std::move( req ),
-                                        sortRequest( params ), name );
+        req += " AND a.nb_albums > 0";
+    return make_query<Artist, IArtist>( ml, "a.*", std::move( req ),
+                                        byRelevance == true ?
+                                            sqlite::Tools::relevanceOrderBy(
+                                                Artist::Table::Name + "Fts.rank", params ) :
+                                            sortRequest( params ),
+                                        sqlite::Tools::ftsPattern( name ) );
+}
+
+Query<IArtist> Artist::fuzzySearch( MediaLibraryPtr ml, const std::string& name,
+                                    bool includeAll, const QueryParameters* params )
+{
+    auto trigrams = sqlite::Tools::trigrams( name );
+    if ( trigrams.empty() == true )
+        return {};
+    std::string req = "FROM (" +
+            sqlite::Tools::trigramRequest( Table::Name + "TrigramVocab",
+                                           trigrams.size() ) + ") t "
+            "CROSS JOIN " + Table::Name + " a ON a.id_artist = t.id "
+            "WHERE a.is_present != 0";
+    // Same as search(), the unknown & various artists are ignored
+    if ( includeAll == false )
+        req += " AND a.nb_albums > 0";
+    auto minOverlap = sqlite::Tools::minTrigramOverlap( trigrams.size() );
+    return make_query<Artist, IArtist>( ml, "a.*", std::move( req ),
+                                        sqlite::Tools::prependSortKey( "t.overlap DESC",
+                                                                       sortRequest( params ) ),
+                                        std::move( trigrams ), minOverlap );
+}
+
+std::vector<ArtistPtr> Artist::searchBestMatches( MediaLibraryPtr ml,
+                                                  const std::string& ftsPattern,
+                                                  uint32_t nbItems )
+{
+    static const std::string req = "SELECT a.* FROM " + Table::Name + "Fts "
+            "CROSS JOIN " + Table::Name + " a "
+            "ON a.id_artist = " + Table::Name + "Fts.rowid "
+            "WHERE " + Table::Name + "Fts MATCH ? "
+            "AND a.is_present != 0 "
+            "ORDER BY bm25(" + Table::Name + "Fts) LIMIT ?";
+    return fetchAll<IArtist>( ml, req, ftsPattern, nbItems );
 }
 
 Query<IArtist> Artist::listAll( MediaLibraryPtr ml, bool includeAll,
@@ -453,18 +547,35 @@ Query<IArtist> Artist::listAll( MediaLibraryPtr ml, bool includeAll,
         req += "nb_albums > 0";
 
     req += " AND is_present != 0";
-    return make_query<Artist, IArtist>( ml, "*", std::move( req ),
-                                        sortRequest( params ) );
+    auto counter = includeAll == true ? Counters::AllArtists : Counters::Artists;
+    return make_counted_query<Artist, IArtist>( ml, Counters::countRequest( counter ),
+                                                "*", std::move( req ),
+                                                sortRequest( params ) );
 }
 
 Query<IArtist> Artist::searchByGenre( MediaLibraryPtr ml, const std::string& pattern,
                                       const QueryParameters* params, int64_t genreId )
 {
+    if ( sqlite::Tools::sortByRelevance( params ) == true )
+    {
+        // Filter the matches instead of grouping the tracks, which would
+        // require to sort them
+        std::string req = sqlite::Tools::ftsSearchRequest( Artist::Table::Name, "a",
+                                                           Artist::Table::PrimaryKeyColumn,
+                                                           "", true ) +
+                " AND a.id_artist IN (SELECT artist_id FROM " +
+                    AlbumTrack::Table::Name + " WHERE genre_id = ?)";
+        return make_query<Artist, IArtist>( ml, "a.*", std::move( req ),
+                                            sqlite::Tools::relevanceOrderBy(
+                                                Artist::Table::Name + "Fts.rank", params ),
+                                            sqlite::Tools::ftsPattern( pattern ), genreId );
+    }
     std::string req = "FROM " + Artist::Table::Name + " a "
                 "INNER JOIN " + AlbumTrack::Table::Name + " att ON att.artist_id = a.id_artist "
                 "WHERE id_artist IN "
-                    "(SELECT rowid FROM " + Artist::Table::Name + "Fts WHERE name MATCH '*' || ? || '*')"
-                "AND att.genre_id = ? ";
+                    "(SELECT rowid FROM " + Artist::Table::Name + "Fts WHERE " +
+                        Artist::Table::Name + "Fts MATCH ?)"
+                " AND att.genre_id = ? ";
 
     std::string groupBy = "GROUP BY att.artist_id "
                           "ORDER BY a.name";
@@ -476,7 +587,8 @@ Query<IArtist> Artist::searchByGenre( MediaLibraryPtr ml, const std::string& pat
             groupBy += " DESC";
     }
     return make_query<Artist, IArtist>( ml, "a.*", std::move( req ),
-                                        std::move( groupBy ), pattern, genreId );
+                                        std::move( groupBy ),
+                                        sqlite::Tools::ftsPattern( pattern ), genreId );
 }
 
 std::string Artist::sortRequest( const QueryParameters* params )
@@ -69,7 +69,7 @@ public:
     virtual unsigned int nbAlbums() const override;
     virtual unsigned int nbTracks() const override;
 
-    static void createTable( sqlite::Connection* dbConnection );
+    static void createTable( sqlite::Connection* dbConnection, uint32_t dbModelVersion );
     static void createTriggers( sqlite::Connection* dbConnection, uint32_t dbModelVersion );
     static bool createDefaultArtists( sqlite::Connection* dbConnection );
     static std::shared_ptr<Artist> create( MediaLibraryPtr ml, const std::string& name );
@@ -79,6 +79,11 @@ public:
                                    const QueryParameters* params );
     static Query<IArtist> searchByGenre( MediaLibraryPtr ml, const std::string& pattern,
                                          const QueryParameters* params, int64_t genreId );
+    static Query<IArtist> fuzzySearch( MediaLibraryPtr ml, const std::string& name,
+                                       bool includeAll, const QueryParameters* params );
+    static std::vector<ArtistPtr> searchBestMatches( MediaLibraryPtr ml,
+                                                     const std::string& ftsPattern,
+                                                     uint32_t nbItems );
 
 private:
     static std::string sortRequest( const QueryParameters* params );
@@ -28,6 +28,8 @@
 
 #include "Media.h"
 
+#include <algorithm>
+
 
 namespace medialibrary
 {
@@ -123,12 +125,24 @@ std::shared_ptr<AudioTrack> AudioTrack::create( MediaLibraryPtr ml, const std::s
                                                 unsigned int bitrate, unsigned int sampleRate, unsigned int nbChannels,
                                                 const std::string& language, const std::string& desc, int64_t mediaId )
 {
-    static const std::string req = "INSERT INTO " + AudioTrack::Table::Name
-            + "(codec, bitrate, samplerate, nb_channels, language, description, media_id) VALUES(?, ?, ?, ?, ?, ?, ?)";
     auto track = std::make_shared<AudioTrack>( ml, codec, bitrate, sampleRate, nbChannels, language, desc, mediaId );
-    if ( insert( ml, track, req, codec, bitrate, sampleRate, nbChannels, language, desc, mediaId ) == false )
+    if ( insert( ml, track, insertRequest(), codec, bitrate, sampleRate,
+                 nbChannels, language, desc, mediaId ) == false )
         return nullptr;
     return track;
 }
 
+bool AudioTrack::createBatch( MediaLibraryPtr ml, const std::vector<Record>& tracks )
+{
+    auto pKeys = sqlite::Tools::executeBatchInsert( ml->getConn(), insertRequest(), tracks );
+    return std::find( begin( pKeys ), end( pKeys ), 0 ) == end( pKeys );
+}
+
+const std::string& AudioTrack::insertRequest()
+{
+    static const std::string req = "INSERT INTO " + AudioTrack::Table::Name
+            + "(codec, bitrate, samplerate, nb_channels, language, description, media_id) VALUES(?, ?, ?, ?, ?, ?, ?)";
+    return req;
+}
+
 }
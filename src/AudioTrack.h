@@ -58,6 +58,19 @@ class AudioTrack : public IAudioTrack, public DatabaseHelpers<AudioTrack>
         static std::shared_ptr<AudioTrack> create( MediaLibraryPtr ml, const std::string& codec,
                                                    unsigned int bitrate, unsigned int sampleRate, unsigned int nbChannels,
                                                    const std::string& language, const std::string& desc, int64_t mediaId );
+        /*
+         * The parameters of a single track, in the order create() expects them
+         */
+        using Record = std::tuple<std::string, unsigned int, unsigned int, unsigned int,
+                                  std::string, std::string, int64_t>;
+        /**
+         * @brief createBatch Inserts multiple tracks using a single request
+         * @return true if all the tracks were inserted
+         */
+        static bool createBatch( MediaLibraryPtr ml, const std::vector<Record>& tracks );
+
+    private:
+        static const std::string& insertRequest();
 
     private:
         int64_t m_id;
@@ -0,0 +1,250 @@
+/*****************************************************************************
+ * Media Library
+ *****************************************************************************
+ * Copyright (C) 2015-2019 Hugo Beauzée-Luyssen, Videolabs, VideoLAN
+ *
+ * Authors: Hugo Beauzée-Luyssen<hugo@beauzee.fr>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+
+#if HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "Counters.h"
+
+#include "Album.h"
+#include "Artist.h"
+#include "File.h"
+#include "Genre.h"
+#include "Media.h"
+#include "Playlist.h"
+#include "Show.h"
+#include "database/SqliteTools.h"
+
+namespace medialibrary
+{
+
+const std::string Counters::Table::Name = "Counters";
+
+const std::string Counters::Albums = "albums";
+const std::string Counters::Artists = "artists";
+const std::string Counters::AllArtists = "all_artists";
+const std::string Counters::Genres = "genres";
+const std::string Counters::Shows = "shows";
+const std::string Counters::Playlists = "playlists";
+
+namespace
+{
+
+constexpr IMedia::Type CountedMediaTypes[] = {
+    IMedia::Type::Audio,
+    IMedia::Type::Video,
+};
+
+std::string toString( IMedia::Type type )
+{
+    return std::to_string( static_cast<std::underlying_type<IMedia::Type>::type>( type ) );
+}
+
+std::string toString( IFile::Type type )
+{
+    return std::to_string( static_cast<std::underlying_type<IFile::Type>::type>( type ) );
+}
+
+}
+
+std::string Counters::media( IMedia::Type type )
+{
+    return "media_" + toString( type );
+}
+
+std::string Counters::countRequest( const std::string& counter )
+{
+    return "SELECT value FROM " + Table::Name + " WHERE name = '" + counter + "'";
+}
+
+void Counters::createTable( sqlite::Connection* dbConn )
+{
+    sqlite::Tools::executeRequest( dbConn,
+        "CREATE TABLE IF NOT EXISTS " + Table::Name + "("
+            "name TEXT PRIMARY KEY NOT NULL,"
+            "value INTEGER NOT NULL DEFAULT 0"
+        ")" );
+    std::string counters[] = {
+        Albums, Artists, AllArtists, Genres, Shows, Playlists,
+        media( IMedia::Type::Audio ), media( IMedia::Type::Video ),
+    };
+    const std::string req = "INSERT OR IGNORE INTO " + Table::Name +
+            "(name) VALUES(?)";
+    for ( const auto& c : counters )
+        sqlite::Tools::executeInsert( dbConn, req, c );
+}
+
+void Counters::createTriggers( sqlite::Connection* dbConn )
+{
+    createTriggers( dbConn, Albums, Album::Table::Name,
+                    []( const std::string& row ) {
+                        return row + ".is_present != 0";
+                    }, "is_present" );
+    createTriggers( dbConn, Artists, Artist::Table::Name,
+                    []( const std::string& row ) {
+                        return row + ".nb_albums > 0 AND " + row + ".is_present != 0";
+                    }, "nb_albums, is_present" );
+    createTriggers( dbConn, AllArtists, Artist::Table::Name,
+                    []( const std::string& row ) {
+                        return "(" + row + ".nb_albums > 0 OR " + row +
+                                ".nb_tracks > 0) AND " + row + ".is_present != 0";
+                    }, "nb_albums, nb_tracks, is_present" );
+    auto all = []( const std::string& ) { return std::string{ "1" }; };
+    createTriggers( dbConn, Genres, Genre::Table::Name, all, "" );
+    createTriggers( dbConn, Shows, Show::Table::Name, all, "" );
+    createTriggers( dbConn, Playlists, Playlist::Table::Name, all, "" );
+
+    /*
+     * A media is listed when it's present, and has a main file. Files are
+     * inserted after their media, and a media gets deleted along with its
+     * last file, so we need to check for both when counting media.
+     * The file deletion is handled before it happens, since the media
+     * can be deleted by a trigger once its last file is gone.
+     */
+    const std::string mediaCounter = "(SELECT 'media_' || type FROM " +
+            Media::Table::Name + " WHERE id_media = %.media_id AND is_present != 0)";
+    const std::string mainFileTypes = Counters::mainFileTypes();
+    const std::string nbMainFiles = "(SELECT COUNT(*) FROM " + File::Table::Name +
+            " WHERE media_id = %.media_id AND type IN " + mainFileTypes + ")";
+    auto forRow = []( std::string req, const std::string& row ) {
+        size_t pos;
+        while ( ( pos = req.find( '%' ) ) != std::string::npos )
+            req.replace( pos, 1, row );
+        return req;
+    };
+    const std::string reqs[] = {
+        "CREATE TRIGGER IF NOT EXISTS media_counter_insert_file "
+            "AFTER INSERT ON " + File::Table::Name + " "
+            "WHEN new.media_id IS NOT NULL AND new.type IN " + mainFileTypes + " "
+        "BEGIN "
+            "UPDATE " + Table::Name + " SET value = value + 1 "
+                "WHERE name = " + forRow( mediaCounter, "new" ) +
+                " AND " + forRow( nbMainFiles, "new" ) + " = 1;"
+        "END",
+
+        "CREATE TRIGGER IF NOT EXISTS media_counter_delete_file "
+            "BEFORE DELETE ON " + File::Table::Name + " "
+            "WHEN old.media_id IS NOT NULL AND old.type IN " + mainFileTypes + " "
+        "BEGIN "
+            "UPDATE " + Table::Name + " SET value = value - 1 "
+                "WHERE name = " + forRow( mediaCounter, "old" ) +
+                " AND " + forRow( nbMainFiles, "old" ) + " = 1;"
+        "END",
+
+        // When a media is deleted, its files are deleted afterward, and won't
+        // find it anymore
+        "CREATE TRIGGER IF NOT EXISTS media_counter_delete "
+            "BEFORE DELETE ON " + Media::Table::Name + " "
+            "WHEN old.is_present != 0 "
+        "BEGIN "
+            "UPDATE " + Table::Name + " SET value = value - 1 "
+                "WHERE name = 'media_' || old.type AND " +
+                hasMainFile( "old.id_media" ) + ";"
+        "END",
+
+        "CREATE TRIGGER IF NOT EXISTS media_counter_update "
+            "AFTER UPDATE OF type, is_present ON " + Media::Table::Name + " "
+            "WHEN old.type IS NOT new.type OR "
+                "(old.is_present != 0) != (new.is_present != 0) "
+        "BEGIN "
+            "UPDATE " + Table::Name + " SET value = value - 1 "
+                "WHERE name = 'media_' || old.type AND old.is_present != 0 "
+                "AND " + hasMainFile( "old.id_media" ) + ";"
+            "UPDATE " + Table::Name + " SET value = value + 1 "
+                "WHERE name = 'media_' || new.type AND new.is_present != 0 "
+                "AND " + hasMainFile( "new.id_media" ) + ";"
+        "END",
+    };
+    for ( const auto& req : reqs )
+        sqlite::Tools::executeRequest( dbConn, req );
+}
+
+void Counters::refresh( sqlite::Connection* dbConn )
+{
+    const std::string req = "UPDATE " + Table::Name + " SET value = (%) "
+            "WHERE name = ?";
+    auto refreshCounter = [dbConn, &req]( const std::string& counter,
+                                          const std::string& countReq ) {
+        auto r = req;
+        r.replace( r.find( '%' ), 1, countReq );
+        sqlite::Tools::executeUpdate( dbConn, r, counter );
+    };
+    refreshCounter( Albums, "SELECT COUNT(*) FROM " + Album::Table::Name +
+                    " WHERE is_present != 0" );
+    refreshCounter( Artists, "SELECT COUNT(*) FROM " + Artist::Table::Name +
+                    " WHERE nb_albums > 0 AND is_present != 0" );
+    refreshCounter( AllArtists, "SELECT COUNT(*) FROM " + Artist::Table::Name +
+                    " WHERE (nb_albums > 0 OR nb_tracks > 0) AND is_present != 0" );
+    refreshCounter( Genres, "SELECT COUNT(*) FROM " + Genre::Table::Name );
+    refreshCounter( Shows, "SELECT COUNT(*) FROM " + Show::Table::Name );
+    refreshCounter( Playlists, "SELECT COUNT(*) FROM " + Playlist::Table::Name );
+    for ( auto type : CountedMediaTypes )
+    {
+        refreshCounter( media( type ), "SELECT COUNT(*) FROM " + Media::Table::Name +
+                        " WHERE type = " + toString( type ) + " AND is_present != 0 "
+                        "AND " + hasMainFile( "id_media" ) );
+    }
+}
+
+void Counters::createTriggers( sqlite::Connection* dbConn,
+                               const std::string& counter,
+                               const std::string& table,
+                               const Predicate& predicate,
+                               const std::string& updatedColumns )
+{
+    const std::string update = "UPDATE " + Table::Name + " SET value = value ";
+    const std::string where = " WHERE name = '" + counter + "';";
+    sqlite::Tools::executeRequest( dbConn,
+        "CREATE TRIGGER IF NOT EXISTS " + counter + "_counter_insert "
+            "AFTER INSERT ON " + table + " "
+            "WHEN " + predicate( "new" ) + " "
+        "BEGIN " + update + "+ 1" + where + " END" );
+    sqlite::Tools::executeRequest( dbConn,
+        "CREATE TRIGGER IF NOT EXISTS " + counter + "_counter_delete "
+            "AFTER DELETE ON " + table + " "
+            "WHEN " + predicate( "old" ) + " "
+        "BEGIN " + update + "- 1" + where + " END" );
+    if ( updatedColumns.empty() == true )
+        return;
+    sqlite::Tools::executeRequest( dbConn,
+        "CREATE TRIGGER IF NOT EXISTS " + counter + "_counter_update "
+            "AFTER UPDATE OF " + updatedColumns + " ON " + table + " "
+            "WHEN (" + predicate( "old" ) + ") != (" + predicate( "new" ) + ") "
+        "BEGIN " + update + "+ (CASE WHEN " + predicate( "new" ) +
+            " THEN 1 ELSE -1 END)" + where + " END" );
+}
+
+std::string Counters::hasMainFile( const std::string& mediaId )
+{
+    return "EXISTS(SELECT 1 FROM " + File::Table::Name + " WHERE media_id = " +
+            mediaId + " AND type IN " + mainFileTypes() + ")";
+}
+
+std::string Counters::mainFileTypes()
+{
+    return "(" + toString( IFile::Type::Main ) + "," +
+            toString( IFile::Type::Disc ) + ")";
+}
+
+}
@@ -0,0 +1,100 @@
+/*****************************************************************************
+ * Media Library
+ *****************************************************************************
+ * Copyright (C) 2015-2019 Hugo Beauzée-Luyssen, Videolabs, VideoLAN
+ *
+ * Authors: Hugo Beauzée-Luyssen<hugo@beauzee.fr>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+
+#pragma once
+
+#include "medialibrary/IMedia.h"
+
+#include <functional>
+#include <string>
+
+namespace medialibrary
+{
+
+namespace sqlite
+{
+class Connection;
+}
+
+/**
+ * @brief The Counters class maintains the number of items of the most common
+ *        listings, so that their count() doesn't have to go through the whole
+ *        listing.
+ *
+ * Each counter is a row in a dedicated table, kept up to date by triggers on
+ * the tables it counts. The predicates used by the triggers must match the
+ * ones used by the corresponding listings.
+ */
+class Counters
+{
+public:
+    struct Table
+    {
+        static const std::string Name;
+    };
+
+    static const std::string Albums;
+    // Artists with at least one album
+    static const std::string Artists;
+    // Artists with at least one album or track
+    static const std::string AllArtists;
+    static const std::string Genres;
+    static const std::string Shows;
+    static const std::string Playlists;
+
+    /**
+     * @brief media Returns the counter of the present media of the provided
+     *              type which have a main file
+     *
+     * Only audio & video media are counted
+     */
+    static std::string media( IMedia::Type type );
+    /**
+     * @brief countRequest Returns a request fetching the value of a counter,
+     *                     without any parameter to bind
+     */
+    static std::string countRequest( const std::string& counter );
+
+    static void createTable( sqlite::Connection* dbConn );
+    static void createTriggers( sqlite::Connection* dbConn );
+    /**
+     * @brief refresh Recomputes all the counters from the existing records
+     *
+     * This is only required when the triggers weren't present while the
+     * records were inserted, ie. when migrating an existing database.
+     */
+    static void refresh( sqlite::Connection* dbConn );
+
+private:
+    using Predicate = std::function<std::string( const std::string& row )>;
+
+    static void createTriggers( sqlite::Connection* dbConn,
+                                const std::string& counter,
+                                const std::string& table,
+                                const Predicate& predicate,
+                                const std::string& updatedColumns );
+    static std::string hasMainFile( const std::string& mediaId );
+    static std::string mainFileTypes();
+};
+
+}
@@ -39,7 +39,7 @@ Device::Device( MediaLibraryPtr ml, sqlite::Row& row )
     , m_uuid( row.extract<decltype(m_uuid)>() )
     , m_scheme( row.extract<decltype(m_scheme)>() )
     , m_isRemovable( row.extract<decltype(m_isRemovable)>() )
-    , m_isPresent( row.extract<decltype(m_isPresent)>() )
+    , m_isPresent( row.extract<bool>() )
     , m_lastSeen( row.extract<decltype(m_lastSeen)>() )
 {
 }
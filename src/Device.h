@@ -24,6 +24,7 @@
 
 #include "Types.h"
 #include "database/DatabaseHelpers.h"
+#include <atomic>
 #include <chrono>
 
 namespace medialibrary
@@ -31,7 +32,7 @@ namespace medialibrary
 
 class Device;
 
-class Device : public DatabaseHelpers<Device>
+class Device : public DatabaseHelpers<Device, cachepolicy::IdentityMapped>
 {
 public:
     struct Table
@@ -73,7 +74,8 @@ private:
     const std::string m_uuid;
     const std::string m_scheme;
     const bool m_isRemovable;
-    bool m_isPresent;
+    // Devices are shared between threads
+    std::atomic_bool m_isPresent;
     time_t m_lastSeen;
 
     friend struct Device::Table;
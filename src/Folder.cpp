@@ -72,22 +72,44 @@ Folder::Folder(MediaLibraryPtr ml, const std::string& path,
 {
 }
 
-void Folder::createTable( sqlite::Connection* connection)
+void Folder::createTable( sqlite::Connection* connection, uint32_t modelVersion )
 {
-    const std::string reqs[] = {
-        #include "database/tables/Folder_v15.sql"
-    };
-    for ( const auto& req : reqs )
-        sqlite::Tools::executeRequest( connection, req );
+    if ( modelVersion >= 18 )
+    {
+        const std::string reqs[] = {
+            #include "database/tables/Folder_v18.sql"
+        };
+        for ( const auto& req : reqs )
+            sqlite::Tools::executeRequest( connection, req );
+    }
+    else
+    {
+        const std::string reqs[] = {
+            #include "database/tables/Folder_v15.sql"
+        };
+        for ( const auto& req : reqs )
+            sqlite::Tools::executeRequest( connection, req );
+    }
 }
 
 void Folder::createTriggers( sqlite::Connection* connection, uint32_t modelVersion )
 {
-    const std::string reqs[] = {
-        #include "database/tables/Folder_triggers_v15.sql"
-    };
-    for ( const auto& req : reqs )
-        sqlite::Tools::executeRequest( connection, req );
+    if ( modelVersion >= 18 )
+    {
+        const std::string reqs[] = {
+            #include "database/tables/Folder_triggers_v18.sql"
+        };
+        for ( const auto& req : reqs )
+            sqlite::Tools::executeRequest( connection, req );
+    }
+    else
+    {
+        const std::string reqs[] = {
+            #include "database/tables/Folder_triggers_v15.sql"
+        };
+        for ( const auto& req : reqs )
+            sqlite::Tools::executeRequest( connection, req );
+    }
     if ( modelVersion >= 14 )
     {
         const std::string v14Reqs[] = {
@@ -203,7 +225,7 @@ void Folder::excludeEntryFolder( MediaLibraryPtr ml, int64_t folderId )
 bool Folder::ban( MediaLibraryPtr ml, const std::string& mrl )
 {
     // Ensure we delete the existing folder if any & ban the folder in an "atomic" way
-    return sqlite::Tools::withRetries( 3, [ml, &mrl]() {
+    return sqlite::Tools::withRetries( ml->getConn(), 3, [ml, &mrl]() {
         auto t = ml->getConn()->newTransaction();
 
         auto f = fromMrl( ml, mrl, BannedType::Any );
@@ -376,13 +398,18 @@ Query<IFolder> Folder::withMedia( MediaLibraryPtr ml, IMedia::Type type,
 Query<IFolder> Folder::searchWithMedia( MediaLibraryPtr ml, const std::string& pattern,
                                         IMedia::Type type, const QueryParameters* params )
 {
-    std::string req = "FROM " + Table::Name + " f "
-            " LEFT JOIN " + Device::Table::Name +
-                " d ON d.id_device = f.device_id "
-            "WHERE f.id_folder IN (SELECT rowid FROM " + Table::Name + "Fts WHERE " +
-                Table::Name + "Fts MATCH '*' || ? || '*') "
-            "AND d.is_present != 0 AND " + filterByMediaType( type );
-    return make_query<Folder, IFolder>( ml, "*", req, sortRequest( params ), pattern );
+    auto byRelevance = sqlite::Tools::sortByRelevance( params );
+    std::string req = sqlite::Tools::ftsSearchRequest( Table::Name, "f",
+                Table::PrimaryKeyColumn,
+                "LEFT JOIN " + Device::Table::Name + " d ON d.id_device = f.device_id",
+                byRelevance ) +
+            " AND d.is_present != 0 AND " + filterByMediaType( type );
+    return make_query<Folder, IFolder>( ml, "f.*", req,
+                                        byRelevance == true ?
+                                            sqlite::Tools::relevanceOrderBy(
+                                                Table::Name + "Fts.rank", params ) :
+                                            sortRequest( params ),
+                                        sqlite::Tools::ftsPattern( pattern ) );
 }
 
 Query<IFolder> Folder::entryPoints( MediaLibraryPtr ml, int64_t deviceId )
@@ -405,29 +432,29 @@ const std::string& Folder::mrl() const
     if ( m_isRemovable == false )
         return m_path;
 
+    std::lock_guard<compat::Mutex> lock( m_deviceLock );
     if ( m_fullPath.empty() == false )
         return m_fullPath;
 
     // We can't compute the full path of a folder if it's removable and the device isn't present.
     // When there's no device, we don't know the mountpoint, therefor we don't know the full path
-    // Calling isPresent will ensure we have the device representation cached locally
-    if ( isPresent() == false )
+    auto device = deviceLocked();
+    if ( device == nullptr || device->isPresent() == false )
         throw fs::DeviceRemovedException();
 
-    auto fsFactory = m_ml->fsFactoryForMrl( m_device->scheme() );
+    // m_fullPath is left empty on failure
+    auto fsFactory = m_ml->fsFactoryForMrl( device->scheme() );
     if ( fsFactory == nullptr )
     {
         assert( !"Failed to find a FileSystemFactory for a known folder" );
-        m_fullPath = "";
         return m_fullPath;
     }
-    auto deviceFs = fsFactory->createDevice( m_device->uuid() );
+    auto deviceFs = fsFactory->createDevice( device->uuid() );
     // In case the device lister hasn't been updated accordingly, we might think
     // a device still is present while it's not.
     if( deviceFs == nullptr )
     {
         assert( !"File system Device representation couldn't be found" );
-        m_fullPath = "";
         return m_fullPath;
     }
     m_fullPath = deviceFs->absoluteMrl( m_path );
@@ -439,18 +466,12 @@ const std::string&Folder::name() const
     return m_name;
 }
 
-void Folder::setName( std::string name )
+void Folder::setName( const std::string& name )
 {
     assert( m_name.empty() == true );
     static const std::string req = "UPDATE " + Table::Name +
             " SET name = ? WHERE id_folder = ?";
-    auto dbConn = m_ml->getConn();
-    if ( sqlite::Tools::executeUpdate( dbConn, req, name, m_id ) == false )
-        return;
-    static const std::string reqFts = "INSERT INTO " + Table::Name + "Fts "
-            "(rowid, name) VALUES(?, ?)";
-    sqlite::Tools::executeInsert( dbConn, reqFts, m_id, name );
-    m_name = std::move( name );
+    sqlite::Tools::executeUpdate( m_ml->getConn(), req, name, m_id );
 }
 
 const std::string& Folder::rawMrl() const
@@ -458,19 +479,13 @@ const std::string& Folder::rawMrl() const
     return m_path;
 }
 
-void Folder::setMrl( std::string mrl )
+void Folder::setMrl( const std::string& mrl )
 {
     if ( m_path == mrl )
         return;
     static const std::string req = "UPDATE " + Folder::Table::Name + " SET "
             "path = ? WHERE id_folder = ?";
-    if ( sqlite::Tools::executeUpdate( m_ml->getConn(), req, mrl, m_id ) == false )
-        return;
-    // We shouldn't use this if any full path/mrl has been cached.
-    // This is meant for migration only, so there is no need to have cached this
-    // information so far.
-    assert( m_isRemovable == false || m_fullPath.empty() == true );
-    m_path = std::move( mrl );
+    sqlite::Tools::executeUpdate( m_ml->getConn(), req, mrl, m_id );
 }
 
 std::vector<std::shared_ptr<File>> Folder::files()
@@ -504,16 +519,23 @@ bool Folder::isRemovable() const
 }
 
 bool Folder::isPresent() const
+{
+    std::lock_guard<compat::Mutex> lock( m_deviceLock );
+    auto device = deviceLocked();
+    // Handle potential sporadic errors gracefully
+    if( device == nullptr )
+        return false;
+    return device->isPresent();
+}
+
+std::shared_ptr<Device> Folder::deviceLocked() const
 {
     if ( m_device == nullptr )
         m_device = Device::fetch( m_ml, m_deviceId );
     // There must be a device containing the folder, since we never create a folder
     // without a device
     assert( m_device != nullptr );
-    // However, handle potential sporadic errors gracefully
-    if( m_device == nullptr )
-        return false;
-    return m_device->isPresent();
+    return m_device;
 }
 
 bool Folder::isBanned() const
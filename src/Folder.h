@@ -26,6 +26,7 @@
 #include "medialibrary/IMedia.h"
 #include "medialibrary/filesystem/IDevice.h"
 #include "database/DatabaseHelpers.h"
+#include "compat/Mutex.h"
 
 #include <sqlite3.h>
 
@@ -44,7 +45,7 @@ namespace fs
 // This doesn't publicly expose the DatabaseHelper inheritance in order to force
 // the user to go through Folder's overloads, as they take care of the device mountpoint
 // fetching & path composition
-class Folder : public IFolder, public DatabaseHelpers<Folder>
+class Folder : public IFolder, public DatabaseHelpers<Folder, cachepolicy::IdentityMapped>
 {
 public:
     struct Table
@@ -56,7 +57,7 @@ public:
     Folder( MediaLibraryPtr ml, sqlite::Row& row );
     Folder(MediaLibraryPtr ml, const std::string& path, int64_t parent , int64_t deviceId , bool isRemovable );
 
-    static void createTable( sqlite::Connection* connection );
+    static void createTable( sqlite::Connection* connection, uint32_t modelVersion );
     static void createTriggers( sqlite::Connection* connection, uint32_t modelVersion );
     static std::shared_ptr<Folder> create( MediaLibraryPtr ml, const std::string& mrl, int64_t parentId, Device& device, fs::IDevice& deviceFs );
     static void excludeEntryFolder( MediaLibraryPtr ml, int64_t folderId );
@@ -76,10 +77,16 @@ public:
     virtual int64_t id() const override;
     virtual const std::string& mrl() const override;
     virtual const std::string& name() const override;
+    /*
+     * The setters only update the database: folders are shared between
+     * threads, so an instance never changes once loaded. The update hook
+     * evicts it from the identity map, and the next fetch returns the new
+     * values.
+     */
     // Use for 13 -> 14 migration
-    void setName( std::string name );
+    void setName( const std::string& name );
     const std::string& rawMrl() const;
-    void setMrl( std::string mrl );
+    void setMrl( const std::string& mrl );
     std::vector<std::shared_ptr<File>> files();
     std::vector<std::shared_ptr<Folder>> folders();
     std::shared_ptr<Folder> parent();
@@ -104,6 +111,8 @@ public:
 private:
     static std::string sortRequest( const QueryParameters* params );
     static std::string filterByMediaType( IMedia::Type type );
+    // Must be called with m_deviceLock held
+    std::shared_ptr<Device> deviceLocked() const;
 
 private:
     MediaLibraryPtr m_ml;
@@ -111,16 +120,21 @@ private:
     int64_t m_id;
     // This contains the path relative to the device mountpoint (ie. excluding it)
     // or the full path (including mrl scheme) for folders on non removable devices
-    std::string m_path;
-    std::string m_name;
+    const std::string m_path;
+    const std::string m_name;
     const int64_t m_parent;
     const bool m_isBanned;
     const int64_t m_deviceId;
     const bool m_isRemovable;
 
+    // Folders are shared between threads, so the lazily fetched device &
+    // mountpoint are protected by a lock
+    mutable compat::Mutex m_deviceLock;
     mutable std::shared_ptr<Device> m_device;
     // This contains the full path, including device mountpoint (and mrl scheme,
     // as its part of the mountpoint
+    // Once computed, this doesn't change for the lifetime of this instance,
+    // since the folder is evicted from its identity map when its device changes
     mutable std::string m_fullPath;
 
     friend struct Folder::Table;
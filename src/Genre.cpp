@@ -29,6 +29,7 @@
 #include "Album.h"
 #include "AlbumTrack.h"
 #include "Artist.h"
+#include "Counters.h"
 #include "Media.h"
 #include "database/SqliteQuery.h"
 
@@ -119,7 +120,7 @@ Query<IAlbum> Genre::searchAlbums( const std::string& pattern,
     return Album::searchFromGenre( m_ml, pattern, m_id, params );
 }
 
-void Genre::createTable( sqlite::Connection* dbConn )
+void Genre::createTable( sqlite::Connection* dbConn, uint32_t dbModelVersion )
 {
     const std::string req = "CREATE TABLE IF NOT EXISTS " + Genre::Table::Name +
         "("
@@ -128,15 +129,24 @@ void Genre::createTable( sqlite::Connection* dbConn )
             "nb_tracks INTEGER NOT NULL DEFAULT 0"
         ")";
     const std::string vtableReq = "CREATE VIRTUAL TABLE IF NOT EXISTS "
+                + Genre::Table::Name + "Fts USING FTS5("
+                "name,"
+                "content=" + Genre::Table::Name + ","
+                "content_rowid=id_genre,"
+                "prefix='2 3 4',"
+                "tokenize='unicode61 remove_diacritics 2'"
+            ")";
+    const std::string vtableReqV17 = "CREATE VIRTUAL TABLE IF NOT EXISTS "
                 + Genre::Table::Name + "Fts USING FTS3("
                 "name"
             ")";
 
     sqlite::Tools::executeRequest( dbConn, req );
-    sqlite::Tools::executeRequest( dbConn, vtableReq );
+    sqlite::Tools::executeRequest( dbConn, dbModelVersion >= 18 ?
+                                       vtableReq : vtableReqV17 );
 }
 
-void Genre::createTriggers( sqlite::Connection* dbConn )
+void Genre::createTriggers( sqlite::Connection* dbConn, uint32_t dbModelVersion )
 {
     const std::string vtableInsertTrigger = "CREATE TRIGGER IF NOT EXISTS insert_genre_fts"
             " AFTER INSERT ON " + Genre::Table::Name +
@@ -144,6 +154,12 @@ void Genre::createTriggers( sqlite::Connection* dbConn )
             " INSERT INTO " + Genre::Table::Name + "Fts(rowid,name) VALUES(new.id_genre, new.name);"
             " END";
     const std::string vtableDeleteTrigger = "CREATE TRIGGER IF NOT EXISTS delete_genre_fts"
+            " BEFORE DELETE ON " + Genre::Table::Name +
+            " BEGIN"
+            " INSERT INTO " + Genre::Table::Name + "Fts(" + Genre::Table::Name + "Fts,rowid,name)"
+                " VALUES('delete', old.id_genre, old.name);"
+            " END";
+    const std::string vtableDeleteTriggerV17 = "CREATE TRIGGER IF NOT EXISTS delete_genre_fts"
             " BEFORE DELETE ON " + Genre::Table::Name +
             " BEGIN"
             " DELETE FROM " + Genre::Table::Name + "Fts WHERE rowid = old.id_genre;"
@@ -163,7 +179,8 @@ void Genre::createTriggers( sqlite::Connection* dbConn )
             " END";
 
     sqlite::Tools::executeRequest( dbConn, vtableInsertTrigger );
-    sqlite::Tools::executeRequest( dbConn, vtableDeleteTrigger );
+    sqlite::Tools::executeRequest( dbConn, dbModelVersion >= 18 ?
+                                       vtableDeleteTrigger : vtableDeleteTriggerV17 );
     sqlite::Tools::executeRequest( dbConn, onTrackCreated );
     sqlite::Tools::executeRequest( dbConn, onTrackDeleted );
 }
@@ -187,19 +204,36 @@ std::shared_ptr<Genre> Genre::fromName( MediaLibraryPtr ml, const std::string& n
 Query<IGenre> Genre::search( MediaLibraryPtr ml, const std::string& name,
                              const QueryParameters* params )
 {
-    std::string req = "FROM " + Genre::Table::Name + " WHERE id_genre IN "
-            "(SELECT rowid FROM " + Genre::Table::Name + "Fts "
-            "WHERE name MATCH '*' || ? || '*')";
-    std::string orderBy = "ORDER BY name";
-    if ( params != nullptr )
+    auto byRelevance = sqlite::Tools::sortByRelevance( params );
+    std::string req = sqlite::Tools::ftsSearchRequest( Genre::Table::Name, "g",
+                                                       Genre::Table::PrimaryKeyColumn,
+                                                       "", byRelevance );
+    std::string orderBy = "ORDER BY g.name";
+    if ( byRelevance == true )
+        orderBy = sqlite::Tools::relevanceOrderBy( Genre::Table::Name + "Fts.rank",
+                                                   params );
+    else if ( params != nullptr )
     {
         if ( params->sort != SortingCriteria::Default && params->sort != SortingCriteria::Alpha )
             LOG_WARN( "Unsupported sorting criteria, falling back to SortingCriteria::Alpha" );
         if ( params->desc == true )
             orderBy += " DESC";
     }
-    return make_query<Genre, IGenre>( ml, "*", std::move( req ),
-                                      std::move( orderBy ), name );
+    return make_query<Genre, IGenre>( ml, "g.*", std::move( req ),
+                                      std::move( orderBy ),
+                                      sqlite::Tools::ftsPattern( name ) );
+}
+
+std::vector<GenrePtr> Genre::searchBestMatches( MediaLibraryPtr ml,
+                                                const std::string& ftsPattern,
+                                                uint32_t nbItems )
+{
+    static const std::string req = "SELECT g.* FROM " + Table::Name + "Fts "
+            "CROSS JOIN " + Table::Name + " g "
+            "ON g.id_genre = " + Table::Name + "Fts.rowid "
+            "WHERE " + Table::Name + "Fts MATCH ? "
+            "ORDER BY bm25(" + Table::Name + "Fts) LIMIT ?";
+    return fetchAll<IGenre>( ml, req, ftsPattern, nbItems );
 }
 
 Query<IGenre> Genre::listAll( MediaLibraryPtr ml, const QueryParameters* params )
@@ -213,8 +247,9 @@ Query<IGenre> Genre::listAll( MediaLibraryPtr ml, const QueryParameters* params
         if ( params->desc == true )
             orderBy += " DESC";
     }
-    return make_query<Genre, IGenre>( ml, "*", std::move( req ),
-                                      std::move( orderBy ) );
+    return make_counted_query<Genre, IGenre>( ml,
+                                    Counters::countRequest( Counters::Genres ),
+                                    "*", std::move( req ), std::move( orderBy ) );
 }
 
 }
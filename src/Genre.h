@@ -57,12 +57,15 @@ public:
     virtual Query<IAlbum> searchAlbums( const std::string& pattern,
                                         const QueryParameters* params = nullptr ) const override;
 
-    static void createTable( sqlite::Connection* dbConn );
-    static void createTriggers( sqlite::Connection* dbConn );
+    static void createTable( sqlite::Connection* dbConn, uint32_t dbModelVersion );
+    static void createTriggers( sqlite::Connection* dbConn, uint32_t dbModelVersion );
     static std::shared_ptr<Genre> create( MediaLibraryPtr ml, const std::string& name );
     static std::shared_ptr<Genre> fromName( MediaLibraryPtr ml, const std::string& name );
     static Query<IGenre> search( MediaLibraryPtr ml, const std::string& name, const QueryParameters* params );
     static Query<IGenre> listAll( MediaLibraryPtr ml, const QueryParameters* params );
+    static std::vector<GenrePtr> searchBestMatches( MediaLibraryPtr ml,
+                                                    const std::string& ftsPattern,
+                                                    uint32_t nbItems );
 
 private:
     MediaLibraryPtr m_ml;
@@ -81,7 +81,7 @@ LabelPtr Label::create( MediaLibraryPtr ml, const std::string& name )
     return self;
 }
 
-void Label::createTable( sqlite::Connection* dbConnection )
+void Label::createTable( sqlite::Connection* dbConnection, uint32_t dbModelVersion )
 {
     const std::string req = "CREATE TABLE IF NOT EXISTS " + Label::Table::Name + "("
                 "id_label INTEGER PRIMARY KEY AUTOINCREMENT, "
@@ -93,20 +93,48 @@ void Label::createTable( sqlite::Connection* dbConnection )
             "PRIMARY KEY (label_id, media_id),"
             "FOREIGN KEY(label_id) REFERENCES Label(id_label) ON DELETE CASCADE,"
             "FOREIGN KEY(media_id) REFERENCES Media(id_media) ON DELETE CASCADE);";
+    const std::string ftsReq = "CREATE VIRTUAL TABLE IF NOT EXISTS " +
+                Label::Table::Name + "Fts USING FTS5("
+                "name,"
+                "content=" + Label::Table::Name + ","
+                "content_rowid=id_label,"
+                "prefix='2 3 4',"
+                "tokenize='unicode61 remove_diacritics 2'"
+            ")";
 
     sqlite::Tools::executeRequest( dbConnection, req );
     sqlite::Tools::executeRequest( dbConnection, relReq );
+    // Before model 18, the labels were indexed along with the media titles
+    if ( dbModelVersion >= 18 )
+        sqlite::Tools::executeRequest( dbConnection, ftsReq );
 }
 
-void Label::createTriggers( sqlite::Connection* dbConnection )
+void Label::createTriggers( sqlite::Connection* dbConnection, uint32_t dbModelVersion )
 {
-    const std::string ftsTrigger = "CREATE TRIGGER IF NOT EXISTS delete_label_fts "
+    if ( dbModelVersion < 18 )
+    {
+        const std::string ftsTrigger = "CREATE TRIGGER IF NOT EXISTS delete_label_fts "
+                "BEFORE DELETE ON " + Label::Table::Name +
+                " BEGIN"
+                " UPDATE " + Media::Table::Name + "Fts SET labels = TRIM(REPLACE(labels, old.name, ''))"
+                " WHERE labels MATCH old.name;"
+                " END";
+        sqlite::Tools::executeRequest( dbConnection, ftsTrigger );
+        return;
+    }
+    const std::string ftsInsertTrigger = "CREATE TRIGGER IF NOT EXISTS insert_label_fts "
+            "AFTER INSERT ON " + Label::Table::Name +
+            " BEGIN"
+            " INSERT INTO " + Label::Table::Name + "Fts(rowid,name) VALUES(new.id_label, new.name);"
+            " END";
+    const std::string ftsDeleteTrigger = "CREATE TRIGGER IF NOT EXISTS delete_label_fts "
             "BEFORE DELETE ON " + Label::Table::Name +
             " BEGIN"
-            " UPDATE " + Media::Table::Name + "Fts SET labels = TRIM(REPLACE(labels, old.name, ''))"
-            " WHERE labels MATCH old.name;"
+            " INSERT INTO " + Label::Table::Name + "Fts(" + Label::Table::Name + "Fts,rowid,name)"
+                " VALUES('delete', old.id_label, old.name);"
             " END";
-    sqlite::Tools::executeRequest( dbConnection, ftsTrigger );
+    sqlite::Tools::executeRequest( dbConnection, ftsInsertTrigger );
+    sqlite::Tools::executeRequest( dbConnection, ftsDeleteTrigger );
 }
 
 }
@@ -53,8 +53,8 @@ class Label : public ILabel, public DatabaseHelpers<Label>
         virtual Query<IMedia> media() override;
 
         static LabelPtr create( MediaLibraryPtr ml, const std::string& name );
-        static void createTable( sqlite::Connection* dbConnection );
-        static void createTriggers( sqlite::Connection* dbConnection );
+        static void createTable( sqlite::Connection* dbConnection, uint32_t dbModelVersion );
+        static void createTriggers( sqlite::Connection* dbConnection, uint32_t dbModelVersion );
 
     private:
         MediaLibraryPtr m_ml;
@@ -34,6 +34,7 @@
 #include "AlbumTrack.h"
 #include "Artist.h"
 #include "AudioTrack.h"
+#include "Counters.h"
 #include "Device.h"
 #include "Media.h"
 #include "File.h"
@@ -184,12 +185,14 @@ uint32_t Media::playCount() const
 
 bool Media::increasePlayCount()
 {
+    // Increment the stored value rather than writing this instance's one, as
+    // other instances might increment it before this write gets committed
     static const std::string req = "UPDATE " + Media::Table::Name + " SET "
-            "play_count = ?, last_played_date = ?, real_last_played_date = ? "
-            "WHERE id_media = ?";
+            "play_count = IFNULL(play_count, 0) + 1, last_played_date = ?, "
+            "real_last_played_date = ? WHERE id_media = ?";
     auto lastPlayedDate = time( nullptr );
-    if ( sqlite::Tools::executeUpdate( m_ml->getConn(), req, m_playCount + 1,
-                                       lastPlayedDate, lastPlayedDate, m_id ) == false )
+    if ( sqlite::Tools::executeDeferrableWrite( m_ml->getConn(), req, lastPlayedDate,
+                                                lastPlayedDate, m_id ) == false )
         return false;
     m_playCount++;
     m_lastPlayedDate = lastPlayedDate;
@@ -200,7 +203,7 @@ bool Media::setPlayCount( uint32_t playCount )
 {
     static const std::string req = "UPDATE " + Media::Table::Name + " SET "
             "play_count = ? WHERE id_media = ?";
-    if ( sqlite::Tools::executeUpdate( m_ml->getConn(), req, playCount, m_id ) == false )
+    if ( sqlite::Tools::executeDeferrableWrite( m_ml->getConn(), req, playCount, m_id ) == false )
         return false;
     m_playCount = playCount;
     return true;
@@ -221,7 +224,7 @@ bool Media::setFavorite( bool favorite )
     static const std::string req = "UPDATE " + Media::Table::Name + " SET is_favorite = ? WHERE id_media = ?";
     if ( m_isFavorite == favorite )
         return true;
-    if ( sqlite::Tools::executeUpdate( m_ml->getConn(), req, favorite, m_id ) == false )
+    if ( sqlite::Tools::executeDeferrableWrite( m_ml->getConn(), req, favorite, m_id ) == false )
         return false;
     m_isFavorite = favorite;
     return true;
@@ -471,6 +474,47 @@ void Media::removeFile( File& file )
         m_files.erase( it );
 }
 
+std::string Media::searchRequest( const std::string& joins, bool byRelevance )
+{
+    if ( byRelevance == true )
+    {
+        // Start from the matches, so that only them get sorted. A media
+        // matched both by its title and a label keeps its best score, which
+        // is the lowest one
+        return "FROM (SELECT id, MIN(score) AS score FROM ("
+                    "SELECT rowid AS id, rank AS score "
+                    "FROM " + Media::Table::Name + "Fts "
+                    "WHERE " + Media::Table::Name + "Fts MATCH ? "
+                    "UNION ALL "
+                    "SELECT lfr.media_id, " + Label::Table::Name + "Fts.rank "
+                    "FROM " + Label::Table::Name + "Fts "
+                    "CROSS JOIN LabelFileRelation lfr "
+                    "ON lfr.label_id = " + Label::Table::Name + "Fts.rowid "
+                    "WHERE " + Label::Table::Name + "Fts MATCH ?"
+                ") GROUP BY id) s "
+               "CROSS JOIN " + Media::Table::Name + " m " + joins +
+               " WHERE m.id_media = s.id";
+    }
+    return "FROM " + Media::Table::Name + " m " + joins +
+           " WHERE m.id_media IN ("
+           "SELECT rowid FROM " + Media::Table::Name + "Fts"
+           " WHERE " + Media::Table::Name + "Fts MATCH ?"
+           " UNION ALL "
+           // Look the matching labels up first, so that the relation's
+           // primary key is used
+           "SELECT lfr.media_id FROM " + Label::Table::Name + "Fts "
+               "CROSS JOIN LabelFileRelation lfr "
+               "ON lfr.label_id = " + Label::Table::Name + "Fts.rowid "
+               "WHERE " + Label::Table::Name + "Fts MATCH ?)";
+}
+
+std::string Media::searchSortRequest( const QueryParameters* params )
+{
+    if ( sqlite::Tools::sortByRelevance( params ) == true )
+        return sqlite::Tools::relevanceOrderBy( "s.score", params );
+    return sortRequest( params );
+}
+
 std::string Media::addRequestJoin( const QueryParameters* params, bool forceFile,
                                     bool forceAlbumTrack )
 {
@@ -512,6 +556,9 @@ std::string Media::addRequestJoin( const QueryParameters* params, bool forceFile
         case SortingCriteria::NbMedia:
             // Unrelated to media requests
             break;
+        case SortingCriteria::Relevance:
+            // Provided by the search requests
+            break;
     }
     std::string req;
     // Use "LEFT JOIN to allow for ordering different media type
@@ -603,6 +650,13 @@ Query<IMedia> Media::listAll( MediaLibraryPtr ml, IMedia::Type type,
             " AND (f.type = ? OR f.type = ?)"
             " AND m.is_present != 0";
 
+    // The listed media are counted by Counters, make sure to keep the
+    // predicates in sync
+    if ( type == IMedia::Type::Audio || type == IMedia::Type::Video )
+        return make_counted_query<Media, IMedia>( ml,
+                                    Counters::countRequest( Counters::media( type ) ),
+                                    "m.*", std::move( req ), sortRequest( params ),
+                                    type, IFile::Type::Main, IFile::Type::Disc );
     return make_query<Media, IMedia>( ml, "m.*", std::move( req ),
                                       sortRequest( params ), type,
                                       IFile::Type::Main, IFile::Type::Disc );
@@ -683,11 +737,44 @@ void Media::setFileName( std::string fileName )
 
 void Media::createTable( sqlite::Connection* connection, uint32_t modelVersion )
 {
-    std::string reqs[] = {
-        #include "database/tables/Media_v14.sql"
-    };
-    for ( const auto& req : reqs )
-        sqlite::Tools::executeRequest( connection, req );
+    if ( modelVersion >= 18 )
+    {
+        const std::string reqs[] = {
+            #include "database/tables/Media_v18.sql"
+        };
+        for ( const auto& req : reqs )
+            sqlite::Tools::executeRequest( connection, req );
+    }
+    else
+    {
+        // Before model 18, MediaFts is a FTS3 table which also contains the
+        // media labels
+        const std::string reqs[] = {
+            #include "database/tables/Media_v14.sql"
+        };
+        for ( const auto& req : reqs )
+            sqlite::Tools::executeRequest( connection, req );
+    }
+    if ( modelVersion >= 19 )
+    {
+        // The fuzzy searches count the trigrams each media shares with the
+        // pattern through the trigram table vocabulary
+        const std::string reqs[] = {
+            "CREATE VIRTUAL TABLE IF NOT EXISTS " + Media::Table::Name +
+                "TrigramFts USING FTS5("
+                "title,"
+                "content=" + Media::Table::Name + ","
+                "content_rowid=id_media,"
+                "tokenize='trigram',"
+                "detail='column'"
+            ")",
+            "CREATE VIRTUAL TABLE IF NOT EXISTS " + Media::Table::Name +
+                "TrigramVocab USING fts5vocab(" + Media::Table::Name +
+                "TrigramFts, instance)",
+        };
+        for ( const auto& req : reqs )
+            sqlite::Tools::executeRequest( connection, req );
+    }
     if ( modelVersion >= 14 )
     {
         // Don't create this index before model 14, as the real_last_played_date
@@ -700,12 +787,51 @@ void Media::createTable( sqlite::Connection* connection, uint32_t modelVersion )
 
 void Media::createTriggers( sqlite::Connection* connection, uint32_t modelVersion )
 {
-    const std::string reqs[] = {
-        #include "database/tables/Media_triggers_v14.sql"
-    };
-
-    for ( const auto& req : reqs )
-        sqlite::Tools::executeRequest( connection, req );
+    if ( modelVersion >= 18 )
+    {
+        const std::string reqs[] = {
+            #include "database/tables/Media_triggers_v18.sql"
+        };
+        for ( const auto& req : reqs )
+            sqlite::Tools::executeRequest( connection, req );
+    }
+    else
+    {
+        const std::string reqs[] = {
+            #include "database/tables/Media_triggers_v14.sql"
+        };
+        for ( const auto& req : reqs )
+            sqlite::Tools::executeRequest( connection, req );
+    }
+    if ( modelVersion >= 19 )
+    {
+        const std::string reqs[] = {
+            "CREATE TRIGGER IF NOT EXISTS insert_media_trigram"
+            " AFTER INSERT ON " + Media::Table::Name +
+            " BEGIN"
+                " INSERT INTO " + Media::Table::Name + "TrigramFts(rowid,title)"
+                    " VALUES(new.id_media, new.title);"
+            " END",
+            "CREATE TRIGGER IF NOT EXISTS delete_media_trigram"
+            " BEFORE DELETE ON " + Media::Table::Name +
+            " BEGIN"
+                " INSERT INTO " + Media::Table::Name + "TrigramFts(" +
+                    Media::Table::Name + "TrigramFts,rowid,title)"
+                    " VALUES('delete', old.id_media, old.title);"
+            " END",
+            "CREATE TRIGGER IF NOT EXISTS update_media_title_trigram"
+            " AFTER UPDATE OF title ON " + Media::Table::Name +
+            " BEGIN"
+                " INSERT INTO " + Media::Table::Name + "TrigramFts(" +
+                    Media::Table::Name + "TrigramFts,rowid,title)"
+                    " VALUES('delete', old.id_media, old.title);"
+                " INSERT INTO " + Media::Table::Name + "TrigramFts(rowid,title)"
+                    " VALUES(new.id_media, new.title);"
+            " END",
+        };
+        for ( const auto& req : reqs )
+            sqlite::Tools::executeRequest( connection, req );
+    }
 
     if ( modelVersion >= 14 )
     {
@@ -738,19 +864,10 @@ bool Media::addLabel( LabelPtr label )
     }
     try
     {
-        return sqlite::Tools::withRetries( 3, [this]( LabelPtr label ) {
-            auto t = m_ml->getConn()->newTransaction();
-
-            const char* req = "INSERT INTO LabelFileRelation VALUES(?, ?)";
-            if ( sqlite::Tools::executeInsert( m_ml->getConn(), req, label->id(), m_id ) == 0 )
-                return false;
-            const std::string reqFts = "UPDATE " + Media::Table::Name + "Fts "
-                "SET labels = labels || ' ' || ? WHERE rowid = ?";
-            if ( sqlite::Tools::executeUpdate( m_ml->getConn(), reqFts, label->name(), m_id ) == false )
-                return false;
-            t->commit();
-            return true;
-        }, std::move( label ) );
+        // The labels are indexed by the LabelFts table, there is no need to
+        // update the media FTS table
+        const char* req = "INSERT INTO LabelFileRelation VALUES(?, ?)";
+        return sqlite::Tools::executeInsert( m_ml->getConn(), req, label->id(), m_id ) != 0;
     }
     catch ( const sqlite::errors::Generic& ex )
     {
@@ -768,19 +885,8 @@ bool Media::removeLabel( LabelPtr label )
     }
     try
     {
-        return sqlite::Tools::withRetries( 3, [this]( LabelPtr label ) {
-            auto t = m_ml->getConn()->newTransaction();
-
-            const char* req = "DELETE FROM LabelFileRelation WHERE label_id = ? AND media_id = ?";
-            if ( sqlite::Tools::executeDelete( m_ml->getConn(), req, label->id(), m_id ) == false )
-                return false;
-            const std::string reqFts = "UPDATE " + Media::Table::Name + "Fts "
-                    "SET labels = TRIM(REPLACE(labels, ?, '')) WHERE rowid = ?";
-            if ( sqlite::Tools::executeUpdate( m_ml->getConn(), reqFts, label->name(), m_id ) == false )
-                return false;
-            t->commit();
-            return true;
-        }, std::move( label ) );
+        const char* req = "DELETE FROM LabelFileRelation WHERE label_id = ? AND media_id = ?";
+        return sqlite::Tools::executeDelete( m_ml->getConn(), req, label->id(), m_id );
     }
     catch ( const sqlite::errors::Generic& ex )
     {
@@ -792,126 +898,182 @@ bool Media::removeLabel( LabelPtr label )
 Query<IMedia> Media::search( MediaLibraryPtr ml, const std::string& title,
                              const QueryParameters* params )
 {
-    std::string req = "FROM " + Media::Table::Name + " m ";
+    std::string req = searchRequest( addRequestJoin( params, true, false ),
+                                     sqlite::Tools::sortByRelevance( params ) );
+    req +=  " AND m.is_present = 1"
+            " AND (f.type = ? OR f.type = ?)"
+            " AND m.type != ? AND m.type != ?";
+    auto ftsPattern = sqlite::Tools::ftsPattern( title );
+    return make_query<Media, IMedia>( ml, "m.*", std::move( req ),
+                                      searchSortRequest( params ), ftsPattern, ftsPattern,
+                                      File::Type::Main, File::Type::Disc,
+                                      Media::Type::External, Media::Type::Stream );
+}
+
+Query<IMedia> Media::search( MediaLibraryPtr ml, const std::string& title,
+                             Media::Type type, const QueryParameters* params )
+{
+    std::string req = searchRequest( addRequestJoin( params, true, false ),
+                                     sqlite::Tools::sortByRelevance( params ) );
+    req +=  " AND m.is_present = 1"
+            " AND (f.type = ? OR f.type = ?)"
+            " AND m.type = ?";
+    auto ftsPattern = sqlite::Tools::ftsPattern( title );
+    return make_query<Media, IMedia>( ml, "m.*", std::move( req ),
+                                      searchSortRequest( params ), ftsPattern, ftsPattern,
+                                      File::Type::Main, File::Type::Disc,
+                                      type );
+}
+
+Query<IMedia> Media::fuzzySearch( MediaLibraryPtr ml, const std::string& title,
+                                  const QueryParameters* params )
+{
+    auto trigrams = sqlite::Tools::trigrams( title );
+    if ( trigrams.empty() == true )
+        return {};
+    // Start from the matching media, instead of filtering all of them
+    std::string req = "FROM (" +
+            sqlite::Tools::trigramRequest( Media::Table::Name + "TrigramVocab",
+                                           trigrams.size() ) + ") t "
+            "CROSS JOIN " + Media::Table::Name + " m ON m.id_media = t.id ";
 
     req += addRequestJoin( params, true, false );
 
     req +=  " WHERE"
-            " m.id_media IN (SELECT rowid FROM " + Media::Table::Name + "Fts"
-            " WHERE " + Media::Table::Name + "Fts MATCH '*' || ? || '*')"
-            " AND m.is_present = 1"
+            " m.is_present = 1"
             " AND (f.type = ? OR f.type = ?)"
             " AND m.type != ? AND m.type != ?";
+    auto minOverlap = sqlite::Tools::minTrigramOverlap( trigrams.size() );
     return make_query<Media, IMedia>( ml, "m.*", std::move( req ),
-                                      sortRequest( params ), title,
+                                      sqlite::Tools::prependSortKey( "t.overlap DESC",
+                                                                     sortRequest( params ) ),
+                                      std::move( trigrams ), minOverlap,
                                       File::Type::Main, File::Type::Disc,
                                       Media::Type::External, Media::Type::Stream );
 }
 
-Query<IMedia> Media::search( MediaLibraryPtr ml, const std::string& title,
-                             Media::Type type, const QueryParameters* params )
+std::vector<MediaPtr> Media::searchBestMatches( MediaLibraryPtr ml,
+                                                const std::string& ftsPattern,
+                                                uint32_t nbItems )
+{
+    // A media matched both by its title and a label keeps its best bm25
+    // score, which is the lowest one
+    static const std::string req = "SELECT m.* FROM ("
+                "SELECT rowid AS id, bm25(" + Media::Table::Name + "Fts) AS score "
+                "FROM " + Media::Table::Name + "Fts "
+                "WHERE " + Media::Table::Name + "Fts MATCH ? "
+                "UNION ALL "
+                "SELECT lfr.media_id, bm25(" + Label::Table::Name + "Fts) "
+                "FROM " + Label::Table::Name + "Fts "
+                "CROSS JOIN LabelFileRelation lfr "
+                "ON lfr.label_id = " + Label::Table::Name + "Fts.rowid "
+                "WHERE " + Label::Table::Name + "Fts MATCH ?"
+            ") s "
+            // Only look the matches up, instead of filtering all the media
+            "CROSS JOIN " + Media::Table::Name + " m ON m.id_media = s.id "
+            "CROSS JOIN " + File::Table::Name + " f ON f.media_id = m.id_media "
+            "WHERE m.is_present = 1 "
+            "AND (f.type = ? OR f.type = ?) "
+            "AND m.type != ? AND m.type != ? "
+            "GROUP BY m.id_media "
+            "ORDER BY MIN(s.score) LIMIT ?";
+    return fetchAll<IMedia>( ml, req, ftsPattern, ftsPattern,
+                             File::Type::Main, File::Type::Disc,
+                             Media::Type::External, Media::Type::Stream, nbItems );
+}
+
+Query<IMedia> Media::fromSearchMatches( MediaLibraryPtr ml, std::vector<int64_t> ids,
+                                        const QueryParameters* params )
 {
     std::string req = "FROM " + Media::Table::Name + " m ";
 
     req += addRequestJoin( params, true, false );
-    req +=  " WHERE"
-            " m.id_media IN (SELECT rowid FROM " + Media::Table::Name + "Fts"
-            " WHERE " + Media::Table::Name + "Fts MATCH '*' || ? || '*')"
-            " AND m.is_present = 1"
+
+    req += " WHERE m.id_media IN (";
+    for ( auto i = 0u; i < ids.size(); ++i )
+        req += i == 0 ? "?" : ",?";
+    req +=  ") AND m.is_present = 1"
             " AND (f.type = ? OR f.type = ?)"
-            " AND m.type = ?";
+            " AND m.type != ? AND m.type != ?";
     return make_query<Media, IMedia>( ml, "m.*", std::move( req ),
-                                      sortRequest( params ), title,
+                                      sortRequest( params ), std::move( ids ),
                                       File::Type::Main, File::Type::Disc,
-                                      type );
+                                      Media::Type::External, Media::Type::Stream );
 }
 
 Query<IMedia> Media::searchAlbumTracks(MediaLibraryPtr ml, const std::string& pattern, int64_t albumId, const QueryParameters* params)
 {
-    std::string req = "FROM " + Media::Table::Name + " m ";
-
-    req += addRequestJoin( params, true, true );
-    req +=  " WHERE"
-            " m.id_media IN (SELECT rowid FROM " + Media::Table::Name + "Fts"
-            " WHERE " + Media::Table::Name + "Fts MATCH '*' || ? || '*')"
-            " AND att.album_id = ?"
+    std::string req = searchRequest( addRequestJoin( params, true, true ),
+                                     sqlite::Tools::sortByRelevance( params ) );
+    req +=  " AND att.album_id = ?"
             " AND m.is_present = 1"
             " AND f.type = ?"
             " AND m.subtype = ?";
+    auto ftsPattern = sqlite::Tools::ftsPattern( pattern );
     return make_query<Media, IMedia>( ml, "m.*", std::move( req ),
-                                      sortRequest( params ), pattern, albumId,
+                                      searchSortRequest( params ), ftsPattern, ftsPattern,
+                                      albumId,
                                       File::Type::Main, Media::SubType::AlbumTrack );
 }
 
 Query<IMedia> Media::searchArtistTracks(MediaLibraryPtr ml, const std::string& pattern, int64_t artistId, const QueryParameters* params)
 {
-    std::string req = "FROM " + Media::Table::Name + " m ";
-
-    req += addRequestJoin( params, true, true );
-
-    req +=  " WHERE"
-            " m.id_media IN (SELECT rowid FROM " + Media::Table::Name + "Fts"
-            " WHERE " + Media::Table::Name + "Fts MATCH '*' || ? || '*')"
-            " AND att.artist_id = ?"
+    std::string req = searchRequest( addRequestJoin( params, true, true ),
+                                     sqlite::Tools::sortByRelevance( params ) );
+    req +=  " AND att.artist_id = ?"
             " AND m.is_present = 1"
             " AND f.type = ?"
             " AND m.subtype = ?";
+    auto ftsPattern = sqlite::Tools::ftsPattern( pattern );
     return make_query<Media, IMedia>( ml, "m.*", std::move( req ),
-                                      sortRequest( params ), pattern, artistId,
+                                      searchSortRequest( params ), ftsPattern, ftsPattern,
+                                      artistId,
                                       File::Type::Main, Media::SubType::AlbumTrack );
 }
 
 Query<IMedia> Media::searchGenreTracks(MediaLibraryPtr ml, const std::string& pattern, int64_t genreId, const QueryParameters* params)
 {
-    std::string req = "FROM " + Media::Table::Name + " m ";
-
-    req += addRequestJoin( params, true, true );
-
-    req +=  " WHERE"
-            " m.id_media IN (SELECT rowid FROM " + Media::Table::Name + "Fts"
-            " WHERE " + Media::Table::Name + "Fts MATCH '*' || ? || '*')"
-            " AND att.genre_id = ?"
+    std::string req = searchRequest( addRequestJoin( params, true, true ),
+                                     sqlite::Tools::sortByRelevance( params ) );
+    req +=  " AND att.genre_id = ?"
             " AND m.is_present = 1"
             " AND f.type = ?"
             " AND m.subtype = ?";
+    auto ftsPattern = sqlite::Tools::ftsPattern( pattern );
     return make_query<Media, IMedia>( ml, "m.*", std::move( req ),
-                                      sortRequest( params ), pattern, genreId,
+                                      searchSortRequest( params ), ftsPattern, ftsPattern,
+                                      genreId,
                                       File::Type::Main, Media::SubType::AlbumTrack );
 }
 
 Query<IMedia> Media::searchShowEpisodes(MediaLibraryPtr ml, const std::string& pattern,
                                         int64_t showId, const QueryParameters* params)
 {
-    std::string req = "FROM " + Media::Table::Name + " m ";
-
-    req += addRequestJoin( params, true, false );
-
-    req +=  " INNER JOIN " + ShowEpisode::Table::Name + " ep ON ep.media_id = m.id_media "
-            " WHERE"
-            " m.id_media IN (SELECT rowid FROM " + Media::Table::Name + "Fts"
-            " WHERE " + Media::Table::Name + "Fts MATCH '*' || ? || '*')"
-            " AND ep.show_id = ?"
+    std::string req = searchRequest( addRequestJoin( params, true, false ) +
+                " INNER JOIN " + ShowEpisode::Table::Name + " ep ON ep.media_id = m.id_media ",
+                sqlite::Tools::sortByRelevance( params ) );
+    req +=  " AND ep.show_id = ?"
             " AND m.is_present = 1"
             " AND f.type = ?"
             " AND m.subtype = ?";
+    auto ftsPattern = sqlite::Tools::ftsPattern( pattern );
     return make_query<Media, IMedia>( ml, "m.*", std::move( req ),
-                                      sortRequest( params ), pattern, showId,
+                                      searchSortRequest( params ), ftsPattern, ftsPattern,
+                                      showId,
                                       File::Type::Main, Media::SubType::ShowEpisode );
 }
 
 Query<IMedia> Media::searchInPlaylist( MediaLibraryPtr ml, const std::string& pattern,
                                        int64_t playlistId, const QueryParameters* params )
 {
-    std::string req = "FROM " + Media::Table::Name + " m ";
-
-    req += addRequestJoin( params, true, false );
-
-    req += "LEFT JOIN PlaylistMediaRelation pmr ON pmr.media_id = m.id_media "
-           "WHERE pmr.playlist_id = ? AND m.is_present != 0 AND "
-           "m.id_media IN (SELECT rowid FROM " + Media::Table::Name + "Fts "
-           "WHERE " + Media::Table::Name + "Fts MATCH '*' || ? || '*')";
+    std::string req = searchRequest( addRequestJoin( params, true, false ) +
+                "LEFT JOIN PlaylistMediaRelation pmr ON pmr.media_id = m.id_media ",
+                sqlite::Tools::sortByRelevance( params ) );
+    req += " AND pmr.playlist_id = ? AND m.is_present != 0";
+    auto ftsPattern = sqlite::Tools::ftsPattern( pattern );
     return make_query<Media, IMedia>( ml, "m.*", std::move( req ),
-                                      sortRequest( params ), playlistId, pattern );
+                                      searchSortRequest( params ), ftsPattern,
+                                      ftsPattern, playlistId );
 }
 
 Query<IMedia> Media::fetchHistory( MediaLibraryPtr ml )
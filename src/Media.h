@@ -152,6 +152,26 @@ class Media : public IMedia, public DatabaseHelpers<Media>
                                                  int64_t showId, const QueryParameters* params );
         static Query<IMedia> searchInPlaylist( MediaLibraryPtr ml, const std::string& pattern,
                                                  int64_t playlistId, const QueryParameters* params );
+        /**
+         * @brief fuzzySearch Returns the media sharing enough trigrams with
+         *        the pattern, the ones sharing the most first
+         */
+        static Query<IMedia> fuzzySearch( MediaLibraryPtr ml, const std::string& title,
+                                          const QueryParameters* params );
+        /**
+         * @brief searchBestMatches Returns the nbItems media matching an
+         *        already converted FTS pattern, the most relevant first
+         */
+        static std::vector<MediaPtr> searchBestMatches( MediaLibraryPtr ml,
+                                                        const std::string& ftsPattern,
+                                                        uint32_t nbItems );
+        /**
+         * @brief fromSearchMatches Returns the media among the provided ones
+         *        which search() would return, sorted the same way
+         * @param ids The media matching a pattern
+         */
+        static Query<IMedia> fromSearchMatches( MediaLibraryPtr ml, std::vector<int64_t> ids,
+                                                const QueryParameters* params );
         static Query<IMedia> fetchHistory( MediaLibraryPtr ml );
         static Query<IMedia> fetchStreamHistory( MediaLibraryPtr ml );
         static Query<IMedia> fromFolderId( MediaLibraryPtr ml, Type type,
@@ -163,6 +183,20 @@ class Media : public IMedia, public DatabaseHelpers<Media>
 
 private:
         static std::string addRequestJoin(const QueryParameters* params, bool forceFile , bool forceAlbumTrack);
+        /**
+         * @brief searchRequest Returns the FROM & WHERE clauses of a request
+         *        listing the media whose title or labels match a FTS pattern,
+         *        which must be bound twice, before any other parameter.
+         *        When sorting by relevance, the matches are exposed as 's',
+         *        along with their best score, as 's.score'
+         * @param joins Some joins inserted before the WHERE clause
+         */
+        static std::string searchRequest( const std::string& joins, bool byRelevance );
+        /**
+         * @brief searchSortRequest Returns the ORDER BY clause of a request
+         *        built from searchRequest()
+         */
+        static std::string searchSortRequest( const QueryParameters* params );
         static std::string sortRequest( const QueryParameters* params );
 
 private:
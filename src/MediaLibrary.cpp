@@ -26,6 +26,7 @@
 
 #include <algorithm>
 #include <functional>
+#include <limits>
 #include <utility>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -34,6 +35,7 @@
 #include "AlbumTrack.h"
 #include "Artist.h"
 #include "AudioTrack.h"
+#include "Counters.h"
 #include "discoverer/DiscovererWorker.h"
 #include "discoverer/probe/CrawlerProbe.h"
 #include "utils/ModificationsNotifier.h"
@@ -48,6 +50,7 @@
 #include "Movie.h"
 #include "parser/Parser.h"
 #include "Playlist.h"
+#include "SearchSession.h"
 #include "Show.h"
 #include "ShowEpisode.h"
 #include "SubtitleTrack.h"
@@ -55,6 +58,7 @@
 #include "database/SqliteTools.h"
 #include "database/SqliteConnection.h"
 #include "database/SqliteQuery.h"
+#include "database/SqliteTransaction.h"
 #include "utils/Filename.h"
 #include "utils/Url.h"
 #include "VideoTrack.h"
@@ -71,6 +75,8 @@
 #endif
 #include "metadata_services/MetadataParser.h"
 #include "metadata_services/ThumbnailerWorker.h"
+#include "database/MaintenanceWorker.h"
+#include "database/QueryExecutor.h"
 
 // FileSystem
 #include "factory/DeviceListerFactory.h"
@@ -121,17 +127,27 @@ MediaLibrary::MediaLibrary()
     , m_initialized( false )
     , m_discovererIdle( true )
     , m_parserIdle( true )
+    , m_searchGeneration( 0 )
 {
     Log::setLogLevel( m_verbosity );
 }
 
 MediaLibrary::~MediaLibrary()
 {
+    // The pending asynchronous queries don't need to run anymore
+    if ( m_queryExecutor != nullptr )
+        m_queryExecutor->stop();
+    if ( m_maintenanceWorker != nullptr )
+        m_maintenanceWorker->stop();
     // Explicitely stop the discoverer, to avoid it writting while tearing down.
     if ( m_discovererWorker != nullptr )
         m_discovererWorker->stop();
     if ( m_parser != nullptr )
         m_parser->stop();
+    // Commit the deferred writes while the entities they may notify about
+    // can still be handled
+    if ( m_dbConnection != nullptr )
+        m_dbConnection->setWriteCoalescingDelay( std::chrono::milliseconds{ 0 } );
 }
 
 void MediaLibrary::createAllTables()
@@ -143,77 +159,141 @@ void MediaLibrary::createAllTables()
     // an update on files, and so on.
 
     Device::createTable( m_dbConnection.get() );
-    Folder::createTable( m_dbConnection.get() );
+    Folder::createTable( m_dbConnection.get(), dbModelVersion );
     Thumbnail::createTable( m_dbConnection.get() );
     Media::createTable( m_dbConnection.get(), dbModelVersion );
     File::createTable( m_dbConnection.get() );
-    Label::createTable( m_dbConnection.get() );
+    Label::createTable( m_dbConnection.get(), dbModelVersion );
     Playlist::createTable( m_dbConnection.get(), dbModelVersion );
-    Genre::createTable( m_dbConnection.get() );
-    Album::createTable( m_dbConnection.get() );
+    Genre::createTable( m_dbConnection.get(), dbModelVersion );
+    Album::createTable( m_dbConnection.get(), dbModelVersion );
     AlbumTrack::createTable( m_dbConnection.get() );
-    Show::createTable( m_dbConnection.get() );
+    Show::createTable( m_dbConnection.get(), dbModelVersion );
     ShowEpisode::createTable( m_dbConnection.get() );
     Movie::createTable( m_dbConnection.get() );
     VideoTrack::createTable( m_dbConnection.get() );
     AudioTrack::createTable( m_dbConnection.get() );
-    Artist::createTable( m_dbConnection.get() );
+    Artist::createTable( m_dbConnection.get(), dbModelVersion );
     Artist::createDefaultArtists( m_dbConnection.get() );
     Settings::createTable( m_dbConnection.get() );
     parser::Task::createTable( m_dbConnection.get() );
     Metadata::createTable( m_dbConnection.get() );
     SubtitleTrack::createTable( m_dbConnection.get() );
+    Counters::createTable( m_dbConnection.get() );
 }
 
 void MediaLibrary::createAllTriggers()
 {
     auto dbModelVersion = m_settings.dbModelVersion();
     Folder::createTriggers( m_dbConnection.get(), dbModelVersion );
-    Album::createTriggers( m_dbConnection.get() );
+    Album::createTriggers( m_dbConnection.get(), dbModelVersion );
     AlbumTrack::createTriggers( m_dbConnection.get() );
     Artist::createTriggers( m_dbConnection.get(), dbModelVersion );
     Media::createTriggers( m_dbConnection.get(), dbModelVersion );
     File::createTriggers( m_dbConnection.get() );
-    Genre::createTriggers( m_dbConnection.get() );
-    Playlist::createTriggers( m_dbConnection.get() );
-    Label::createTriggers( m_dbConnection.get() );
-    Show::createTriggers( m_dbConnection.get() );
+    Genre::createTriggers( m_dbConnection.get(), dbModelVersion );
+    Playlist::createTriggers( m_dbConnection.get(), dbModelVersion );
+    Label::createTriggers( m_dbConnection.get(), dbModelVersion );
+    Show::createTriggers( m_dbConnection.get(), dbModelVersion );
+    if ( dbModelVersion >= 17 )
+        Counters::createTriggers( m_dbConnection.get() );
+}
+
+/*
+ * Creates all the tables & triggers which don't exist yet, and saves the
+ * schema fingerprint once the model is up to date.
+ * The settings are loaded first, as some tables & triggers depend on the
+ * model version.
+ */
+bool MediaLibrary::createSchema()
+{
+    auto t = m_dbConnection->newTransaction();
+    Settings::createTable( m_dbConnection.get() );
+    if ( m_settings.load() == false )
+        return false;
+    createAllTables();
+    createAllTriggers();
+    // An outdated model is about to be migrated, and the migrations create
+    // their own schema. It will be fingerprinted during the next startup.
+    if ( m_settings.dbModelVersion() == Settings::DbModelVersion &&
+         m_settings.isRescanPending() == false )
+    {
+        if ( m_settings.saveSchemaFingerprint( schemaFingerprint() ) == false )
+            return false;
+    }
+    t->commit();
+    return true;
+}
+
+uint32_t MediaLibrary::schemaFingerprint()
+{
+    sqlite::SchemaRecorder recorder( m_settings.dbModelVersion() );
+    createAllTables();
+    createAllTriggers();
+    return recorder.fingerprint();
+}
+
+/*
+ * Returns true when the schema was already created by this version of the
+ * library, in which case there's no need to run all of its requests again.
+ * The settings are loaded along the way.
+ */
+bool MediaLibrary::isSchemaUpToDate()
+{
+    auto fingerprint = m_settings.schemaFingerprint();
+    if ( fingerprint == 0 || m_settings.load() == false )
+        return false;
+    if ( m_settings.dbModelVersion() != Settings::DbModelVersion ||
+         m_settings.isRescanPending() == true )
+        return false;
+    return schemaFingerprint() == fingerprint;
 }
 
 void MediaLibrary::registerEntityHooks()
 {
+    // Folders cache their device mountpoint, so they must be reloaded once
+    // their device changes
+    m_dbConnection->registerUpdateHook( Device::Table::Name,
+                                        [this]( sqlite::Connection::HookReason, int64_t rowId ) {
+        Folder::identityMap( this ).evictIf<Folder>( [rowId]( const Folder& f ) {
+            return f.deviceId() == rowId;
+        });
+    });
+
+    // The search sessions must forget their matches once the media titles or
+    // the labels they were matched by change. The FTS triggers modify the
+    // FTS5 shadow tables, while the labels are linked without modifying them
+    for ( const auto& table : { Media::Table::Name + "Fts_docsize",
+                                Label::Table::Name + "Fts_docsize",
+                                std::string{ "LabelFileRelation" } } )
+    {
+        m_dbConnection->registerModificationHook( table, [this]() {
+            ++m_searchGeneration;
+        });
+    }
+
     if ( m_modificationNotifier == nullptr )
         return;
 
-    m_dbConnection->registerUpdateHook( Media::Table::Name,
-                                        [this]( sqlite::Connection::HookReason reason, int64_t rowId ) {
-        if ( reason != sqlite::Connection::HookReason::Delete )
-            return;
-        m_modificationNotifier->notifyMediaRemoval( rowId );
+    m_dbConnection->registerDeletionHook( Media::Table::Name,
+                                          [this]( std::vector<int64_t> rowIds ) {
+        m_modificationNotifier->notifyMediaRemoval( std::move( rowIds ) );
     });
-    m_dbConnection->registerUpdateHook( Artist::Table::Name,
-                                        [this]( sqlite::Connection::HookReason reason, int64_t rowId ) {
-        if ( reason != sqlite::Connection::HookReason::Delete )
-            return;
-        m_modificationNotifier->notifyArtistRemoval( rowId );
+    m_dbConnection->registerDeletionHook( Artist::Table::Name,
+                                          [this]( std::vector<int64_t> rowIds ) {
+        m_modificationNotifier->notifyArtistRemoval( std::move( rowIds ) );
     });
-    m_dbConnection->registerUpdateHook( Album::Table::Name,
-                                        [this]( sqlite::Connection::HookReason reason, int64_t rowId ) {
-        if ( reason != sqlite::Connection::HookReason::Delete )
-            return;
-        m_modificationNotifier->notifyAlbumRemoval( rowId );
+    m_dbConnection->registerDeletionHook( Album::Table::Name,
+                                          [this]( std::vector<int64_t> rowIds ) {
+        m_modificationNotifier->notifyAlbumRemoval( std::move( rowIds ) );
     });
-    m_dbConnection->registerUpdateHook( Playlist::Table::Name,
-                                        [this]( sqlite::Connection::HookReason reason, int64_t rowId ) {
-        if ( reason != sqlite::Connection::HookReason::Delete )
-            return;
-        m_modificationNotifier->notifyPlaylistRemoval( rowId );
+    m_dbConnection->registerDeletionHook( Playlist::Table::Name,
+                                          [this]( std::vector<int64_t> rowIds ) {
+        m_modificationNotifier->notifyPlaylistRemoval( std::move( rowIds ) );
     });
-    m_dbConnection->registerUpdateHook( Genre::Table::Name,
-                                        [this]( sqlite::Connection::HookReason reason, int64_t rowId ) {
-        if ( reason != sqlite::Connection::HookReason::Delete )
-            return;
-        m_modificationNotifier->notifyGenreRemoval( rowId );
+    m_dbConnection->registerDeletionHook( Genre::Table::Name,
+                                          [this]( std::vector<int64_t> rowIds ) {
+        m_modificationNotifier->notifyGenreRemoval( std::move( rowIds ) );
     });
 }
 
@@ -263,7 +343,8 @@ bool MediaLibrary::createThumbnailFolder( const std::string& thumbnailPath ) con
 
 InitializeResult MediaLibrary::initialize( const std::string& dbPath,
                                            const std::string& thumbnailPath,
-                                           IMediaLibraryCb* mlCallback )
+                                           IMediaLibraryCb* mlCallback,
+                                           const DatabaseTuning& tuning )
 {
     LOG_INFO( "Initializing medialibrary..." );
     if ( m_initialized == true )
@@ -290,7 +371,8 @@ InitializeResult MediaLibrary::initialize( const std::string& dbPath,
         return InitializeResult::Failed;
     }
     m_callback = mlCallback;
-    m_dbConnection = sqlite::Connection::connect( dbPath );
+    m_dbTuning = tuning;
+    m_dbConnection = sqlite::Connection::connect( dbPath, m_dbTuning );
 
     // Give a chance to test overloads to reject the creation of a notifier
     startDeletionNotifier();
@@ -300,17 +382,16 @@ InitializeResult MediaLibrary::initialize( const std::string& dbPath,
     auto res = InitializeResult::Success;
     try
     {
-        auto t = m_dbConnection->newTransaction();
-        createAllTables();
-        if ( m_settings.load() == false )
+        if ( isSchemaUpToDate() == false && createSchema() == false )
         {
             LOG_ERROR( "Failed to load settings" );
             return InitializeResult::Failed;
         }
-        createAllTriggers();
-        t->commit();
 
-        if ( m_settings.dbModelVersion() != Settings::DbModelVersion )
+        // A pending rescan means the previous upgrade was interrupted right
+        // before completing
+        if ( m_settings.dbModelVersion() != Settings::DbModelVersion ||
+             m_settings.isRescanPending() == true )
         {
             res = updateDatabaseModel( m_settings.dbModelVersion(), dbPath );
             if ( res == InitializeResult::Failed )
@@ -325,6 +406,8 @@ InitializeResult MediaLibrary::initialize( const std::string& dbPath,
         LOG_ERROR( "Can't initialize medialibrary: ", ex.what() );
         return InitializeResult::Failed;
     }
+    m_maintenanceWorker.reset( new MaintenanceWorker( this ) );
+    m_queryExecutor.reset( new QueryExecutor( QueryExecutor::DefaultNbThreads ) );
     m_initialized = true;
     LOG_INFO( "Successfuly initialized" );
     return res;
@@ -380,7 +463,7 @@ MediaPtr MediaLibrary::addExternalMedia( const std::string& mrl, IMedia::Type ty
 {
     try
     {
-        return sqlite::Tools::withRetries( 3, [this, &mrl, type]() -> MediaPtr {
+        return sqlite::Tools::withRetries( getConn(), 3, [this, &mrl, type]() -> MediaPtr {
             auto t = m_dbConnection->newTransaction();
             auto fileName = utils::file::fileName( mrl );
             auto media = Media::create( this, type, 0, 0,
@@ -439,42 +522,19 @@ bool MediaLibrary::isExtensionSupported( const char* ext )
         });
 }
 
-void MediaLibrary::onDiscoveredFile( std::shared_ptr<fs::IFile> fileFs,
-                                     std::shared_ptr<Folder> parentFolder,
-                                     std::shared_ptr<fs::IDirectory> parentFolderFs,
-                                     IFile::Type fileType,
-                                     std::pair<std::shared_ptr<Playlist>, unsigned int> parentPlaylist )
+void MediaLibrary::onDiscoveredFiles( std::vector<std::shared_ptr<fs::IFile>> filesFs,
+                                      std::shared_ptr<Folder> parentFolder,
+                                      std::shared_ptr<fs::IDirectory> parentFolderFs,
+                                      IFile::Type fileType,
+                                      std::pair<std::shared_ptr<Playlist>, unsigned int> parentPlaylist )
 {
-    auto mrl = fileFs->mrl();
-    try
-    {
-        std::shared_ptr<parser::Task> task;
-        if ( parentPlaylist.first == nullptr )
-        {
-            // Sqlite won't ensure uniqueness for Task with the same (mrl, parent_playlist_id)
-            // when parent_playlist_id is null, so we have to ensure of it ourselves
-            const std::string req = "SELECT * FROM " + parser::Task::Table::Name + " "
-                    "WHERE mrl = ? AND parent_playlist_id IS NULL";
-            task = parser::Task::fetch( this, req, mrl );
-            if ( task != nullptr )
-            {
-                LOG_INFO( "Not creating duplicated task for mrl: ", mrl );
-                return;
-            }
-        }
-        task = parser::Task::create( this, mrl, std::move( fileFs ), std::move( parentFolder ),
-                                     std::move( parentFolderFs ), fileType,
-                                     std::move( parentPlaylist ) );
-        if ( task != nullptr && m_parser != nullptr )
-            m_parser->parse( task );
-    }
-    catch(sqlite::errors::ConstraintViolation& ex)
-    {
-        // Most likely the file is already scheduled and we restarted the
-        // discovery after a crash.
-        LOG_WARN( "Failed to insert ", mrl, ": ", ex.what(), ". "
-                  "Assuming the file is already scheduled for discovery" );
-    }
+    // Files which are already scheduled, most likely because we restarted the
+    // discovery after a crash, are silently ignored
+    auto tasks = parser::Task::createBatch( this, std::move( filesFs ),
+                                            std::move( parentFolder ),
+                                            std::move( parentFolderFs ), fileType,
+                                            std::move( parentPlaylist ) );
+    scheduleParsing( std::move( tasks ) );
 }
 
 void MediaLibrary::onUpdatedFile( std::shared_ptr<File> file,
@@ -484,8 +544,8 @@ void MediaLibrary::onUpdatedFile( std::shared_ptr<File> file,
     try
     {
         auto task = parser::Task::createRefreshTask( this, std::move( file ), std::move( fileFs ) );
-        if ( task != nullptr && m_parser != nullptr )
-            m_parser->parse( std::move( task ) );
+        if ( task != nullptr )
+            scheduleParsing( { std::move( task ) } );
     }
     catch( const sqlite::errors::ConstraintViolation& ex )
     {
@@ -496,6 +556,22 @@ void MediaLibrary::onUpdatedFile( std::shared_ptr<File> file,
     }
 }
 
+void MediaLibrary::scheduleParsing( std::vector<std::shared_ptr<parser::Task>> tasks )
+{
+    if ( m_parser == nullptr || tasks.empty() == true )
+        return;
+    // The parser reads the tasks through its own connections, which won't see
+    // them until the transaction they were created in gets committed.
+    if ( sqlite::Transaction::transactionInProgress() == true )
+    {
+        sqlite::Transaction::onCurrentTransactionSuccess(
+                    [this, tasks]() { scheduleParsing( tasks ); } );
+        return;
+    }
+    for ( auto& t : tasks )
+        m_parser->parse( std::move( t ) );
+}
+
 bool MediaLibrary::deleteFolder( const Folder& folder )
 {
     LOG_INFO( "deleting folder ", folder.mrl() );
@@ -649,7 +725,7 @@ bool MediaLibrary::clearHistory()
 {
     try
     {
-        return sqlite::Tools::withRetries( 3, [this]() {
+        return sqlite::Tools::withRetries( getConn(), 3, [this]() {
             Media::clearHistory( this );
             return true;
         });
@@ -715,6 +791,30 @@ Query<IArtist> MediaLibrary::searchArtists( const std::string& name, bool includ
     return Artist::search( this, name, includeAll, params );
 }
 
+Query<IMedia> MediaLibrary::fuzzySearchMedia( const std::string& pattern,
+                                              const QueryParameters* params ) const
+{
+    if ( validateSearchPattern( pattern ) == false )
+        return {};
+    return Media::fuzzySearch( this, pattern, params );
+}
+
+Query<IAlbum> MediaLibrary::fuzzySearchAlbums( const std::string& pattern,
+                                               const QueryParameters* params ) const
+{
+    if ( validateSearchPattern( pattern ) == false )
+        return {};
+    return Album::fuzzySearch( this, pattern, params );
+}
+
+Query<IArtist> MediaLibrary::fuzzySearchArtists( const std::string& name, bool includeAll,
+                                                 const QueryParameters* params ) const
+{
+    if ( validateSearchPattern( name ) == false )
+        return {};
+    return Artist::fuzzySearch( this, name, includeAll, params );
+}
+
 Query<IShow> MediaLibrary::searchShows( const std::string& pattern,
                                         const QueryParameters* params ) const
 {
@@ -734,6 +834,52 @@ SearchAggregate MediaLibrary::search( const std::string& pattern,
     return res;
 }
 
+SearchResults MediaLibrary::searchBestMatches( const std::string& pattern,
+                                               uint32_t nbItems ) const
+{
+    SearchResults res;
+    if ( validateSearchPattern( pattern ) == false || nbItems == 0 )
+        return res;
+    auto ftsPattern = sqlite::Tools::ftsPattern( pattern );
+    // Hold a read context so that all the requests reuse the same pooled
+    // connection. No read transaction is opened, so each request still sees
+    // the database as it is when it runs, and a write can land in between.
+    auto ctx = getConn()->acquireReadContext();
+    res.albums = Album::searchBestMatches( this, ftsPattern, nbItems );
+    res.artists = Artist::searchBestMatches( this, ftsPattern, nbItems );
+    res.genres = Genre::searchBestMatches( this, ftsPattern, nbItems );
+    res.media = Media::searchBestMatches( this, ftsPattern, nbItems );
+    res.shows = Show::searchBestMatches( this, ftsPattern, nbItems );
+    res.playlists = Playlist::searchBestMatches( this, ftsPattern, nbItems );
+    return res;
+}
+
+void MediaLibrary::searchBestMatchesAsync( const std::string& pattern,
+                                           uint32_t nbItems,
+                                           std::function<void(SearchResults)> callback,
+                                           uint64_t tag ) const
+{
+    m_queryExecutor->submit( tag, [this, pattern, nbItems, callback]() {
+        auto res = std::make_shared<SearchResults>();
+        try
+        {
+            *res = searchBestMatches( pattern, nbItems );
+        }
+        catch ( const sqlite::errors::Generic& ex )
+        {
+            LOG_ERROR( "Failed to run asynchronous search: ", ex.what() );
+        }
+        return std::function<void()>{ [callback, res]() {
+            callback( std::move( *res ) );
+        } };
+    });
+}
+
+std::unique_ptr<ISearchSession> MediaLibrary::createSearchSession() const
+{
+    return std::unique_ptr<ISearchSession>( new SearchSession( this ) );
+}
+
 bool MediaLibrary::startParser()
 {
     m_parser.reset( new parser::Parser( this ) );
@@ -814,7 +960,6 @@ InitializeResult MediaLibrary::updateDatabaseModel( unsigned int previousVersion
     {
         try
         {
-            bool needRescan = false;
             // Up until model 3, it's safer (and potentially more efficient with index changes) to drop the DB
             // It's also way simpler to implement
             // In case of downgrade, just recreate the database
@@ -850,7 +995,8 @@ InitializeResult MediaLibrary::updateDatabaseModel( unsigned int previousVersion
             {
                 // Force a rescan to solve metadata analysis problems.
                 // The insertion is fixed, but won't edit already inserted data.
-                forceRescan();
+                m_settings.setRescanPending( true );
+                saveModelVersion( 7 );
                 previousVersion = 7;
             }
             /**
@@ -872,25 +1018,26 @@ InitializeResult MediaLibrary::updateDatabaseModel( unsigned int previousVersion
                 //   break.
                 // - Fix in the way we chose album candidates, meaning some
                 //   albums were likely to be wrongfully created.
-                needRescan = true;
+                m_settings.setRescanPending( true );
                 migrateModel8to9();
                 previousVersion = 9;
             }
             if ( previousVersion == 9 )
             {
-                needRescan = true;
+                m_settings.setRescanPending( true );
                 migrateModel9to10();
                 previousVersion = 10;
             }
             if ( previousVersion == 10 )
             {
-                needRescan = true;
+                m_settings.setRescanPending( true );
                 migrateModel10to11();
                 previousVersion = 11;
             }
             if ( previousVersion == 11 )
             {
                 parser::Task::recoverUnscannedFiles( this );
+                saveModelVersion( 12 );
                 previousVersion = 12;
             }
             if ( previousVersion == 12 )
@@ -902,7 +1049,7 @@ InitializeResult MediaLibrary::updateDatabaseModel( unsigned int previousVersion
             {
                 // We need to recreate many thumbnail records, and hopefully
                 // generate better ones
-                needRescan = true;
+                m_settings.setRescanPending( true );
                 migrateModel13to14( originalPreviousVersion );
                 previousVersion = 14;
             }
@@ -911,10 +1058,33 @@ InitializeResult MediaLibrary::updateDatabaseModel( unsigned int previousVersion
                 migrateModel14to15();
                 previousVersion = 15;
             }
+            if ( previousVersion == 15 )
+            {
+                migrateModel15to16();
+                previousVersion = 16;
+            }
+            if ( previousVersion == 16 )
+            {
+                migrateModel16to17();
+                previousVersion = 17;
+            }
+            if ( previousVersion == 17 )
+            {
+                migrateModel17to18();
+                previousVersion = 18;
+            }
+            if ( previousVersion == 18 )
+            {
+                migrateModel18to19();
+                previousVersion = 19;
+            }
             // To be continued in the future!
 
-            if ( needRescan == true )
+            if ( m_settings.isRescanPending() == true )
+            {
                 forceRescan();
+                m_settings.setRescanPending( false );
+            }
 
             // Safety check: ensure we didn't forget a migration along the way
             assert( previousVersion == Settings::DbModelVersion );
@@ -960,10 +1130,14 @@ bool MediaLibrary::recreateDatabase( const std::string& dbPath )
     // Close all active connections, flushes all previously run statements.
     m_dbConnection.reset();
     unlink( dbPath.c_str() );
-    m_dbConnection = sqlite::Connection::connect( dbPath );
-    createAllTables();
-    // We dropped the database, there is no setting to be read anymore
-    return m_settings.load();
+    // Don't let a stale write-ahead log be replayed on the new database
+    unlink( ( dbPath + "-wal" ).c_str() );
+    unlink( ( dbPath + "-shm" ).c_str() );
+    m_dbConnection = sqlite::Connection::connect( dbPath, m_dbTuning );
+    registerEntityHooks();
+    // We dropped the database, there is no setting to be read anymore, and
+    // the triggers maintain the counters & caches from the first insertion
+    return createSchema();
 }
 
 void MediaLibrary::migrateModel3to5()
@@ -984,7 +1158,8 @@ void MediaLibrary::migrateModel3to5()
         sqlite::Tools::executeRequest( getConn(), req );
     // Re-create triggers removed in the process
     Media::createTriggers( getConn(), 5 );
-    Playlist::createTriggers( getConn() );
+    Playlist::createTriggers( getConn(), 5 );
+    saveModelVersion( 5 );
     t->commit();
 }
 
@@ -996,6 +1171,7 @@ void MediaLibrary::migrateModel5to6()
     sqlite::Connection::WeakDbContext weakConnCtx{ getConn() };
     req = "UPDATE " + Media::Table::Name + " SET is_present = 1 WHERE is_present != 0";
     sqlite::Tools::executeRequest( getConn(), req );
+    saveModelVersion( 6 );
 }
 
 void MediaLibrary::migrateModel7to8()
@@ -1012,6 +1188,7 @@ void MediaLibrary::migrateModel7to8()
     Artist::createTriggers( getConn(), 8u );
     Media::createTriggers( getConn(), 5 );
     File::createTriggers( getConn() );
+    saveModelVersion( 8 );
     t->commit();
 }
 
@@ -1030,48 +1207,157 @@ void MediaLibrary::migrateModel8to9()
     // Don't check for the return value, we don't mind if nothing deleted.
     // Quite the opposite actually :)
     sqlite::Tools::executeDelete( getConn(), req );
+    saveModelVersion( 9 );
 }
 
-void MediaLibrary::migrateModel9to10()
+void MediaLibrary::saveModelVersion( uint32_t modelVersion )
 {
-    const std::string req = "SELECT * FROM " + File::Table::Name +
-            " WHERE mrl LIKE '%#%%' ESCAPE '#'";
-    auto files = File::fetchAll<File>( this, req );
-    auto t = getConn()->newTransaction();
-    for ( const auto& f : files )
+    m_settings.setDbModelVersion( modelVersion );
+    if ( m_settings.save() == false )
+        throw std::runtime_error( "Failed to save the database model version" );
+}
+
+void MediaLibrary::reportMigrationProgress( uint32_t modelVersion, uint32_t percent )
+{
+    if ( m_callback != nullptr )
+        m_callback->onMigrationProgress( modelVersion, percent );
+}
+
+/*
+ * Converts the records matching the provided filter by chunks, each of them in
+ * its own transaction, along with a checkpoint allowing an interrupted
+ * migration to resume where it stopped.
+ * Each migration step spans over nbSteps sub steps, which are used to report
+ * the overall progress.
+ */
+template <typename T>
+void MediaLibrary::migrateByChunks( uint32_t modelVersion, uint32_t step,
+                                    uint32_t nbSteps, const std::string& filter,
+                                    std::function<void( T& )> convert )
+{
+    auto checkpoint = m_settings.migrationCheckpoint();
+    if ( checkpoint.step > step )
+        return;
+    if ( checkpoint.step < step )
+        checkpoint = Settings::MigrationCheckpoint{ step, 0 };
+    auto dbConn = getConn();
+    const std::string pk = T::Table::Name + "." + T::Table::PrimaryKeyColumn;
+    // Count the records up to the provided id, to report the progress of a
+    // resumed migration as well
+    auto count = [dbConn, &filter, &pk]( int64_t lastId ) {
+        const std::string req = "SELECT COUNT(*) FROM " + T::Table::Name +
+                " WHERE (" + filter + ") AND " + pk + " <= ?";
+        auto ctx = dbConn->acquireReadContext();
+        sqlite::Statement stmt( ctx.handle(), req );
+        stmt.execute( lastId );
+        auto row = stmt.row();
+        size_t res;
+        row >> res;
+        return res;
+    };
+    const auto total = count( std::numeric_limits<int64_t>::max() );
+    auto done = count( checkpoint.lastId );
+    const std::string req = "SELECT * FROM " + T::Table::Name +
+            " WHERE (" + filter + ") AND " + pk + " > ? ORDER BY " + pk + " LIMIT ?";
+    const auto chunkSize = std::max( m_dbTuning.migrationChunkSize, 1u );
+    while ( true )
     {
-        // We must not call mrl() from here. We might not have all devices yet,
-        // and calling mrl would crash for files stored on removable devices.
-        auto newMrl = utils::url::encode( utils::url::decode( f->rawMrl() ) );
-        LOG_INFO( "Converting ", f->rawMrl(), " to ", newMrl );
-        f->setMrl( newMrl );
+        auto t = dbConn->newTransaction();
+        auto entities = T::template fetchAll<T>( this, req, checkpoint.lastId,
+                                                 chunkSize );
+        if ( entities.empty() == true )
+            break;
+        for ( const auto& e : entities )
+            convert( *e );
+        checkpoint.lastId = entities.back()->id();
+        if ( m_settings.saveMigrationCheckpoint( checkpoint ) == false )
+            throw std::runtime_error( "Failed to save the migration checkpoint" );
+        t->commit();
+        done += entities.size();
+        reportMigrationProgress( modelVersion,
+                                 ( step * 100 + done * 100 / total ) / nbSteps );
     }
-    t->commit();
+    reportMigrationProgress( modelVersion, ( step + 1 ) * 100 / nbSteps );
 }
 
-void MediaLibrary::migrateModel10to11()
+/*
+ * Copies the records of a staging table by chunks of consecutive primary keys,
+ * each of them in its own transaction, along with a checkpoint.
+ * The copy function is given the (lastId, upToId] range of primary keys to copy
+ */
+void MediaLibrary::copyByChunks( uint32_t modelVersion, uint32_t step,
+                                 uint32_t nbSteps, const std::string& table,
+                                 const std::string& pk,
+                                 std::function<void( int64_t, int64_t )> copy )
 {
-    const std::string req = "SELECT * FROM " + parser::Task::Table::Name +
-            " WHERE mrl LIKE '%#%%' ESCAPE '#'";
-    const std::string folderReq = "SELECT * FROM " + Folder::Table::Name +
-            " WHERE path LIKE '%#%%' ESCAPE '#'";
-    auto tasks = parser::Task::fetchAll<parser::Task>( this, req );
-    auto folders = Folder::fetchAll<Folder>( this, folderReq );
-    auto t = getConn()->newTransaction();
-    for ( const auto& t : tasks )
+    auto checkpoint = m_settings.migrationCheckpoint();
+    if ( checkpoint.step > step )
+        return;
+    if ( checkpoint.step < step )
+        checkpoint = Settings::MigrationCheckpoint{ step, 0 };
+    auto dbConn = getConn();
+    auto select = [dbConn]( const std::string& req, int64_t arg1, int64_t arg2 ) {
+        auto ctx = dbConn->acquireReadContext();
+        sqlite::Statement stmt( ctx.handle(), req );
+        stmt.execute( arg1, arg2 );
+        auto row = stmt.row();
+        int64_t res;
+        row >> res;
+        return res;
+    };
+    const std::string countReq = "SELECT COUNT(*) FROM " + table +
+            " WHERE " + pk + " > ? AND " + pk + " <= ?";
+    const auto total = select( countReq, 0, std::numeric_limits<int64_t>::max() );
+    auto done = select( countReq, 0, checkpoint.lastId );
+    // MAX() yields NULL, hence 0, once all the records have been copied
+    const std::string boundReq = "SELECT MAX(" + pk + ") FROM (SELECT " + pk +
+            " FROM " + table + " WHERE " + pk + " > ? ORDER BY " + pk + " LIMIT ?)";
+    const auto chunkSize = std::max( m_dbTuning.migrationChunkSize, 1u );
+    while ( true )
     {
-        auto newMrl = utils::url::encode( utils::url::decode( t->item().mrl() ) );
-        LOG_INFO( "Converting task mrl: ", t->item().mrl(), " to ", newMrl );
-        t->setMrl( std::move( newMrl ) );
+        auto t = dbConn->newTransaction();
+        auto upToId = select( boundReq, checkpoint.lastId, chunkSize );
+        if ( upToId == 0 )
+            break;
+        copy( checkpoint.lastId, upToId );
+        done += select( countReq, checkpoint.lastId, upToId );
+        checkpoint.lastId = upToId;
+        if ( m_settings.saveMigrationCheckpoint( checkpoint ) == false )
+            throw std::runtime_error( "Failed to save the migration checkpoint" );
+        t->commit();
+        reportMigrationProgress( modelVersion,
+                                 ( step * 100 + done * 100 / total ) / nbSteps );
     }
-    for ( const auto &f : folders )
-    {
+    reportMigrationProgress( modelVersion, ( step + 1 ) * 100 / nbSteps );
+}
+
+void MediaLibrary::migrateModel9to10()
+{
+    migrateByChunks<File>( 10, 0, 1, "mrl LIKE '%#%%' ESCAPE '#'", []( File& f ) {
         // We must not call mrl() from here. We might not have all devices yet,
         // and calling mrl would crash for files stored on removable devices.
-        auto newMrl = utils::url::encode( utils::url::decode( f->rawMrl() ) );
-        f->setMrl( std::move( newMrl ) );
-    }
-    t->commit();
+        auto newMrl = utils::url::encode( utils::url::decode( f.rawMrl() ) );
+        LOG_INFO( "Converting ", f.rawMrl(), " to ", newMrl );
+        f.setMrl( newMrl );
+    });
+    saveModelVersion( 10 );
+}
+
+void MediaLibrary::migrateModel10to11()
+{
+    migrateByChunks<parser::Task>( 11, 0, 2, "mrl LIKE '%#%%' ESCAPE '#'",
+                                   []( parser::Task& t ) {
+        auto newMrl = utils::url::encode( utils::url::decode( t.item().mrl() ) );
+        LOG_INFO( "Converting task mrl: ", t.item().mrl(), " to ", newMrl );
+        t.setMrl( std::move( newMrl ) );
+    });
+    migrateByChunks<Folder>( 11, 1, 2, "path LIKE '%#%%' ESCAPE '#'", []( Folder& f ) {
+        // We must not call mrl() from here. We might not have all devices yet,
+        // and calling mrl would crash for files stored on removable devices.
+        auto newMrl = utils::url::encode( utils::url::decode( f.rawMrl() ) );
+        f.setMrl( std::move( newMrl ) );
+    });
+    saveModelVersion( 11 );
 }
 
 /*
@@ -1099,7 +1385,7 @@ void MediaLibrary::migrateModel12to13()
         sqlite::Tools::executeDelete( getConn(), req );
 
     AlbumTrack::createTriggers( getConn() );
-    Album::createTriggers( getConn() );
+    Album::createTriggers( getConn(), 13 );
     Artist::createTriggers( getConn(), 13 );
     // Leave the weak context as we now need to update is_present fields, which
     // are propagated through recursive triggers
@@ -1107,6 +1393,7 @@ void MediaLibrary::migrateModel12to13()
             " SET is_present = (SELECT is_present FROM " + Media::Table::Name +
             " WHERE id_media = media_id)";
     sqlite::Tools::executeUpdate( getConn(), migrateData );
+    saveModelVersion( 13 );
     t->commit();
 }
 
@@ -1156,88 +1443,196 @@ void MediaLibrary::migrateModel13to14( uint32_t originalPreviousVersion )
 {
     auto dbConn = getConn();
     sqlite::Connection::WeakDbContext weakConnCtx{ dbConn };
-    auto t = dbConn->newTransaction();
-    using ThumbnailType = typename std::underlying_type<Thumbnail::Origin>::type;
-    std::string reqs[] = {
+    /*
+     * The schema is remodeled at once. The Media, Folder & File tables are
+     * renamed to regular staging tables in the process, which are then copied
+     * by chunks, so that no transaction spans over all the records. The
+     * triggers are recreated once the staging tables are dropped, as those
+     * still hold the previous triggers & indexes names.
+     */
+    const uint32_t nbSteps = 7;
+    if ( m_settings.migrationCheckpoint().step == 0 )
+    {
+        auto t = dbConn->newTransaction();
+        std::string reqs[] = {
 #               include "database/migrations/migration13-14.sql"
-    };
+        };
 
-    for ( const auto& req : reqs )
-        sqlite::Tools::executeRequest( dbConn, req );
-    // Task table was introduced in model 8, so if the user is migrating from a
-    // version earlier than this one, the Task table will be properly created and
-    // doesn't need a migration
-    if ( originalPreviousVersion >= 8 )
-    {
-        const std::string migrateTaskReqs[] = {
-            "CREATE TEMPORARY TABLE " + parser::Task::Table::Name + "_backup"
-            "("
-                "id_task INTEGER PRIMARY KEY AUTOINCREMENT,"
-                "step INTEGER NOT NULL DEFAULT 0,"
-                "retry_count INTEGER NOT NULL DEFAULT 0,"
-                "mrl TEXT,"
-                "file_id UNSIGNED INTEGER,"
-                "parent_folder_id UNSIGNED INTEGER,"
-                "parent_playlist_id INTEGER,"
-                "parent_playlist_index UNSIGNED INTEGER"
-            ")",
-
-            "INSERT INTO " + parser::Task::Table::Name + "_backup SELECT * FROM " + parser::Task::Table::Name,
-
-            "DROP TABLE " + parser::Task::Table::Name,
+        for ( const auto& req : reqs )
+            sqlite::Tools::executeRequest( dbConn, req );
+        // Task table was introduced in model 8, so if the user is migrating from a
+        // version earlier than this one, the Task table will be properly created and
+        // doesn't need a migration
+        if ( originalPreviousVersion >= 8 )
+        {
+            const std::string migrateTaskReqs[] = {
+                "CREATE TEMPORARY TABLE " + parser::Task::Table::Name + "_backup"
+                "("
+                    "id_task INTEGER PRIMARY KEY AUTOINCREMENT,"
+                    "step INTEGER NOT NULL DEFAULT 0,"
+                    "retry_count INTEGER NOT NULL DEFAULT 0,"
+                    "mrl TEXT,"
+                    "file_id UNSIGNED INTEGER,"
+                    "parent_folder_id UNSIGNED INTEGER,"
+                    "parent_playlist_id INTEGER,"
+                    "parent_playlist_index UNSIGNED INTEGER"
+                ")",
+
+                "INSERT INTO " + parser::Task::Table::Name + "_backup SELECT * FROM " + parser::Task::Table::Name,
+
+                "DROP TABLE " + parser::Task::Table::Name,
 
             #include "database/tables/Task_v14.sql"
 
-            "INSERT INTO " + parser::Task::Table::Name + " SELECT "
-            "id_task, step, retry_count, mrl, " +
-            std::to_string( static_cast<std::underlying_type<IFile::Type>::type>(
-                                IFile::Type::Main ) ) + ","
-            "file_id, parent_folder_id, parent_playlist_id,"
-            "parent_playlist_index, 0 FROM " + parser::Task::Table::Name + "_backup",
-
-            "DROP TABLE " + parser::Task::Table::Name + "_backup",
+                "INSERT INTO " + parser::Task::Table::Name + " SELECT "
+                "id_task, step, retry_count, mrl, " +
+                std::to_string( static_cast<std::underlying_type<IFile::Type>::type>(
+                                    IFile::Type::Main ) ) + ","
+                "file_id, parent_folder_id, parent_playlist_id,"
+                "parent_playlist_index, 0 FROM " + parser::Task::Table::Name + "_backup",
+
+                "DROP TABLE " + parser::Task::Table::Name + "_backup",
+            };
+            for ( const auto& req : migrateTaskReqs )
+                sqlite::Tools::executeRequest( dbConn, req );
+        }
+        // Re-create tables that we just removed
+        // We will run a re-scan, so we don't care about keeping their content
+        Album::createTable( dbConn, 14 );
+        Artist::createTable( dbConn, 14 );
+        Movie::createTable( dbConn );
+        Show::createTable( dbConn, 14 );
+        VideoTrack::createTable( dbConn );
+        if ( m_settings.saveMigrationCheckpoint( Settings::MigrationCheckpoint{ 1, 0 } ) == false )
+            throw std::runtime_error( "Failed to save the migration checkpoint" );
+        t->commit();
+        reportMigrationProgress( 14, 100 / nbSteps );
+    }
+    copyByChunks( 14, 1, nbSteps, Folder::Table::Name + "_backup", "id_folder",
+                  [dbConn]( int64_t lastId, int64_t upToId ) {
+        static const std::string req = "INSERT INTO " + Folder::Table::Name + "("
+                "id_folder, path, parent_id, is_banned, device_id, is_removable"
+            ") "
+            "SELECT id_folder, path, parent_id, is_blacklisted, device_id, is_removable "
+            "FROM " + Folder::Table::Name + "_backup "
+            "WHERE id_folder > ? AND id_folder <= ?";
+        sqlite::Tools::executeRequest( dbConn, req, lastId, upToId );
+    });
+    copyByChunks( 14, 2, nbSteps, File::Table::Name + "_backup", "id_file",
+                  [dbConn]( int64_t lastId, int64_t upToId ) {
+        static const std::string req = "INSERT INTO " + File::Table::Name + "("
+                "id_file, media_id, playlist_id, mrl, type, last_modification_date,"
+                "size, folder_id, is_removable, is_external, is_network) "
+            "SELECT id_file, media_id, playlist_id, mrl, type, last_modification_date,"
+                "size, folder_id, is_removable, is_external, 0 "
+            "FROM " + File::Table::Name + "_backup "
+            "WHERE id_file > ? AND id_file <= ?";
+        sqlite::Tools::executeRequest( dbConn, req, lastId, upToId );
+    });
+    copyByChunks( 14, 3, nbSteps, Media::Table::Name + "_backup", "id_media",
+                  [this, dbConn]( int64_t lastId, int64_t upToId ) {
+        using ThumbnailType = typename std::underlying_type<Thumbnail::Origin>::type;
+        using MediaType = typename std::underlying_type<IMedia::Type>::type;
+        // Migrate path to thumbnails out of the sql file, as we need to bind
+        // the mrl
+        static const std::string thumbnailReq = "INSERT INTO " + Thumbnail::Table::Name +
+                "(id_thumbnail, mrl, origin, is_generated) "
+            "SELECT id_media, replace(thumbnail, ?, ''), " +
+                std::to_string( static_cast<ThumbnailType>( Thumbnail::Origin::UserProvided ) ) +
+                ", 1 FROM " + Media::Table::Name + "_backup "
+            "WHERE thumbnail IS NOT NULL AND thumbnail != '' "
+            "AND id_media > ? AND id_media <= ?";
+        static const std::string mediaReq = "INSERT INTO " + Media::Table::Name + "("
+                "id_media, type, subtype, duration, play_count, last_played_date,"
+                "real_last_played_date, insertion_date, release_date, thumbnail_id,"
+                "title, filename, is_favorite, is_present) "
+            "SELECT id_media, type, ifnull(subtype, " +
+                std::to_string( static_cast<typename std::underlying_type<IMedia::SubType>::type>(
+                                    IMedia::SubType::Unknown ) ) +
+                "), duration, play_count, last_played_date,"
+                "strftime('%s', 'now'),"
+                "insertion_date, release_date, "
+                "CASE thumbnail WHEN NULL THEN 0 WHEN '' THEN 0 ELSE id_media END,"
+                "title, filename, is_favorite, is_present "
+            "FROM " + Media::Table::Name + "_backup "
+            "WHERE id_media > ? AND id_media <= ?";
+        static const std::string nbPlaylistsReq = "UPDATE " + Media::Table::Name +
+            " SET nb_playlists = "
+                "(SELECT COUNT(media_id) FROM PlaylistMediaRelation WHERE media_id = id_media) "
+            "WHERE id_media > ? AND id_media <= ? "
+            "AND id_media IN (SELECT media_id FROM PlaylistMediaRelation)";
+        // The File staging table still holds its media_id index
+        static const std::string locationReq = "UPDATE " + Media::Table::Name +
+            " SET (device_id, folder_id) = "
+                "(SELECT d.id_device, f.id_folder FROM " + Device::Table::Name + " d "
+                "INNER JOIN " + Folder::Table::Name + " f ON d.id_device = f.device_id "
+                "INNER JOIN " + File::Table::Name + "_backup fi ON fi.folder_id = f.id_folder "
+                "WHERE fi.type = " +
+                    std::to_string( static_cast<typename std::underlying_type<IFile::Type>::type>(
+                                        IFile::Type::Main ) ) + " "
+                "AND fi.media_id = " + Media::Table::Name + ".id_media) "
+            "WHERE id_media > ? AND id_media <= ?";
+        // Playlist external media were stored as Unknown
+        static const std::string externalReq = "UPDATE " + Media::Table::Name +
+            " SET type = " + std::to_string( static_cast<MediaType>( IMedia::Type::External ) ) +
+            " WHERE id_media > ? AND id_media <= ? AND nb_playlists > 0 "
+            "AND type = " + std::to_string( static_cast<MediaType>( IMedia::Type::Unknown ) );
+        // Media.folder_id isn't indexed, so add the folders media counts from
+        // the copied chunk at once
+        static const std::string folderCountReq = "UPDATE " + Folder::Table::Name + " SET "
+                "nb_audio = " + Folder::Table::Name + ".nb_audio + c.nb_audio,"
+                "nb_video = " + Folder::Table::Name + ".nb_video + c.nb_video "
+            "FROM (SELECT folder_id, "
+                "SUM(type = " + std::to_string( static_cast<MediaType>( IMedia::Type::Audio ) ) +
+                    ") AS nb_audio,"
+                "SUM(type = " + std::to_string( static_cast<MediaType>( IMedia::Type::Video ) ) +
+                    ") AS nb_video "
+                "FROM " + Media::Table::Name + " WHERE id_media > ? AND id_media <= ? "
+                "AND folder_id IS NOT NULL GROUP BY folder_id) AS c "
+            "WHERE c.folder_id = " + Folder::Table::Name + ".id_folder";
+        sqlite::Tools::executeRequest( dbConn, thumbnailReq, m_thumbnailPath,
+                                       lastId, upToId );
+        sqlite::Tools::executeRequest( dbConn, mediaReq, lastId, upToId );
+        sqlite::Tools::executeRequest( dbConn, nbPlaylistsReq, lastId, upToId );
+        sqlite::Tools::executeRequest( dbConn, locationReq, lastId, upToId );
+        sqlite::Tools::executeRequest( dbConn, externalReq, lastId, upToId );
+        sqlite::Tools::executeRequest( dbConn, folderCountReq, lastId, upToId );
+    });
+    if ( m_settings.migrationCheckpoint().step <= 4 )
+    {
+        auto t = dbConn->newTransaction();
+        const std::string reqs[] = {
+            "DROP TABLE " + Media::Table::Name + "_backup",
+            "DROP TABLE " + Folder::Table::Name + "_backup",
+            "DROP TABLE " + File::Table::Name + "_backup",
         };
-        for ( const auto& req : migrateTaskReqs )
+        for ( const auto& req : reqs )
             sqlite::Tools::executeRequest( dbConn, req );
+        // Re-create triggers removed in the process
+        Media::createTriggers( dbConn, 14 );
+        File::createTriggers( dbConn );
+        AlbumTrack::createTriggers( dbConn );
+        Album::createTriggers( dbConn, 14 );
+        Artist::createTriggers( dbConn, 14 );
+        Show::createTriggers( dbConn, 14 );
+        Playlist::createTriggers( dbConn, 14 );
+        Folder::createTriggers( dbConn, 14 );
+        if ( m_settings.saveMigrationCheckpoint( Settings::MigrationCheckpoint{ 5, 0 } ) == false )
+            throw std::runtime_error( "Failed to save the migration checkpoint" );
+        t->commit();
+        reportMigrationProgress( 14, 5 * 100 / nbSteps );
     }
-    // Migrate path to thumbnails out of the sql file, as we need to bind the
-    // the mrl
-    const std::string updateThumbnailReq = "UPDATE " + Thumbnail::Table::Name +
-            " SET mrl = replace(mrl, ?, '')";
-    sqlite::Tools::executeUpdate( dbConn, updateThumbnailReq, m_thumbnailPath );
-    // Re-create tables that we just removed
-    // We will run a re-scan, so we don't care about keeping their content
-    Album::createTable( dbConn );
-    Artist::createTable( dbConn );
-    Movie::createTable( dbConn );
-    Show::createTable( dbConn );
-    VideoTrack::createTable( dbConn );
-    // Re-create triggers removed in the process
-    Media::createTriggers( dbConn, 14 );
-    AlbumTrack::createTriggers( dbConn );
-    Album::createTriggers( dbConn );
-    Artist::createTriggers( dbConn, 14 );
-    Show::createTriggers( dbConn );
-    Playlist::createTriggers( dbConn );
-    Folder::createTriggers( dbConn, 14 );
-    const std::string req = "SELECT * FROM " + Media::Table::Name +
-            " WHERE filename LIKE '%#%%' ESCAPE '#'";
-    auto media = Media::fetchAll<Media>( this, req );
-    for ( const auto& m : media )
-    {
+    migrateByChunks<Media>( 14, 5, nbSteps, "filename LIKE '%#%%' ESCAPE '#'", []( Media& m ) {
         // We must not call mrl() from here. We might not have all devices yet,
         // and calling mrl would crash for files stored on removable devices.
-        auto newFileName = utils::url::decode( m->fileName() );
-        LOG_INFO( "Converting ", m->fileName(), " to ", newFileName );
-        m->setFileName( std::move( newFileName ) );
-    }
-    auto folders = Folder::fetchAll<Folder>( this );
-    for ( const auto& f : folders )
-    {
-        f->setName( utils::file::directoryName( f->rawMrl() ) );
-    }
-
-    t->commit();
+        auto newFileName = utils::url::decode( m.fileName() );
+        LOG_INFO( "Converting ", m.fileName(), " to ", newFileName );
+        m.setFileName( std::move( newFileName ) );
+    });
+    migrateByChunks<Folder>( 14, 6, nbSteps, "1", []( Folder& f ) {
+        f.setName( utils::file::directoryName( f.rawMrl() ) );
+    });
+    saveModelVersion( 14 );
 }
 
 /**
@@ -1257,6 +1652,109 @@ void MediaLibrary::migrateModel14to15()
     for ( const auto& req : reqs )
         sqlite::Tools::executeRequest( dbConn, req );
     Folder::createTriggers( dbConn, 15 );
+    saveModelVersion( 15 );
+    t->commit();
+}
+
+void MediaLibrary::migrateModel15to16()
+{
+    /*
+     * Switch to incremental auto vacuum, so that the maintenance can release
+     * the free pages without rewriting the whole database. Existing databases
+     * need to be vacuumed once for this to be taken into account, which can't
+     * be done during a transaction.
+     */
+    auto dbConn = getConn();
+    {
+        auto ctx = dbConn->acquireWriteContext();
+        LOG_INFO( "Vacuuming the database to enable incremental auto vacuum" );
+        sqlite::Statement stmt( dbConn->handle(), "PRAGMA auto_vacuum = INCREMENTAL" );
+        stmt.execute();
+        while ( stmt.row() != nullptr )
+            ;
+        sqlite::Statement vacuum( dbConn->handle(), "VACUUM" );
+        vacuum.execute();
+        while ( vacuum.row() != nullptr )
+            ;
+    }
+    saveModelVersion( 16 );
+}
+
+void MediaLibrary::migrateModel16to17()
+{
+    // The counters table is created along with the other tables, but the
+    // records it counts were inserted before its triggers existed
+    auto dbConn = getConn();
+    auto t = dbConn->newTransaction();
+    Counters::createTriggers( dbConn );
+    Counters::refresh( dbConn );
+    saveModelVersion( 17 );
+    t->commit();
+}
+
+void MediaLibrary::migrateModel17to18()
+{
+    auto dbConn = getConn();
+    auto t = dbConn->newTransaction();
+    std::string reqs[] = {
+#               include "database/migrations/migration17-18.sql"
+    };
+
+    for ( const auto& req : reqs )
+        sqlite::Tools::executeRequest( dbConn, req );
+
+    Media::createTable( dbConn, 18 );
+    Folder::createTable( dbConn, 18 );
+    Label::createTable( dbConn, 18 );
+    Playlist::createTable( dbConn, 18 );
+    Genre::createTable( dbConn, 18 );
+    Album::createTable( dbConn, 18 );
+    Show::createTable( dbConn, 18 );
+    Artist::createTable( dbConn, 18 );
+
+    // The NULL titles & names, which the triggers skip, don't produce any
+    // token, so the FTS tables can be rebuilt from their content table
+    const std::string ftsTables[] = {
+        Media::Table::Name, Folder::Table::Name, Label::Table::Name,
+        Playlist::Table::Name, Genre::Table::Name, Album::Table::Name,
+        Show::Table::Name, Artist::Table::Name,
+    };
+    for ( const auto& table : ftsTables )
+        sqlite::Tools::executeRequest( dbConn, "INSERT INTO " + table + "Fts(" +
+                                       table + "Fts) VALUES('rebuild')" );
+
+    Media::createTriggers( dbConn, 18 );
+    Folder::createTriggers( dbConn, 18 );
+    Label::createTriggers( dbConn, 18 );
+    Playlist::createTriggers( dbConn, 18 );
+    Genre::createTriggers( dbConn, 18 );
+    Album::createTriggers( dbConn, 18 );
+    Show::createTriggers( dbConn, 18 );
+    Artist::createTriggers( dbConn, 18 );
+    saveModelVersion( 18 );
+    t->commit();
+}
+
+void MediaLibrary::migrateModel18to19()
+{
+    auto dbConn = getConn();
+    auto t = dbConn->newTransaction();
+
+    Media::createTable( dbConn, 19 );
+    Album::createTable( dbConn, 19 );
+    Artist::createTable( dbConn, 19 );
+
+    const std::string trigramTables[] = {
+        Media::Table::Name, Album::Table::Name, Artist::Table::Name,
+    };
+    for ( const auto& table : trigramTables )
+        sqlite::Tools::executeRequest( dbConn, "INSERT INTO " + table + "TrigramFts(" +
+                                       table + "TrigramFts) VALUES('rebuild')" );
+
+    Media::createTriggers( dbConn, 19 );
+    Album::createTriggers( dbConn, 19 );
+    Artist::createTriggers( dbConn, 19 );
+    saveModelVersion( 19 );
     t->commit();
 }
 
@@ -1290,6 +1788,8 @@ void MediaLibrary::pauseBackgroundOperations()
 {
     if ( m_parser != nullptr )
         m_parser->pause();
+    if ( m_maintenanceWorker != nullptr )
+        m_maintenanceWorker->pause();
 #ifdef HAVE_LIBVLC
     if ( m_thumbnailer != nullptr )
         m_thumbnailer->pause();
@@ -1300,12 +1800,40 @@ void MediaLibrary::resumeBackgroundOperations()
 {
     if ( m_parser != nullptr )
         m_parser->resume();
+    if ( m_maintenanceWorker != nullptr &&
+         m_discovererIdle == true && m_parserIdle == true )
+        m_maintenanceWorker->resume();
 #ifdef HAVE_LIBVLC
     if ( m_thumbnailer != nullptr )
         m_thumbnailer->resume();
 #endif
 }
 
+void MediaLibrary::setWriteCoalescingDelay( uint32_t delayMs )
+{
+    m_dbConnection->setWriteCoalescingDelay( std::chrono::milliseconds{ delayMs } );
+}
+
+void MediaLibrary::flushPendingWrites()
+{
+    m_dbConnection->flushPendingWrites();
+}
+
+DatabaseStatistics MediaLibrary::databaseStatistics() const
+{
+    return m_dbConnection->statistics().get();
+}
+
+void MediaLibrary::resetDatabaseStatistics()
+{
+    m_dbConnection->statistics().reset();
+}
+
+void MediaLibrary::setSlowRequestThreshold( uint32_t thresholdMs )
+{
+    m_dbConnection->setSlowRequestThreshold( std::chrono::milliseconds{ thresholdMs } );
+}
+
 void MediaLibrary::onDiscovererIdleChanged( bool idle )
 {
     bool expected = !idle;
@@ -1325,6 +1853,15 @@ void MediaLibrary::onDiscovererIdleChanged( bool idle )
                 // goes back to idle
                 m_modificationNotifier->flush();
             }
+            // Only tidy the database up when nothing else needs it, and
+            // yield as soon as some work comes in
+            if ( m_maintenanceWorker != nullptr )
+            {
+                if ( idle == true )
+                    m_maintenanceWorker->resume();
+                else
+                    m_maintenanceWorker->pause();
+            }
             LOG_INFO( "Setting background idle state to ",
                       idle ? "true" : "false" );
             m_callback->onBackgroundTasksIdleChanged( idle );
@@ -1345,6 +1882,13 @@ void MediaLibrary::onParserIdleChanged( bool idle )
                 // See comments above
                 m_modificationNotifier->flush();
             }
+            if ( m_maintenanceWorker != nullptr )
+            {
+                if ( idle == true )
+                    m_maintenanceWorker->resume();
+                else
+                    m_maintenanceWorker->pause();
+            }
             LOG_INFO( "Setting background idle state to ",
                       idle ? "true" : "false" );
             m_callback->onBackgroundTasksIdleChanged( idle );
@@ -1357,6 +1901,11 @@ sqlite::Connection* MediaLibrary::getConn() const
     return m_dbConnection.get();
 }
 
+QueryExecutor* MediaLibrary::queryExecutor() const
+{
+    return m_queryExecutor.get();
+}
+
 IMediaLibraryCb* MediaLibrary::getCb() const
 {
     return m_callback;
@@ -1367,6 +1916,11 @@ std::shared_ptr<ModificationNotifier> MediaLibrary::getNotifier() const
     return m_modificationNotifier;
 }
 
+uint32_t MediaLibrary::searchGeneration() const
+{
+    return m_searchGeneration.load();
+}
+
 IDeviceListerCb* MediaLibrary::setDeviceLister( DeviceListerPtr lister )
 {
     assert( m_initialized == false );
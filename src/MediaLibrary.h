@@ -31,6 +31,7 @@
 #include "medialibrary/IMedia.h"
 
 #include <atomic>
+#include <functional>
 
 namespace medialibrary
 {
@@ -38,6 +39,8 @@ namespace medialibrary
 class ModificationNotifier;
 class DiscovererWorker;
 class ThumbnailerWorker;
+class MaintenanceWorker;
+class QueryExecutor;
 
 class Album;
 class Artist;
@@ -61,6 +64,7 @@ namespace parser
 {
 class Parser;
 class Worker;
+class Task;
 }
 
 class MediaLibrary : public IMediaLibrary
@@ -70,7 +74,8 @@ public:
     virtual ~MediaLibrary();
     virtual InitializeResult initialize( const std::string& dbPath,
                                          const std::string& thumbnailPath,
-                                         IMediaLibraryCb* mlCallback ) override;
+                                         IMediaLibraryCb* mlCallback,
+                                         const DatabaseTuning& tuning = DatabaseTuning{} ) override;
     virtual bool start() override;
     virtual void setVerbosity( LogLevel v ) override;
 
@@ -82,11 +87,11 @@ public:
     virtual Query<IMedia> audioFiles( const QueryParameters* params ) const override;
     virtual Query<IMedia> videoFiles( const QueryParameters* params ) const override;
 
-    virtual void onDiscoveredFile( std::shared_ptr<fs::IFile> fileFs,
-                                   std::shared_ptr<Folder> parentFolder,
-                                   std::shared_ptr<fs::IDirectory> parentFolderFs,
-                                   IFile::Type fileType,
-                                   std::pair<std::shared_ptr<Playlist>, unsigned int> parentPlaylist );
+    virtual void onDiscoveredFiles( std::vector<std::shared_ptr<fs::IFile>> filesFs,
+                                    std::shared_ptr<Folder> parentFolder,
+                                    std::shared_ptr<fs::IDirectory> parentFolderFs,
+                                    IFile::Type fileType,
+                                    std::pair<std::shared_ptr<Playlist>, unsigned int> parentPlaylist );
     void onUpdatedFile( std::shared_ptr<File> file,
                         std::shared_ptr<fs::IFile> fileFs );
 
@@ -137,10 +142,23 @@ public:
                                        const QueryParameters* params ) const override;
     virtual Query<IArtist> searchArtists( const std::string& name, bool includeAll,
                                           const QueryParameters* params ) const override;
+    virtual Query<IMedia> fuzzySearchMedia( const std::string& pattern,
+                                            const QueryParameters* params = nullptr ) const override;
+    virtual Query<IAlbum> fuzzySearchAlbums( const std::string& pattern,
+                                             const QueryParameters* params = nullptr ) const override;
+    virtual Query<IArtist> fuzzySearchArtists( const std::string& name, bool includeAll,
+                                               const QueryParameters* params = nullptr ) const override;
     virtual Query<IShow> searchShows( const std::string& pattern,
                                       const QueryParameters* params = nullptr ) const override;
     virtual SearchAggregate search( const std::string& pattern,
                                     const QueryParameters* params ) const override;
+    virtual SearchResults searchBestMatches( const std::string& pattern,
+                                             uint32_t nbItems ) const override;
+    virtual void searchBestMatchesAsync( const std::string& pattern,
+                                         uint32_t nbItems,
+                                         std::function<void(SearchResults)> callback,
+                                         uint64_t tag = 0 ) const override;
+    virtual std::unique_ptr<ISearchSession> createSearchSession() const override;
 
     virtual void discover( const std::string& entryPoint ) override;
     virtual bool setDiscoverNetworkEnabled( bool enabled ) override;
@@ -166,12 +184,24 @@ public:
 
     virtual void pauseBackgroundOperations() override;
     virtual void resumeBackgroundOperations() override;
+    virtual void setWriteCoalescingDelay( uint32_t delayMs ) override;
+    virtual void flushPendingWrites() override;
+    virtual DatabaseStatistics databaseStatistics() const override;
+    virtual void resetDatabaseStatistics() override;
+    virtual void setSlowRequestThreshold( uint32_t thresholdMs ) override;
     void onDiscovererIdleChanged( bool idle );
     void onParserIdleChanged( bool idle );
 
     sqlite::Connection* getConn() const;
+    QueryExecutor* queryExecutor() const;
     IMediaLibraryCb* getCb() const;
     std::shared_ptr<ModificationNotifier> getNotifier() const;
+    /**
+     * @brief searchGeneration Returns a counter incremented whenever the
+     *        media full text search index gets modified
+     */
+    uint32_t searchGeneration() const;
+    static bool validateSearchPattern( const std::string& pattern );
 
     virtual IDeviceListerCb* setDeviceLister( DeviceListerPtr lister ) override;
     std::shared_ptr<fs::IFileSystemFactory> fsFactoryForMrl( const std::string& path ) const;
@@ -217,10 +247,25 @@ private:
     void migrateModel12to13();
     void migrateModel13to14( uint32_t originalPreviousVersion );
     void migrateModel14to15();
+    void migrateModel15to16();
+    void migrateModel16to17();
+    void migrateModel17to18();
+    void migrateModel18to19();
+    void saveModelVersion( uint32_t modelVersion );
+    template <typename T>
+    void migrateByChunks( uint32_t modelVersion, uint32_t step, uint32_t nbSteps,
+                          const std::string& filter, std::function<void( T& )> convert );
+    void copyByChunks( uint32_t modelVersion, uint32_t step, uint32_t nbSteps,
+                       const std::string& table, const std::string& pk,
+                       std::function<void( int64_t, int64_t )> copy );
+    void reportMigrationProgress( uint32_t modelVersion, uint32_t percent );
     void createAllTables();
     void createAllTriggers();
+    bool createSchema();
+    uint32_t schemaFingerprint();
+    bool isSchemaUpToDate();
     void registerEntityHooks();
-    static bool validateSearchPattern( const std::string& pattern );
+    void scheduleParsing( std::vector<std::shared_ptr<parser::Task>> tasks );
     bool createThumbnailFolder( const std::string& thumbnailPath ) const;
 
 protected:
@@ -260,6 +305,7 @@ private:
 
 protected:
     std::shared_ptr<sqlite::Connection> m_dbConnection;
+    DatabaseTuning m_dbTuning;
     std::vector<std::shared_ptr<fs::IFileSystemFactory>> m_fsFactories;
     std::vector<std::shared_ptr<fs::IFileSystemFactory>> m_externalNetworkFsFactories;
     std::string m_thumbnailPath;
@@ -288,7 +334,10 @@ protected:
     bool m_initialized;
     std::atomic_bool m_discovererIdle;
     std::atomic_bool m_parserIdle;
+    std::atomic_uint m_searchGeneration;
     std::unique_ptr<ThumbnailerWorker> m_thumbnailer;
+    std::unique_ptr<MaintenanceWorker> m_maintenanceWorker;
+    std::unique_ptr<QueryExecutor> m_queryExecutor;
 };
 
 }
@@ -92,7 +92,6 @@ void Metadata::init( int64_t entityId, uint32_t nbMeta )
     static const std::string req = "SELECT * FROM " + Metadata::Table::Name +
             " WHERE id_media = ? AND entity_type = ?";
     auto conn = m_ml->getConn();
-    auto ctx = conn->acquireReadContext();
     sqlite::Statement stmt( conn->handle(), req );
     stmt.execute( m_entityId, m_entityType );
     for ( sqlite::Row row = stmt.row(); row != nullptr; row = stmt.row() )
@@ -141,8 +140,12 @@ bool Metadata::set( uint32_t type, const std::string& value )
     {
         static const std::string req = "INSERT OR REPLACE INTO " + Metadata::Table::Name +
                 "(id_media, entity_type, type, value) VALUES(?, ?, ?, ?)";
-        return sqlite::Tools::executeInsert( m_ml->getConn(), req, m_entityId, m_entityType,
-                                             type, value );
+        auto dbConn = m_ml->getConn();
+        if ( sqlite::Tools::deferWrite( dbConn, nullptr, req, m_entityId,
+                                        m_entityType, type, value ) == true )
+            return true;
+        return sqlite::Tools::executeInsert( dbConn, req, m_entityId, m_entityType,
+                                             type, value ) != 0;
     }
     catch ( const sqlite::errors::Generic& ex )
     {
@@ -168,8 +171,8 @@ bool Metadata::unset( uint32_t type )
         static const std::string req = "DELETE FROM " + Metadata::Table::Name +
                 " WHERE id_media = ? AND entity_type = ? AND type = ?";
         (*it).unset();
-        return sqlite::Tools::executeDelete( m_ml->getConn(), req, m_entityId,
-                                             m_entityType, type );
+        return sqlite::Tools::executeDeferrableWrite( m_ml->getConn(), req, m_entityId,
+                                                      m_entityType, type );
     }
     return true;
 }
@@ -178,6 +181,8 @@ void Metadata::unset( sqlite::Connection* dbConn, IMetadata::EntityType entityTy
 {
     static const std::string req = "DELETE FROM " + Metadata::Table::Name +
             " WHERE entity_type = ? AND type = ? ";
+    // Don't let a deferred Metadata::set restore a value afterward
+    dbConn->flushPendingWrites();
     sqlite::Tools::executeDelete( dbConn, req, entityType, type );
 }
 
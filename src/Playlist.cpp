@@ -26,6 +26,7 @@
 
 #include "Playlist.h"
 
+#include "Counters.h"
 #include "Media.h"
 #include "utils/ModificationsNotifier.h"
 #include "database/SqliteQuery.h"
@@ -173,25 +174,19 @@ bool Playlist::append( const IMedia& media )
 
 bool Playlist::add( const IMedia& media, unsigned int position )
 {
-    static const std::string req = "INSERT INTO PlaylistMediaRelation"
-            "(media_id, mrl, playlist_id, position) VALUES(?, ?, ?, ?)";
     try
     {
         // position isn't a foreign key, but we want it to be passed as NULL if it equals to 0
         // When the position is NULL, the insertion triggers takes care of
         // counting the number of records to auto append.
-        auto files = media.files();
-        assert( files.size() > 0 );
-        auto mainFile = std::find_if( begin( files ), end( files ), []( const FilePtr& f) {
-            return f->isMain();
-        });
-        if ( mainFile == end( files ) )
-        {
-            LOG_ERROR( "Can't add a media without any files to a playlist" );
+        auto mrl = mainFileMrl( media );
+        if ( mrl.empty() == true )
             return false;
-        }
-        if ( sqlite::Tools::executeInsert( m_ml->getConn(), req, media.id(),
-                                             (*mainFile)->mrl(), m_id,
+        // The positions are shifted by the insertion triggers, so the
+        // deferred moves must be applied first
+        m_ml->getConn()->flushPendingWrites();
+        if ( sqlite::Tools::executeInsert( m_ml->getConn(), addRequest(), media.id(),
+                                             mrl, m_id,
                                              sqlite::ForeignKey{ position } ) == false )
             return false;
         static_cast<const Media&>( media ).udpateNbPlaylist( 1 );
@@ -207,6 +202,63 @@ bool Playlist::add( const IMedia& media, unsigned int position )
     }
 }
 
+bool Playlist::addBatch( const std::vector<std::pair<MediaPtr, unsigned int>>& media )
+{
+    using Record = std::tuple<int64_t, std::string, int64_t, sqlite::ForeignKey>;
+    std::vector<Record> records;
+    records.reserve( media.size() );
+    for ( const auto& m : media )
+    {
+        auto mrl = mainFileMrl( *m.first );
+        if ( mrl.empty() == true )
+            return false;
+        records.emplace_back( m.first->id(), std::move( mrl ), m_id,
+                              sqlite::ForeignKey{ m.second } );
+    }
+    if ( records.empty() == true )
+        return true;
+    std::vector<int64_t> pKeys;
+    try
+    {
+        m_ml->getConn()->flushPendingWrites();
+        pKeys = sqlite::Tools::executeBatchInsert( m_ml->getConn(), addRequest(),
+                                                   records );
+    }
+    catch (const sqlite::errors::ConstraintViolation& ex)
+    {
+        LOG_WARN( "Rejected playlist insertion: ", ex.what() );
+        return false;
+    }
+    for ( const auto& m : media )
+        static_cast<const Media&>( *m.first ).udpateNbPlaylist( 1 );
+    auto notifier = m_ml->getNotifier();
+    if ( notifier != nullptr )
+        notifier->notifyPlaylistModification( shared_from_this() );
+    return std::find( begin( pKeys ), end( pKeys ), 0 ) == end( pKeys );
+}
+
+const std::string& Playlist::addRequest()
+{
+    static const std::string req = "INSERT INTO PlaylistMediaRelation"
+            "(media_id, mrl, playlist_id, position) VALUES(?, ?, ?, ?)";
+    return req;
+}
+
+std::string Playlist::mainFileMrl( const IMedia& media )
+{
+    auto files = media.files();
+    assert( files.size() > 0 );
+    auto mainFile = std::find_if( begin( files ), end( files ), []( const FilePtr& f) {
+        return f->isMain();
+    });
+    if ( mainFile == end( files ) )
+    {
+        LOG_ERROR( "Can't add a media without any files to a playlist" );
+        return {};
+    }
+    return (*mainFile)->mrl();
+}
+
 bool Playlist::append( int64_t mediaId )
 {
     auto media = m_ml->media( mediaId );
@@ -247,7 +299,6 @@ bool Playlist::contains( int64_t mediaId, unsigned int position )
     uint32_t count;
     auto dbConn = m_ml->getConn();
     {
-        auto ctx = dbConn->acquireReadContext();
         auto chrono = std::chrono::steady_clock::now();
         sqlite::Statement stmt( dbConn->handle(), req );
         stmt.execute( mediaId, m_id, position );
@@ -266,14 +317,22 @@ bool Playlist::move( int64_t mediaId, unsigned int position )
         return false;
     static const std::string req = "UPDATE PlaylistMediaRelation SET position = ? WHERE "
             "playlist_id = ? AND media_id = ?";
-    auto res = sqlite::Tools::executeUpdate( m_ml->getConn(), req, position, m_id, mediaId );
-    if ( res == true )
-    {
-        auto notifier = m_ml->getNotifier();
+    auto self = shared_from_this();
+    auto ml = m_ml;
+    auto notify = [ml, self]() {
+        auto notifier = ml->getNotifier();
         if ( notifier != nullptr )
-            notifier->notifyPlaylistModification( shared_from_this() );
-    }
-    return res;
+            notifier->notifyPlaylistModification( self );
+    };
+    // A deferred move is only notified once committed, so that the listeners
+    // fetch the new position
+    auto dbConn = m_ml->getConn();
+    if ( sqlite::Tools::deferWrite( dbConn, notify, req, position, m_id, mediaId ) == true )
+        return true;
+    if ( sqlite::Tools::executeUpdate( dbConn, req, position, m_id, mediaId ) == false )
+        return false;
+    notify();
+    return true;
 }
 
 bool Playlist::remove( int64_t mediaId )
@@ -288,6 +347,7 @@ bool Playlist::remove( const IMedia& media )
 {
     static const std::string req = "DELETE FROM PlaylistMediaRelation WHERE "
             "playlist_id = ? AND media_id = ?";
+    m_ml->getConn()->flushPendingWrites();
     if ( sqlite::Tools::executeDelete( m_ml->getConn(), req, m_id, media.id() ) == false )
         return false;
     static_cast<const Media&>( media ).udpateNbPlaylist( -1 );
@@ -299,11 +359,22 @@ bool Playlist::remove( const IMedia& media )
 
 void Playlist::createTable( sqlite::Connection* dbConn, uint32_t dbModel )
 {
-    std::string reqs[] = {
-        #include "database/tables/Playlist_v14.sql"
-    };
-    for ( const auto& req : reqs )
-        sqlite::Tools::executeRequest( dbConn, req );
+    if ( dbModel >= 18 )
+    {
+        const std::string reqs[] = {
+            #include "database/tables/Playlist_v18.sql"
+        };
+        for ( const auto& req : reqs )
+            sqlite::Tools::executeRequest( dbConn, req );
+    }
+    else
+    {
+        const std::string reqs[] = {
+            #include "database/tables/Playlist_v14.sql"
+        };
+        for ( const auto& req : reqs )
+            sqlite::Tools::executeRequest( dbConn, req );
+    }
     // Playlist doesn't have an mrl field before version 14, so we must not
     // create the trigger before migrating to that version
     if ( dbModel >= 14 )
@@ -313,29 +384,59 @@ void Playlist::createTable( sqlite::Connection* dbConn, uint32_t dbModel )
     }
 }
 
-void Playlist::createTriggers( sqlite::Connection* dbConn )
+void Playlist::createTriggers( sqlite::Connection* dbConn, uint32_t dbModel )
 {
-    std::string reqs[] = {
-        #include "database/tables/Playlist_triggers_v14.sql"
-    };
-    for ( const auto& req : reqs )
-        sqlite::Tools::executeRequest( dbConn, req );
+    if ( dbModel >= 18 )
+    {
+        const std::string reqs[] = {
+            #include "database/tables/Playlist_triggers_v18.sql"
+        };
+        for ( const auto& req : reqs )
+            sqlite::Tools::executeRequest( dbConn, req );
+    }
+    else
+    {
+        const std::string reqs[] = {
+            #include "database/tables/Playlist_triggers_v14.sql"
+        };
+        for ( const auto& req : reqs )
+            sqlite::Tools::executeRequest( dbConn, req );
+    }
 }
 
 Query<IPlaylist> Playlist::search( MediaLibraryPtr ml, const std::string& name,
                                    const QueryParameters* params )
 {
-    std::string req = "FROM " + Playlist::Table::Name + " WHERE id_playlist IN "
-            "(SELECT rowid FROM " + Playlist::Table::Name + "Fts WHERE name MATCH '*' || ? || '*')";
-    return make_query<Playlist, IPlaylist>( ml, "*", std::move( req ),
-                                            sortRequest( params ), name );
+    auto byRelevance = sqlite::Tools::sortByRelevance( params );
+    std::string req = sqlite::Tools::ftsSearchRequest( Playlist::Table::Name, "p",
+                                                       Playlist::Table::PrimaryKeyColumn,
+                                                       "", byRelevance );
+    return make_query<Playlist, IPlaylist>( ml, "p.*", std::move( req ),
+                                            byRelevance == true ?
+                                                sqlite::Tools::relevanceOrderBy(
+                                                    Playlist::Table::Name + "Fts.rank", params ) :
+                                                sortRequest( params ),
+                                            sqlite::Tools::ftsPattern( name ) );
+}
+
+std::vector<PlaylistPtr> Playlist::searchBestMatches( MediaLibraryPtr ml,
+                                                      const std::string& ftsPattern,
+                                                      uint32_t nbItems )
+{
+    static const std::string req = "SELECT p.* FROM " + Table::Name + "Fts "
+            "CROSS JOIN " + Table::Name + " p "
+            "ON p.id_playlist = " + Table::Name + "Fts.rowid "
+            "WHERE " + Table::Name + "Fts MATCH ? "
+            "ORDER BY bm25(" + Table::Name + "Fts) LIMIT ?";
+    return fetchAll<IPlaylist>( ml, req, ftsPattern, nbItems );
 }
 
 Query<IPlaylist> Playlist::listAll( MediaLibraryPtr ml, const QueryParameters* params )
 {
     std::string req = "FROM " + Playlist::Table::Name;
-    return make_query<Playlist, IPlaylist>( ml, "*", std::move( req ),
-                                            sortRequest( params ) );
+    return make_counted_query<Playlist, IPlaylist>( ml,
+                                    Counters::countRequest( Counters::Playlists ),
+                                    "*", std::move( req ), sortRequest( params ) );
 }
 
 void Playlist::clearExternalPlaylistContent(MediaLibraryPtr ml)
@@ -62,15 +62,25 @@ public:
     virtual bool move( int64_t mediaId, unsigned int position ) override;
     virtual bool remove( int64_t mediaId ) override;
     virtual bool remove( const IMedia& media ) override;
+    /**
+     * @brief addBatch Inserts multiple media at the given positions using a
+     *                 single request, in the provided order
+     * The playlist modification is only notified once.
+     * @return true if all the media were inserted
+     */
+    bool addBatch( const std::vector<std::pair<MediaPtr, unsigned int>>& media );
     std::shared_ptr<File> addFile( const fs::IFile& fileFs, int64_t parentFolderId,
                                    bool isFolderFsRemovable );
     bool contains( int64_t mediaId, unsigned int position );
 
     static void createTable( sqlite::Connection* dbConn , uint32_t dbModel );
-    static void createTriggers( sqlite::Connection* dbConn );
+    static void createTriggers( sqlite::Connection* dbConn, uint32_t dbModel );
     static Query<IPlaylist> search( MediaLibraryPtr ml, const std::string& name,
                                     const QueryParameters* params );
     static Query<IPlaylist> listAll( MediaLibraryPtr ml, const QueryParameters* params );
+    static std::vector<PlaylistPtr> searchBestMatches( MediaLibraryPtr ml,
+                                                       const std::string& ftsPattern,
+                                                       uint32_t nbItems );
 
     /**
      * @brief deleteAllExternal Delete all external playlists, ie. all playlist
@@ -88,6 +98,8 @@ public:
 
 private:
     static std::string sortRequest( const QueryParameters* params );
+    static const std::string& addRequest();
+    static std::string mainFileMrl( const IMedia& media );
     void curateNullMediaID() const;
 
 private:
@@ -0,0 +1,217 @@
+/*****************************************************************************
+ * Media Library
+ *****************************************************************************
+ * Copyright (C) 2015-2019 Hugo Beauzée-Luyssen, Videolabs, VideoLAN
+ *
+ * Authors: Hugo Beauzée-Luyssen<hugo@beauzee.fr>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#if HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "SearchSession.h"
+
+#include "Label.h"
+#include "Media.h"
+#include "MediaLibrary.h"
+#include "database/SqliteTools.h"
+
+#include <algorithm>
+
+namespace medialibrary
+{
+
+namespace
+{
+
+bool isSpace( char c )
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+bool isAscii( const std::string& str )
+{
+    return std::all_of( begin( str ), end( str ), []( char c ) {
+        return static_cast<unsigned char>( c ) < 0x80;
+    });
+}
+
+/*
+ * Splits an ASCII text in lowercase tokens, as the unicode61 tokenizer does:
+ * only the letters & digits are part of a token
+ */
+std::vector<std::string> tokenize( std::string::const_iterator first,
+                                   std::string::const_iterator last )
+{
+    std::vector<std::string> tokens;
+    std::string token;
+    for ( ; first != last; ++first )
+    {
+        auto c = *first;
+        if ( c >= 'A' && c <= 'Z' )
+            token += static_cast<char>( c - 'A' + 'a' );
+        else if ( ( c >= 'a' && c <= 'z' ) || ( c >= '0' && c <= '9' ) )
+            token += c;
+        else if ( token.empty() == false )
+        {
+            tokens.push_back( std::move( token ) );
+            token.clear();
+        }
+    }
+    if ( token.empty() == false )
+        tokens.push_back( std::move( token ) );
+    return tokens;
+}
+
+/*
+ * Returns true if the tokens contain the phrase, whose last token only needs
+ * to be a prefix, as with the phrases built by sqlite::Tools::ftsPattern
+ */
+bool containsPhrase( const std::vector<std::string>& tokens,
+                     const std::vector<std::string>& phrase )
+{
+    for ( auto i = 0u; i + phrase.size() <= tokens.size(); ++i )
+    {
+        auto j = 0u;
+        while ( j + 1 < phrase.size() && tokens[i + j] == phrase[j] )
+            ++j;
+        if ( j + 1 == phrase.size() &&
+             tokens[i + j].compare( 0, phrase[j].size(), phrase[j] ) == 0 )
+            return true;
+    }
+    return false;
+}
+
+}
+
+constexpr uint32_t SearchSession::MaxDocuments;
+
+SearchSession::SearchSession( MediaLibraryPtr ml )
+    : m_ml( ml )
+    , m_generation( ml->searchGeneration() )
+{
+}
+
+Query<IMedia> SearchSession::searchMedia( const std::string& pattern,
+                                          const QueryParameters* params )
+{
+    if ( MediaLibrary::validateSearchPattern( pattern ) == false )
+        return {};
+    // The documents don't keep their score
+    if ( sqlite::Tools::sortByRelevance( params ) == true )
+        return Media::search( m_ml, pattern, params );
+    // The generation is read before looking the documents up, so that they
+    // get fetched again if the index is modified in the meantime
+    auto generation = m_ml->searchGeneration();
+    if ( generation != m_generation )
+    {
+        m_matches.clear();
+        m_generation = generation;
+    }
+    while ( m_matches.empty() == false &&
+            pattern.compare( 0, m_matches.back().pattern.size(),
+                             m_matches.back().pattern ) != 0 )
+        m_matches.pop_back();
+    if ( m_matches.empty() == true || m_matches.back().pattern != pattern )
+    {
+        Matches matches{ pattern, {} };
+        if ( ( m_matches.empty() == true ||
+               narrowMatches( pattern, m_matches.back().documents,
+                              matches.documents ) == false ) &&
+             fetchMatches( pattern, matches.documents ) == false )
+            return Media::search( m_ml, pattern, params );
+        m_matches.push_back( std::move( matches ) );
+    }
+    std::vector<int64_t> ids;
+    ids.reserve( m_matches.back().documents.size() );
+    for ( const auto& d : m_matches.back().documents )
+        ids.push_back( d.mediaId );
+    std::sort( begin( ids ), end( ids ) );
+    ids.erase( std::unique( begin( ids ), end( ids ) ), end( ids ) );
+    return Media::fromSearchMatches( m_ml, std::move( ids ), params );
+}
+
+bool SearchSession::fetchMatches( const std::string& pattern,
+                                  std::vector<Document>& documents )
+{
+    static const std::string req = "SELECT rowid, title "
+            "FROM " + Media::Table::Name + "Fts "
+            "WHERE " + Media::Table::Name + "Fts MATCH ? "
+            "UNION ALL "
+            "SELECT lfr.media_id, " + Label::Table::Name + "Fts.name "
+            "FROM " + Label::Table::Name + "Fts "
+            "CROSS JOIN LabelFileRelation lfr "
+            "ON lfr.label_id = " + Label::Table::Name + "Fts.rowid "
+            "WHERE " + Label::Table::Name + "Fts MATCH ? "
+            "LIMIT ?";
+    documents.clear();
+    auto ftsPattern = sqlite::Tools::ftsPattern( pattern );
+    auto ctx = m_ml->getConn()->acquireReadContext();
+    sqlite::Statement stmt( ctx.handle(), req );
+    stmt.execute( ftsPattern, ftsPattern, MaxDocuments + 1 );
+    sqlite::Row row;
+    while ( ( row = stmt.row() ) != nullptr )
+    {
+        Document d;
+        row >> d.mediaId >> d.text;
+        documents.push_back( std::move( d ) );
+    }
+    return documents.size() <= MaxDocuments;
+}
+
+bool SearchSession::narrowMatches( const std::string& pattern,
+                                   const std::vector<Document>& candidates,
+                                   std::vector<Document>& documents )
+{
+    // Only the ASCII texts are split here exactly as the tokenizer does, since
+    // it also folds the case & removes the diacritics of the other characters
+    if ( isAscii( pattern ) == false )
+        return false;
+    std::vector<std::vector<std::string>> phrases;
+    auto it = begin( pattern );
+    while ( true )
+    {
+        it = std::find_if_not( it, end( pattern ), isSpace );
+        if ( it == end( pattern ) )
+            break;
+        auto wordEnd = std::find_if( it, end( pattern ), isSpace );
+        auto phrase = tokenize( it, wordEnd );
+        // Leave the words without any letter nor digit to the FTS engine
+        if ( phrase.empty() == true )
+            return false;
+        phrases.push_back( std::move( phrase ) );
+        it = wordEnd;
+    }
+    if ( phrases.empty() == true )
+        return false;
+    for ( const auto& c : candidates )
+    {
+        if ( isAscii( c.text ) == false )
+            return false;
+        auto tokens = tokenize( begin( c.text ), end( c.text ) );
+        auto match = std::all_of( begin( phrases ), end( phrases ),
+                                  [&tokens]( const std::vector<std::string>& p ) {
+            return containsPhrase( tokens, p );
+        });
+        if ( match == true )
+            documents.push_back( c );
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,86 @@
+/*****************************************************************************
+ * Media Library
+ *****************************************************************************
+ * Copyright (C) 2015-2019 Hugo Beauzée-Luyssen, Videolabs, VideoLAN
+ *
+ * Authors: Hugo Beauzée-Luyssen<hugo@beauzee.fr>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#pragma once
+
+#include "medialibrary/ISearchSession.h"
+#include "Types.h"
+
+#include <string>
+#include <vector>
+
+namespace medialibrary
+{
+
+class SearchSession : public ISearchSession
+{
+public:
+    explicit SearchSession( MediaLibraryPtr ml );
+    virtual Query<IMedia> searchMedia( const std::string& pattern,
+                                       const QueryParameters* params ) override;
+
+    // The maximum number of documents matching a pattern kept in memory. The
+    // patterns matching more of them are searched for with the full text
+    // index only
+    static constexpr uint32_t MaxDocuments = 500;
+
+private:
+    /*
+     * A media title or label matching a pattern
+     */
+    struct Document
+    {
+        int64_t mediaId;
+        std::string text;
+    };
+
+    struct Matches
+    {
+        std::string pattern;
+        std::vector<Document> documents;
+    };
+
+    /**
+     * @brief fetchMatches Looks the documents matching a pattern up in the
+     *        full text index
+     * @return false if the pattern matches more than MaxDocuments documents
+     */
+    bool fetchMatches( const std::string& pattern, std::vector<Document>& documents );
+    /**
+     * @brief narrowMatches Finds the documents matching a pattern among the
+     *        ones matching a previous pattern, which it extends
+     * @return false if the documents can't be matched without the full text
+     *         index, in which case fetchMatches() must be used
+     */
+    static bool narrowMatches( const std::string& pattern,
+                               const std::vector<Document>& candidates,
+                               std::vector<Document>& documents );
+
+private:
+    MediaLibraryPtr m_ml;
+    uint32_t m_generation;
+    // The matches of the previous patterns, each one extending the previous
+    // one, so that they can be reused after some characters get erased
+    std::vector<Matches> m_matches;
+};
+
+}
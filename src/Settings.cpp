@@ -32,11 +32,13 @@
 namespace medialibrary
 {
 
-const uint32_t Settings::DbModelVersion = 15u;
+const uint32_t Settings::DbModelVersion = 19u;
 
 Settings::Settings( MediaLibrary* ml )
     : m_ml( ml )
     , m_dbModelVersion( 0 )
+    , m_migrationCheckpoint{ 0, 0 }
+    , m_rescanPending( false )
     , m_changed( false )
 {
 }
@@ -58,6 +60,24 @@ bool Settings::load()
         // safety check: there sould only be one row
         assert( s.row() == nullptr );
     }
+    sqlite::Statement migration( m_ml->getConn()->handle(),
+                                 "SELECT * FROM MigrationCheckpoint" );
+    migration.execute();
+    row = migration.row();
+    if ( row == nullptr )
+    {
+        if ( sqlite::Tools::executeInsert( m_ml->getConn(),
+                "INSERT INTO MigrationCheckpoint VALUES(0, 0, 0)" ) == false )
+            return false;
+        m_migrationCheckpoint = MigrationCheckpoint{ 0, 0 };
+        m_rescanPending = false;
+    }
+    else
+    {
+        row >> m_migrationCheckpoint.step >> m_migrationCheckpoint.lastId
+            >> m_rescanPending;
+        assert( migration.row() == nullptr );
+    }
     return true;
 }
 
@@ -69,14 +89,20 @@ uint32_t Settings::dbModelVersion() const
 bool Settings::save()
 {
     static const std::string req = "UPDATE Settings SET db_model_version = ?";
+    static const std::string migrationReq = "UPDATE MigrationCheckpoint "
+            "SET step = 0, last_id = 0, rescan_pending = ?";
     if ( m_changed == false )
         return true;
-    if ( sqlite::Tools::executeUpdate( m_ml->getConn(), req, m_dbModelVersion ) == true )
-    {
-        m_changed = false;
-        return true;
-    }
-    return false;
+    // Save both at once, so that a new model version never gets paired with
+    // the checkpoint of the previous migration
+    auto t = m_ml->getConn()->newTransaction();
+    if ( sqlite::Tools::executeUpdate( m_ml->getConn(), req, m_dbModelVersion ) == false ||
+         sqlite::Tools::executeUpdate( m_ml->getConn(), migrationReq, m_rescanPending ) == false )
+        return false;
+    t->commit();
+    m_migrationCheckpoint = MigrationCheckpoint{ 0, 0 };
+    m_changed = false;
+    return true;
 }
 
 void Settings::setDbModelVersion(uint32_t dbModelVersion)
@@ -85,12 +111,63 @@ void Settings::setDbModelVersion(uint32_t dbModelVersion)
     m_changed = true;
 }
 
+const Settings::MigrationCheckpoint& Settings::migrationCheckpoint() const
+{
+    return m_migrationCheckpoint;
+}
+
+bool Settings::saveMigrationCheckpoint( MigrationCheckpoint checkpoint )
+{
+    static const std::string req = "UPDATE MigrationCheckpoint SET step = ?, last_id = ?";
+    if ( sqlite::Tools::executeUpdate( m_ml->getConn(), req, checkpoint.step,
+                                       checkpoint.lastId ) == false )
+        return false;
+    m_migrationCheckpoint = checkpoint;
+    return true;
+}
+
+bool Settings::isRescanPending() const
+{
+    return m_rescanPending;
+}
+
+void Settings::setRescanPending( bool rescanPending )
+{
+    m_rescanPending = rescanPending;
+    m_changed = true;
+}
+
+uint32_t Settings::schemaFingerprint() const
+{
+    sqlite::Statement s( m_ml->getConn()->handle(), "PRAGMA user_version" );
+    s.execute();
+    auto row = s.row();
+    uint32_t fingerprint = 0;
+    if ( row != nullptr )
+        row >> fingerprint;
+    return fingerprint;
+}
+
+bool Settings::saveSchemaFingerprint( uint32_t fingerprint )
+{
+    // Pragmas can't be bound
+    sqlite::Tools::executeRequest( m_ml->getConn(), "PRAGMA user_version = " +
+                                   std::to_string( fingerprint ) );
+    return schemaFingerprint() == fingerprint;
+}
+
 void Settings::createTable( sqlite::Connection* dbConn )
 {
     const std::string req = "CREATE TABLE IF NOT EXISTS Settings("
                 "db_model_version UNSIGNED INTEGER NOT NULL"
             ")";
     sqlite::Tools::executeRequest( dbConn, req );
+    const std::string migrationReq = "CREATE TABLE IF NOT EXISTS MigrationCheckpoint("
+                "step UNSIGNED INTEGER NOT NULL,"
+                "last_id INTEGER NOT NULL,"
+                "rescan_pending BOOLEAN NOT NULL"
+            ")";
+    sqlite::Tools::executeRequest( dbConn, migrationReq );
 }
 
 }
@@ -38,6 +38,19 @@ class Connection;
 class Settings
 {
 public:
+    /*
+     * The progress of the migration from the current model version to the
+     * next one. It is saved along with each chunk of migrated records, so
+     * that an interrupted migration resumes after the last saved chunk.
+     */
+    struct MigrationCheckpoint
+    {
+        // The index of the migration step in progress
+        uint32_t step;
+        // The last record processed by this step
+        int64_t lastId;
+    };
+
     Settings( MediaLibrary* ml );
     bool load();
     /**
@@ -46,8 +59,36 @@ public:
      * This can be different from the \ref DbModelVersion when upgrading the model
      */
     uint32_t dbModelVersion() const;
+    /**
+     * @brief save Saves the model version and the pending rescan
+     *
+     * Saving a new model version resets the migration checkpoint.
+     */
     bool save();
     void setDbModelVersion( uint32_t dbModelVersion );
+    const MigrationCheckpoint& migrationCheckpoint() const;
+    /**
+     * @brief saveMigrationCheckpoint Saves the migration progress right away.
+     *
+     * This is expected to be called from the transaction of the checkpointed
+     * changes.
+     */
+    bool saveMigrationCheckpoint( MigrationCheckpoint checkpoint );
+    /**
+     * @brief isRescanPending Returns true if a migration requested all the
+     *        media to be rescanned, which is done once the model is up to date
+     */
+    bool isRescanPending() const;
+    void setRescanPending( bool rescanPending );
+    /**
+     * @brief schemaFingerprint Returns the fingerprint of the schema, as saved
+     *        when it was last created, or 0 if it wasn't.
+     *
+     * This is stored as the database user_version, so it can be read before
+     * any table is created.
+     */
+    uint32_t schemaFingerprint() const;
+    bool saveSchemaFingerprint( uint32_t fingerprint );
 
     static void createTable( sqlite::Connection* dbConn );
 
@@ -57,6 +98,8 @@ private:
     MediaLibrary* m_ml;
 
     uint32_t m_dbModelVersion;
+    MigrationCheckpoint m_migrationCheckpoint;
+    bool m_rescanPending;
 
     bool m_changed;
 };
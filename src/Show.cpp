@@ -26,6 +26,7 @@
 
 #include "Show.h"
 
+#include "Counters.h"
 #include "Media.h"
 #include "ShowEpisode.h"
 #include "MediaLibrary.h"
@@ -148,7 +149,7 @@ Query<IMedia> Show::episodes( const QueryParameters* params ) const
     switch ( sort )
     {
         case SortingCriteria::Alpha:
-            orderBy += "med.name";
+            orderBy += "med.title";
             if ( desc == true )
                 orderBy += " DESC";
             break;
@@ -183,7 +184,7 @@ uint32_t Show::nbEpisodes() const
     return 0;
 }
 
-void Show::createTable( sqlite::Connection* dbConnection )
+void Show::createTable( sqlite::Connection* dbConnection, uint32_t dbModelVersion )
 {
     const std::string req = "CREATE TABLE IF NOT EXISTS " + Show::Table::Name + "("
                         "id_show INTEGER PRIMARY KEY AUTOINCREMENT,"
@@ -194,15 +195,25 @@ void Show::createTable( sqlite::Connection* dbConnection )
                         "tvdb_id TEXT"
                     ")";
     const std::string reqFts = "CREATE VIRTUAL TABLE IF NOT EXISTS " +
+                Show::Table::Name + "Fts USING FTS5"
+            "("
+                "title,"
+                "content=" + Show::Table::Name + ","
+                "content_rowid=id_show,"
+                "prefix='2 3 4',"
+                "tokenize='unicode61 remove_diacritics 2'"
+            ")";
+    const std::string reqFtsV17 = "CREATE VIRTUAL TABLE IF NOT EXISTS " +
                 Show::Table::Name + "Fts USING FTS3"
             "("
                 "title"
             ")";
     sqlite::Tools::executeRequest( dbConnection, req );
-    sqlite::Tools::executeRequest( dbConnection, reqFts );
+    sqlite::Tools::executeRequest( dbConnection, dbModelVersion >= 18 ?
+                                       reqFts : reqFtsV17 );
 }
 
-void Show::createTriggers( sqlite::Connection* dbConnection )
+void Show::createTriggers( sqlite::Connection* dbConnection, uint32_t dbModelVersion )
 {
     const std::string insertTrigger = "CREATE TRIGGER IF NOT EXISTS insert_show_fts"
             " AFTER INSERT ON " + Show::Table::Name +
@@ -210,12 +221,19 @@ void Show::createTriggers( sqlite::Connection* dbConnection )
             " INSERT INTO " + Show::Table::Name + "Fts(rowid,title) VALUES(new.id_show, new.title);"
             " END";
     const std::string deleteTrigger = "CREATE TRIGGER IF NOT EXISTS delete_show_fts"
+            " BEFORE DELETE ON " + Show::Table::Name +
+            " BEGIN"
+            " INSERT INTO " + Show::Table::Name + "Fts(" + Show::Table::Name + "Fts,rowid,title)"
+                " VALUES('delete', old.id_show, old.title);"
+            " END";
+    const std::string deleteTriggerV17 = "CREATE TRIGGER IF NOT EXISTS delete_show_fts"
             " BEFORE DELETE ON " + Show::Table::Name +
             " BEGIN"
             " DELETE FROM " + Show::Table::Name + "Fts WHERE rowid = old.id_show;"
             " END";
     sqlite::Tools::executeRequest( dbConnection, insertTrigger );
-    sqlite::Tools::executeRequest( dbConnection, deleteTrigger );
+    sqlite::Tools::executeRequest( dbConnection, dbModelVersion >= 18 ?
+                                       deleteTrigger : deleteTriggerV17 );
 }
 
 std::shared_ptr<Show> Show::create( MediaLibraryPtr ml, const std::string& name )
@@ -231,7 +249,9 @@ std::shared_ptr<Show> Show::create( MediaLibraryPtr ml, const std::string& name
 Query<IShow> Show::listAll( MediaLibraryPtr ml, const QueryParameters* params )
 {
     std::string req = "FROM " + Show::Table::Name;
-    return make_query<Show, IShow>( ml, "*", std::move( req ), orderBy( params ) );
+    return make_counted_query<Show, IShow>( ml,
+                                    Counters::countRequest( Counters::Shows ),
+                                    "*", std::move( req ), orderBy( params ) );
 }
 
 std::string Show::orderBy( const QueryParameters* params )
@@ -258,11 +278,29 @@ std::string Show::orderBy( const QueryParameters* params )
 Query<IShow> Show::search( MediaLibraryPtr ml, const std::string& pattern,
                            const QueryParameters* params )
 {
-    std::string req = "FROM " + Show::Table::Name + " WHERE id_show IN"
-            "(SELECT rowid FROM " + Show::Table::Name + "Fts WHERE " +
-            Show::Table::Name + "Fts MATCH '*' || ? || '*')";
-    return make_query<Show, IShow>( ml, "*", std::move( req ),
-                                    orderBy( params ), pattern );
+    auto byRelevance = sqlite::Tools::sortByRelevance( params );
+    std::string req = sqlite::Tools::ftsSearchRequest( Show::Table::Name, "s",
+                                                       Show::Table::PrimaryKeyColumn,
+                                                       "", byRelevance );
+    return make_query<Show, IShow>( ml, "s.*", std::move( req ),
+                                    byRelevance == true ?
+                                        sqlite::Tools::relevanceOrderBy(
+                                            Show::Table::Name + "Fts.rank", params ) :
+                                        orderBy( params ),
+                                    sqlite::Tools::ftsPattern( pattern ) );
+}
+
+
+std::vector<ShowPtr> Show::searchBestMatches( MediaLibraryPtr ml,
+                                              const std::string& ftsPattern,
+                                              uint32_t nbItems )
+{
+    static const std::string req = "SELECT s.* FROM " + Table::Name + "Fts "
+            "CROSS JOIN " + Table::Name + " s "
+            "ON s.id_show = " + Table::Name + "Fts.rowid "
+            "WHERE " + Table::Name + "Fts MATCH ? "
+            "ORDER BY bm25(" + Table::Name + "Fts) LIMIT ?";
+    return fetchAll<IShow>( ml, req, ftsPattern, nbItems );
 }
 
 }
@@ -65,13 +65,16 @@ class Show : public IShow, public DatabaseHelpers<Show>
         virtual uint32_t nbSeasons() const override;
         virtual uint32_t nbEpisodes() const override;
 
-        static void createTable( sqlite::Connection* dbConnection );
-        static void createTriggers( sqlite::Connection* dbConnection );
+        static void createTable( sqlite::Connection* dbConnection, uint32_t dbModelVersion );
+        static void createTriggers( sqlite::Connection* dbConnection, uint32_t dbModelVersion );
         static std::shared_ptr<Show> create( MediaLibraryPtr ml, const std::string& title );
 
         static Query<IShow> listAll( MediaLibraryPtr ml, const QueryParameters* params );
         static Query<IShow> search( MediaLibraryPtr ml, const std::string& pattern,
                                     const QueryParameters* params );
+        static std::vector<ShowPtr> searchBestMatches( MediaLibraryPtr ml,
+                                                       const std::string& ftsPattern,
+                                                       uint32_t nbItems );
 
     private:
         static std::string orderBy( const QueryParameters* params );
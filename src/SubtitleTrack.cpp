@@ -28,6 +28,8 @@
 
 #include "Media.h"
 
+#include <algorithm>
+
 namespace medialibrary
 {
 
@@ -103,15 +105,26 @@ std::shared_ptr<SubtitleTrack> SubtitleTrack::create( MediaLibraryPtr ml,
             std::string codec, std::string language, std::string description,
             std::string encoding, int64_t mediaId )
 {
-    const std::string req = "INSERT INTO " + Table::Name + "(codec, language,"
-            "description, encoding, media_id) VALUES(?, ?, ?, ?, ?)";
     auto track = std::make_shared<SubtitleTrack>( ml, std::move( codec ),
                     std::move( language ), std::move( description ),
                     std::move( encoding ) );
-    if ( insert( ml, track, req, track->codec(), track->language(),
+    if ( insert( ml, track, insertRequest(), track->codec(), track->language(),
                  track->description(), track->encoding(), mediaId ) == false )
         return nullptr;
     return track;
 }
 
+bool SubtitleTrack::createBatch( MediaLibraryPtr ml, const std::vector<Record>& tracks )
+{
+    auto pKeys = sqlite::Tools::executeBatchInsert( ml->getConn(), insertRequest(), tracks );
+    return std::find( begin( pKeys ), end( pKeys ), 0 ) == end( pKeys );
+}
+
+const std::string& SubtitleTrack::insertRequest()
+{
+    static const std::string req = "INSERT INTO " + Table::Name + "(codec, language,"
+            "description, encoding, media_id) VALUES(?, ?, ?, ?, ?)";
+    return req;
+}
+
 }
@@ -50,6 +50,18 @@ public:
     static std::shared_ptr<SubtitleTrack> create( MediaLibraryPtr ml,
                 std::string codec, std::string language, std::string description,
                 std::string encoding, int64_t mediaId );
+    /*
+     * The parameters of a single track, in the order create() expects them
+     */
+    using Record = std::tuple<std::string, std::string, std::string, std::string, int64_t>;
+    /**
+     * @brief createBatch Inserts multiple tracks using a single request
+     * @return true if all the tracks were inserted
+     */
+    static bool createBatch( MediaLibraryPtr ml, const std::vector<Record>& tracks );
+
+private:
+    static const std::string& insertRequest();
 
 private:
     int64_t m_id;
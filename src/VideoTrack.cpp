@@ -27,6 +27,8 @@
 #include "VideoTrack.h"
 #include "Media.h"
 
+#include <algorithm>
+
 namespace medialibrary
 {
 
@@ -135,18 +137,29 @@ std::shared_ptr<VideoTrack> VideoTrack::create( MediaLibraryPtr ml, const std::s
                                                 int64_t mediaId, const std::string& language,
                                                 const std::string& description )
 {
-    static const std::string req  = "INSERT INTO " + VideoTrack::Table::Name
-            + "(codec, width, height, fps_num, fps_den, bitrate, sar_num, sar_den,"
-               "media_id, language, description) VALUES(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
     auto track = std::make_shared<VideoTrack>( ml, codec, width, height, fpsNum,
                                                fpsDen, bitrate, sarNum, sarDen,
                                                mediaId, language, description );
-    if ( insert( ml, track, req, codec, width, height, fpsNum, fpsDen, bitrate,
-                 sarNum, sarDen, mediaId, language, description ) == false )
+    if ( insert( ml, track, insertRequest(), codec, width, height, fpsNum, fpsDen,
+                 bitrate, sarNum, sarDen, mediaId, language, description ) == false )
         return nullptr;
     return track;
 }
 
+bool VideoTrack::createBatch( MediaLibraryPtr ml, const std::vector<Record>& tracks )
+{
+    auto pKeys = sqlite::Tools::executeBatchInsert( ml->getConn(), insertRequest(), tracks );
+    return std::find( begin( pKeys ), end( pKeys ), 0 ) == end( pKeys );
+}
+
+const std::string& VideoTrack::insertRequest()
+{
+    static const std::string req  = "INSERT INTO " + VideoTrack::Table::Name
+            + "(codec, width, height, fps_num, fps_den, bitrate, sar_num, sar_den,"
+               "media_id, language, description) VALUES(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
+    return req;
+}
+
 void VideoTrack::createTable( sqlite::Connection* dbConnection )
 {
     const std::string req = "CREATE TABLE IF NOT EXISTS " + VideoTrack::Table::Name
@@ -67,6 +67,20 @@ class VideoTrack : public IVideoTrack, public DatabaseHelpers<VideoTrack>
                                     uint32_t fpsDen, uint32_t bitrate, uint32_t sarNum,
                                     uint32_t sarDen, int64_t mediaId, const std::string& language,
                                     const std::string& description );
+        /*
+         * The parameters of a single track, in the order create() expects them
+         */
+        using Record = std::tuple<std::string, unsigned int, unsigned int, uint32_t,
+                                  uint32_t, uint32_t, uint32_t, uint32_t, int64_t,
+                                  std::string, std::string>;
+        /**
+         * @brief createBatch Inserts multiple tracks using a single request
+         * @return true if all the tracks were inserted
+         */
+        static bool createBatch( MediaLibraryPtr ml, const std::vector<Record>& tracks );
+
+    private:
+        static const std::string& insertRequest();
 
     private:
         int64_t m_id;
@@ -27,13 +27,22 @@
 #include <vector>
 
 #include "compat/Mutex.h"
+#include "IdentityMap.h"
 #include "SqliteTools.h"
 #include "SqliteTransaction.h"
 
 namespace medialibrary
 {
 
-template <typename IMPL>
+/*
+ * Entities using the cachepolicy::IdentityMapped policy are shared by all
+ * the callers fetching them, which implies their instances must be safe to
+ * use from multiple threads.
+ * The identity map is bypassed while a transaction is in progress, as the
+ * entities loaded by the writer might not be committed yet, or might differ
+ * from what the other threads can see.
+ */
+template <typename IMPL, typename CACHEPOLICY = cachepolicy::Uncached>
 class DatabaseHelpers
 {
     public:
@@ -42,7 +51,16 @@ class DatabaseHelpers
         {
             try
             {
-                return sqlite::Tools::fetchOne<IMPL>( ml, req, std::forward<Args>( args )... );
+                if ( CACHEPOLICY::UseIdentityMap == false ||
+                     sqlite::Transaction::transactionInProgress() == true )
+                    return sqlite::Tools::fetchOne<IMPL>( ml, req, std::forward<Args>( args )... );
+                auto& map = identityMap( ml );
+                auto generation = map.generation();
+                auto res = sqlite::Tools::fetchOne<IMPL>( ml, req, std::forward<Args>( args )... );
+                if ( res == nullptr )
+                    return nullptr;
+                auto pkValue = (res.get())->*IMPL::Table::PrimaryKey;
+                return map.insert( pkValue, std::move( res ), generation );
             }
             catch ( const sqlite::errors::GenericExecution& ex )
             {
@@ -59,7 +77,18 @@ class DatabaseHelpers
                     IMPL::Table::PrimaryKeyColumn + " = ?";
             try
             {
-                return sqlite::Tools::fetchOne<IMPL>( ml, req, pkValue );
+                if ( CACHEPOLICY::UseIdentityMap == false ||
+                     sqlite::Transaction::transactionInProgress() == true )
+                    return sqlite::Tools::fetchOne<IMPL>( ml, req, pkValue );
+                auto& map = identityMap( ml );
+                auto res = map.get<IMPL>( pkValue );
+                if ( res != nullptr )
+                    return res;
+                auto generation = map.generation();
+                res = sqlite::Tools::fetchOne<IMPL>( ml, req, pkValue );
+                if ( res == nullptr )
+                    return nullptr;
+                return map.insert( pkValue, std::move( res ), generation );
             }
             catch ( const sqlite::errors::GenericExecution& ex )
             {
@@ -105,6 +134,25 @@ class DatabaseHelpers
             return {};
         }
 
+        template <typename INTF, typename... Args>
+        static size_t forEach( MediaLibraryPtr ml, const std::string& req,
+                               const std::function<bool(std::shared_ptr<INTF>)>& callback,
+                               Args&&... args )
+        {
+            try
+            {
+                return sqlite::Tools::forEach<IMPL, INTF>( ml, req, callback,
+                                                           std::forward<Args>( args )... );
+            }
+            catch ( const sqlite::errors::GenericExecution& ex )
+            {
+                if ( sqlite::errors::isInnocuous( ex ) == false )
+                    throw;
+                LOG_WARN( "Ignoring innocuous error: ", ex.what() );
+            }
+            return 0;
+        }
+
         static bool destroy( MediaLibraryPtr ml, int64_t pkValue )
         {
             static const std::string req = "DELETE FROM " + IMPL::Table::Name + " WHERE "
@@ -115,7 +163,17 @@ class DatabaseHelpers
         static bool deleteAll( MediaLibraryPtr ml )
         {
             static const std::string req = "DELETE FROM " + IMPL::Table::Name;
-            return sqlite::Tools::executeDelete( ml->getConn(), req );
+            auto res = sqlite::Tools::executeDelete( ml->getConn(), req );
+            // Deleting all the rows doesn't invoke the update hook when sqlite
+            // uses its truncate optimization
+            if ( CACHEPOLICY::UseIdentityMap == true )
+                identityMap( ml ).clear();
+            return res;
+        }
+
+        static sqlite::IdentityMap& identityMap( MediaLibraryPtr ml )
+        {
+            return ml->getConn()->identityMap( IMPL::Table::Name );
         }
 
     protected:
@@ -131,6 +189,30 @@ class DatabaseHelpers
             (self.get())->*IMPL::Table::PrimaryKey = pKey;
             return true;
         }
+
+        /*
+         * Insert multiple instances at once. records[i] holds the request
+         * parameters for instances[i].
+         * Instances which didn't get inserted are removed from the vector.
+         */
+        template <typename... Args>
+        static void insertBatch( MediaLibraryPtr ml, std::vector<std::shared_ptr<IMPL>>& instances,
+                                 const std::string& req, const std::vector<std::tuple<Args...>>& records )
+        {
+            assert( instances.size() == records.size() );
+            auto pKeys = sqlite::Tools::executeBatchInsert( ml->getConn(), req, records );
+            auto nbInserted = 0u;
+            for ( auto i = 0u; i < pKeys.size(); ++i )
+            {
+                if ( pKeys[i] == 0 )
+                    continue;
+                (instances[i].get())->*IMPL::Table::PrimaryKey = pKeys[i];
+                if ( nbInserted != i )
+                    instances[nbInserted] = std::move( instances[i] );
+                ++nbInserted;
+            }
+            instances.resize( nbInserted );
+        }
 };
 
 }
@@ -0,0 +1,97 @@
+/*****************************************************************************
+ * Media Library
+ *****************************************************************************
+ * Copyright (C) 2015-2019 Hugo Beauzée-Luyssen, Videolabs, VideoLAN
+ *
+ * Authors: Hugo Beauzée-Luyssen<hugo@beauzee.fr>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace medialibrary
+{
+
+namespace sqlite
+{
+
+/**
+ * @brief The EntityPage class provides the storage for a fixed number of
+ *        entities, which get destroyed along with the page.
+ *
+ * This allows listings to allocate their entities by pages instead of one by
+ * one. The entities are handed out as aliasing shared pointers, which share
+ * the ownership of their page: the page is released when none of its
+ * entities is used anymore.
+ */
+template <typename T>
+class EntityPage
+{
+public:
+    explicit EntityPage( uint32_t capacity )
+        : m_storage( new Storage[capacity] )
+        , m_capacity( capacity )
+        , m_size( 0 )
+    {
+    }
+
+    ~EntityPage()
+    {
+        while ( m_size > 0 )
+            reinterpret_cast<T*>( &m_storage[--m_size] )->~T();
+    }
+
+    EntityPage( const EntityPage& ) = delete;
+    EntityPage& operator=( const EntityPage& ) = delete;
+
+    bool full() const
+    {
+        return m_size == m_capacity;
+    }
+
+    template <typename... Args>
+    T* emplace( Args&&... args )
+    {
+        assert( full() == false );
+        auto entity = new ( &m_storage[m_size] ) T( std::forward<Args>( args )... );
+        ++m_size;
+        return entity;
+    }
+
+    /*
+     * Entities relying on shared_from_this() need to be owned by their own
+     * control block
+     */
+    static constexpr bool IsPageable =
+            std::is_base_of<std::enable_shared_from_this<T>, T>::value == false;
+
+private:
+    using Storage = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+
+    std::unique_ptr<Storage[]> m_storage;
+    const uint32_t m_capacity;
+    uint32_t m_size;
+};
+
+}
+
+}
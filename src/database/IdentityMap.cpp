@@ -0,0 +1,82 @@
+/*****************************************************************************
+ * Media Library
+ *****************************************************************************
+ * Copyright (C) 2015-2019 Hugo Beauzée-Luyssen, Videolabs, VideoLAN
+ *
+ * Authors: Hugo Beauzée-Luyssen<hugo@beauzee.fr>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#if HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "IdentityMap.h"
+
+#include <algorithm>
+
+namespace medialibrary
+{
+
+namespace sqlite
+{
+
+constexpr size_t IdentityMap::MinPurgeThreshold;
+
+IdentityMap::IdentityMap()
+    : m_generation( 0 )
+    , m_purgeThreshold( MinPurgeThreshold )
+{
+}
+
+uint64_t IdentityMap::generation() const
+{
+    std::lock_guard<compat::Mutex> lock( m_lock );
+    return m_generation;
+}
+
+void IdentityMap::evict( int64_t id )
+{
+    std::lock_guard<compat::Mutex> lock( m_lock );
+    ++m_generation;
+    m_entities.erase( id );
+}
+
+void IdentityMap::clear()
+{
+    std::lock_guard<compat::Mutex> lock( m_lock );
+    ++m_generation;
+    m_entities.clear();
+    m_purgeThreshold = MinPurgeThreshold;
+}
+
+void IdentityMap::purgeExpired()
+{
+    for ( auto it = begin( m_entities ); it != end( m_entities ); )
+    {
+        if ( it->second.expired() == true )
+            it = m_entities.erase( it );
+        else
+            ++it;
+    }
+    // Don't walk through the map on each insertion when most entities are
+    // still alive
+    m_purgeThreshold = std::max( MinPurgeThreshold, m_entities.size() * 2 );
+}
+
+}
+
+}
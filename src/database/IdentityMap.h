@@ -0,0 +1,145 @@
+/*****************************************************************************
+ * Media Library
+ *****************************************************************************
+ * Copyright (C) 2015-2019 Hugo Beauzée-Luyssen, Videolabs, VideoLAN
+ *
+ * Authors: Hugo Beauzée-Luyssen<hugo@beauzee.fr>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#pragma once
+
+#include "compat/Mutex.h"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+
+namespace medialibrary
+{
+
+namespace sqlite
+{
+
+/**
+ * @brief The IdentityMap class keeps track of the live instances of the
+ *        entities stored in a table, so that fetching a row which is already
+ *        loaded returns the existing instance instead of running a request.
+ *
+ * Only weak references are kept: an entity is forgotten as soon as nobody
+ * uses it anymore.
+ * The entities are evicted when their row gets modified (see
+ * Connection::updateHook), and once more when the modification is committed
+ * or rolled back, since a reader might have loaded the previous version of
+ * the row in between. A reader only inserts an entity if no eviction happened
+ * since it started loading it, which is checked through a generation counter.
+ */
+class IdentityMap
+{
+public:
+    IdentityMap();
+
+    template <typename T>
+    std::shared_ptr<T> get( int64_t id )
+    {
+        std::lock_guard<compat::Mutex> lock( m_lock );
+        auto it = m_entities.find( id );
+        if ( it == end( m_entities ) )
+            return nullptr;
+        return std::static_pointer_cast<T>( it->second.lock() );
+    }
+
+    /**
+     * @brief insert Stores a freshly loaded entity
+     * @param generation The generation of the map before the entity was loaded
+     * @return The instance callers must use, which is the already existing
+     *         one if another thread inserted the same entity in the meantime.
+     */
+    template <typename T>
+    std::shared_ptr<T> insert( int64_t id, std::shared_ptr<T> entity,
+                               uint64_t generation )
+    {
+        std::lock_guard<compat::Mutex> lock( m_lock );
+        if ( generation != m_generation )
+            return entity;
+        auto& e = m_entities[id];
+        auto existing = e.lock();
+        if ( existing != nullptr )
+            return std::static_pointer_cast<T>( existing );
+        e = entity;
+        if ( m_entities.size() >= m_purgeThreshold )
+            purgeExpired();
+        return entity;
+    }
+
+    uint64_t generation() const;
+    void evict( int64_t id );
+    /**
+     * @brief evictIf Evicts all the live entities matching the predicate
+     *
+     * This is meant for entities which depend on rows from other tables.
+     */
+    template <typename T>
+    void evictIf( const std::function<bool(const T&)>& predicate )
+    {
+        std::lock_guard<compat::Mutex> lock( m_lock );
+        ++m_generation;
+        for ( auto it = begin( m_entities ); it != end( m_entities ); )
+        {
+            auto e = it->second.lock();
+            if ( e == nullptr ||
+                 predicate( *std::static_pointer_cast<T>( e ) ) == true )
+                it = m_entities.erase( it );
+            else
+                ++it;
+        }
+    }
+    void clear();
+
+private:
+    // Must be called with the lock held
+    void purgeExpired();
+
+private:
+    static constexpr size_t MinPurgeThreshold = 64;
+
+    mutable compat::Mutex m_lock;
+    std::unordered_map<int64_t, std::weak_ptr<void>> m_entities;
+    uint64_t m_generation;
+    size_t m_purgeThreshold;
+};
+
+}
+
+namespace cachepolicy
+{
+
+// Each fetch builds a new instance
+struct Uncached
+{
+    static constexpr bool UseIdentityMap = false;
+};
+
+// All the callers share the live instance of a row, see sqlite::IdentityMap
+struct IdentityMapped
+{
+    static constexpr bool UseIdentityMap = true;
+};
+
+}
+
+}
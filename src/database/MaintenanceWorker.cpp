@@ -0,0 +1,225 @@
+/*****************************************************************************
+ * Media Library
+ *****************************************************************************
+ * Copyright (C) 2015-2019 Hugo Beauzée-Luyssen, Videolabs, VideoLAN
+ *
+ * Authors: Hugo Beauzée-Luyssen<hugo@beauzee.fr>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+
+#if HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "MaintenanceWorker.h"
+
+#include "MediaLibrary.h"
+#include "database/SqliteTools.h"
+#include "logging/Logger.h"
+
+namespace medialibrary
+{
+
+constexpr uint32_t MaintenanceWorker::NbVacuumPages;
+constexpr uint32_t MaintenanceWorker::AnalysisLimit;
+constexpr std::chrono::hours MaintenanceWorker::MinInterval;
+
+MaintenanceWorker::MaintenanceWorker( MediaLibraryPtr ml )
+    : m_ml( ml )
+    , m_step( Step::Analyze )
+    , m_paused( true )
+    , m_run( false )
+{
+}
+
+MaintenanceWorker::~MaintenanceWorker()
+{
+    stop();
+}
+
+void MaintenanceWorker::resume()
+{
+    {
+        std::lock_guard<compat::Mutex> lock( m_mutex );
+        m_paused = false;
+        if ( m_step == Step::Done )
+        {
+            if ( std::chrono::steady_clock::now() - m_lastCompletion < MinInterval )
+                return;
+            m_step = Step::Analyze;
+        }
+        // Start the thread while holding the lock, so that a concurrent call
+        // to stop() can't observe m_run before the thread is joinable
+        if ( m_thread.get_id() == compat::Thread::id{} )
+        {
+            m_run = true;
+            m_thread = compat::Thread( &MaintenanceWorker::run, this );
+            return;
+        }
+    }
+    m_cond.notify_all();
+}
+
+void MaintenanceWorker::pause()
+{
+    std::lock_guard<compat::Mutex> lock( m_mutex );
+    m_paused = true;
+}
+
+void MaintenanceWorker::stop()
+{
+    {
+        std::lock_guard<compat::Mutex> lock( m_mutex );
+        if ( m_run == false )
+            return;
+        m_run = false;
+    }
+    m_cond.notify_all();
+    m_thread.join();
+}
+
+void MaintenanceWorker::run()
+{
+    LOG_INFO( "Starting database maintenance thread" );
+    sqlite::Connection::setBackgroundThread();
+    while ( m_run == true )
+    {
+        {
+            std::unique_lock<compat::Mutex> lock( m_mutex );
+            m_cond.wait( lock, [this]() {
+                return ( m_paused == false && m_step != Step::Done ) ||
+                        m_run == false;
+            });
+            if ( m_run == false )
+                break;
+        }
+        try
+        {
+            if ( runStep() == false )
+                LOG_INFO( "Database maintenance completed" );
+        }
+        catch ( const sqlite::errors::Generic& ex )
+        {
+            LOG_ERROR( "Database maintenance failed: ", ex.what() );
+            std::lock_guard<compat::Mutex> lock( m_mutex );
+            m_step = Step::Done;
+            m_lastCompletion = std::chrono::steady_clock::now();
+        }
+    }
+    LOG_INFO( "Exiting database maintenance thread" );
+}
+
+bool MaintenanceWorker::runStep()
+{
+    Step step;
+    {
+        std::lock_guard<compat::Mutex> lock( m_mutex );
+        step = m_step;
+    }
+    auto next = step;
+    switch ( step )
+    {
+    case Step::Analyze:
+    {
+        analyze();
+        m_ftsTables.clear();
+        // This skips the fts5vocab tables, which don't have segments
+        sqlite::Statement stmt( m_ml->getConn()->handle(),
+                "SELECT name FROM sqlite_master WHERE type = 'table' "
+                "AND sql LIKE 'CREATE VIRTUAL TABLE % USING FTS5(%'" );
+        stmt.execute();
+        sqlite::Row row;
+        while ( ( row = stmt.row() ) != nullptr )
+            m_ftsTables.push_back( row.load<std::string>( 0 ) );
+        next = Step::MergeFts;
+        break;
+    }
+    case Step::MergeFts:
+        // Merging the FTS5 segments releases some pages, so this must be done
+        // before vacuuming
+        if ( m_ftsTables.empty() == true )
+            next = Step::Vacuum;
+        else if ( mergeFts( m_ftsTables.back() ) == false )
+            m_ftsTables.pop_back();
+        break;
+    case Step::Vacuum:
+        if ( vacuum() == false )
+            next = Step::Done;
+        break;
+    case Step::Done:
+        return false;
+    }
+    std::lock_guard<compat::Mutex> lock( m_mutex );
+    m_step = next;
+    if ( next != Step::Done )
+        return true;
+    m_lastCompletion = std::chrono::steady_clock::now();
+    return false;
+}
+
+void MaintenanceWorker::analyze()
+{
+    auto dbConn = m_ml->getConn();
+    // Bound the number of rows read from each index, so that analyzing a
+    // large database doesn't hold the write context for too long
+    sqlite::Tools::executeRequest( dbConn, "PRAGMA analysis_limit = " +
+                                   std::to_string( AnalysisLimit ) );
+    // PRAGMA optimize only refreshes the existing statistics, so make sure
+    // they have been gathered at least once
+    if ( count( "SELECT COUNT(*) FROM sqlite_master "
+                "WHERE name = 'sqlite_stat1'" ) == 0 )
+        sqlite::Tools::executeRequest( dbConn, "ANALYZE" );
+    else
+        sqlite::Tools::executeRequest( dbConn, "PRAGMA optimize" );
+}
+
+bool MaintenanceWorker::vacuum()
+{
+    if ( count( "PRAGMA freelist_count" ) == 0 )
+        return false;
+    sqlite::Tools::executeRequest( m_ml->getConn(), "PRAGMA incremental_vacuum(" +
+                                   std::to_string( NbVacuumPages ) + ")" );
+    return true;
+}
+
+bool MaintenanceWorker::mergeFts( const std::string& table )
+{
+    auto dbConn = m_ml->getConn();
+    auto changes = sqlite3_total_changes( dbConn->handle() );
+    // Merge at most 32 pages of the segments. A positive value only merges
+    // the levels containing at least 'usermerge' (4 by default) segments
+    sqlite::Tools::executeRequest( dbConn, "INSERT INTO " + table + "(" +
+                                   table + ", rank) VALUES('merge', 32)" );
+    // Per the FTS5 documentation, less than 2 changes means there was nothing
+    // left to merge
+    return sqlite3_total_changes( dbConn->handle() ) - changes >= 2;
+}
+
+int64_t MaintenanceWorker::count( const std::string& req )
+{
+    sqlite::Statement stmt( m_ml->getConn()->handle(), req );
+    stmt.execute();
+    auto row = stmt.row();
+    int64_t res = 0;
+    if ( row != nullptr )
+        row >> res;
+    while ( stmt.row() != nullptr )
+        ;
+    return res;
+}
+
+}
@@ -0,0 +1,103 @@
+/*****************************************************************************
+ * Media Library
+ *****************************************************************************
+ * Copyright (C) 2015-2019 Hugo Beauzée-Luyssen, Videolabs, VideoLAN
+ *
+ * Authors: Hugo Beauzée-Luyssen<hugo@beauzee.fr>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+
+#pragma once
+
+#include "compat/ConditionVariable.h"
+#include "compat/Mutex.h"
+#include "compat/Thread.h"
+#include "Types.h"
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace medialibrary
+{
+
+/**
+ * @brief The MaintenanceWorker class keeps the database compact and its
+ *        statistics up to date while the media library is idle.
+ *
+ * The maintenance is split in short steps, each running in its own write
+ * context, so that it can be interrupted as soon as some other work comes in,
+ * and resumed from where it stopped on the next idle period.
+ */
+class MaintenanceWorker
+{
+public:
+    explicit MaintenanceWorker( MediaLibraryPtr ml );
+    ~MaintenanceWorker();
+    /**
+     * @brief resume Runs or resumes the maintenance in a background thread.
+     *
+     * Once a maintenance has completed, this is a no-op until MinInterval
+     * has elapsed.
+     */
+    void resume();
+    /**
+     * @brief pause Interrupts the maintenance once the current step completes
+     */
+    void pause();
+    void stop();
+    /**
+     * @brief runStep Runs the next maintenance step from the calling thread
+     * @return false if the maintenance is completed
+     */
+    bool runStep();
+
+    // The number of free pages to release at each step
+    static constexpr uint32_t NbVacuumPages = 256;
+    // The maximum number of rows ANALYZE reads from each index
+    static constexpr uint32_t AnalysisLimit = 400;
+    static constexpr std::chrono::hours MinInterval{ 1 };
+
+private:
+    enum class Step
+    {
+        Analyze,
+        MergeFts,
+        Vacuum,
+        Done,
+    };
+
+    void run();
+    void analyze();
+    bool vacuum();
+    bool mergeFts( const std::string& table );
+    int64_t count( const std::string& req );
+
+private:
+    MediaLibraryPtr m_ml;
+    compat::Mutex m_mutex;
+    compat::ConditionVariable m_cond;
+    Step m_step;
+    std::vector<std::string> m_ftsTables;
+    std::chrono::steady_clock::time_point m_lastCompletion;
+    bool m_paused;
+    std::atomic_bool m_run;
+    compat::Thread m_thread;
+};
+
+}
@@ -0,0 +1,125 @@
+/*****************************************************************************
+ * Media Library
+ *****************************************************************************
+ * Copyright (C) 2015-2019 Hugo Beauzée-Luyssen, Videolabs, VideoLAN
+ *
+ * Authors: Hugo Beauzée-Luyssen<hugo@beauzee.fr>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+
+#if HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "QueryExecutor.h"
+
+#include "logging/Logger.h"
+
+#include <algorithm>
+
+namespace medialibrary
+{
+
+constexpr unsigned int QueryExecutor::DefaultNbThreads;
+
+QueryExecutor::QueryExecutor( unsigned int nbThreads )
+    : m_nbThreads( std::max( nbThreads, 1u ) )
+    , m_nextGeneration( 1 )
+    , m_run( true )
+{
+}
+
+QueryExecutor::~QueryExecutor()
+{
+    stop();
+}
+
+void QueryExecutor::submit( uint64_t tag, Request request )
+{
+    {
+        std::lock_guard<compat::Mutex> lock( m_mutex );
+        if ( m_run == false )
+            return;
+        auto generation = m_nextGeneration++;
+        if ( tag != 0 )
+        {
+            m_generations[tag] = generation;
+            m_tasks.erase( std::remove_if( begin( m_tasks ), end( m_tasks ),
+                                           [tag]( const Task& t ) {
+                return t.tag == tag;
+            }), end( m_tasks ) );
+        }
+        m_tasks.push_back( Task{ tag, generation, std::move( request ) } );
+        // Spawn the threads lazily, most applications don't use
+        // the asynchronous queries
+        while ( m_threads.size() < m_nbThreads )
+            m_threads.emplace_back( &QueryExecutor::run, this );
+    }
+    m_cond.notify_one();
+}
+
+void QueryExecutor::stop()
+{
+    {
+        std::lock_guard<compat::Mutex> lock( m_mutex );
+        if ( m_run == false )
+            return;
+        m_run = false;
+        m_tasks.clear();
+    }
+    m_cond.notify_all();
+    for ( auto& t : m_threads )
+        t.join();
+}
+
+void QueryExecutor::run()
+{
+    LOG_INFO( "Starting query executor thread" );
+    while ( m_run == true )
+    {
+        Task task;
+        {
+            std::unique_lock<compat::Mutex> lock( m_mutex );
+            m_cond.wait( lock, [this]() {
+                return m_tasks.empty() == false || m_run == false;
+            });
+            if ( m_run == false )
+                break;
+            task = std::move( m_tasks.front() );
+            m_tasks.pop_front();
+        }
+        auto deliver = task.request();
+        {
+            std::lock_guard<compat::Mutex> lock( m_mutex );
+            if ( m_run == false )
+                break;
+            if ( task.tag != 0 )
+            {
+                // A more recent request with the same tag might have already
+                // completed and removed the generation
+                auto it = m_generations.find( task.tag );
+                if ( it == end( m_generations ) || it->second != task.generation )
+                    continue;
+                m_generations.erase( it );
+            }
+        }
+        deliver();
+    }
+    LOG_INFO( "Exiting query executor thread" );
+}
+
+}
@@ -0,0 +1,88 @@
+/*****************************************************************************
+ * Media Library
+ *****************************************************************************
+ * Copyright (C) 2015-2019 Hugo Beauzée-Luyssen, Videolabs, VideoLAN
+ *
+ * Authors: Hugo Beauzée-Luyssen<hugo@beauzee.fr>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+
+#pragma once
+
+#include "compat/ConditionVariable.h"
+#include "compat/Mutex.h"
+#include "compat/Thread.h"
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+namespace medialibrary
+{
+
+/**
+ * @brief The QueryExecutor class runs the asynchronous queries on a small
+ *        pool of threads.
+ *
+ * Requests can be tagged, in which case submitting a new request with the
+ * same tag supersedes the previous ones: if they are still pending, they are
+ * dropped, and if they are already running, their result is discarded.
+ * This allows a search-as-you-type UI to only ever wait for the latest
+ * pattern.
+ */
+class QueryExecutor
+{
+public:
+    /*
+     * A request runs a query, and returns the function which delivers its
+     * result. This function is only invoked if the request wasn't superseded
+     * while it was running.
+     */
+    using Request = std::function<std::function<void()>()>;
+
+    explicit QueryExecutor( unsigned int nbThreads );
+    ~QueryExecutor();
+    void submit( uint64_t tag, Request request );
+    void stop();
+
+    static constexpr unsigned int DefaultNbThreads = 2;
+
+private:
+    struct Task
+    {
+        uint64_t tag;
+        uint64_t generation;
+        Request request;
+    };
+
+    void run();
+
+private:
+    const unsigned int m_nbThreads;
+    compat::Mutex m_mutex;
+    compat::ConditionVariable m_cond;
+    std::deque<Task> m_tasks;
+    // The generation of the latest request submitted with each tag
+    std::unordered_map<uint64_t, uint64_t> m_generations;
+    uint64_t m_nextGeneration;
+    std::atomic_bool m_run;
+    std::vector<compat::Thread> m_threads;
+};
+
+}
@@ -28,15 +28,26 @@
 
 #include "database/SqliteTools.h"
 
+#include <algorithm>
+#include <random>
+
+namespace
+{
+thread_local bool BackgroundThread = false;
+// The connection whose write context is held by the calling thread
+thread_local const medialibrary::sqlite::Connection* WriteContextOwner = nullptr;
+}
+
 namespace medialibrary
 {
 namespace sqlite
 {
 
-Connection::Connection( const std::string& dbPath )
+Connection::Connection( const std::string& dbPath, const DatabaseTuning& tuning )
     : m_dbPath( dbPath )
-    , m_readLock( m_contextLock )
-    , m_writeLock( m_contextLock )
+    , m_tuning( tuning )
+    , m_coalescingDelay( 0 )
+    , m_slowRequestThreshold( 0 )
 {
     if ( sqlite3_threadsafe() == 0 )
         throw std::runtime_error( "SQLite isn't built with threadsafe mode" );
@@ -46,7 +57,12 @@ Connection::Connection( const std::string& dbPath )
 
 Connection::~Connection()
 {
-    sqlite::Statement::FlushStatementCache();
+    stopWriteCoalescing();
+    // Other threads might still have statements cached for our connections,
+    // which they will finalize next time they fetch a statement. Until then,
+    // the connections closed with sqlite3_close_v2 stay alive as zombies.
+    for ( const auto& c : m_conns )
+        sqlite::Statement::FlushConnectionStatementCache( c.second.get() );
 }
 
 Connection::Handle Connection::handle()
@@ -70,51 +86,141 @@ Connection::Handle Connection::handle()
      * when a thread gets terminated, as it would become unusable as well.
      *
      * \sa sqlite::Connection::ThreadSpecificConnection::~ThreadSpecificConnection
-     * \sa sqlite::Statement::StatementsCache
+     * \sa sqlite::StatementCache
      */
     std::unique_lock<compat::Mutex> lock( m_connMutex );
     sqlite3* dbConnection;
     auto it = m_conns.find( compat::this_thread::get_id() );
     if ( it == end( m_conns ) )
     {
-        auto res = sqlite3_open( m_dbPath.c_str(), &dbConnection );
-        ConnPtr dbConn( dbConnection, &sqlite3_close );
-        if ( res != SQLITE_OK )
-            throw sqlite::errors::Generic( std::string( "Failed to connect to database: " )
-                                           + sqlite3_errstr( res ) );
-        sqlite3_extended_result_codes( dbConnection, 1 );
-        sqlite3_busy_timeout( dbConnection, 500 );
+        auto dbConn = open();
+        dbConnection = dbConn.get();
+        // The page size and auto vacuum mode can only be changed before the
+        // database gets created, including by switching to WAL mode, and are
+        // silently ignored afterward. Incremental vacuum lets the maintenance
+        // release free pages in small steps.
+        std::vector<std::string> reqs;
+        if ( m_tuning.pageSize != 0 )
+            reqs.push_back( "PRAGMA page_size = " + std::to_string( m_tuning.pageSize ) );
+        reqs.push_back( "PRAGMA auto_vacuum = INCREMENTAL" );
+        for ( const auto& req : reqs )
+        {
+            sqlite::Statement stmt( dbConnection, req );
+            stmt.execute();
+            while ( stmt.row() != nullptr )
+                ;
+        }
+        // Use a write-ahead log so that readers use a snapshot of the last
+        // committed state instead of waiting for the writer to be done.
+        // This is persistent, but we need to check for it on every
+        // connection, as the database might have just been created.
+        setJournalModeWal( dbConnection );
         // Don't use public wrapper, they need to be able to call getConn, which
         // would result from a recursive call and a deadlock from here.
         setPragma( dbConnection, "foreign_keys", "1" );
         setPragma( dbConnection, "recursive_triggers", "1" );
-#ifdef __ANDROID__
-        // https://github.com/mozilla/mentat/issues/505
-        // Should solve `Failed to run request <DELETE FROM File WHERE id_file = ?>: disk I/O error(6410)`
-        setPragma( dbConnection, "temp_store", "2" );
-#endif
+        applyTuning( dbConnection, false );
 
         m_conns.emplace( compat::this_thread::get_id(), std::move( dbConn ) );
         sqlite3_update_hook( dbConnection, &updateHook, this );
+        sqlite3_rollback_hook( dbConnection, &rollbackHook, this );
         static thread_local ThreadSpecificConnection tsc( shared_from_this() );
         return dbConnection;
     }
     return it->second.get();
 }
 
-std::unique_ptr<sqlite::Transaction> Connection::newTransaction()
+Connection::ConnPtr Connection::open()
 {
-    return std::unique_ptr<sqlite::Transaction>{ new sqlite::Transaction( this ) };
+    sqlite3* dbConnection;
+    auto res = sqlite3_open( m_dbPath.c_str(), &dbConnection );
+    ConnPtr dbConn( dbConnection, &sqlite3_close_v2 );
+    if ( res != SQLITE_OK )
+        throw sqlite::errors::Generic( std::string( "Failed to connect to database: " )
+                                       + sqlite3_errstr( res ) );
+    sqlite3_extended_result_codes( dbConnection, 1 );
+    sqlite3_busy_handler( dbConnection, &busyHandler, this );
+    sqlite3_trace_v2( dbConnection, SQLITE_TRACE_PROFILE, &traceCallback, this );
+    return dbConn;
+}
+
+Connection::ThreadReadContext& Connection::threadReadContext()
+{
+    static thread_local ThreadReadContext ctx{ nullptr, nullptr, 0 };
+    return ctx;
 }
 
 Connection::ReadContext Connection::acquireReadContext()
 {
-    return ReadContext{ m_readLock };
+    if ( Transaction::transactionInProgress() == true )
+        return ReadContext{ this, handle(), nullptr };
+    auto& current = threadReadContext();
+    if ( current.depth == 0 )
+    {
+        current.owner = this;
+        current.conn = acquirePooledConnection();
+    }
+    assert( current.owner == this );
+    ++current.depth;
+    return ReadContext{ this, current.conn->conn.get(), current.conn };
+}
+
+void Connection::releaseReadContext()
+{
+    auto& current = threadReadContext();
+    assert( current.owner == this && current.depth > 0 );
+    if ( --current.depth > 0 )
+        return;
+    releasePooledConnection( current.conn );
+    current.owner = nullptr;
+    current.conn = nullptr;
+}
+
+Connection::PooledConnection* Connection::acquirePooledConnection()
+{
+    std::unique_lock<compat::Mutex> lock( m_readPoolLock );
+    if ( m_idleReadConns.empty() == true &&
+         m_readConns.size() < std::max( m_tuning.nbReadConnections, 1u ) )
+    {
+        auto dbConn = open();
+        // Ensure nothing gets written through the reader connections
+        setPragma( dbConn.get(), "query_only", "1" );
+        applyTuning( dbConn.get(), true );
+        m_readConns.emplace_back( new PooledConnection( std::move( dbConn ) ) );
+        m_idleReadConns.push_back( m_readConns.back().get() );
+    }
+    m_readPoolCond.wait( lock, [this]() {
+        return m_idleReadConns.empty() == false;
+    });
+    auto conn = m_idleReadConns.back();
+    m_idleReadConns.pop_back();
+    StatementCache::attachToThread( *conn->cache );
+    return conn;
+}
+
+void Connection::releasePooledConnection( PooledConnection* conn )
+{
+    StatementCache::detachFromThread( *conn->cache );
+    {
+        std::lock_guard<compat::Mutex> lock( m_readPoolLock );
+        m_idleReadConns.push_back( conn );
+    }
+    m_readPoolCond.notify_one();
+}
+
+std::unique_ptr<sqlite::Transaction> Connection::newTransaction()
+{
+    return std::unique_ptr<sqlite::Transaction>{ new sqlite::Transaction( this ) };
 }
 
 Connection::WriteContext Connection::acquireWriteContext()
 {
-    return WriteContext{ m_writeLock };
+    auto chrono = std::chrono::steady_clock::now();
+    WriteContext ctx{ this };
+    auto duration = std::chrono::steady_clock::now() - chrono;
+    m_statistics.recordWriteLockWait(
+        std::chrono::duration_cast<std::chrono::microseconds>( duration ).count() );
+    return ctx;
 }
 
 void Connection::setPragma( Connection::Handle conn, const std::string& pragmaName,
@@ -138,6 +244,51 @@ void Connection::setPragma( Connection::Handle conn, const std::string& pragmaNa
         throw std::runtime_error( "PRAGMA " + pragmaName + " value mismatch" );
 }
 
+void Connection::setJournalModeWal( Connection::Handle conn )
+{
+    // Unlike most other pragmas, setting the journal mode returns the new
+    // journal mode, so we can't use setPragma here.
+    sqlite::Statement stmt( conn, "PRAGMA journal_mode = WAL" );
+    stmt.execute();
+    auto row = stmt.row();
+    std::string mode;
+    if ( row != nullptr )
+        row >> mode;
+    while ( stmt.row() != nullptr )
+        ;
+    // This can fail if the underlying filesystem doesn't support shared
+    // memory. We can still run in this mode, but readers might have to wait
+    // for the busy timeout to expire.
+    if ( mode != "wal" )
+        LOG_WARN( "Failed to enable WAL journal mode. Current mode: ", mode );
+}
+
+void Connection::applyTuning( Connection::Handle conn, bool readOnly )
+{
+    auto cacheSize = readOnly == true ? m_tuning.readCacheSize : m_tuning.cacheSize;
+    auto mmapSize = readOnly == true ? m_tuning.readMmapSize : m_tuning.mmapSize;
+    if ( cacheSize != 0 )
+    {
+        // A negative value is a size in KiB, instead of a number of pages
+        setPragma( conn, "cache_size", "-" + std::to_string( cacheSize ) );
+    }
+    // The mmap size gets silently capped to the maximum SQLite was compiled
+    // with, so we can't check it with setPragma
+    if ( mmapSize != 0 )
+    {
+        sqlite::Statement stmt( conn, "PRAGMA mmap_size = " +
+                                std::to_string( mmapSize ) );
+        stmt.execute();
+        while ( stmt.row() != nullptr )
+            ;
+    }
+    setPragma( conn, "synchronous",
+               std::to_string( static_cast<int>( m_tuning.synchronous ) ) );
+    if ( m_tuning.tempStore != TempStore::Default )
+        setPragma( conn, "temp_store",
+                   std::to_string( static_cast<int>( m_tuning.tempStore ) ) );
+}
+
 void Connection::setForeignKeyEnabled( bool value )
 {
     // Ensure no transaction will be started during the pragma change
@@ -165,53 +316,507 @@ void Connection::setRecursiveTriggersEnabled( bool value )
     setPragma( h, "recursive_triggers", value == true ? "1" : "0" );
 }
 
+void Connection::setLegacyAlterTableEnabled( bool value )
+{
+    auto ctx = acquireWriteContext();
+    setPragma( handle(), "legacy_alter_table", value == true ? "1" : "0" );
+}
+
 void Connection::registerUpdateHook( const std::string& table, Connection::UpdateHookCb cb )
 {
-    m_hooks.emplace( table, cb );
+    WriteContext ctx;
+    if ( ownsWriteContext() == false )
+        ctx = acquireWriteContext();
+    trackTable( table ).hook = std::move( cb );
+}
+
+void Connection::registerDeletionHook( const std::string& table, DeletionHookCb cb )
+{
+    WriteContext ctx;
+    if ( ownsWriteContext() == false )
+        ctx = acquireWriteContext();
+    trackTable( table ).deletionHook = std::move( cb );
+}
+
+void Connection::registerModificationHook( const std::string& table,
+                                           ModificationHookCb cb )
+{
+    WriteContext ctx;
+    if ( ownsWriteContext() == false )
+        ctx = acquireWriteContext();
+    trackTable( table ).modificationHook = std::move( cb );
+}
+
+IdentityMap& Connection::identityMap( const std::string& table )
+{
+    {
+        std::lock_guard<compat::Mutex> lock( m_identityMapsLock );
+        auto it = m_identityMaps.find( table );
+        if ( it != end( m_identityMaps ) )
+            return *it->second;
+    }
+    // The update hook must know about the map before any entity gets inserted
+    WriteContext ctx;
+    if ( ownsWriteContext() == false )
+        ctx = acquireWriteContext();
+    std::lock_guard<compat::Mutex> lock( m_identityMapsLock );
+    auto& map = m_identityMaps[table];
+    if ( map == nullptr )
+    {
+        map.reset( new IdentityMap );
+        trackTable( table ).identityMap = map.get();
+    }
+    return *map;
+}
+
+uint64_t Connection::tableHash( const char* table )
+{
+    // FNV-1a
+    uint64_t hash = 14695981039346656037u;
+    for ( ; *table != 0; ++table )
+    {
+        hash ^= static_cast<unsigned char>( *table );
+        hash *= 1099511628211u;
+    }
+    return hash;
+}
+
+Connection::TrackedTable* Connection::trackedTable( const char* table )
+{
+    auto hash = tableHash( table );
+    for ( auto& t : m_trackedTables )
+    {
+        if ( t.hash == hash && t.name == table )
+            return &t;
+    }
+    return nullptr;
+}
+
+Connection::TrackedTable& Connection::trackTable( const std::string& table )
+{
+    assert( ownsWriteContext() == true );
+    auto t = trackedTable( table.c_str() );
+    if ( t != nullptr )
+        return *t;
+    m_trackedTables.push_back( TrackedTable{ table, tableHash( table.c_str() ),
+                                             nullptr, nullptr, nullptr, {},
+                                             nullptr, false } );
+    return m_trackedTables.back();
+}
+
+void Connection::evictModifiedEntities()
+{
+    // The modified entities are only recorded by the writer, while holding
+    // the write context, so there's no need to lock here
+    for ( const auto& e : m_modifiedEntities )
+        e.first->evict( e.second );
+    m_modifiedEntities.clear();
+}
+
+void Connection::flushDeletions()
+{
+    for ( auto& t : m_trackedTables )
+    {
+        if ( t.deleted.empty() == true )
+            continue;
+        std::vector<int64_t> deleted;
+        std::swap( deleted, t.deleted );
+        if ( t.deletionHook != nullptr )
+            t.deletionHook( std::move( deleted ) );
+    }
+}
+
+std::vector<size_t> Connection::deletionsMark() const
+{
+    assert( ownsWriteContext() == true );
+    std::vector<size_t> mark;
+    mark.reserve( m_trackedTables.size() );
+    for ( const auto& t : m_trackedTables )
+        mark.push_back( t.deleted.size() );
+    return mark;
+}
+
+void Connection::rollbackDeletions( const std::vector<size_t>& mark )
+{
+    assert( ownsWriteContext() == true );
+    // The tables tracked after the mark was taken had no deletion recorded
+    for ( auto i = 0u; i < m_trackedTables.size(); ++i )
+    {
+        auto& deleted = m_trackedTables[i].deleted;
+        deleted.resize( i < mark.size() ? std::min( mark[i], deleted.size() ) : 0 );
+    }
+}
+
+void Connection::flushModifications()
+{
+    for ( auto& t : m_trackedTables )
+    {
+        if ( t.modified == false )
+            continue;
+        t.modified = false;
+        if ( t.modificationHook != nullptr )
+            t.modificationHook();
+    }
+}
+
+bool Connection::ownsWriteContext() const
+{
+    return WriteContextOwner == this;
+}
+
+void Connection::setWriteCoalescingDelay( std::chrono::milliseconds delay )
+{
+    if ( delay.count() == 0 )
+    {
+        stopWriteCoalescing();
+        return;
+    }
+    std::lock_guard<compat::Mutex> lock( m_pendingWritesLock );
+    m_coalescingDelay = delay;
+    if ( m_coalescingThread.joinable() == false )
+        m_coalescingThread = compat::Thread( &Connection::coalesceWrites, this );
+}
+
+bool Connection::deferWrite( DeferredWrite write, std::function<void()> onCommitted )
+{
+    if ( Transaction::transactionInProgress() == true )
+        return false;
+    {
+        std::lock_guard<compat::Mutex> lock( m_pendingWritesLock );
+        if ( m_coalescingDelay.count() == 0 )
+            return false;
+        m_pendingWrites.push_back( PendingWrite{ std::move( write ),
+                                                 std::move( onCommitted ) } );
+    }
+    m_pendingWritesCond.notify_all();
+    return true;
+}
+
+void Connection::flushPendingWrites()
+{
+    {
+        std::lock_guard<compat::Mutex> lock( m_pendingWritesLock );
+        if ( m_pendingWrites.empty() == true )
+            return;
+    }
+    std::vector<PendingWrite> writes;
+    auto run = [this, &writes]() {
+        std::unique_ptr<sqlite::Transaction> t;
+        if ( Transaction::transactionInProgress() == false )
+            t = newTransaction();
+        // Only fetch the pending writes once we hold the write context, so
+        // that concurrent flushes can't reorder them. When retrying, the same
+        // writes are replayed.
+        if ( writes.empty() == true )
+        {
+            std::lock_guard<compat::Mutex> lock( m_pendingWritesLock );
+            std::swap( writes, m_pendingWrites );
+        }
+        for ( const auto& w : writes )
+        {
+            w.write();
+            // This is discarded if the transaction gets rolled back, and
+            // registered again when retrying
+            if ( w.onCommitted != nullptr )
+                Transaction::onCurrentTransactionSuccess( w.onCommitted );
+        }
+        if ( t != nullptr )
+            t->commit();
+    };
+    try
+    {
+        sqlite::Tools::withRetries( this, 3, run );
+    }
+    catch ( const std::exception& ex )
+    {
+        // The entities which were modified in memory keep their new values
+        // until they get loaded again
+        LOG_ERROR( "Failed to flush ", writes.size(), " deferred writes: ", ex.what() );
+    }
+}
+
+Statistics& Connection::statistics()
+{
+    return m_statistics;
+}
+
+void Connection::setSlowRequestThreshold( std::chrono::microseconds threshold )
+{
+    m_slowRequestThreshold = threshold.count();
+}
+
+int Connection::traceCallback( unsigned int type, void* data, void* p, void* x )
+{
+    assert( type == SQLITE_TRACE_PROFILE );
+    (void)type;
+    const auto self = reinterpret_cast<Connection*>( data );
+    auto stmt = static_cast<sqlite3_stmt*>( p );
+    auto durationUs = static_cast<uint64_t>( *static_cast<sqlite3_int64*>( x ) / 1000 );
+    auto stmtRows = Statement::nbRows( stmt );
+    auto req = sqlite3_sql( stmt );
+    if ( req == nullptr )
+        return 0;
+    self->m_statistics.recordExecution( stmt, durationUs, stmtRows );
+    auto threshold = self->m_slowRequestThreshold.load( std::memory_order_relaxed );
+    if ( threshold != 0 && durationUs >= threshold )
+    {
+        auto expandedReq = sqlite3_expanded_sql( stmt );
+        LOG_WARN( "Slow request: ", expandedReq != nullptr ? expandedReq : req,
+                  " ran in ", durationUs, "µs and returned ", stmtRows, " rows" );
+        sqlite3_free( expandedReq );
+    }
+    return 0;
+}
+
+void Connection::setBackgroundThread()
+{
+    BackgroundThread = true;
+}
+
+std::chrono::microseconds Connection::backoffDelay( uint32_t nbAttempts )
+{
+    // Interactive threads poll the lock more often, which gives them a better
+    // chance to acquire it as soon as it gets released.
+    auto initialDelay = std::chrono::microseconds{ BackgroundThread ? 2000 : 500 };
+    auto maxDelay = std::chrono::microseconds{ BackgroundThread ? 64000 : 8000 };
+    auto delay = std::min( initialDelay * ( 1 << std::min( nbAttempts, 8u ) ), maxDelay );
+    // Randomize the delay so that the connections waiting for the same lock
+    // don't all retry at the same time
+    static thread_local std::minstd_rand rng{ static_cast<std::minstd_rand::result_type>(
+                std::hash<compat::Thread::id>{}( compat::this_thread::get_id() ) ) };
+    std::uniform_int_distribution<int64_t> dist{ delay.count() / 2, delay.count() };
+    return std::chrono::microseconds{ dist( rng ) };
+}
+
+int Connection::busyHandler( void* data, int nbCalls )
+{
+    // The handler is invoked repeatedly while a single request waits, so the
+    // first call marks the beginning of the wait
+    static thread_local std::chrono::steady_clock::time_point busySince;
+
+    const auto self = reinterpret_cast<Connection*>( data );
+    auto now = std::chrono::steady_clock::now();
+    if ( nbCalls == 0 )
+    {
+        busySince = now;
+        self->m_statistics.recordBusy();
+    }
+    auto timeout = std::chrono::milliseconds{ self->m_tuning.busyTimeout };
+    auto elapsed = now - busySince;
+    if ( elapsed >= timeout )
+    {
+        self->m_statistics.recordBusyTimeout();
+        return 0;
+    }
+    auto delay = std::min<std::chrono::steady_clock::duration>(
+                backoffDelay( nbCalls ), timeout - elapsed );
+    compat::this_thread::sleep_for( delay );
+    auto waited = std::chrono::steady_clock::now() - now;
+    self->m_statistics.recordBusyWait( static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>( waited ).count() ) );
+    return 1;
+}
+
+void Connection::coalesceWrites()
+{
+    // Open this thread's connection right away, as handle() requires the
+    // Connection to still be owned, which isn't the case anymore when
+    // flushing from the destructor.
+    handle();
+    setBackgroundThread();
+    std::unique_lock<compat::Mutex> lock( m_pendingWritesLock );
+    while ( true )
+    {
+        m_pendingWritesCond.wait( lock, [this]() {
+            return m_pendingWrites.empty() == false || m_coalescingDelay.count() == 0;
+        });
+        // Give more writes a chance to be queued before committing them
+        if ( m_coalescingDelay.count() != 0 )
+        {
+            m_pendingWritesCond.wait_for( lock, m_coalescingDelay, [this]() {
+                return m_coalescingDelay.count() == 0;
+            });
+        }
+        auto stop = m_coalescingDelay.count() == 0;
+        lock.unlock();
+        flushPendingWrites();
+        if ( stop == true )
+            break;
+        lock.lock();
+    }
+}
+
+void Connection::stopWriteCoalescing()
+{
+    {
+        std::lock_guard<compat::Mutex> lock( m_pendingWritesLock );
+        m_coalescingDelay = std::chrono::milliseconds{ 0 };
+    }
+    m_pendingWritesCond.notify_all();
+    // The coalescing thread flushes the remaining writes before returning
+    if ( m_coalescingThread.joinable() == true )
+        m_coalescingThread.join();
 }
 
-std::shared_ptr<Connection> Connection::connect( const std::string& dbPath )
+const DatabaseTuning& Connection::tuning() const
+{
+    return m_tuning;
+}
+
+std::shared_ptr<Connection> Connection::connect( const std::string& dbPath,
+                                                 const DatabaseTuning& tuning )
 {
     // Use a wrapper to allow make_shared to use the private Connection ctor
     struct SqliteConnectionWrapper : public Connection
     {
-        SqliteConnectionWrapper( const std::string& p ) : Connection( p ) {}
+        SqliteConnectionWrapper( const std::string& p, const DatabaseTuning& t )
+            : Connection( p, t ) {}
     };
-    return std::make_shared<SqliteConnectionWrapper>( dbPath );
+    return std::make_shared<SqliteConnectionWrapper>( dbPath, tuning );
 }
 
 void Connection::updateHook( void* data, int reason, const char*,
                                    const char* table, sqlite_int64 rowId )
 {
     const auto self = reinterpret_cast<Connection*>( data );
-    auto it = self->m_hooks.find( table );
-    if ( it == end( self->m_hooks ) )
+    auto t = self->trackedTable( table );
+    if ( t == nullptr )
+        return;
+    if ( t->identityMap != nullptr )
+    {
+        t->identityMap->evict( rowId );
+        self->m_modifiedEntities.emplace_back( t->identityMap, rowId );
+    }
+    if ( reason == SQLITE_DELETE && t->deletionHook != nullptr )
+        t->deleted.push_back( rowId );
+    if ( t->modificationHook != nullptr )
+        t->modified = true;
+    if ( t->hook == nullptr )
         return;
     switch ( reason )
     {
     case SQLITE_INSERT:
-        it->second( HookReason::Insert, rowId );
+        t->hook( HookReason::Insert, rowId );
         break;
     case SQLITE_UPDATE:
-        it->second( HookReason::Update, rowId );
+        t->hook( HookReason::Update, rowId );
         break;
     case SQLITE_DELETE:
-        it->second( HookReason::Delete, rowId );
+        t->hook( HookReason::Delete, rowId );
         break;
     }
 }
 
+void Connection::rollbackHook( void* data )
+{
+    // Only invoked by the writer, when the whole transaction gets rolled back.
+    // The rows deleted by a savepoint which got rolled back are dropped by
+    // the nested transaction itself
+    const auto self = reinterpret_cast<Connection*>( data );
+    for ( auto& t : self->m_trackedTables )
+    {
+        t.deleted.clear();
+        t.modified = false;
+    }
+}
+
+Connection::WriteContext::WriteContext()
+    : m_conn( nullptr )
+{
+}
+
+Connection::WriteContext::WriteContext( Connection* conn )
+    : m_conn( conn )
+    , m_lock( conn->m_writeLock )
+{
+    WriteContextOwner = conn;
+}
+
+Connection::WriteContext::WriteContext( WriteContext&& other )
+    : m_conn( other.m_conn )
+    , m_lock( std::move( other.m_lock ) )
+{
+}
+
+Connection::WriteContext&
+Connection::WriteContext::operator=( WriteContext&& other )
+{
+    unlock();
+    m_conn = other.m_conn;
+    m_lock = std::move( other.m_lock );
+    return *this;
+}
+
+Connection::WriteContext::~WriteContext()
+{
+    unlock();
+}
+
+void Connection::WriteContext::unlock()
+{
+    if ( m_lock.owns_lock() == false )
+        return;
+    // Readers may have loaded the previous version of the modified rows
+    // until now
+    m_conn->evictModifiedEntities();
+    m_conn->flushDeletions();
+    m_conn->flushModifications();
+    WriteContextOwner = nullptr;
+    m_lock.unlock();
+}
+
 Connection::WeakDbContext::WeakDbContext( Connection* conn )
     : m_conn( conn )
 {
     m_conn->setForeignKeyEnabled( false );
     m_conn->setRecursiveTriggersEnabled( false );
+    m_conn->setLegacyAlterTableEnabled( true );
 }
 
 Connection::WeakDbContext::~WeakDbContext()
 {
     m_conn->setForeignKeyEnabled( true );
     m_conn->setRecursiveTriggersEnabled( true );
+    m_conn->setLegacyAlterTableEnabled( false );
+}
+
+Connection::PooledConnection::PooledConnection( ConnPtr c )
+    : conn( std::move( c ) )
+    , cache( new StatementCache( conn.get() ) )
+{
+}
+
+Connection::PooledConnection::~PooledConnection()
+{
+    // Finalize the statements before closing the connection
+    cache.reset();
+}
+
+Connection::ReadContext::ReadContext( Connection* conn, Handle handle,
+                                      PooledConnection* pooled )
+    : m_conn( conn )
+    , m_handle( handle )
+    , m_pooled( pooled )
+{
+}
+
+Connection::ReadContext::ReadContext( ReadContext&& other )
+    : m_conn( other.m_conn )
+    , m_handle( other.m_handle )
+    , m_pooled( other.m_pooled )
+{
+    other.m_pooled = nullptr;
+}
+
+Connection::ReadContext::~ReadContext()
+{
+    if ( m_pooled != nullptr )
+        m_conn->releaseReadContext();
+}
+
+Connection::Handle Connection::ReadContext::handle() const
+{
+    return m_handle;
 }
 
 Connection::ThreadSpecificConnection::ThreadSpecificConnection(
@@ -22,16 +22,21 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <functional>
 #include <memory>
 #include <sqlite3.h>
 #include "compat/ConditionVariable.h"
 #include <unordered_map>
 #include <string>
+#include <vector>
 
-#include "utils/SWMRLock.h"
 #include "compat/Mutex.h"
 #include "compat/Thread.h"
+#include "medialibrary/IMediaLibrary.h"
+#include "IdentityMap.h"
+#include "SqliteStatistics.h"
 
 namespace medialibrary
 {
@@ -40,12 +45,12 @@ namespace sqlite
 {
 
 class Transaction;
+class StatementCache;
 
 class Connection : public std::enable_shared_from_this<Connection>
 {
 public:
-    using ReadContext = std::unique_lock<utils::ReadLocker>;
-    using WriteContext = std::unique_lock<utils::WriteLocker>;
+    class WriteContext;
     using Handle = sqlite3*;
     enum class HookReason
     {
@@ -66,13 +71,40 @@ public:
     };
 
     using UpdateHookCb = std::function<void(HookReason, int64_t)>;
+    using DeletionHookCb = std::function<void(std::vector<int64_t>)>;
+    using ModificationHookCb = std::function<void()>;
+    using DeferredWrite = std::function<void()>;
+
+    class ReadContext;
 
     // Returns the current thread's connection
     // This will initiate a connection if required
     Handle handle();
     std::unique_ptr<sqlite::Transaction> newTransaction();
-    ReadContext acquireReadContext();
+    /**
+     * @brief acquireWriteContext Serializes writers.
+     *
+     * The database is opened in WAL mode, so readers don't need any context:
+     * they will read from the last committed snapshot, and will never wait
+     * for a writer to complete.
+     * The time spent waiting for the context is reported in the statistics.
+     */
     WriteContext acquireWriteContext();
+    /**
+     * @brief acquireReadContext Provides a connection to run read-only
+     *        requests with.
+     *
+     * Outside of a transaction, this is a connection from a bounded pool of
+     * read-only connections, so that threads only running queries don't each
+     * open their own connection, with its own page cache and compiled
+     * statements. If no pooled connection is available, this waits for one
+     * to be released.
+     * When a transaction is in progress, this is the current thread's
+     * connection, so that the uncommitted changes are visible.
+     * A thread holding a read context will reuse its connection if it
+     * acquires another one.
+     */
+    ReadContext acquireReadContext();
     /**
      * @brief setForeignKeyEnabled Enables/disables foreign key for the sqlite
      *        connection for the current thread.
@@ -87,13 +119,137 @@ public:
      * This will not change existing connection in other threads
      */
     void setRecursiveTriggersEnabled( bool value );
+    /**
+     * @brief setLegacyAlterTableEnabled Enables/disables the legacy ALTER TABLE
+     *        behavior for the connection for the current thread.
+     *
+     * When enabled, renaming a table doesn't rewrite the references to it in
+     * the other tables foreign keys & in the triggers, so that the renamed
+     * table can be replaced by a new one, as if it was dropped.
+     * This will not change existing connection in other threads
+     */
+    void setLegacyAlterTableEnabled( bool value );
 
+    /**
+     * @brief registerUpdateHook Registers a callback invoked for each row of
+     *        \p table modified through this connection, replacing any callback
+     *        previously registered for this table.
+     *
+     * The callback is invoked by the writer, while the row is being modified.
+     */
     void registerUpdateHook( const std::string& table, UpdateHookCb cb );
+    /**
+     * @brief registerDeletionHook Registers a callback invoked with all the
+     *        rows deleted from \p table by a write, once it is committed.
+     *
+     * The callback is invoked right before the write context gets released,
+     * and therefore mustn't block. The deletions rolled back along with
+     * their transaction or savepoint aren't reported.
+     */
+    void registerDeletionHook( const std::string& table, DeletionHookCb cb );
+    /**
+     * @brief deletionsMark Returns the number of deletions recorded so far for
+     *        each tracked table
+     *
+     * Nested transactions use it to drop the deletions made by a savepoint
+     * which gets rolled back, through rollbackDeletions().
+     * Both must be called while holding the write context.
+     */
+    std::vector<size_t> deletionsMark() const;
+    void rollbackDeletions( const std::vector<size_t>& mark );
+    /**
+     * @brief registerModificationHook Registers a callback invoked once a
+     *        write modifying \p table, including through a trigger, is
+     *        committed.
+     *
+     * As for the deletion hook, the callback is invoked right before the
+     * write context gets released, and therefore mustn't block.
+     */
+    void registerModificationHook( const std::string& table, ModificationHookCb cb );
 
-    static std::shared_ptr<Connection> connect( const std::string& dbPath );
+    /**
+     * @brief identityMap Returns the identity map of the entities stored in
+     *        the provided table, creating it if needed.
+     *
+     * The entities get evicted from it when their row is modified through
+     * this connection.
+     */
+    IdentityMap& identityMap( const std::string& table );
+
+    /**
+     * @brief setWriteCoalescingDelay Enables or disables the coalescing of
+     *        small writes.
+     * @param delay The maximum duration a write can be deferred for. 0
+     *              disables the coalescing, which is the default.
+     *
+     * When enabled, the writes submitted through deferWrite() are queued and
+     * committed together by a background thread, instead of each of them
+     * waiting for the write context and committing its own transaction.
+     * Disabling the coalescing flushes the pending writes.
+     */
+    void setWriteCoalescingDelay( std::chrono::milliseconds delay );
+    /**
+     * @brief deferWrite Queues a write to be executed with the other pending ones
+     * @param onCommitted An optional callback, invoked once the write is
+     *                    committed. It won't be invoked if the write fails.
+     * @return false if the write can't be deferred, in which case the caller
+     *         is expected to execute it immediately.
+     *
+     * Writes are not deferred when the coalescing is disabled, nor when a
+     * transaction is in progress on the calling thread, so that they still
+     * get rolled back along with this transaction.
+     * If the pending writes still can't be committed after being retried,
+     * they are dropped and the failure is logged.
+     * The deferred writes only run after the immediate ones issued in the
+     * meantime, so an immediate write which depends on the rows a deferred
+     * write modifies must call flushPendingWrites() first.
+     */
+    bool deferWrite( DeferredWrite write, std::function<void()> onCommitted );
+    /**
+     * @brief flushPendingWrites Commits all the deferred writes before returning
+     *
+     * When a transaction is in progress on the calling thread, the writes
+     * are executed as part of it. This is a no-op if no write is pending.
+     */
+    void flushPendingWrites();
+
+    /**
+     * @brief statistics Returns the execution statistics of the requests run
+     *        by all the per-thread connections
+     */
+    Statistics& statistics();
+    /**
+     * @brief setBackgroundThread Flags the calling thread as running
+     *        background work.
+     *
+     * When the database is locked, the requests from such threads poll the
+     * lock less often, so that the other threads are more likely to acquire
+     * it first.
+     */
+    static void setBackgroundThread();
+    /**
+     * @brief backoffDelay Returns how long the calling thread should wait
+     *        before its next attempt to acquire a lock, after it failed
+     *        \p nbAttempts times.
+     */
+    static std::chrono::microseconds backoffDelay( uint32_t nbAttempts );
+    /**
+     * @brief setSlowRequestThreshold Logs the requests which take longer than
+     *        the provided threshold to run, with their bound parameters.
+     *        0 disables the logging.
+     */
+    void setSlowRequestThreshold( std::chrono::microseconds threshold );
+
+    /**
+     * @brief tuning Returns the settings applied to all the connections
+     */
+    const DatabaseTuning& tuning() const;
+
+    static std::shared_ptr<Connection> connect( const std::string& dbPath,
+                                                const DatabaseTuning& tuning = DatabaseTuning{} );
 
 protected:
-    explicit Connection( const std::string& dbPath );
+    Connection( const std::string& dbPath, const DatabaseTuning& tuning );
     ~Connection();
 
 private:
@@ -104,8 +260,100 @@ private:
 
     void setPragma( Handle conn, const std::string& pragmaName,
                     const std::string& value );
+    void setJournalModeWal( Handle conn );
+    void applyTuning( Handle conn, bool readOnly );
     static void updateHook( void* data, int reason, const char* database,
                             const char* table, sqlite_int64 rowId );
+    static int traceCallback( unsigned int type, void* data, void* p, void* x );
+    static int busyHandler( void* data, int nbCalls );
+    static void rollbackHook( void* data );
+    void coalesceWrites();
+    void stopWriteCoalescing();
+    void evictModifiedEntities();
+    void flushDeletions();
+    void flushModifications();
+    bool ownsWriteContext() const;
+
+private:
+    using ConnPtr = std::unique_ptr<sqlite3, int(*)(sqlite3*)>;
+
+    struct PooledConnection
+    {
+        PooledConnection( ConnPtr c );
+        ~PooledConnection();
+
+        ConnPtr conn;
+        // Pooled connections are used by multiple threads, so they own their
+        // compiled statements instead of relying on the per-thread caches.
+        std::unique_ptr<StatementCache> cache;
+    };
+
+    /*
+     * A thread only ever uses a single pooled connection, which is released
+     * when its last read context goes away.
+     */
+    struct ThreadReadContext
+    {
+        Connection* owner;
+        PooledConnection* conn;
+        unsigned int depth;
+    };
+
+    ConnPtr open();
+    static ThreadReadContext& threadReadContext();
+    void releaseReadContext();
+    PooledConnection* acquirePooledConnection();
+    void releasePooledConnection( PooledConnection* conn );
+
+public:
+    /*
+     * Serializes the writers. When released, the writes it covered are
+     * either committed or rolled back, and the entities they modified get
+     * evicted once more from their identity map.
+     */
+    class WriteContext
+    {
+    public:
+        WriteContext();
+        WriteContext( WriteContext&& other );
+        WriteContext& operator=( WriteContext&& other );
+        ~WriteContext();
+        WriteContext( const WriteContext& ) = delete;
+        WriteContext& operator=( const WriteContext& ) = delete;
+
+        void unlock();
+
+    private:
+        WriteContext( Connection* conn );
+
+    private:
+        Connection* m_conn;
+        std::unique_lock<compat::Mutex> m_lock;
+
+        friend Connection;
+    };
+
+    class ReadContext
+    {
+    public:
+        ReadContext( ReadContext&& other );
+        ~ReadContext();
+        ReadContext( const ReadContext& ) = delete;
+        ReadContext& operator=( const ReadContext& ) = delete;
+        ReadContext& operator=( ReadContext&& ) = delete;
+
+        Handle handle() const;
+
+    private:
+        ReadContext( Connection* conn, Handle handle, PooledConnection* pooled );
+
+    private:
+        Connection* m_conn;
+        Handle m_handle;
+        PooledConnection* m_pooled;
+
+        friend Connection;
+    };
 
 private:
     struct ThreadSpecificConnection
@@ -117,14 +365,60 @@ private:
         std::weak_ptr<Connection> m_weakConnection;
     };
 
-    using ConnPtr = std::unique_ptr<sqlite3, int(*)(sqlite3*)>;
     const std::string m_dbPath;
+    const DatabaseTuning m_tuning;
     compat::Mutex m_connMutex;
     std::unordered_map<compat::Thread::id, ConnPtr> m_conns;
-    utils::SWMRLock m_contextLock;
-    utils::ReadLocker m_readLock;
-    utils::WriteLocker m_writeLock;
-    std::unordered_map<std::string, UpdateHookCb> m_hooks;
+    compat::Mutex m_writeLock;
+
+    /*
+     * The tables the update hook reacts to.
+     * SQLite invokes the hook for each modified row, including the ones
+     * modified by triggers, so the other tables must be ruled out without
+     * allocating. Since the hook only runs while a write context is held, the
+     * tracked tables are only modified while holding it as well.
+     */
+    struct TrackedTable
+    {
+        std::string name;
+        uint64_t hash;
+        UpdateHookCb hook;
+        DeletionHookCb deletionHook;
+        IdentityMap* identityMap;
+        // The rows deleted since the write context was acquired
+        std::vector<int64_t> deleted;
+        ModificationHookCb modificationHook;
+        // True when a row was modified since the write context was acquired
+        bool modified;
+    };
+    static uint64_t tableHash( const char* table );
+    TrackedTable* trackedTable( const char* table );
+    TrackedTable& trackTable( const std::string& table );
+    std::vector<TrackedTable> m_trackedTables;
+
+    compat::Mutex m_identityMapsLock;
+    std::unordered_map<std::string, std::unique_ptr<IdentityMap>> m_identityMaps;
+    // The entities modified since the write context was acquired
+    std::vector<std::pair<IdentityMap*, int64_t>> m_modifiedEntities;
+
+    compat::Mutex m_pendingWritesLock;
+    compat::ConditionVariable m_pendingWritesCond;
+    struct PendingWrite
+    {
+        DeferredWrite write;
+        std::function<void()> onCommitted;
+    };
+    std::vector<PendingWrite> m_pendingWrites;
+    std::chrono::milliseconds m_coalescingDelay;
+    compat::Thread m_coalescingThread;
+
+    Statistics m_statistics;
+    std::atomic<uint64_t> m_slowRequestThreshold;
+
+    compat::Mutex m_readPoolLock;
+    compat::ConditionVariable m_readPoolCond;
+    std::vector<std::unique_ptr<PooledConnection>> m_readConns;
+    std::vector<PooledConnection*> m_idleReadConns;
 };
 
 }
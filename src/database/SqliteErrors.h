@@ -85,6 +85,22 @@ public:
     }
 };
 
+/*
+ * Thrown when a nested transaction is used after SQLite implicitely rolled
+ * back the enclosing one, as its changes would otherwise be committed on their
+ * own.
+ * This doesn't inherit GenericExecution, so that it doesn't get retried on its
+ * own: the entire enclosing transaction must be restarted instead.
+ */
+class TransactionRolledBack : public Generic
+{
+public:
+    TransactionRolledBack()
+        : Generic( "The enclosing transaction was rolled back" )
+    {
+    }
+};
+
 class ColumnOutOfRange : public Generic
 {
 public:
@@ -0,0 +1,252 @@
+/*****************************************************************************
+ * Media Library
+ *****************************************************************************
+ * Copyright (C) 2015-2019 Hugo Beauzée-Luyssen, Videolabs, VideoLAN
+ *
+ * Authors: Hugo Beauzée-Luyssen<hugo@beauzee.fr>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#if HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "SqliteQuery.h"
+
+#include <cassert>
+#include <cstring>
+#include <strings.h>
+
+namespace medialibrary
+{
+
+namespace sqlite
+{
+
+namespace
+{
+
+/*
+ * Returns the positions of all the occurrences of token which aren't part of a
+ * nested expression or a string literal.
+ */
+std::vector<size_t> findTopLevel( const std::string& req, const std::string& token )
+{
+    std::vector<size_t> res;
+    auto depth = 0;
+    auto inLiteral = false;
+    for ( auto i = 0u; i < req.size(); ++i )
+    {
+        auto c = req[i];
+        if ( c == '\'' )
+            inLiteral = !inLiteral;
+        if ( inLiteral == true )
+            continue;
+        if ( c == '(' )
+            ++depth;
+        else if ( c == ')' )
+            --depth;
+        else if ( depth == 0 && req.compare( i, token.size(), token ) == 0 )
+            res.push_back( i );
+    }
+    return res;
+}
+
+std::string trim( const std::string& str )
+{
+    auto first = str.find_first_not_of( ' ' );
+    if ( first == std::string::npos )
+        return {};
+    auto last = str.find_last_not_of( ' ' );
+    return str.substr( first, last - first + 1 );
+}
+
+bool removeSuffix( std::string& str, const char* suffix )
+{
+    auto len = strlen( suffix );
+    if ( str.size() <= len ||
+         strcasecmp( str.c_str() + str.size() - len, suffix ) != 0 )
+        return false;
+    str = trim( str.substr( 0, str.size() - len ) );
+    return true;
+}
+
+std::string keyAlias( size_t idx )
+{
+    return "_seek_key" + std::to_string( idx );
+}
+
+}
+
+SeekRequest::SeekRequest( std::string field, std::string base,
+                          const std::string& groupAndOrderBy,
+                          const std::string& primaryKey )
+    : m_field( std::move( field ) )
+    , m_base( std::move( base ) )
+{
+    auto orderByPos = findTopLevel( groupAndOrderBy, "ORDER BY" );
+    if ( orderByPos.empty() == true )
+        m_groupBy = groupAndOrderBy;
+    else
+    {
+        m_groupBy = groupAndOrderBy.substr( 0, orderByPos.back() );
+        auto orderBy = groupAndOrderBy.substr( orderByPos.back() + strlen( "ORDER BY" ) );
+        auto prev = 0u;
+        auto commas = findTopLevel( orderBy, "," );
+        commas.push_back( orderBy.size() );
+        for ( auto pos : commas )
+        {
+            auto expr = trim( orderBy.substr( prev, pos - prev ) );
+            prev = pos + 1;
+            if ( expr.empty() == true )
+                continue;
+            auto desc = removeSuffix( expr, " DESC" );
+            if ( desc == false )
+                removeSuffix( expr, " ASC" );
+            m_keys.push_back( Key{ std::move( expr ), desc } );
+        }
+    }
+    // Use the primary key to discriminate between rows with equal sorting keys
+    m_keys.push_back( Key{ primaryKey, false } );
+}
+
+SeekRequest SeekRequest::fromRequest( const std::string& req,
+                                      const std::string& primaryKey )
+{
+    auto select = req.find( "SELECT " );
+    auto from = findTopLevel( req, " FROM " );
+    assert( select != std::string::npos && from.empty() == false );
+    auto field = req.substr( select + strlen( "SELECT " ),
+                             from.front() - select - strlen( "SELECT " ) );
+    auto orderBy = findTopLevel( req, "ORDER BY" );
+    if ( orderBy.empty() == true )
+        return SeekRequest{ std::move( field ), req.substr( from.front() ),
+                            "", primaryKey };
+    return SeekRequest{ std::move( field ),
+                        req.substr( from.front(), orderBy.back() - from.front() ),
+                        req.substr( orderBy.back() ), primaryKey };
+}
+
+std::string SeekRequest::cursorRequest() const
+{
+    std::string req = "SELECT ";
+    for ( auto i = 0u; i < m_keys.size(); ++i )
+    {
+        if ( i > 0 )
+            req += ", ";
+        req += m_keys[i].expr + " AS " + keyAlias( i );
+    }
+    // Filter on the outer request to let SQLite push the condition down, in
+    // the WHERE or HAVING clause depending on the listing request.
+    return "SELECT * FROM (" + req + " " + m_base + " " + m_groupBy + ") WHERE " +
+            keyAlias( m_keys.size() - 1 ) + " = ?";
+}
+
+size_t SeekRequest::nbKeys() const
+{
+    return m_keys.size();
+}
+
+std::string SeekRequest::pageRequest( const std::vector<Value>& cursor,
+                                      bool before, bool limit,
+                                      std::vector<const sqlite3_value*>& args ) const
+{
+    assert( cursor.empty() == true || cursor.size() == m_keys.size() );
+    std::string req = "SELECT * FROM (SELECT " + m_field;
+    for ( auto i = 0u; i < m_keys.size(); ++i )
+        req += ", " + m_keys[i].expr + " AS " + keyAlias( i );
+    req += " " + m_base + " " + m_groupBy + ")";
+
+    if ( cursor.empty() == false )
+    {
+        /*
+         * For keys k0, k1, ... kn and the cursor values v0, v1, ... vn, a row
+         * comes after the cursor if:
+         * k0 > v0 OR (k0 = v0 AND k1 > v1) OR ... OR (k0 = v0 AND ... AND kn > vn)
+         * SQLite sorts NULL values first, so they need to be special cased
+         * since comparing them always yield NULL.
+         */
+        std::string equals;
+        std::vector<const sqlite3_value*> equalsArgs;
+        std::string cond;
+        for ( auto i = 0u; i < m_keys.size(); ++i )
+        {
+            const auto alias = keyAlias( i );
+            auto value = cursor[i].get();
+            auto isNull = sqlite3_value_type( value ) == SQLITE_NULL;
+            auto greater = m_keys[i].desc == before;
+            std::string after;
+            if ( isNull == true )
+            {
+                // Only non NULL values can come after NULL in ascending order,
+                // and nothing comes after it in descending order
+                if ( greater == true )
+                    after = alias + " IS NOT NULL";
+            }
+            else if ( greater == true )
+                after = alias + " > ?";
+            else
+                after = alias + " < ? OR " + alias + " IS NULL";
+            if ( after.empty() == false )
+            {
+                if ( cond.empty() == false )
+                    cond += " OR ";
+                cond += "(" + equals + "(" + after + "))";
+                args.insert( end( args ), begin( equalsArgs ), end( equalsArgs ) );
+                if ( isNull == false )
+                    args.push_back( value );
+            }
+            if ( isNull == true )
+                equals += alias + " IS NULL AND ";
+            else
+            {
+                equals += alias + " = ? AND ";
+                equalsArgs.push_back( value );
+            }
+        }
+        // The last key is the primary key, which can't be NULL, so there's
+        // always at least one condition
+        assert( cond.empty() == false );
+        req += " WHERE ";
+        // Provide SQLite with a range on the first key so it can seek to the
+        // cursor when this key is indexed
+        auto first = cursor[0].get();
+        if ( m_keys.size() > 1 && m_keys[0].desc == before &&
+             sqlite3_value_type( first ) != SQLITE_NULL )
+        {
+            req += keyAlias( 0 ) + " >= ? AND ";
+            args.insert( begin( args ), first );
+        }
+        req += "(" + cond + ")";
+    }
+
+    req += " ORDER BY ";
+    for ( auto i = 0u; i < m_keys.size(); ++i )
+    {
+        if ( i > 0 )
+            req += ", ";
+        req += keyAlias( i );
+        if ( m_keys[i].desc != before )
+            req += " DESC";
+    }
+    if ( limit == true )
+        req += " LIMIT ?";
+    return req;
+}
+
+}
+
+}
@@ -25,7 +25,9 @@
 #include "medialibrary/IQuery.h"
 #include "SqliteConnection.h"
 #include "SqliteTools.h"
+#include "QueryExecutor.h"
 
+#include <algorithm>
 #include <vector>
 #include <functional>
 #include <string>
@@ -33,6 +35,66 @@
 namespace medialibrary
 {
 
+namespace sqlite
+{
+
+/**
+ * @brief The SeekRequest class builds the requests used for keyset pagination
+ *
+ * The ORDER BY clause of a listing request is split into its sorting keys, and
+ * the primary key is appended to them, so that each row has a unique position
+ * in the listing. Fetching the items following (or preceding) a given row can
+ * then be done by comparing the sorting keys to this row's ones, which lets
+ * SQLite start from the cursor instead of walking all the previous rows.
+ */
+class SeekRequest
+{
+public:
+    SeekRequest( std::string field, std::string base,
+                 const std::string& groupAndOrderBy, const std::string& primaryKey );
+    /**
+     * @brief fromRequest Splits a full "SELECT ... FROM ... ORDER BY ..." request
+     */
+    static SeekRequest fromRequest( const std::string& req, const std::string& primaryKey );
+
+    /**
+     * @brief cursorRequest Returns a request fetching all the sorting keys of
+     *                      a single row.
+     *
+     * The request expects the listing parameters followed by the primary key
+     * of the row to fetch.
+     */
+    std::string cursorRequest() const;
+    size_t nbKeys() const;
+    /**
+     * @brief pageRequest Returns the request fetching the rows following (or
+     *                    preceding, if before is true) the provided cursor
+     * @param cursor The sorting keys, as returned by cursorRequest(), or an
+     *               empty vector to start from the first/last row.
+     * @param limit true if the request must end with a LIMIT parameter
+     * @param args Will be filled with the values to bind after the listing
+     *             parameters, and before the limit.
+     *
+     * When before is true, the rows are returned in reverse order.
+     */
+    std::string pageRequest( const std::vector<Value>& cursor, bool before,
+                             bool limit, std::vector<const sqlite3_value*>& args ) const;
+
+private:
+    struct Key
+    {
+        std::string expr;
+        bool desc;
+    };
+
+    std::string m_field;
+    std::string m_base;
+    std::string m_groupBy;
+    std::vector<Key> m_keys;
+};
+
+}
+
 template <typename Impl, typename Intf, typename... RequestParams>
 class SqliteQueryBase : public IQuery<Intf>
 {
@@ -46,13 +108,65 @@ protected:
     {
     }
 
+public:
+    virtual void itemsAsync( uint32_t nbItems, uint32_t offset,
+                             typename IQuery<Intf>::ItemsCallback callback,
+                             uint64_t tag ) override
+    {
+        // Run a copy of the query, which the caller is free to destroy
+        std::shared_ptr<IQuery<Intf>> query = clone();
+        m_ml->queryExecutor()->submit( tag, [query, nbItems, offset, callback]() {
+            Result res;
+            try
+            {
+                res = query->items( nbItems, offset );
+            }
+            catch ( const sqlite::errors::Generic& ex )
+            {
+                LOG_ERROR( "Failed to run asynchronous query: ", ex.what() );
+            }
+            return std::function<void()>{ [callback, res]() mutable {
+                callback( std::move( res ) );
+            } };
+        });
+    }
+
+    virtual void countAsync( typename IQuery<Intf>::CountCallback callback,
+                             uint64_t tag ) override
+    {
+        std::shared_ptr<IQuery<Intf>> query = clone();
+        m_ml->queryExecutor()->submit( tag, [query, callback]() {
+            size_t count = 0;
+            try
+            {
+                count = query->count();
+            }
+            catch ( const sqlite::errors::Generic& ex )
+            {
+                LOG_ERROR( "Failed to run asynchronous query: ", ex.what() );
+            }
+            return std::function<void()>{ [callback, count]() {
+                callback( count );
+            } };
+        });
+    }
+
+protected:
+    virtual std::shared_ptr<IQuery<Intf>> clone() const = 0;
+
     size_t executeCount( const std::string& req )
+    {
+        return executeCount( req, m_params );
+    }
+
+    template <typename Params>
+    size_t executeCount( const std::string& req, const Params& params )
     {
         auto dbConn = m_ml->getConn();
-        auto ctx = dbConn->acquireReadContext();
         auto chrono = std::chrono::steady_clock::now();
-        sqlite::Statement stmt( dbConn->handle(), req );
-        stmt.execute( m_params );
+        auto ctx = dbConn->acquireReadContext();
+        sqlite::Statement stmt( ctx.handle(), req );
+        stmt.execute( params );
         auto duration = std::chrono::steady_clock::now() - chrono;
         LOG_DEBUG("Executed ", req, " in ",
                  std::chrono::duration_cast<std::chrono::microseconds>( duration ).count(), "µs" );
@@ -73,6 +187,42 @@ protected:
         return Impl::template fetchAll<Intf>( m_ml, req, m_params );
     }
 
+    size_t executeForEach( const std::string& req,
+                           const typename IQuery<Intf>::Callback& callback )
+    {
+        return Impl::template forEach<Intf>( m_ml, req, callback, m_params );
+    }
+
+    Result executeSeek( const sqlite::SeekRequest& seek, int64_t cursor,
+                        uint32_t nbItems, bool before )
+    {
+        std::vector<sqlite::Value> keys;
+        if ( cursor != 0 )
+        {
+            auto dbConn = m_ml->getConn();
+            auto ctx = dbConn->acquireReadContext();
+            sqlite::Statement stmt( ctx.handle(), seek.cursorRequest() );
+            stmt.execute( m_params, cursor );
+            auto row = stmt.row();
+            // The cursor isn't part of this listing (anymore)
+            if ( row == nullptr )
+                return {};
+            keys.reserve( seek.nbKeys() );
+            for ( auto i = 0u; i < seek.nbKeys(); ++i )
+                keys.push_back( row.extract<sqlite::Value>() );
+        }
+        std::vector<const sqlite3_value*> args;
+        auto req = seek.pageRequest( keys, before, nbItems != 0, args );
+        Result res;
+        if ( nbItems != 0 )
+            res = Impl::template fetchAll<Intf>( m_ml, req, m_params, args, nbItems );
+        else
+            res = Impl::template fetchAll<Intf>( m_ml, req, m_params, args );
+        if ( before == true )
+            std::reverse( begin( res ), end( res ) );
+        return res;
+    }
+
 private:
     MediaLibraryPtr m_ml;
     std::tuple<typename std::decay<RequestParams>::type...> m_params;
@@ -118,6 +268,36 @@ public:
         return Base::executeFetchAll( req );
     }
 
+    virtual size_t forEach( const typename IQuery<Intf>::Callback& callback ) override
+    {
+        const std::string req = "SELECT " + m_field + " " + m_base + " " +
+                m_groupAndOrderBy;
+        return Base::executeForEach( req, callback );
+    }
+
+    virtual Result itemsAfter( int64_t cursor, uint32_t nbItems ) override
+    {
+        return Base::executeSeek( seekRequest(), cursor, nbItems, false );
+    }
+
+    virtual Result itemsBefore( int64_t cursor, uint32_t nbItems ) override
+    {
+        return Base::executeSeek( seekRequest(), cursor, nbItems, true );
+    }
+
+protected:
+    virtual std::shared_ptr<IQuery<Intf>> clone() const override
+    {
+        return std::make_shared<SqliteQuery>( *this );
+    }
+
+private:
+    sqlite::SeekRequest seekRequest() const
+    {
+        return sqlite::SeekRequest{ m_field, m_base, m_groupAndOrderBy,
+                                    Impl::Table::PrimaryKeyColumn };
+    }
+
 private:
     std::string m_field;
     std::string m_base;
@@ -162,11 +342,72 @@ public:
         return Base::executeFetchAll( m_req );
     }
 
+    virtual size_t forEach( const typename IQuery<Intf>::Callback& callback ) override
+    {
+        return Base::executeForEach( m_req, callback );
+    }
+
+    virtual Result itemsAfter( int64_t cursor, uint32_t nbItems ) override
+    {
+        return Base::executeSeek( sqlite::SeekRequest::fromRequest( m_req,
+                                    Impl::Table::PrimaryKeyColumn ),
+                                  cursor, nbItems, false );
+    }
+
+    virtual Result itemsBefore( int64_t cursor, uint32_t nbItems ) override
+    {
+        return Base::executeSeek( sqlite::SeekRequest::fromRequest( m_req,
+                                    Impl::Table::PrimaryKeyColumn ),
+                                  cursor, nbItems, true );
+    }
+
+protected:
+    virtual std::shared_ptr<IQuery<Intf>> clone() const override
+    {
+        return std::make_shared<SqliteQueryWithCount>( *this );
+    }
+
 private:
     std::string m_countReq;
     std::string m_req;
 };
 
+/**
+ * Listing whose number of items is maintained in the Counters table, so that
+ * counting doesn't require running the listing request.
+ */
+template <typename Impl, typename Intf, typename... Args>
+class SqliteCountedQuery : public SqliteQuery<Impl, Intf, Args...>
+{
+public:
+    using Base = SqliteQuery<Impl, Intf, Args...>;
+
+    template <typename... Params>
+    SqliteCountedQuery( MediaLibraryPtr ml, std::string countReq,
+                        std::string field, std::string base,
+                        std::string groupAndOrderBy, Params&&... params )
+        : Base( ml, std::move( field ), std::move( base ),
+                std::move( groupAndOrderBy ), std::forward<Params>( params )... )
+        , m_countReq( std::move( countReq ) )
+    {
+    }
+
+    virtual size_t count() override
+    {
+        // The counter doesn't depend on the listing parameters
+        return Base::executeCount( m_countReq, std::tuple<>{} );
+    }
+
+protected:
+    virtual std::shared_ptr<IQuery<Intf>> clone() const override
+    {
+        return std::make_shared<SqliteCountedQuery>( *this );
+    }
+
+private:
+    std::string m_countReq;
+};
+
 template <typename Impl, typename Intf = Impl, typename... Args>
 Query<Intf> make_query( MediaLibraryPtr ml, std::string field, std::string base,
                         std::string orderAndGroupBy, Args&&... args )
@@ -179,6 +420,20 @@ Query<Intf> make_query( MediaLibraryPtr ml, std::string field, std::string base,
     );
 }
 
+template <typename Impl, typename Intf = Impl, typename... Args>
+Query<Intf> make_counted_query( MediaLibraryPtr ml, std::string countReq,
+                                std::string field, std::string base,
+                                std::string orderAndGroupBy, Args&&... args )
+{
+    return std::unique_ptr<IQuery<Intf>>(
+        new SqliteCountedQuery<Impl, Intf, Args...>( ml, std::move( countReq ),
+                                                   std::move( field ),
+                                                   std::move( base ),
+                                                   std::move( orderAndGroupBy ),
+                                                   std::forward<Args>( args )... )
+    );
+}
+
 template <typename Impl, typename Intf = Impl, typename... Args>
 Query<Intf> make_query_with_count( MediaLibraryPtr ml, std::string countReq,
                                    std::string req, Args&&... args )
@@ -0,0 +1,265 @@
+/*****************************************************************************
+ * Media Library
+ *****************************************************************************
+ * Copyright (C) 2015-2019 Hugo Beauzée-Luyssen, Videolabs, VideoLAN
+ *
+ * Authors: Hugo Beauzée-Luyssen<hugo@beauzee.fr>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#if HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "SqliteStatistics.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace medialibrary
+{
+
+namespace sqlite
+{
+
+namespace
+{
+
+// Bounds the statement to request cache of each shard. It is simply cleared
+// when reaching this size, as it gets populated again on the next executions
+constexpr size_t MaxCachedStatements = 1024;
+
+std::atomic<uint64_t> NextStatisticsId{ 1 };
+
+struct ThreadShard
+{
+    const void* owner;
+    uint64_t id;
+    void* shard;
+};
+
+// The shards of the calling thread, one per Statistics instance
+thread_local std::vector<ThreadShard> ThreadShards;
+
+}
+
+constexpr size_t Statistics::MaxRequests;
+const std::string Statistics::OtherRequests = "<other requests>";
+
+Statistics::Statistics()
+    : m_id( NextStatisticsId.fetch_add( 1, std::memory_order_relaxed ) )
+    , m_nbRequests( 0 )
+{
+}
+
+Statistics::~Statistics() = default;
+
+void Statistics::recordExecution( sqlite3_stmt* stmt, uint64_t durationUs,
+                                  uint64_t nbRows )
+{
+    auto& shard = threadShard();
+    std::lock_guard<compat::Mutex> lock( shard.lock );
+    auto& r = request( shard, stmt );
+    r.duration.add( durationUs );
+    r.nbRows += nbRows;
+}
+
+Statistics::Shard& Statistics::threadShard()
+{
+    for ( const auto& s : ThreadShards )
+    {
+        if ( s.owner == this && s.id == m_id )
+            return *static_cast<Shard*>( s.shard );
+    }
+    // Forget about the shard of a previous instance which used the same
+    // address, as it was destroyed along with it
+    ThreadShards.erase( std::remove_if( begin( ThreadShards ), end( ThreadShards ),
+                        [this]( const ThreadShard& s ) {
+                            return s.owner == this;
+                        }), end( ThreadShards ) );
+    std::lock_guard<compat::Mutex> lock( m_lock );
+    m_shards.emplace_back( new Shard );
+    auto shard = m_shards.back().get();
+    ThreadShards.push_back( ThreadShard{ this, m_id, shard } );
+    return *shard;
+}
+
+Statistics::Request& Statistics::request( Shard& shard, sqlite3_stmt* stmt )
+{
+    auto sql = sqlite3_sql( stmt );
+    auto it = shard.statements.find( stmt );
+    if ( it != end( shard.statements ) )
+    {
+        if ( it->second == nullptr )
+            return shard.others;
+        if ( strcmp( it->second->first.c_str(), sql ) == 0 )
+            return it->second->second;
+    }
+    if ( shard.statements.size() >= MaxCachedStatements )
+        shard.statements.clear();
+    auto reqIt = shard.requests.find( sql );
+    if ( reqIt == end( shard.requests ) )
+    {
+        if ( m_nbRequests.fetch_add( 1, std::memory_order_relaxed ) >= MaxRequests )
+        {
+            m_nbRequests.fetch_sub( 1, std::memory_order_relaxed );
+            shard.statements[stmt] = nullptr;
+            return shard.others;
+        }
+        reqIt = shard.requests.emplace( sql, Request{} ).first;
+    }
+    shard.statements[stmt] = &*reqIt;
+    return reqIt->second;
+}
+
+void Statistics::recordWriteLockWait( uint64_t durationUs )
+{
+    std::lock_guard<compat::Mutex> lock( m_lock );
+    m_writeLockWait.add( durationUs );
+}
+
+void Statistics::recordBusy()
+{
+    std::lock_guard<compat::Mutex> lock( m_lock );
+    ++m_nbBusy;
+}
+
+void Statistics::recordBusyWait( uint64_t durationUs )
+{
+    std::lock_guard<compat::Mutex> lock( m_lock );
+    m_busyWait.add( durationUs );
+}
+
+void Statistics::recordBusyTimeout()
+{
+    std::lock_guard<compat::Mutex> lock( m_lock );
+    ++m_nbBusyTimeouts;
+}
+
+void Statistics::recordRetry()
+{
+    std::lock_guard<compat::Mutex> lock( m_lock );
+    ++m_nbRetries;
+}
+
+DatabaseStatistics Statistics::get() const
+{
+    DatabaseStatistics res;
+    std::lock_guard<compat::Mutex> lock( m_lock );
+    Requests requests;
+    Request others;
+    for ( const auto& s : m_shards )
+    {
+        std::lock_guard<compat::Mutex> shardLock( s->lock );
+        for ( const auto& p : s->requests )
+        {
+            auto& r = requests[p.first];
+            r.duration.merge( p.second.duration );
+            r.nbRows += p.second.nbRows;
+        }
+        others.duration.merge( s->others.duration );
+        others.nbRows += s->others.nbRows;
+    }
+    res.requests.reserve( requests.size() + 1 );
+    for ( const auto& p : requests )
+        res.requests.push_back( RequestStatistics{ p.first, p.second.duration.get(),
+                                                   p.second.nbRows } );
+    auto othersDuration = others.duration.get();
+    if ( othersDuration.count > 0 )
+        res.requests.push_back( RequestStatistics{ OtherRequests, othersDuration,
+                                                   others.nbRows } );
+    // Report the requests which took the most time overall first
+    std::sort( begin( res.requests ), end( res.requests ),
+               []( const RequestStatistics& l, const RequestStatistics& r ) {
+        return l.duration.total > r.duration.total;
+    });
+    res.writeLockWait = m_writeLockWait.get();
+    res.contention = ContentionStatistics{ m_nbBusy, m_nbBusyTimeouts,
+                                           m_nbRetries, m_busyWait.get() };
+    return res;
+}
+
+void Statistics::reset()
+{
+    std::lock_guard<compat::Mutex> lock( m_lock );
+    for ( const auto& s : m_shards )
+    {
+        std::lock_guard<compat::Mutex> shardLock( s->lock );
+        s->requests.clear();
+        s->statements.clear();
+        s->others = Request{};
+    }
+    m_nbRequests.store( 0, std::memory_order_relaxed );
+    m_writeLockWait = Histogram{};
+    m_nbBusy = 0;
+    m_nbBusyTimeouts = 0;
+    m_nbRetries = 0;
+    m_busyWait = Histogram{};
+}
+
+Statistics::Histogram::Histogram()
+    : m_count( 0 )
+    , m_total( 0 )
+    , m_max( 0 )
+{
+    m_buckets.fill( 0 );
+}
+
+void Statistics::Histogram::add( uint64_t durationUs )
+{
+    // Bucket i counts the durations in [2^(i-1), 2^i[
+    auto idx = 0u;
+    while ( idx < m_buckets.size() - 1 && ( durationUs >> idx ) != 0 )
+        ++idx;
+    ++m_buckets[idx];
+    ++m_count;
+    m_total += durationUs;
+    m_max = std::max( m_max, durationUs );
+}
+
+void Statistics::Histogram::merge( const Histogram& other )
+{
+    for ( auto i = 0u; i < m_buckets.size(); ++i )
+        m_buckets[i] += other.m_buckets[i];
+    m_count += other.m_count;
+    m_total += other.m_total;
+    m_max = std::max( m_max, other.m_max );
+}
+
+DurationStatistics Statistics::Histogram::get() const
+{
+    return DurationStatistics{ m_count, m_total, percentile( 50 ),
+                               percentile( 99 ), m_max };
+}
+
+uint64_t Statistics::Histogram::percentile( uint32_t percent ) const
+{
+    if ( m_count == 0 )
+        return 0;
+    auto rank = ( m_count * percent + 99 ) / 100;
+    uint64_t nb = 0;
+    for ( auto i = 0u; i < m_buckets.size(); ++i )
+    {
+        nb += m_buckets[i];
+        if ( nb >= rank )
+            return std::min( ( uint64_t{ 1 } << i ) - 1, m_max );
+    }
+    return m_max;
+}
+
+}
+
+}
@@ -0,0 +1,137 @@
+/*****************************************************************************
+ * Media Library
+ *****************************************************************************
+ * Copyright (C) 2015-2019 Hugo Beauzée-Luyssen, Videolabs, VideoLAN
+ *
+ * Authors: Hugo Beauzée-Luyssen<hugo@beauzee.fr>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#pragma once
+
+#include "medialibrary/IMediaLibrary.h"
+#include "compat/Mutex.h"
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <sqlite3.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace medialibrary
+{
+
+namespace sqlite
+{
+
+/**
+ * @brief The Statistics class aggregates the execution time of the requests
+ *
+ * Requests are identified by their SQL, before the parameters get bound, so
+ * that all the executions of a given request end up in the same histogram.
+ * Since executions are recorded for every statement, each thread records them
+ * in its own shard, which is only merged with the others when the statistics
+ * are fetched. The number of distinct requests is bounded, the requests seen
+ * after the bound is reached being reported together.
+ */
+class Statistics
+{
+public:
+    Statistics();
+    ~Statistics();
+    Statistics( const Statistics& ) = delete;
+    Statistics& operator=( const Statistics& ) = delete;
+
+    void recordExecution( sqlite3_stmt* stmt, uint64_t durationUs, uint64_t nbRows );
+    void recordWriteLockWait( uint64_t durationUs );
+    void recordBusy();
+    void recordBusyWait( uint64_t durationUs );
+    void recordBusyTimeout();
+    void recordRetry();
+    DatabaseStatistics get() const;
+    void reset();
+
+    static constexpr size_t MaxRequests = 512;
+    static const std::string OtherRequests;
+
+private:
+    /*
+     * Counts durations in buckets of power of 2 microseconds, which is
+     * cheap to update, and precise enough to spot the slow requests.
+     */
+    class Histogram
+    {
+    public:
+        Histogram();
+        void add( uint64_t durationUs );
+        void merge( const Histogram& other );
+        DurationStatistics get() const;
+
+    private:
+        uint64_t percentile( uint32_t percent ) const;
+
+    private:
+        std::array<uint64_t, 40> m_buckets;
+        uint64_t m_count;
+        uint64_t m_total;
+        uint64_t m_max;
+    };
+
+    struct Request
+    {
+        Histogram duration;
+        uint64_t nbRows = 0;
+    };
+
+    using Requests = std::unordered_map<std::string, Request>;
+
+    /*
+     * The executions recorded by a single thread. The lock is only contended
+     * when the statistics are fetched or reset.
+     */
+    struct Shard
+    {
+        compat::Mutex lock;
+        Requests requests;
+        // Avoids building the SQL string for each execution. The statement
+        // SQL is compared as well, as a finalized statement's address may be
+        // reused by another request.
+        std::unordered_map<sqlite3_stmt*, Requests::value_type*> statements;
+        Request others;
+    };
+
+    Shard& threadShard();
+    Request& request( Shard& shard, sqlite3_stmt* stmt );
+
+private:
+    // Identifies this instance in the threads shards cache, as another
+    // instance may later be allocated at the same address
+    const uint64_t m_id;
+    mutable compat::Mutex m_lock;
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    std::atomic<size_t> m_nbRequests;
+    Histogram m_writeLockWait;
+    uint64_t m_nbBusy = 0;
+    uint64_t m_nbBusyTimeouts = 0;
+    uint64_t m_nbRetries = 0;
+    Histogram m_busyWait;
+};
+
+}
+
+}
@@ -26,15 +26,544 @@
 
 #include "SqliteTools.h"
 
+#include <algorithm>
+
 namespace medialibrary
 {
 
 namespace sqlite
 {
-std::unordered_map<Connection::Handle,
-                    std::unordered_map<std::string, Statement::CachedStmtPtr>> Statement::StatementsCache;
 
-compat::Mutex Statement::StatementsCacheLock;
+constexpr size_t Tools::MinEntityPageSize;
+
+namespace
+{
+
+/*
+ * Holds all the statement caches used by a thread, one per connection.
+ * A thread is expected to use a single connection most of the time, so a
+ * vector is more efficient than a map here.
+ * The caches are only ever accessed by their thread, including when they get
+ * flushed: invalidating a connection only records its handle along with a new
+ * epoch, and each thread drops its caches for that handle the next time it
+ * fetches a statement. Since the connections are closed with
+ * sqlite3_close_v2, a closed handle stays allocated until its last statement
+ * gets finalized, so it can't be reused by another connection meanwhile.
+ * The registry lock is only taken when a thread starts or stops using caches,
+ * when invalidating a connection, and when catching up with an invalidation,
+ * never when fetching a statement.
+ */
+class ThreadStatementCaches
+{
+public:
+    ThreadStatementCaches()
+        : m_epoch( 0 )
+        , m_hasStaleCaches( false )
+    {
+        std::lock_guard<compat::Mutex> lock( registryLock() );
+        m_epoch = Epoch.load( std::memory_order_relaxed );
+        registry().push_back( this );
+        Current = this;
+    }
+
+    ~ThreadStatementCaches()
+    {
+        Current = nullptr;
+        {
+            std::lock_guard<compat::Mutex> lock( registryLock() );
+            auto& r = registry();
+            r.erase( std::remove( begin( r ), end( r ), this ), end( r ) );
+            pruneInvalidations();
+        }
+        m_caches.clear();
+    }
+
+    StatementCache& get( Connection::Handle dbConnection )
+    {
+        if ( m_epoch != Epoch.load( std::memory_order_acquire ) )
+            sync();
+        else if ( m_hasStaleCaches == true )
+            purge();
+        for ( const auto& c : m_caches )
+        {
+            if ( c.cache->handle() == dbConnection && c.stale == false )
+                return *c.cache;
+        }
+        m_caches.push_back( Cache{ std::unique_ptr<StatementCache>(
+                                       new StatementCache( dbConnection ) ),
+                                   m_epoch, false } );
+        return *m_caches.back().cache;
+    }
+
+    /*
+     * Drops all the caches of the calling thread
+     */
+    void flush()
+    {
+        for ( auto& c : m_caches )
+            c.stale = true;
+        purge();
+    }
+
+    /*
+     * Applies the invalidations recorded since this thread last checked
+     */
+    void sync()
+    {
+        {
+            std::lock_guard<compat::Mutex> lock( registryLock() );
+            for ( const auto& i : invalidations() )
+            {
+                if ( i.epoch <= m_epoch )
+                    continue;
+                for ( auto& c : m_caches )
+                {
+                    // A cache created after the invalidation uses a new
+                    // connection which got the same address
+                    if ( c.cache->handle() == i.handle && c.epoch < i.epoch )
+                        c.stale = true;
+                }
+            }
+            m_epoch = Epoch.load( std::memory_order_relaxed );
+            pruneInvalidations();
+        }
+        purge();
+    }
+
+    /*
+     * Invalidates the caches of all threads for the provided connection.
+     * The calling thread drops its own caches right away.
+     */
+    static void invalidate( Connection::Handle dbConnection )
+    {
+        {
+            std::lock_guard<compat::Mutex> lock( registryLock() );
+            auto epoch = Epoch.load( std::memory_order_relaxed ) + 1;
+            invalidations().push_back( Invalidation{ dbConnection, epoch } );
+            Epoch.store( epoch, std::memory_order_release );
+        }
+        // The thread local caches might already be destroyed when a thread
+        // releases its connection while exiting
+        if ( Current != nullptr )
+            Current->sync();
+    }
+
+    static ThreadStatementCaches* current()
+    {
+        return Current;
+    }
+
+private:
+    struct Cache
+    {
+        std::unique_ptr<StatementCache> cache;
+        // The invalidation epoch when this cache was created
+        uint64_t epoch;
+        bool stale;
+    };
+
+    struct Invalidation
+    {
+        Connection::Handle handle;
+        uint64_t epoch;
+    };
+
+    /*
+     * Destroys the stale caches, unless one of their statements is still
+     * being executed by this thread, in which case they'll be destroyed on
+     * the next statement fetch.
+     */
+    void purge()
+    {
+        m_caches.erase( std::remove_if( begin( m_caches ), end( m_caches ),
+                        []( const Cache& c ) {
+                            return c.stale == true && c.cache->inUse() == false;
+                        }), end( m_caches ) );
+        m_hasStaleCaches = std::any_of( begin( m_caches ), end( m_caches ),
+                                        []( const Cache& c ) {
+                                            return c.stale;
+                                        });
+    }
+
+    /*
+     * Forgets about the invalidations all threads have caught up with.
+     * Must be called with the registry lock held.
+     */
+    static void pruneInvalidations()
+    {
+        auto minEpoch = Epoch.load( std::memory_order_relaxed );
+        for ( const auto c : registry() )
+            minEpoch = std::min( minEpoch, c->m_epoch );
+        auto& inv = invalidations();
+        inv.erase( std::remove_if( begin( inv ), end( inv ),
+                   [minEpoch]( const Invalidation& i ) {
+                        return i.epoch <= minEpoch;
+                   }), end( inv ) );
+    }
+
+    static compat::Mutex& registryLock()
+    {
+        static compat::Mutex lock;
+        return lock;
+    }
+
+    static std::vector<ThreadStatementCaches*>& registry()
+    {
+        static std::vector<ThreadStatementCaches*> r;
+        return r;
+    }
+
+    static std::vector<Invalidation>& invalidations()
+    {
+        static std::vector<Invalidation> i;
+        return i;
+    }
+
+private:
+    std::vector<Cache> m_caches;
+    // The last invalidation epoch this thread caught up with. Only written by
+    // the owning thread, with the registry lock held
+    uint64_t m_epoch;
+    bool m_hasStaleCaches;
+
+    static std::atomic<uint64_t> Epoch;
+    // Unlike ThreadCaches, this is trivially destructible, so it can still be
+    // checked while the thread local objects are being destroyed
+    static thread_local ThreadStatementCaches* Current;
+};
+
+std::atomic<uint64_t> ThreadStatementCaches::Epoch{ 0 };
+thread_local ThreadStatementCaches* ThreadStatementCaches::Current = nullptr;
+
+thread_local ThreadStatementCaches ThreadCaches;
+thread_local std::vector<StatementCache*> AttachedCaches;
+
+}
+
+std::atomic<size_t> StatementCache::MaxSize{ 256 };
+constexpr uint32_t StatementCache::MaxPrepareAttempts;
+
+thread_local SchemaRecorder* SchemaRecorder::Current = nullptr;
+
+SchemaRecorder::SchemaRecorder( uint32_t modelVersion )
+    // FNV-1a
+    : m_hash( 2166136261u )
+    , m_previous( Current )
+{
+    hash( reinterpret_cast<const char*>( &modelVersion ), sizeof( modelVersion ) );
+    Current = this;
+}
+
+SchemaRecorder::~SchemaRecorder()
+{
+    Current = m_previous;
+}
+
+uint32_t SchemaRecorder::fingerprint() const
+{
+    // This is meant to be stored as the database user_version, which is a
+    // signed integer, and 0 is the user_version of a new database
+    auto res = m_hash & 0x7FFFFFFFu;
+    return res != 0 ? res : 1;
+}
+
+bool SchemaRecorder::record( const std::string& req )
+{
+    if ( Current == nullptr )
+        return false;
+    // Include the terminating character, so that the requests boundaries are
+    // part of the hash
+    Current->hash( req.c_str(), req.size() + 1 );
+    return true;
+}
+
+void SchemaRecorder::hash( const char* data, size_t size )
+{
+    for ( auto i = 0u; i < size; ++i )
+    {
+        m_hash ^= static_cast<unsigned char>( data[i] );
+        m_hash *= 16777619u;
+    }
+}
+
+std::string Tools::ftsPattern( const std::string& pattern )
+{
+    std::string res;
+    res.reserve( pattern.size() + 8 );
+    auto isSpace = []( char c ) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+    };
+    auto it = begin( pattern );
+    while ( true )
+    {
+        it = std::find_if_not( it, end( pattern ), isSpace );
+        if ( it == end( pattern ) )
+            break;
+        if ( res.empty() == false )
+            res += ' ';
+        res += '"';
+        for ( ; it != end( pattern ) && isSpace( *it ) == false; ++it )
+        {
+            // Double quotes are escaped by doubling them in a FTS5 string
+            if ( *it == '"' )
+                res += '"';
+            res += *it;
+        }
+        res += "\"*";
+    }
+    // An empty query is a FTS5 syntax error, while an empty phrase matches
+    // nothing
+    if ( res.empty() == true )
+        return "\"\"";
+    return res;
+}
+
+constexpr size_t Tools::MaxTrigrams;
+
+std::vector<std::string> Tools::trigrams( const std::string& pattern )
+{
+    // Split the pattern in UTF-8 characters. The tokenizer folds the case of
+    // all letters, but only ASCII & Latin-1 letters are handled here
+    std::vector<std::string> chars;
+    for ( auto i = 0u; i < pattern.size(); )
+    {
+        auto c = static_cast<unsigned char>( pattern[i] );
+        auto len = c < 0x80 ? 1u : ( c & 0xE0 ) == 0xC0 ? 2u :
+                   ( c & 0xF0 ) == 0xE0 ? 3u : 4u;
+        auto ch = pattern.substr( i, len );
+        i += len;
+        if ( len == 1 && c >= 'A' && c <= 'Z' )
+            ch[0] = static_cast<char>( c - 'A' + 'a' );
+        else if ( len == 2 && ch.size() == 2 )
+        {
+            auto cp = ( ( c & 0x1F ) << 6 ) | ( ch[1] & 0x3F );
+            // Latin-1 uppercase letters, except the multiplication sign
+            if ( cp >= 0xC0 && cp <= 0xDE && cp != 0xD7 )
+            {
+                cp += 0x20;
+                ch[0] = static_cast<char>( 0xC0 | ( cp >> 6 ) );
+                ch[1] = static_cast<char>( 0x80 | ( cp & 0x3F ) );
+            }
+        }
+        chars.push_back( std::move( ch ) );
+    }
+    std::vector<std::string> res;
+    for ( auto i = 0u; i + 2 < chars.size() && res.size() < MaxTrigrams; ++i )
+    {
+        auto trigram = chars[i] + chars[i + 1] + chars[i + 2];
+        if ( std::find( begin( res ), end( res ), trigram ) == end( res ) )
+            res.push_back( std::move( trigram ) );
+    }
+    return res;
+}
+
+std::string Tools::trigramRequest( const std::string& vocabTable, size_t nbTrigrams )
+{
+    std::string req = "SELECT doc AS id, COUNT(*) AS overlap FROM " + vocabTable +
+            " WHERE term IN (";
+    for ( auto i = 0u; i < nbTrigrams; ++i )
+        req += i == 0 ? "?" : ",?";
+    // The trigram tables only index a single column, and don't store the
+    // offsets, so there is exactly one instance per matching trigram
+    return req + ") GROUP BY doc HAVING COUNT(*) >= ?";
+}
+
+uint32_t Tools::minTrigramOverlap( size_t nbTrigrams )
+{
+    // A typo alters up to 3 trigrams, so only require a third of them
+    return std::max<uint32_t>( 1u, ( nbTrigrams + 2 ) / 3 );
+}
+
+std::string Tools::prependSortKey( const std::string& key, const std::string& orderBy )
+{
+    static const std::string prefix = " ORDER BY ";
+    assert( orderBy.compare( 0, prefix.size(), prefix ) == 0 );
+    return prefix + key + ", " + orderBy.substr( prefix.size() );
+}
+
+bool Tools::sortByRelevance( const QueryParameters* params )
+{
+    return params != nullptr && params->sort == SortingCriteria::Relevance;
+}
+
+std::string Tools::ftsSearchRequest( const std::string& table, const std::string& alias,
+                                     const std::string& primaryKey,
+                                     const std::string& joins, bool byRelevance )
+{
+    const auto ftsTable = table + "Fts";
+    if ( byRelevance == true )
+        return "FROM " + ftsTable + " CROSS JOIN " + table + " " + alias +
+               " ON " + alias + "." + primaryKey + " = " + ftsTable + ".rowid " +
+               joins + " WHERE " + ftsTable + " MATCH ?";
+    return "FROM " + table + " " + alias + " " + joins +
+           " WHERE " + alias + "." + primaryKey + " IN (SELECT rowid FROM " +
+           ftsTable + " WHERE " + ftsTable + " MATCH ?)";
+}
+
+std::string Tools::relevanceOrderBy( const std::string& score,
+                                     const QueryParameters* params )
+{
+    // FTS5 ranks & bm25 scores are lower for better matches
+    if ( params != nullptr && params->desc == true )
+        return " ORDER BY " + score + " DESC";
+    return " ORDER BY " + score;
+}
+
+StatementCache::StatementCache( Connection::Handle dbConnection )
+    : m_dbConn( dbConnection )
+{
+}
+
+StatementCache::~StatementCache()
+{
+    clear();
+}
+
+Connection::Handle StatementCache::handle() const
+{
+    return m_dbConn;
+}
+
+StatementCache::CachedStatement* StatementCache::acquire( const std::string& req )
+{
+    auto it = m_index.find( std::cref( req ) );
+    if ( it != end( m_index ) )
+    {
+        auto entryIt = it->second;
+        // Stepping the same statement from 2 places would reset it under the
+        // feet of its first user
+        if ( entryIt->second.nbUsers > 0 )
+            return nullptr;
+        // Move the entry to the front of the list, without invalidating any
+        // iterator
+        if ( entryIt != begin( m_entries ) )
+            m_entries.splice( begin( m_entries ), m_entries, entryIt );
+        entryIt->second.nbUsers++;
+        return &entryIt->second;
+    }
+    auto stmt = prepare( req );
+    evict();
+    m_entries.emplace_front( req, CachedStatement{ stmt, 1 } );
+    m_index.emplace( std::cref( m_entries.front().first ), begin( m_entries ) );
+    return &m_entries.front().second;
+}
+
+sqlite3_stmt* StatementCache::prepare( const std::string& req )
+{
+    sqlite3_stmt* stmt;
+    int res;
+    // Compiling a request which uses a FTS5 table connects to it, which can
+    // fail if another connection changes the schema meanwhile, for instance
+    // when analyzing the database. sqlite only retries once by itself.
+    auto nbAttempts = 0u;
+    do
+    {
+        res = sqlite3_prepare_v2( m_dbConn, req.c_str(), -1, &stmt, nullptr );
+    } while ( ( res & 0xFF ) == SQLITE_SCHEMA && ++nbAttempts < MaxPrepareAttempts );
+    if ( res != SQLITE_OK )
+        throw errors::Generic( req.c_str(), sqlite3_errmsg( m_dbConn ), res );
+    return stmt;
+}
+
+void StatementCache::release( CachedStatement* cached )
+{
+    assert( cached->nbUsers > 0 );
+    cached->nbUsers--;
+}
+
+void StatementCache::clear()
+{
+    m_index.clear();
+    for ( auto& e : m_entries )
+        sqlite3_finalize( e.second.stmt );
+    m_entries.clear();
+}
+
+size_t StatementCache::size() const
+{
+    return m_entries.size();
+}
+
+bool StatementCache::inUse() const
+{
+    return std::any_of( begin( m_entries ), end( m_entries ), []( const Entry& e ) {
+        return e.second.nbUsers > 0;
+    });
+}
+
+void StatementCache::evict()
+{
+    // Evict the least recently used statements that aren't currently running
+    // until we have room for a new one.
+    // If all statements are running, we just let the cache grow, it will get
+    // back to its bound on the next insertions.
+    auto maxSize = MaxSize.load( std::memory_order_relaxed );
+    auto it = m_entries.rbegin();
+    while ( m_entries.size() >= maxSize && it != m_entries.rend() )
+    {
+        if ( it->second.nbUsers != 0 )
+        {
+            ++it;
+            continue;
+        }
+        m_index.erase( std::cref( it->first ) );
+        sqlite3_finalize( it->second.stmt );
+        it = Entries::reverse_iterator( m_entries.erase( std::next( it ).base() ) );
+    }
+}
+
+StatementCache& StatementCache::forConnection( Connection::Handle dbConnection )
+{
+    for ( auto c : AttachedCaches )
+    {
+        if ( c->handle() == dbConnection )
+            return *c;
+    }
+    return ThreadCaches.get( dbConnection );
+}
+
+void StatementCache::attachToThread( StatementCache& cache )
+{
+    AttachedCaches.push_back( &cache );
+}
+
+void StatementCache::detachFromThread( StatementCache& cache )
+{
+    AttachedCaches.erase( std::remove( begin( AttachedCaches ), end( AttachedCaches ),
+                                       &cache ), end( AttachedCaches ) );
+}
+
+void StatementCache::setMaxSize( size_t maxSize )
+{
+    MaxSize.store( maxSize, std::memory_order_relaxed );
+}
+
+size_t StatementCache::maxSize()
+{
+    return MaxSize.load( std::memory_order_relaxed );
+}
+
+thread_local const Statement* Statement::Stepping = nullptr;
+
+uint64_t Statement::nbRows( sqlite3_stmt* stmt )
+{
+    if ( Stepping == nullptr || Stepping->m_stmt != stmt )
+        return 0;
+    return Stepping->m_nbRows;
+}
+
+void Statement::FlushStatementCache()
+{
+    auto caches = ThreadStatementCaches::current();
+    if ( caches != nullptr )
+        caches->flush();
+}
+
+void Statement::FlushConnectionStatementCache( Connection::Handle h )
+{
+    ThreadStatementCaches::invalidate( h );
+}
+
 }
 
 }
@@ -22,9 +22,13 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <chrono>
 #include <cstring>
+#include <functional>
+#include <list>
 #include <memory>
 #include <sqlite3.h>
 #include <string>
@@ -32,6 +36,7 @@
 #include <vector>
 
 #include <compat/Mutex.h>
+#include "database/EntityPage.h"
 #include "database/SqliteConnection.h"
 #include "database/SqliteErrors.h"
 #include "database/SqliteTraits.h"
@@ -129,44 +134,147 @@ private:
     unsigned int m_nbColumns;
 };
 
+/**
+ * @brief The StatementCache class holds the compiled statements for a single
+ *        connection.
+ *
+ * Since a connection is only ever used by the thread that created it, each
+ * thread owns the caches for the connections it uses, and looking up a
+ * statement doesn't require any locking.
+ * The number of cached statements is bounded, and the least recently used ones
+ * get finalized first when the bound is reached. Statements that are currently
+ * being executed are never evicted.
+ */
+class StatementCache
+{
+public:
+    struct CachedStatement
+    {
+        sqlite3_stmt* stmt;
+        unsigned int nbUsers;
+    };
+
+    explicit StatementCache( Connection::Handle dbConnection );
+    ~StatementCache();
+    StatementCache( const StatementCache& ) = delete;
+    StatementCache& operator=( const StatementCache& ) = delete;
+
+    Connection::Handle handle() const;
+    /**
+     * @brief acquire Returns a compiled statement for the given request,
+     *        compiling it if needed.
+     *
+     * The returned statement is marked as being used until release() is
+     * called with it, so that it doesn't get evicted while executing.
+     * If the cached statement is already being executed, for instance when
+     * a request is run again while iterating over its own results, nullptr
+     * is returned and the caller must use a private statement, as returned
+     * by prepare()
+     */
+    CachedStatement* acquire( const std::string& req );
+    void release( CachedStatement* cached );
+    /**
+     * @brief prepare Compiles a statement without caching it.
+     *
+     * The caller is responsible for finalizing the returned statement.
+     */
+    sqlite3_stmt* prepare( const std::string& req );
+    void clear();
+    size_t size() const;
+    /**
+     * @brief inUse Returns true if any of the cached statements is currently
+     *        being executed
+     */
+    bool inUse() const;
+
+    /**
+     * @brief forConnection Returns the calling thread's cache for the provided
+     *        connection.
+     */
+    static StatementCache& forConnection( Connection::Handle dbConnection );
+    /**
+     * @brief attachToThread Makes the calling thread use the provided cache
+     *        for its connection, instead of one of its own caches.
+     *
+     * This is meant for connections shared between threads, which own their
+     * cache, and must be detached before another thread can use them.
+     */
+    static void attachToThread( StatementCache& cache );
+    static void detachFromThread( StatementCache& cache );
+    /**
+     * @brief setMaxSize Sets the maximum number of statement cached for each
+     *        connection.
+     *
+     * This is applied the next time a statement gets inserted in a cache.
+     */
+    static void setMaxSize( size_t maxSize );
+    static size_t maxSize();
+
+private:
+    void evict();
+
+private:
+    using Entry = std::pair<const std::string, CachedStatement>;
+    using Entries = std::list<Entry>;
+    using Index = std::unordered_map<std::reference_wrapper<const std::string>,
+                                     Entries::iterator, std::hash<std::string>,
+                                     std::equal_to<std::string>>;
+    Connection::Handle m_dbConn;
+    // Most recently used statements first
+    Entries m_entries;
+    Index m_index;
+
+    static std::atomic<size_t> MaxSize;
+    static constexpr uint32_t MaxPrepareAttempts = 5;
+};
+
 class Statement
 {
 public:
     Statement( Connection::Handle dbConnection, const std::string& req )
-        : m_stmt( nullptr, [](sqlite3_stmt* stmt) {
-                sqlite3_clear_bindings( stmt );
-                sqlite3_reset( stmt );
-            })
+        : m_cache( StatementCache::forConnection( dbConnection ) )
+        , m_cached( m_cache.acquire( req ) )
+        , m_stmt( m_cached != nullptr ? m_cached->stmt : m_cache.prepare( req ) )
         , m_dbConn( dbConnection )
         , m_bindIdx( 0 )
         , m_isCommit( false )
+        , m_nbRows( 0 )
     {
-        std::lock_guard<compat::Mutex> lock( StatementsCacheLock );
-        auto& connMap = StatementsCache[ dbConnection ];
-        auto it = connMap.find( req );
-        if ( it == end( connMap ) )
-        {
-            sqlite3_stmt* stmt;
-            int res = sqlite3_prepare_v2( dbConnection, req.c_str(), -1, &stmt, nullptr );
-            if ( res != SQLITE_OK )
-            {
-                throw errors::Generic( req.c_str(), sqlite3_errmsg( dbConnection ), res );
-            }
-            m_stmt.reset( stmt );
-            connMap.emplace( req, CachedStmtPtr( stmt, &sqlite3_finalize ) );
-        }
-        else
-        {
-            m_stmt.reset( it->second.get() );
-        }
         if ( req == "COMMIT" )
             m_isCommit = true;
     }
 
+    ~Statement()
+    {
+        Stepping = this;
+        if ( m_cached == nullptr )
+        {
+            sqlite3_finalize( m_stmt );
+            Stepping = nullptr;
+            return;
+        }
+        // Reset before clearing the bindings, as the statement completion
+        // gets reported when resetting it, with its parameters.
+        sqlite3_reset( m_stmt );
+        Stepping = nullptr;
+        sqlite3_clear_bindings( m_stmt );
+        m_cache.release( m_cached );
+    }
+
+    Statement( const Statement& ) = delete;
+    Statement& operator=( const Statement& ) = delete;
+
     template <typename... Args>
     void execute(Args&&... args)
     {
+        // Allow the same statement to be executed multiple times
+        if ( m_bindIdx != 0 )
+        {
+            Stepping = this;
+            sqlite3_reset( m_stmt );
+        }
         m_bindIdx = 1;
+        m_nbRows = 0;
         (void)std::initializer_list<bool>{ _bind( std::forward<Args>( args ) )... };
     }
 
@@ -175,17 +283,39 @@ public:
         auto maxRetries = 10;
         while ( true )
         {
-            auto extRes = sqlite3_step( m_stmt.get() );
+            Stepping = this;
+            auto extRes = sqlite3_step( m_stmt );
             auto res = extRes & 0xFF;
             if ( res == SQLITE_ROW )
-                return Row( m_stmt.get() );
+            {
+                ++m_nbRows;
+                return Row( m_stmt );
+            }
             else if ( res == SQLITE_DONE )
                 return Row();
+            else if ( extRes == SQLITE_BUSY_SNAPSHOT &&
+                      Transaction::transactionInProgress() == false &&
+                      maxRetries-- > 0 )
+            {
+                // Our read snapshot got outdated by another connection
+                // committing to the WAL before we could upgrade to a write.
+                // Resetting the statement ends the implicit transaction, so
+                // the next step will start over from the latest snapshot.
+                // If we are in an explicit transaction, we can't retry a single
+                // statement, and the entire transaction must be retried
+                sqlite3_reset( m_stmt );
+                m_nbRows = 0;
+                continue;
+            }
+            // SQLITE_BUSY was already retried by the busy handler until the
+            // busy timeout expired, or can't be retried without restarting
+            // the transaction
             else if ( ( Transaction::transactionInProgress() == false || m_isCommit == true ) &&
-                     errors::isInnocuous( res ) && maxRetries-- > 0 )
+                     res != SQLITE_BUSY && errors::isInnocuous( res ) &&
+                     maxRetries-- > 0 )
                 continue;
             auto errMsg = sqlite3_errmsg( m_dbConn );
-            const char* reqStr = sqlite3_sql( m_stmt.get() );
+            const char* reqStr = sqlite3_sql( m_stmt );
             if ( reqStr == nullptr )
                 reqStr = "<unknown request>";
             switch ( res )
@@ -198,48 +328,103 @@ public:
         }
     }
 
-    static void FlushStatementCache()
-    {
-        std::lock_guard<compat::Mutex> lock( StatementsCacheLock );
-        StatementsCache.clear();
-    }
+    /**
+     * @brief nbRows Returns the number of rows a statement returned so far
+     *
+     * This is meant for the trace callback, which gets invoked when the
+     * statement completes, and only knows about statements being stepped,
+     * reset or finalized by the calling thread through a Statement instance.
+     * Counting the rows here is cheaper than having SQLite invoke a callback
+     * for each of them.
+     */
+    static uint64_t nbRows( sqlite3_stmt* stmt );
 
-    static void FlushConnectionStatementCache( Connection::Handle h )
-    {
-        std::lock_guard<compat::Mutex> lock( StatementsCacheLock );
-        auto it = StatementsCache.find( h );
-        if ( it != end( StatementsCache ) )
-            StatementsCache.erase( it );
-    }
+    /**
+     * @brief FlushStatementCache Finalizes all the statements cached by the
+     *        calling thread
+     */
+    static void FlushStatementCache();
+    /**
+     * @brief FlushConnectionStatementCache Invalidates the statements cached
+     *        by all threads for the provided connection.
+     *
+     * The calling thread finalizes its statements right away, while the other
+     * threads do so the next time they fetch a statement, as they might be
+     * executing some of them.
+     * The connection must be closed with sqlite3_close_v2, which defers its
+     * release until all its statements are finalized.
+     */
+    static void FlushConnectionStatementCache( Connection::Handle h );
 
 private:
     template <typename T>
     bool _bind( T&& value )
     {
-        auto res = Traits<T>::Bind( m_stmt.get(), m_bindIdx, std::forward<T>( value ) );
+        auto res = Traits<T>::Bind( m_stmt, m_bindIdx, std::forward<T>( value ) );
         if ( res != SQLITE_OK )
-            throw errors::Generic( sqlite3_sql( m_stmt.get() ), "Failed to bind parameter", res );
+            throw errors::Generic( sqlite3_sql( m_stmt ), "Failed to bind parameter", res );
         m_bindIdx++;
         return true;
     }
 
 private:
-    // Used during the connection lifetime. This holds a compiled request
-    using CachedStmtPtr = std::unique_ptr<sqlite3_stmt, int (*)(sqlite3_stmt*)>;
-    // Used for the current statement execution, this
-    // basically holds the state of the currently executed request.
-    using StatementPtr = std::unique_ptr<sqlite3_stmt, void(*)(sqlite3_stmt*)>;
-    StatementPtr m_stmt;
+    // The cache & compiled request are owned by the calling thread, and
+    // outlive this statement.
+    StatementCache& m_cache;
+    // nullptr if m_stmt is a private statement, owned by this instance
+    StatementCache::CachedStatement* m_cached;
+    sqlite3_stmt* m_stmt;
     Connection::Handle m_dbConn;
     int m_bindIdx;
     bool m_isCommit;
-    static compat::Mutex StatementsCacheLock;
-    static std::unordered_map<Connection::Handle,
-                            std::unordered_map<std::string, CachedStmtPtr>> StatementsCache;
+    uint64_t m_nbRows;
+
+    // The statement which is being stepped, reset or finalized by the
+    // calling thread
+    static thread_local const Statement* Stepping;
+};
+
+/**
+ * While an instance is alive, the requests run through Tools::executeRequest,
+ * executeUpdate, executeDelete & executeInsert on the calling thread are hashed
+ * instead of being executed.
+ * This allows the schema creation code to be fingerprinted without preparing
+ * any of its requests.
+ */
+class SchemaRecorder
+{
+public:
+    explicit SchemaRecorder( uint32_t modelVersion );
+    ~SchemaRecorder();
+    SchemaRecorder( const SchemaRecorder& ) = delete;
+    SchemaRecorder& operator=( const SchemaRecorder& ) = delete;
+
+    /**
+     * @brief fingerprint Returns a non zero hash of the model version and all
+     *        the recorded requests, which fits in a positive 32 bits integer
+     */
+    uint32_t fingerprint() const;
+
+    /**
+     * @brief record Records the request if a recorder is active on this thread
+     * @return true if the request was recorded, and must not be executed.
+     */
+    static bool record( const std::string& req );
+
+private:
+    void hash( const char* data, size_t size );
+
+private:
+    uint32_t m_hash;
+    SchemaRecorder* m_previous;
+    static thread_local SchemaRecorder* Current;
 };
 
 class Tools
 {
+    private:
+        static constexpr size_t MinEntityPageSize = 4;
+
     public:
         /**
          * Will fetch all records of type IMPL and return them as a shared_ptr to INTF
@@ -252,19 +437,32 @@ class Tools
         static std::vector<std::shared_ptr<INTF> > fetchAll( MediaLibraryPtr ml, const std::string& req, Args&&... args )
         {
             auto dbConnection = ml->getConn();
-            Connection::ReadContext ctx;
-            if (Transaction::transactionInProgress() == false)
-                ctx = dbConnection->acquireReadContext();
             auto chrono = std::chrono::steady_clock::now();
 
             std::vector<std::shared_ptr<INTF>> results;
-            Statement stmt( dbConnection->handle(), req );
+            auto pageSize = EntityPage<IMPL>::IsPageable == true ?
+                        dbConnection->tuning().entityPageSize : 0u;
+            std::shared_ptr<EntityPage<IMPL>> page;
+            auto ctx = dbConnection->acquireReadContext();
+            Statement stmt( ctx.handle(), req );
             stmt.execute( std::forward<Args>( args )... );
             Row sqliteRow;
             while ( ( sqliteRow = stmt.row() ) != nullptr )
             {
-                auto row = std::make_shared<IMPL>( ml, sqliteRow );
-                results.push_back( row );
+                if ( pageSize == 0 )
+                {
+                    results.push_back( std::make_shared<IMPL>( ml, sqliteRow ) );
+                    continue;
+                }
+                if ( page == nullptr || page->full() == true )
+                {
+                    // Grow the pages along with the results, so that small
+                    // listings don't allocate a whole page
+                    auto capacity = std::max<size_t>( results.size(), MinEntityPageSize );
+                    page = std::make_shared<EntityPage<IMPL>>(
+                                std::min<size_t>( capacity, pageSize ) );
+                }
+                results.emplace_back( page, page->emplace( ml, sqliteRow ) );
             }
             auto duration = std::chrono::steady_clock::now() - chrono;
             LOG_DEBUG("Executed ", req, " in ",
@@ -272,16 +470,46 @@ class Tools
             return results;
         }
 
+        /**
+         * Will call the provided callback for each record of type IMPL, as a
+         * shared_ptr to INTF, as soon as it gets fetched.
+         * The iteration stops when the callback returns false.
+         *
+         * @return The number of records passed to the callback
+         */
+        template <typename IMPL, typename INTF, typename... Args>
+        static size_t forEach( MediaLibraryPtr ml, const std::string& req,
+                               const std::function<bool(std::shared_ptr<INTF>)>& callback,
+                               Args&&... args )
+        {
+            auto dbConnection = ml->getConn();
+            auto chrono = std::chrono::steady_clock::now();
+
+            size_t nbRecords = 0;
+            auto ctx = dbConnection->acquireReadContext();
+            Statement stmt( ctx.handle(), req );
+            stmt.execute( std::forward<Args>( args )... );
+            Row sqliteRow;
+            while ( ( sqliteRow = stmt.row() ) != nullptr )
+            {
+                ++nbRecords;
+                if ( callback( std::make_shared<IMPL>( ml, sqliteRow ) ) == false )
+                    break;
+            }
+            auto duration = std::chrono::steady_clock::now() - chrono;
+            LOG_DEBUG("Iterated over ", req, " in ",
+                     std::chrono::duration_cast<std::chrono::microseconds>( duration ).count(), "µs" );
+            return nbRecords;
+        }
+
         template <typename T, typename... Args>
         static std::shared_ptr<T> fetchOne( MediaLibraryPtr ml, const std::string& req, Args&&... args )
         {
             auto dbConnection = ml->getConn();
-            Connection::ReadContext ctx;
-            if (Transaction::transactionInProgress() == false)
-                ctx = dbConnection->acquireReadContext();
             auto chrono = std::chrono::steady_clock::now();
 
-            Statement stmt( dbConnection->handle(), req );
+            auto ctx = dbConnection->acquireReadContext();
+            Statement stmt( ctx.handle(), req );
             stmt.execute( std::forward<Args>( args )... );
             auto row = stmt.row();
             std::shared_ptr<T> res;
@@ -296,6 +524,8 @@ class Tools
         template <typename... Args>
         static void executeRequest( sqlite::Connection* dbConnection, const std::string& req, Args&&... args )
         {
+            if ( SchemaRecorder::record( req ) == true )
+                return;
             Connection::WriteContext ctx;
             if (Transaction::transactionInProgress() == false)
                 ctx = dbConnection->acquireWriteContext();
@@ -305,6 +535,8 @@ class Tools
         template <typename... Args>
         static bool executeDelete( sqlite::Connection* dbConnection, const std::string& req, Args&&... args )
         {
+            if ( SchemaRecorder::record( req ) == true )
+                return true;
             Connection::WriteContext ctx;
             if (Transaction::transactionInProgress() == false)
                 ctx = dbConnection->acquireWriteContext();
@@ -319,6 +551,43 @@ class Tools
             return executeDelete( dbConnection, req, std::forward<Args>( args )... );
         }
 
+        /**
+         * Defers a write request when the connection coalesces small writes.
+         * This is meant for requests which don't return anything the caller
+         * depends upon, the in-memory state being updated beforehand.
+         *
+         * @param onCommitted An optional callback invoked once the request
+         *                    is committed, for instance to notify about the
+         *                    modification.
+         * @return false if the request couldn't be deferred, in which case the
+         *         caller must execute it itself.
+         */
+        template <typename... Args>
+        static bool deferWrite( sqlite::Connection* dbConnection,
+                                std::function<void()> onCommitted,
+                                const std::string& req, Args&&... args )
+        {
+            auto params = std::make_tuple( std::forward<Args>( args )... );
+            return dbConnection->deferWrite( [dbConnection, req, params]() {
+                executeRequestLocked( dbConnection, req, params );
+            }, std::move( onCommitted ) );
+        }
+
+        /**
+         * Executes a write request, or defers it when the connection coalesces
+         * small writes, see deferWrite().
+         *
+         * @return false if the request was executed right away and didn't
+         *         change any record. A deferred request is assumed to succeed.
+         */
+        template <typename... Args>
+        static bool executeDeferrableWrite( sqlite::Connection* dbConnection, const std::string& req, Args&&... args )
+        {
+            if ( deferWrite( dbConnection, nullptr, req, args... ) == true )
+                return true;
+            return executeUpdate( dbConnection, req, std::forward<Args>( args )... );
+        }
+
         /**
          * Inserts a record to the DB and return the newly created primary key.
          * Returns 0 (which is an invalid sqlite primary key) when insertion fails.
@@ -326,6 +595,8 @@ class Tools
         template <typename... Args>
         static int64_t executeInsert( sqlite::Connection* dbConnection, const std::string& req, Args&&... args )
         {
+            if ( SchemaRecorder::record( req ) == true )
+                return 0;
             Connection::WriteContext ctx;
             if (Transaction::transactionInProgress() == false)
                 ctx = dbConnection->acquireWriteContext();
@@ -333,14 +604,57 @@ class Tools
             return sqlite3_last_insert_rowid( dbConnection->handle() );
         }
 
+        /**
+         * Inserts multiple records using a single compiled request, and returns
+         * the newly created primary keys, in the same order as the records.
+         * The primary key is 0 for records that weren't inserted, for instance
+         * when using INSERT OR IGNORE.
+         * If no transaction is in progress, all records are inserted as part
+         * of a single transaction.
+         */
+        template <typename... Args>
+        static std::vector<int64_t> executeBatchInsert( sqlite::Connection* dbConnection,
+                                                        const std::string& req,
+                                                        const std::vector<std::tuple<Args...>>& records )
+        {
+            std::vector<int64_t> res;
+            if ( records.empty() == true )
+                return res;
+            std::unique_ptr<sqlite::Transaction> t;
+            if ( Transaction::transactionInProgress() == false )
+                t = dbConnection->newTransaction();
+            auto chrono = std::chrono::steady_clock::now();
+
+            res.reserve( records.size() );
+            auto handle = dbConnection->handle();
+            Statement stmt( handle, req );
+            for ( const auto& r : records )
+            {
+                stmt.execute( r );
+                while ( stmt.row() != nullptr )
+                    ;
+                res.push_back( sqlite3_changes( handle ) > 0 ?
+                                   sqlite3_last_insert_rowid( handle ) : 0 );
+            }
+            if ( t != nullptr )
+                t->commit();
+            auto duration = std::chrono::steady_clock::now() - chrono;
+            LOG_DEBUG("Executed ", req, " for ", records.size(), " records in ",
+                     std::chrono::duration_cast<std::chrono::microseconds>( duration ).count(), "µs" );
+            return res;
+        }
+
         /**
          * \brief   Automatically retry a code block when innocuous sqlite errors occur.
          *
          * We can't retry individual requests as sqlite might implicitely rollback the current transaction
          * causing previously sucessfuly inserted entities to be removed from the database.
+         * The attempts are spaced out in order to let the other connections
+         * release their locks.
          */
         template <typename T, typename... Args>
-        static auto withRetries( uint8_t nbRetries, T&& f, Args&&... args ) -> decltype( f( args... ) )
+        static auto withRetries( sqlite::Connection* dbConnection, uint8_t nbRetries,
+                                 T&& f, Args&&... args ) -> decltype( f( args... ) )
         {
             uint8_t i = 0;
             while ( true )
@@ -356,10 +670,74 @@ class Tools
                     ++i;
                     LOG_WARN( ex.what(), ". Retrying (", static_cast<uint32_t>( i ),
                               '/',  static_cast<uint32_t>( nbRetries ), ')' );
+                    dbConnection->statistics().recordRetry();
+                    compat::this_thread::sleep_for( Connection::backoffDelay( i ) );
                 }
             }
         }
 
+        /**
+         * Converts a user provided search pattern to a FTS5 query, matching
+         * the records containing a word starting with each of the pattern
+         * words. The words are quoted, so that the FTS5 operators & special
+         * characters they may contain are matched as plain text.
+         */
+        static std::string ftsPattern( const std::string& pattern );
+
+        /**
+         * Returns the distinct trigrams of a user provided search pattern, as
+         * the FTS5 trigram tokenizer would index them. At most MaxTrigrams
+         * are returned.
+         */
+        static std::vector<std::string> trigrams( const std::string& pattern );
+        /**
+         * Returns a request listing the documents of a FTS5 trigram table
+         * sharing enough trigrams with a pattern, as 'id', along with the
+         * number of shared trigrams, as 'overlap'.
+         * The request expects the trigrams to be bound, followed by the
+         * minimum overlap, as returned by minTrigramOverlap()
+         * @param vocabTable A fts5vocab table of type 'instance'
+         */
+        static std::string trigramRequest( const std::string& vocabTable,
+                                           size_t nbTrigrams );
+        static uint32_t minTrigramOverlap( size_t nbTrigrams );
+        /**
+         * Inserts a sorting key before the ones of an ORDER BY clause
+         */
+        static std::string prependSortKey( const std::string& key,
+                                           const std::string& orderBy );
+
+        /**
+         * Returns true when the results of a search are to be ordered by
+         * their relevance, as computed by FTS5
+         */
+        static bool sortByRelevance( const QueryParameters* params );
+        /**
+         * Returns the FROM & WHERE clauses of a request listing the rows of
+         * a table matching a FTS5 pattern, which must be bound first.
+         * When sorting by relevance, the request starts from the FTS table,
+         * which returns the matches ordered by their rank without sorting
+         * them, so that a LIMIT stops the request after the first rows.
+         * Otherwise, the matches only filter the table, so that its indexes
+         * can still provide the requested order.
+         * @param alias The table alias used by the joins & the conditions
+         * @param joins Some joins inserted before the WHERE clause
+         */
+        static std::string ftsSearchRequest( const std::string& table,
+                                             const std::string& alias,
+                                             const std::string& primaryKey,
+                                             const std::string& joins,
+                                             bool byRelevance );
+        /**
+         * Returns an ORDER BY clause listing the best matches first, or last
+         * for a descending order
+         * @param score A FTS5 rank, or a bm25() score
+         */
+        static std::string relevanceOrderBy( const std::string& score,
+                                             const QueryParameters* params );
+
+        static constexpr size_t MaxTrigrams = 32;
+
     private:
         template <typename... Args>
         static void executeRequestLocked( sqlite::Connection* dbConnection, const std::string& req, Args&&... args )
@@ -25,7 +25,9 @@
 #include <sqlite3.h>
 #include <tuple>
 #include <atomic>
+#include <memory>
 #include <utility>
+#include <vector>
 
 namespace medialibrary
 {
@@ -250,6 +252,68 @@ struct Traits<T, typename std::enable_if<
 static_assert( is_instanciation_of<std::atomic_uint, std::atomic>::value == true,
                "std::atomic_uint should be an instanciation of std::atomic" );
 
+/**
+ * @brief Value holds a copy of a column value, whatever its storage class is.
+ *
+ * This is meant for values that are only fetched to be bound to another
+ * request, without knowing their type beforehand.
+ */
+using Value = std::unique_ptr<sqlite3_value, void(*)(sqlite3_value*)>;
+
+template <typename T>
+struct Traits<T, typename std::enable_if<IsSameDecay<T, Value>::value>::type>
+{
+    static int Bind( sqlite3_stmt* stmt, int pos, const Value& value )
+    {
+        return sqlite3_bind_value( stmt, pos, value.get() );
+    }
+
+    static Value Load( sqlite3_stmt* stmt, int pos )
+    {
+        return Value{ sqlite3_value_dup( sqlite3_column_value( stmt, pos ) ),
+                      &sqlite3_value_free };
+    }
+};
+
+template <typename T>
+struct Traits<T, typename std::enable_if<
+        IsSameDecay<T, const sqlite3_value*>::value ||
+        IsSameDecay<T, sqlite3_value*>::value>::type>
+{
+    static int Bind( sqlite3_stmt* stmt, int pos, const sqlite3_value* value )
+    {
+        return sqlite3_bind_value( stmt, pos, value );
+    }
+};
+
+/*
+ * Binds each element of a vector to a consecutive parameter, for requests
+ * which have a number of parameters only known at runtime.
+ */
+template <typename T>
+struct Traits<T, typename std::enable_if<
+        is_instanciation_of<typename std::decay<T>::type, std::vector>::value>::type
+    >
+{
+    using value_type = typename std::decay<T>::type::value_type;
+
+    static int Bind( sqlite3_stmt* stmt, int& pos, const T& values )
+    {
+        for ( const auto& v : values )
+        {
+            auto res = Traits<value_type>::Bind( stmt, pos, v );
+            if ( res != SQLITE_OK )
+                return res;
+            ++pos;
+        }
+        // Decrement the position since the original SqliteTools::_bind call will
+        // increment the position for each parameter.
+        assert(pos >= 1);
+        --pos;
+        return SQLITE_OK;
+    }
+};
+
 } // namespace sqlite
 
 }
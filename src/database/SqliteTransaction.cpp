@@ -38,31 +38,63 @@ thread_local Transaction* Transaction::CurrentTransaction = nullptr;
 
 Transaction::Transaction( sqlite::Connection* dbConn)
     : m_dbConn( dbConn )
-    , m_ctx( dbConn->acquireWriteContext() )
+    , m_ctx( CurrentTransaction == nullptr ? dbConn->acquireWriteContext() :
+                                             Connection::WriteContext{} )
+    , m_parent( CurrentTransaction )
+    , m_depth( CurrentTransaction == nullptr ? 0 : CurrentTransaction->m_depth + 1 )
 {
-    assert( CurrentTransaction == nullptr );
-    LOG_DEBUG( "Starting SQLite transaction" );
-    Statement s( dbConn->handle(), "BEGIN" );
-    s.execute();
-    while ( s.row() != nullptr )
-        ;
+    if ( m_parent == nullptr )
+    {
+        LOG_DEBUG( "Starting SQLite transaction" );
+        execute( "BEGIN" );
+    }
+    else
+    {
+        // The enclosing transaction already holds the write context, which
+        // is bound to its connection
+        assert( m_parent->m_dbConn == dbConn );
+        // A savepoint would otherwise start a new transaction, which would
+        // be committed when released
+        if ( sqlite3_get_autocommit( dbConn->handle() ) != 0 )
+            throw errors::TransactionRolledBack();
+        LOG_DEBUG( "Starting nested SQLite transaction #", m_depth );
+        execute( "SAVEPOINT sp" + std::to_string( m_depth ) );
+        m_deletionsMark = dbConn->deletionsMark();
+    }
     CurrentTransaction = this;
 }
 
 void Transaction::commit()
 {
-    assert( CurrentTransaction != nullptr );
+    assert( CurrentTransaction == this );
+    if ( m_parent != nullptr )
+    {
+        if ( sqlite3_get_autocommit( m_dbConn->handle() ) != 0 )
+            throw errors::TransactionRolledBack();
+        execute( "RELEASE sp" + std::to_string( m_depth ) );
+        // Our changes are now part of the enclosing transaction, and will be
+        // reverted if it gets rolled back
+        for ( auto& f : m_failureHandlers )
+            m_parent->m_failureHandlers.emplace_back( std::move( f ) );
+        for ( auto& f : m_successHandlers )
+            m_parent->m_successHandlers.emplace_back( std::move( f ) );
+        m_failureHandlers.clear();
+        m_successHandlers.clear();
+        CurrentTransaction = m_parent;
+        return;
+    }
     auto chrono = std::chrono::steady_clock::now();
-    Statement s( m_dbConn->handle(), "COMMIT" );
-    s.execute();
-    while ( s.row() != nullptr )
-        ;
+    execute( "COMMIT" );
     auto duration = std::chrono::steady_clock::now() - chrono;
     LOG_DEBUG( "Flushed transaction in ",
              std::chrono::duration_cast<std::chrono::microseconds>( duration ).count(), "µs" );
     m_failureHandlers.clear();
     CurrentTransaction = nullptr;
     m_ctx.unlock();
+    auto successHandlers = std::move( m_successHandlers );
+    m_successHandlers.clear();
+    for ( const auto& f : successHandlers )
+        f();
 }
 
 bool Transaction::transactionInProgress()
@@ -76,32 +108,58 @@ void Transaction::onCurrentTransactionFailure( std::function<void ()> f )
     CurrentTransaction->m_failureHandlers.emplace_back( std::move( f ) );
 }
 
+void Transaction::onCurrentTransactionSuccess( std::function<void ()> f )
+{
+    assert( transactionInProgress() == true );
+    CurrentTransaction->m_successHandlers.emplace_back( std::move( f ) );
+}
+
+void Transaction::execute( const std::string& req )
+{
+    Statement s( m_dbConn->handle(), req );
+    s.execute();
+    while ( s.row() != nullptr )
+        ;
+}
+
+void Transaction::rollback()
+{
+    if ( m_parent == nullptr )
+    {
+        execute( "ROLLBACK" );
+        return;
+    }
+    // Rolling back to a savepoint leaves it on the transaction stack
+    auto savepoint = "sp" + std::to_string( m_depth );
+    execute( "ROLLBACK TO " + savepoint );
+    execute( "RELEASE " + savepoint );
+    // SQLite doesn't invoke the rollback hook for a savepoint
+    m_dbConn->rollbackDeletions( m_deletionsMark );
+}
+
 Transaction::~Transaction()
 {
+    // Nothing to do if we were committed
+    if ( CurrentTransaction != this )
+        return;
     try
     {
-        if ( CurrentTransaction != nullptr )
-        {
-            Statement s( m_dbConn->handle(), "ROLLBACK" );
-            s.execute();
-            while ( s.row() != nullptr )
-                ;
-            for ( const auto& f : m_failureHandlers )
-                f();
-            CurrentTransaction = nullptr;
-        }
+        rollback();
     }
     // Ignore a rollback failure as it is most likely innocuous (see
     // http://www.sqlite.org/lang_transaction.html
+    // If a nested transaction fails to rollback because SQLite already rolled
+    // back the entire transaction, the enclosing transaction will fail to
+    // commit and will invoke its own failure handlers.
     catch( const std::exception& ex )
     {
-        // Ensure we don't assume a transaction is still running
-        for ( const auto& f : m_failureHandlers )
-            f();
-        CurrentTransaction = nullptr;
         LOG_WARN( "Failed to rollback transaction: ", ex.what() );
         // Don't call std::terminate if ROLLBACK throws an exception
     }
+    for ( const auto& f : m_failureHandlers )
+        f();
+    // Ensure we don't assume a transaction is still running
+    CurrentTransaction = m_parent;
 }
 
 }
@@ -26,6 +26,7 @@
 #include "Types.h"
 
 #include <functional>
+#include <string>
 #include <vector>
 
 namespace medialibrary
@@ -34,6 +35,20 @@ namespace medialibrary
 namespace sqlite
 {
 
+/**
+ * @brief The Transaction class wraps an SQLite transaction
+ *
+ * When a transaction is already in progress on the current thread, the new
+ * instance is nested in it by the mean of a SAVEPOINT: committing it merges its
+ * changes in the enclosing transaction, and destroying it without committing
+ * only rolls back the changes made since it was created.
+ * Only the outermost transaction holds the write context, and only its commit
+ * makes the changes persistent.
+ * If SQLite implicitely rolled back the enclosing transaction, for instance
+ * after an I/O error, creating or committing a nested transaction throws
+ * errors::TransactionRolledBack, so that the caller can restart from the
+ * outermost transaction.
+ */
 class Transaction
 {
 public:
@@ -45,14 +60,36 @@ public:
     void commit();
 
     static bool transactionInProgress();
+    /**
+     * @brief onCurrentTransactionFailure Registers a callback to be invoked if
+     *        the changes made by the current transaction are rolled back.
+     *
+     * When registered from a nested transaction, the callback is also invoked
+     * if an enclosing transaction gets rolled back after the nested one was
+     * committed.
+     */
     static void onCurrentTransactionFailure( std::function<void()> f );
+    /**
+     * @brief onCurrentTransactionSuccess Registers a callback to be invoked
+     *        once the outermost transaction has been committed, and the write
+     *        context released.
+     */
+    static void onCurrentTransactionSuccess( std::function<void()> f );
     ~Transaction();
 
+private:
+    void execute( const std::string& req );
+    void rollback();
+
 private:
     sqlite::Connection* m_dbConn;
     Connection::WriteContext m_ctx;
+    Transaction* m_parent;
+    uint32_t m_depth;
+    // The deletions recorded when the savepoint was created
+    std::vector<size_t> m_deletionsMark;
     std::vector<std::function<void()>> m_failureHandlers;
-
+    std::vector<std::function<void()>> m_successHandlers;
 
     static thread_local Transaction* CurrentTransaction;
 };
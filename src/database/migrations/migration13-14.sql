@@ -1,73 +1,14 @@
 /******************* Migrate Media table **************************************/
-"CREATE TEMPORARY TABLE " + Media::Table::Name + "_backup("
-    "id_media INTEGER PRIMARY KEY AUTOINCREMENT,"
-    "type INTEGER,"
-    "subtype INTEGER,"
-    "duration INTEGER DEFAULT -1,"
-    "play_count UNSIGNED INTEGER,"
-    "last_played_date UNSIGNED INTEGER,"
-    "insertion_date UNSIGNED INTEGER,"
-    "release_date UNSIGNED INTEGER,"
-    "thumbnail TEXT,"
-    "title TEXT COLLATE NOCASE,"
-    "filename TEXT,"
-    "is_favorite BOOLEAN NOT NULL DEFAULT 0,"
-    "is_present BOOLEAN NOT NULL DEFAULT 1"
-")",
-
-"INSERT INTO " + Media::Table::Name + "_backup SELECT * FROM " + Media::Table::Name,
-
-"INSERT INTO " + Thumbnail::Table::Name + "(id_thumbnail, mrl, origin, is_generated) "
-    "SELECT id_media, thumbnail, " +
-    std::to_string( static_cast<ThumbnailType>( Thumbnail::Origin::UserProvided ) ) + ", 1"
-    " FROM " + Media::Table::Name + " WHERE thumbnail IS NOT NULL AND thumbnail != ''",
-
-"DROP TABLE " + Media::Table::Name,
+/*
+ * The Media, Folder & File tables are renamed to regular staging tables, which
+ * are copied to their new version by chunks, and dropped once copied.
+ * Their indexes & triggers are kept by the staging tables, so the new ones can
+ * only be created once those are dropped.
+ */
+"ALTER TABLE " + Media::Table::Name + " RENAME TO " + Media::Table::Name + "_backup",
 
 #include "database/tables/Media_v14.sql"
 
-"INSERT INTO " + Media::Table::Name + "("
-    "id_media, type, subtype, duration, play_count, last_played_date, real_last_played_date, insertion_date,"
-    "release_date, thumbnail_id, title, filename, is_favorite,"
-    "is_present) "
-"SELECT id_media, type, ifnull(subtype, " +
-        std::to_string( static_cast<typename std::underlying_type<IMedia::SubType>::type>(
-                    IMedia::SubType::Unknown ) )
-    + "), duration, play_count, last_played_date,"
-    "strftime('%s', 'now'),"
-    "insertion_date, release_date, "
-    "CASE thumbnail WHEN NULL THEN 0 WHEN '' THEN 0 ELSE id_media END,"
-    "title, filename, is_favorite, is_present FROM " + Media::Table::Name + "_backup",
-
-"DROP TABLE " + Media::Table::Name + "_backup",
-
-/******************* Populate new media.nb_playlists **************************/
-
-"UPDATE " + Media::Table::Name + " SET nb_playlists = "
-"(SELECT COUNT(media_id) FROM PlaylistMediaRelation WHERE media_id = id_media )"
-"WHERE id_media IN (SELECT media_id FROM PlaylistMediaRelation)",
-
-/*************** Populate new media.device_id & folder_id *********************/
-
-"UPDATE " + Media::Table::Name + " SET (device_id, folder_id) = "
-"(SELECT d.id_device, f.id_folder FROM " + Device::Table::Name + " d "
-"INNER JOIN " + Folder::Table::Name + " f ON d.id_device = f.device_id "
-"INNER JOIN " + File::Table::Name + " fi ON fi.folder_id = f.id_folder "
-"WHERE fi.type = " +
-    std::to_string( static_cast<typename std::underlying_type<IFile::Type>::type>(
-        IFile::Type::Main) ) + " "
-"AND fi.media_id = " + Media::Table::Name + ".id_media"
-")",
-
-/************ Playlist external media were stored as Unknown ******************/
-
-"UPDATE " + Media::Table::Name + " SET type = " +
-std::to_string( static_cast<typename std::underlying_type<IMedia::Type>::type>(
-            IMedia::Type::External ) ) + " "
-"WHERE nb_playlists > 0 AND "
-"type = " + std::to_string( static_cast<typename std::underlying_type<IMedia::Type>::type>(
-IMedia::Type::Unknown ) ),
-
 /******************* Migrate metadata table ***********************************/
 "CREATE TEMPORARY TABLE " + Metadata::Table::Name + "_backup"
 "("
@@ -149,72 +90,16 @@ IMedia::Type::Unknown ) ),
 
 /******************* Migrate Folder table *************************************/
 
-"CREATE TEMPORARY TABLE " + Folder::Table::Name + "_backup"
-"("
-    "id_folder INTEGER PRIMARY KEY AUTOINCREMENT,"
-    "path TEXT,"
-    "parent_id UNSIGNED INTEGER,"
-    "is_blacklisted BOOLEAN NOT NULL DEFAULT 0,"
-    "device_id UNSIGNED INTEGER,"
-    "is_present BOOLEAN NOT NULL DEFAULT 1,"
-    "is_removable BOOLEAN NOT NULL"
-")",
-
-"INSERT INTO " + Folder::Table::Name + "_backup SELECT * FROM " + Folder::Table::Name,
-
-"DROP TABLE " + Folder::Table::Name,
+"ALTER TABLE " + Folder::Table::Name + " RENAME TO " + Folder::Table::Name + "_backup",
 
 #include "database/tables/Folder_v14.sql"
 
-"INSERT INTO " + Folder::Table::Name + "("
-    "id_folder, path, parent_id, is_banned, device_id, is_removable"
-") "
-"SELECT id_folder, path, parent_id, is_blacklisted, device_id, is_removable "
-"FROM " + Folder::Table::Name + "_backup",
-
-"UPDATE " + Folder::Table::Name + " SET "
-    "nb_audio = (SELECT COUNT() FROM " + Media::Table::Name +
-        " m WHERE m.folder_id = id_folder AND m.type = "
-                + std::to_string( static_cast<std::underlying_type<IMedia::Type>::type>(
-                                    IMedia::Type::Audio ) ) + "),"
-    "nb_video = (SELECT COUNT() FROM " + Media::Table::Name +
-        " m WHERE m.folder_id = id_folder AND m.type = "
-            + std::to_string( static_cast<std::underlying_type<IMedia::Type>::type>(
-                                IMedia::Type::Video ) ) + ")",
-
-"DROP TABLE " + Folder::Table::Name + "_backup",
-
 /******************* Migrate File table *************************************/
 
-"CREATE TEMPORARY TABLE " + File::Table::Name + "_backup"
-"("
-    "id_file INTEGER PRIMARY KEY AUTOINCREMENT,"
-    "media_id UNSIGNED INT DEFAULT NULL,"
-    "playlist_id UNSIGNED INT DEFAULT NULL,"
-    "mrl TEXT,"
-    "type UNSIGNED INTEGER,"
-    "last_modification_date UNSIGNED INT,"
-    "size UNSIGNED INT,"
-    "folder_id UNSIGNED INTEGER,"
-    "is_present BOOLEAN NOT NULL DEFAULT 1,"
-    "is_removable BOOLEAN NOT NULL,"
-    "is_external BOOLEAN NOT NULL"
-")",
-
-"INSERT INTO " + File::Table::Name + "_backup SELECT * FROM " + File::Table::Name,
-
-"DROP TABLE " + File::Table::Name,
+"ALTER TABLE " + File::Table::Name + " RENAME TO " + File::Table::Name + "_backup",
 
 #include "database/tables/File_v14.sql"
 
-"INSERT INTO " + File::Table::Name + "("
-"id_file, media_id, playlist_id, mrl, type, last_modification_date, size,"
-"folder_id, is_removable, is_external, is_network) "
-"SELECT id_file, media_id, playlist_id, mrl, type, last_modification_date, size,"
-"folder_id, is_removable, is_external, 0 FROM " + File::Table::Name + "_backup",
-
-"DROP TABLE " + File::Table::Name + "_backup",
-
 /******************* Delete removed triggers **********************************/
 
 "DROP TRIGGER on_track_genre_changed",
@@ -230,10 +115,12 @@ IMedia::Type::Unknown ) ),
 "DROP TRIGGER delete_album_track",
 
 // Old Folder -> File is_present trigger
-// is_folder_present has been implicitely removed by dropping the File table
+// is_folder_present will be implicitely removed by dropping the Folder backup
+// table
 
 // Old File -> Media is_present trigger
-// has_files_present has been implicitely removed by dropping the Folder table
+// has_files_present will be implicitely removed by dropping the File backup
+// table
 
 // Old Device -> Folder is_present trigger
 // is_device_present has been implicitely removed by dropping the Device table
@@ -0,0 +1,32 @@
+/******************* Drop the FTS3 triggers ***********************************/
+
+"DROP TRIGGER IF EXISTS insert_media_fts",
+"DROP TRIGGER IF EXISTS delete_media_fts",
+"DROP TRIGGER IF EXISTS update_media_title_fts",
+"DROP TRIGGER IF EXISTS insert_album_fts",
+"DROP TRIGGER IF EXISTS delete_album_fts",
+"DROP TRIGGER IF EXISTS insert_artist_fts",
+"DROP TRIGGER IF EXISTS delete_artist_fts",
+"DROP TRIGGER IF EXISTS insert_genre_fts",
+"DROP TRIGGER IF EXISTS delete_genre_fts",
+"DROP TRIGGER IF EXISTS insert_show_fts",
+"DROP TRIGGER IF EXISTS delete_show_fts",
+"DROP TRIGGER IF EXISTS insert_playlist_fts",
+"DROP TRIGGER IF EXISTS update_playlist_fts",
+"DROP TRIGGER IF EXISTS delete_playlist_fts",
+"DROP TRIGGER IF EXISTS insert_folder_fts",
+"DROP TRIGGER IF EXISTS delete_folder_fts",
+"DROP TRIGGER IF EXISTS delete_label_fts",
+
+/******************* Drop the FTS3 tables *************************************/
+
+// They will be recreated as FTS5 external content tables, which only store
+// the index, and populated from their content table
+
+"DROP TABLE IF EXISTS " + Media::Table::Name + "Fts",
+"DROP TABLE IF EXISTS " + Album::Table::Name + "Fts",
+"DROP TABLE IF EXISTS " + Artist::Table::Name + "Fts",
+"DROP TABLE IF EXISTS " + Genre::Table::Name + "Fts",
+"DROP TABLE IF EXISTS " + Show::Table::Name + "Fts",
+"DROP TABLE IF EXISTS " + Playlist::Table::Name + "Fts",
+"DROP TABLE IF EXISTS " + Folder::Table::Name + "Fts",
@@ -0,0 +1,45 @@
+"CREATE INDEX IF NOT EXISTS index_last_played_date ON "
+            + Media::Table::Name + "(last_played_date DESC)",
+
+"CREATE INDEX IF NOT EXISTS index_media_presence ON "
+            + Media::Table::Name + "(is_present)",
+
+"CREATE TRIGGER IF NOT EXISTS is_media_device_present AFTER UPDATE OF "
+"is_present ON " + Device::Table::Name + " "
+"BEGIN "
+"UPDATE " + Media::Table::Name + " "
+    "SET is_present=new.is_present "
+    "WHERE device_id=new.id_device;"
+"END;",
+
+"CREATE TRIGGER IF NOT EXISTS cascade_file_deletion AFTER DELETE ON "
++ File::Table::Name +
+" BEGIN "
+" DELETE FROM " + Media::Table::Name + " WHERE "
+    "(SELECT COUNT(id_file) FROM " + File::Table::Name +
+        " WHERE media_id=old.media_id) = 0"
+        " AND id_media=old.media_id;"
+" END;",
+
+// MediaFts is an external content table: removing a record requires the
+// values which were indexed for it
+"CREATE TRIGGER IF NOT EXISTS insert_media_fts"
+" AFTER INSERT ON " + Media::Table::Name +
+" BEGIN"
+    " INSERT INTO " + Media::Table::Name + "Fts(rowid,title) VALUES(new.id_media, new.title);"
+" END",
+
+"CREATE TRIGGER IF NOT EXISTS delete_media_fts"
+" BEFORE DELETE ON " + Media::Table::Name +
+" BEGIN"
+    " INSERT INTO " + Media::Table::Name + "Fts(" + Media::Table::Name + "Fts,rowid,title)"
+        " VALUES('delete', old.id_media, old.title);"
+" END",
+
+"CREATE TRIGGER IF NOT EXISTS update_media_title_fts"
+" AFTER UPDATE OF title ON " + Media::Table::Name +
+" BEGIN"
+    " INSERT INTO " + Media::Table::Name + "Fts(" + Media::Table::Name + "Fts,rowid,title)"
+        " VALUES('delete', old.id_media, old.title);"
+    " INSERT INTO " + Media::Table::Name + "Fts(rowid,title) VALUES(new.id_media, new.title);"
+" END",
@@ -0,0 +1,33 @@
+"CREATE TABLE IF NOT EXISTS " + Playlist::Table::Name + "("
+    + Playlist::Table::PrimaryKeyColumn + " INTEGER PRIMARY KEY AUTOINCREMENT,"
+    "name TEXT COLLATE NOCASE,"
+    "file_id UNSIGNED INT DEFAULT NULL,"
+    "creation_date UNSIGNED INT NOT NULL,"
+    "artwork_mrl TEXT,"
+    "FOREIGN KEY (file_id) REFERENCES " + File::Table::Name
+    + "(id_file) ON DELETE CASCADE"
+")",
+
+"CREATE TABLE IF NOT EXISTS PlaylistMediaRelation"
+"("
+    "media_id INTEGER,"
+    "mrl STRING,"
+    "playlist_id INTEGER,"
+    "position INTEGER,"
+    "FOREIGN KEY(media_id) REFERENCES " + Media::Table::Name + "("
+        + Media::Table::PrimaryKeyColumn + ") ON DELETE SET NULL,"
+    "FOREIGN KEY(playlist_id) REFERENCES " + Playlist::Table::Name + "("
+        + Playlist::Table::PrimaryKeyColumn + ") ON DELETE CASCADE"
+")",
+
+"CREATE INDEX IF NOT EXISTS playlist_media_pl_id_index "
+    "ON PlaylistMediaRelation(media_id, playlist_id)",
+
+"CREATE VIRTUAL TABLE IF NOT EXISTS " + Playlist::Table::Name + "Fts USING FTS5"
+"("
+    "name,"
+    "content=" + Playlist::Table::Name + ","
+    "content_rowid=id_playlist,"
+    "prefix='2 3 4',"
+    "tokenize='unicode61 remove_diacritics 2'"
+")",
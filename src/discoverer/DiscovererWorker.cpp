@@ -32,6 +32,7 @@
 #include "MediaLibrary.h"
 #include "Device.h"
 #include "utils/Filename.h"
+#include "database/SqliteConnection.h"
 #include <cassert>
 
 namespace medialibrary
@@ -142,6 +143,7 @@ void DiscovererWorker::notify()
 void DiscovererWorker::run()
 {
     LOG_INFO( "Entering DiscovererWorker thread" );
+    sqlite::Connection::setBackgroundThread();
     m_ml->onDiscovererIdleChanged( false );
     while ( m_run == true )
     {
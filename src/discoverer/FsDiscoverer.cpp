@@ -36,11 +36,21 @@
 #include "File.h"
 #include "Device.h"
 #include "Folder.h"
+#include "database/SqliteTransaction.h"
 #include "logging/Logger.h"
 #include "MediaLibrary.h"
 #include "probe/CrawlerProbe.h"
 #include "utils/Filename.h"
 
+namespace
+{
+// Maximum number of folders whose changes are committed at once
+constexpr uint32_t MaxBatchedFolders = 16;
+// Maximum delay before the changes made to a folder are committed, so that
+// they don't stay invisible for too long while browsing slow folders
+constexpr auto MaxBatchDuration = std::chrono::milliseconds{ 500 };
+}
+
 namespace medialibrary
 {
 
@@ -72,6 +82,7 @@ bool FsDiscoverer::discover( const std::string& entryPoint )
     // If the folder exists, we assume it will be handled by reload()
     if ( f != nullptr )
         return true;
+    BatchGuard batchGuard{ this };
     try
     {
         if ( m_probe->proceedOnDirectory( *fsDir ) == false || m_probe->isHidden( *fsDir ) == true )
@@ -121,6 +132,7 @@ bool FsDiscoverer::reloadFolder( std::shared_ptr<Folder> f )
             return false;
         }
     }
+    BatchGuard batchGuard{ this };
     try
     {
         checkFolder( std::move( directory ), std::move( f ), false );
@@ -174,7 +186,7 @@ bool FsDiscoverer::reload( const std::string& entryPoint )
 
 void FsDiscoverer::checkFolder( std::shared_ptr<fs::IDirectory> currentFolderFs,
                                 std::shared_ptr<Folder> currentFolder,
-                                bool newFolder ) const
+                                bool newFolder )
 {
     try
     {
@@ -297,7 +309,7 @@ void FsDiscoverer::checkFolder( std::shared_ptr<fs::IDirectory> currentFolderFs,
 }
 
 void FsDiscoverer::checkFiles( std::shared_ptr<fs::IDirectory> parentFolderFs,
-                               std::shared_ptr<Folder> parentFolder ) const
+                               std::shared_ptr<Folder> parentFolder )
 {
     LOG_INFO( "Checking file in ", parentFolderFs->mrl() );
 
@@ -328,12 +340,12 @@ void FsDiscoverer::checkFiles( std::shared_ptr<fs::IDirectory> parentFolderFs,
     }
     if ( m_probe->deleteUnseenFiles() == false )
         files.clear();
-    using FilesT = decltype( files );
-    using FilesToRefreshT = decltype( filesToRefresh );
-    using FilesToAddT = decltype( filesToAdd );
-    sqlite::Tools::withRetries( 3, [this, &parentFolder, &parentFolderFs]
-                            ( FilesT files, FilesToAddT filesToAdd, FilesToRefreshT filesToRefresh ) {
-        auto t = m_ml->getConn()->newTransaction();
+    // The changes may be applied more than once if the batch needs to be
+    // retried, so they only use copies of the files. The probe state must be
+    // captured now, as it will have moved on to other folders by then
+    auto playlistParent = m_probe->getPlaylistParent();
+    batchFolderChanges( [this, parentFolder, parentFolderFs, files, filesToAdd,
+                         filesToRefresh, playlistParent]() {
         for ( const auto& file : files )
         {
             LOG_INFO( "File ", file->mrl(), " not found on filesystem, deleting it" );
@@ -348,19 +360,17 @@ void FsDiscoverer::checkFiles( std::shared_ptr<fs::IDirectory> parentFolderFs,
                 file->destroy();
             }
         }
-        for ( auto& p: filesToRefresh )
-            m_ml->onUpdatedFile( std::move( p.first ), std::move( p.second ) );
+        for ( const auto& p: filesToRefresh )
+            m_ml->onUpdatedFile( p.first, p.second );
         // Insert all files at once to avoid SQL write contention
-        for ( auto& p : filesToAdd )
-            m_ml->onDiscoveredFile( p, parentFolder, parentFolderFs,
-                                    IFile::Type::Main, m_probe->getPlaylistParent() );
-        t->commit();
+        m_ml->onDiscoveredFiles( filesToAdd, parentFolder, parentFolderFs,
+                                 IFile::Type::Main, playlistParent );
         LOG_INFO( "Done checking files in ", parentFolderFs->mrl() );
-    }, std::move( files ), std::move( filesToAdd ), std::move( filesToRefresh ) );
+    });
 }
 
 bool FsDiscoverer::addFolder( std::shared_ptr<fs::IDirectory> folder,
-                              Folder* parentFolder ) const
+                              Folder* parentFolder )
 {
     auto deviceFs = folder->device();
     // We are creating a folder, there has to be a device containing it.
@@ -388,4 +398,75 @@ bool FsDiscoverer::addFolder( std::shared_ptr<fs::IDirectory> folder,
     return true;
 }
 
+void FsDiscoverer::batchFolderChanges( std::function<void()> changes )
+{
+    // Let the caller's transaction handle the failures
+    if ( sqlite::Transaction::transactionInProgress() == true )
+    {
+        changes();
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if ( m_batch.empty() == true )
+        m_batchStart = now;
+    m_batch.push_back( std::move( changes ) );
+    if ( m_batch.size() >= MaxBatchedFolders || now - m_batchStart >= MaxBatchDuration )
+        commitBatch();
+}
+
+void FsDiscoverer::commitBatch()
+{
+    if ( m_batch.empty() == true )
+        return;
+    auto batch = std::move( m_batch );
+    m_batch.clear();
+    try
+    {
+        // Retry the whole batch, as SQLite might have rolled back its
+        // transaction, in which case retrying a single folder would commit it
+        // on its own
+        sqlite::Tools::withRetries( m_ml->getConn(), 3, [this, &batch]() {
+            auto t = m_ml->getConn()->newTransaction();
+            for ( const auto& changes : batch )
+            {
+                auto folderTransaction = m_ml->getConn()->newTransaction();
+                try
+                {
+                    changes();
+                    folderTransaction->commit();
+                }
+                catch ( const sqlite::errors::GenericExecution& ex )
+                {
+                    if ( sqlite::errors::isInnocuous( ex ) == true )
+                        throw;
+                    // Only this folder's changes get rolled back. It will be
+                    // checked again during the next reload
+                    LOG_ERROR( "Failed to apply a folder changes: ", ex.what() );
+                }
+                catch ( const sqlite::errors::ConstraintViolation& ex )
+                {
+                    LOG_ERROR( "Failed to apply a folder changes: ", ex.what() );
+                }
+                catch ( const fs::DeviceRemovedException& )
+                {
+                    LOG_INFO( "Folder changes were discarded after the device was removed" );
+                }
+            }
+            t->commit();
+        });
+        LOG_DEBUG( "Committed changes for ", batch.size(), " folder(s)" );
+    }
+    catch ( const std::exception& ex )
+    {
+        // The folders will be checked again during the next reload
+        LOG_ERROR( "Failed to commit changes for ", batch.size(),
+                   " folder(s): ", ex.what() );
+    }
+}
+
+FsDiscoverer::BatchGuard::~BatchGuard()
+{
+    discoverer->commitBatch();
+}
+
 }
@@ -22,7 +22,10 @@
 
 #pragma once
 
+#include <chrono>
+#include <functional>
 #include <memory>
+#include <vector>
 
 #include "discoverer/IDiscoverer.h"
 #include "medialibrary/filesystem/IFileSystemFactory.h"
@@ -52,18 +55,42 @@ private:
     /// \return true if files in this folder needs to be listed, false otherwise
     ///
     void checkFolder( std::shared_ptr<fs::IDirectory> currentFolderFs,
-                      std::shared_ptr<Folder> currentFolder, bool newFolder ) const;
+                      std::shared_ptr<Folder> currentFolder, bool newFolder );
     void checkFiles( std::shared_ptr<fs::IDirectory> parentFolderFs,
-                     std::shared_ptr<Folder> parentFolder ) const;
+                     std::shared_ptr<Folder> parentFolder );
     bool addFolder( std::shared_ptr<fs::IDirectory> folder,
-                    Folder* parentFolder ) const;
+                    Folder* parentFolder );
     bool reloadFolder( std::shared_ptr<Folder> folder );
+    /*
+     * Queues the database changes for a folder, once all the filesystem
+     * accesses they depend upon are done.
+     */
+    void batchFolderChanges( std::function<void()> changes );
+    void commitBatch();
+
+private:
+    /*
+     * Commits the pending batch when leaving the scope of a discovery or a
+     * reload, including when it gets interrupted by an exception
+     */
+    struct BatchGuard
+    {
+        ~BatchGuard();
+        FsDiscoverer* discoverer;
+    };
 
 private:
     MediaLibrary* m_ml;
     std::shared_ptr<fs::IFileSystemFactory> m_fsFactory;
     IMediaLibraryCb* m_cb;
     std::unique_ptr<prober::IProbe> m_probe;
+    // The changes made to several folders are committed at once, since
+    // committing each folder individually is dominated by the cost of
+    // syncing the database. They are queued until then, so that the batch
+    // transaction doesn't hold the write context while accessing the
+    // filesystem. Each folder is still applied in its own nested transaction.
+    std::vector<std::function<void()>> m_batch;
+    std::chrono::steady_clock::time_point m_batchStart;
 };
 
 }
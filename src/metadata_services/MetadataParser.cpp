@@ -28,6 +28,7 @@
 #include "Album.h"
 #include "AlbumTrack.h"
 #include "Artist.h"
+#include "AudioTrack.h"
 #include "File.h"
 #include "medialibrary/filesystem/IDevice.h"
 #include "medialibrary/filesystem/IDirectory.h"
@@ -37,6 +38,8 @@
 #include "Playlist.h"
 #include "Show.h"
 #include "ShowEpisode.h"
+#include "SubtitleTrack.h"
+#include "VideoTrack.h"
 #include "Movie.h"
 #include "utils/Directory.h"
 #include "utils/Filename.h"
@@ -228,15 +231,21 @@ bool MetadataAnalyzer::addPlaylistMedias( IItem& item ) const
     // be recreated if need be, and appropriate entries in PlaylistMediaRelation
     // table will be recreated to link things together.
 
+    // The media which already exist, or don't need to be discovered, are
+    // inserted in the playlist at once after the loop
+    std::vector<std::pair<MediaPtr, unsigned int>> knownMedia;
     for ( auto i = 0u; i < item.nbSubItems(); ++i ) // FIXME: Interrupt loop if paused
-        addPlaylistElement( item, playlistPtr, item.subItem( i ) );
+        addPlaylistElement( item, playlistPtr, item.subItem( i ), knownMedia );
+    if ( playlistPtr->addBatch( knownMedia ) == false )
+        LOG_ERROR( "Failed to insert some media in playlist ", mrl );
 
     return true;
 }
 
 void MetadataAnalyzer::addPlaylistElement( IItem& item,
                                          std::shared_ptr<Playlist> playlistPtr,
-                                         const IItem& subitem ) const
+                                         const IItem& subitem,
+                                         std::vector<std::pair<MediaPtr, unsigned int>>& knownMedia ) const
 {
     const auto& mrl = subitem.mrl();
     const auto& playlistMrl = item.mrl();
@@ -245,9 +254,7 @@ void MetadataAnalyzer::addPlaylistElement( IItem& item,
     if ( media != nullptr )
     {
         LOG_INFO( "Media for ", mrl, " already exists, adding it to the playlist ", playlistMrl );
-        auto res = playlistPtr->add( *media, subitem.parentPlaylistIndex() );
-        if ( res == false )
-            LOG_ERROR( "Failed to insert ", mrl, " in playlist ", playlistMrl );
+        knownMedia.emplace_back( std::move( media ), subitem.parentPlaylistIndex() );
         return;
     }
     // Create Media, etc.
@@ -270,8 +277,8 @@ void MetadataAnalyzer::addPlaylistElement( IItem& item,
             LOG_ERROR( "Failed to create external file for ", mrl, " in the playlist ", playlistMrl );
             return;
         }
-        playlistPtr->add( *externalMedia, subitem.parentPlaylistIndex() );
         t2->commit();
+        knownMedia.emplace_back( std::move( externalMedia ), subitem.parentPlaylistIndex() );
         return;
     }
     bool isDirectory;
@@ -335,7 +342,7 @@ bool MetadataAnalyzer::parseVideoFile( IItem& item ) const
     const auto& showName = item.meta( IItem::Metadata::ShowName );
     const auto& artworkMrl = item.meta( IItem::Metadata::ArtworkUrl );
 
-    return sqlite::Tools::withRetries( 3, [this, &showName, &title, media, &item, &artworkMrl]() {
+    return sqlite::Tools::withRetries( m_ml->getConn(), 3, [this, &showName, &title, media, &item, &artworkMrl]() {
         auto t = m_ml->getConn()->newTransaction();
         media->setTitleBuffered( title );
 
@@ -473,28 +480,35 @@ std::tuple<Status, bool> MetadataAnalyzer::createFileAndMedia( IItem& item ) con
 void MetadataAnalyzer::createTracks( Media& m, const std::vector<IItem::Track>& tracks ) const
 {
     assert( sqlite::Transaction::transactionInProgress() == true );
+    std::vector<VideoTrack::Record> videoTracks;
+    std::vector<AudioTrack::Record> audioTracks;
+    std::vector<SubtitleTrack::Record> subtitleTracks;
     for ( const auto& track : tracks )
     {
         if ( track.type == IItem::Track::Type::Video )
         {
-            m.addVideoTrack( track.codec, track.v.width, track.v.height,
-                                  track.v.fpsNum, track.v.fpsDen, track.bitrate,
-                                  track.v.sarNum, track.v.sarDen,
-                                  track.language, track.description );
+            videoTracks.emplace_back( track.codec, track.v.width, track.v.height,
+                                      track.v.fpsNum, track.v.fpsDen, track.bitrate,
+                                      track.v.sarNum, track.v.sarDen, m.id(),
+                                      track.language, track.description );
         }
         else if ( track.type == IItem::Track::Type::Audio )
         {
-            m.addAudioTrack( track.codec, track.bitrate,
-                                       track.a.rate, track.a.nbChannels,
-                                       track.language, track.description );
+            audioTracks.emplace_back( track.codec, track.bitrate,
+                                      track.a.rate, track.a.nbChannels,
+                                      track.language, track.description, m.id() );
         }
         else
         {
             assert( track.type == IItem::Track::Type::Subtitle );
-            m.addSubtitleTrack( track.codec, track.language, track.description,
-                                track.s.encoding );
+            subtitleTracks.emplace_back( track.codec, track.language,
+                                         track.description, track.s.encoding,
+                                         m.id() );
         }
     }
+    VideoTrack::createBatch( m_ml, videoTracks );
+    AudioTrack::createBatch( m_ml, audioTracks );
+    SubtitleTrack::createBatch( m_ml, subtitleTracks );
 }
 
 std::tuple<bool, bool> MetadataAnalyzer::refreshFile( IItem& item ) const
@@ -643,7 +657,7 @@ bool MetadataAnalyzer::parseAudioFile( IItem& item )
     if ( artists.first == nullptr && artists.second == nullptr )
         return false;
     auto album = findAlbum( item, artists.first, artists.second );
-    return sqlite::Tools::withRetries( 3, [this, &item, &artists, media]( std::string artworkMrl,
+    return sqlite::Tools::withRetries( m_ml->getConn(), 3, [this, &item, &artists, media]( std::string artworkMrl,
                                                   std::shared_ptr<Album> album, std::shared_ptr<Genre> genre ) {
         auto t = m_ml->getConn()->newTransaction();
         if ( album == nullptr )
@@ -50,7 +50,8 @@ protected:
 
     bool addPlaylistMedias( IItem& item ) const;
     void addPlaylistElement( IItem& item, std::shared_ptr<Playlist> playlistPtr,
-                             const IItem& subitem ) const;
+                             const IItem& subitem,
+                             std::vector<std::pair<MediaPtr, unsigned int>>& knownMedia ) const;
     bool parseAudioFile( IItem& task );
     bool parseVideoFile( IItem& task ) const;
     std::tuple<Status, bool> createFileAndMedia( IItem& item ) const;
@@ -32,6 +32,7 @@
 #include "logging/Logger.h"
 #include "MediaLibrary.h"
 #include "utils/ModificationsNotifier.h"
+#include "database/SqliteConnection.h"
 
 #include <algorithm>
 
@@ -85,6 +86,7 @@ void ThumbnailerWorker::resume()
 void ThumbnailerWorker::run()
 {
     LOG_INFO( "Starting thumbnailer thread" );
+    sqlite::Connection::setBackgroundThread();
     while ( m_run == true )
     {
         MediaPtr media;
@@ -28,6 +28,7 @@
 #include "Parser.h"
 #include "Media.h"
 #include "Folder.h"
+#include "database/SqliteConnection.h"
 
 namespace medialibrary
 {
@@ -152,6 +153,7 @@ void Worker::mainloop()
     // that the underlying service has been deleted already.
     std::string serviceName = m_service->name();
     LOG_INFO("Entering ParserService [", serviceName, "] thread");
+    sqlite::Connection::setBackgroundThread();
     setIdle( false );
 
     while ( m_stopParser == false )
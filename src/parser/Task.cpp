@@ -528,6 +528,43 @@ Task::create( MediaLibraryPtr ml, std::string mrl, std::shared_ptr<fs::IFile> fi
     return self;
 }
 
+std::vector<std::shared_ptr<Task>>
+Task::createBatch( MediaLibraryPtr ml, std::vector<std::shared_ptr<fs::IFile>> filesFs,
+                   std::shared_ptr<Folder> parentFolder,
+                   std::shared_ptr<fs::IDirectory> parentFolderFs, IFile::Type fileType,
+                   std::pair<std::shared_ptr<Playlist>, unsigned int> parentPlaylist )
+{
+    auto parentFolderId = parentFolder->id();
+    auto parentPlaylistId = parentPlaylist.first != nullptr ? parentPlaylist.first->id() : 0;
+    auto parentPlaylistIndex = parentPlaylist.second;
+
+    // Sqlite won't ensure uniqueness for Task with the same (mrl, parent_playlist_id)
+    // when parent_playlist_id is null, so we have to ensure of it ourselves
+    static const std::string req = "INSERT OR IGNORE INTO " + Task::Table::Name +
+        "(mrl, file_type, parent_folder_id, parent_playlist_id, "
+        "parent_playlist_index, is_refresh) "
+        "SELECT ?, ?, ?, ?, ?, ? WHERE NOT EXISTS (SELECT 1 FROM " + Task::Table::Name +
+        " WHERE mrl = ? AND parent_playlist_id IS ?)";
+    std::vector<std::shared_ptr<Task>> tasks;
+    std::vector<std::tuple<std::string, IFile::Type, int64_t, sqlite::ForeignKey,
+                           unsigned int, bool, std::string, sqlite::ForeignKey>> records;
+    tasks.reserve( filesFs.size() );
+    records.reserve( filesFs.size() );
+    for ( auto& fileFs : filesFs )
+    {
+        auto mrl = fileFs->mrl();
+        records.emplace_back( mrl, fileType, parentFolderId,
+                              sqlite::ForeignKey( parentPlaylistId ),
+                              parentPlaylistIndex, false, mrl,
+                              sqlite::ForeignKey( parentPlaylistId ) );
+        tasks.push_back( std::make_shared<Task>( ml, std::move( mrl ), std::move( fileFs ),
+                                parentFolder, parentFolderFs, fileType,
+                                parentPlaylist.first, parentPlaylistIndex ) );
+    }
+    insertBatch( ml, tasks, req, records );
+    return tasks;
+}
+
 std::shared_ptr<Task>
 Task::createRefreshTask( MediaLibraryPtr ml, std::shared_ptr<File> file,
               std::shared_ptr<fs::IFile> fileFs )
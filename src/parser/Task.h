@@ -226,6 +226,18 @@ public:
                                          IFile::Type fileType,
                                          std::pair<std::shared_ptr<Playlist>,
                                          unsigned int> parentPlaylist );
+    /**
+     * @brief createBatch Creates tasks for multiple files of the same folder
+     *
+     * Files which already have a task for the same parent playlist are ignored
+     * and no task is returned for them.
+     */
+    static std::vector<std::shared_ptr<Task>>
+    createBatch( MediaLibraryPtr ml, std::vector<std::shared_ptr<fs::IFile>> filesFs,
+                 std::shared_ptr<Folder> parentFolder,
+                 std::shared_ptr<fs::IDirectory> parentFolderFs,
+                 IFile::Type fileType,
+                 std::pair<std::shared_ptr<Playlist>, unsigned int> parentPlaylist );
     static std::shared_ptr<Task> createRefreshTask( MediaLibraryPtr ml, std::shared_ptr<File> file,
                                          std::shared_ptr<fs::IFile> fsFile );
     static void recoverUnscannedFiles( MediaLibraryPtr ml );
@@ -66,9 +66,9 @@ void ModificationNotifier::notifyMediaModification( MediaPtr media )
     notifyModification( std::move( media ), m_media );
 }
 
-void ModificationNotifier::notifyMediaRemoval( int64_t mediaId )
+void ModificationNotifier::notifyMediaRemoval( std::vector<int64_t> rowIds )
 {
-    notifyRemoval( mediaId, m_media );
+    notifyRemoval( std::move( rowIds ), m_media );
 }
 
 void ModificationNotifier::notifyArtistCreation( ArtistPtr artist )
@@ -81,9 +81,9 @@ void ModificationNotifier::notifyArtistModification( ArtistPtr artist )
     notifyModification( std::move( artist ), m_artists );
 }
 
-void ModificationNotifier::notifyArtistRemoval( int64_t artist )
+void ModificationNotifier::notifyArtistRemoval( std::vector<int64_t> rowIds )
 {
-    notifyRemoval( std::move( artist ), m_artists );
+    notifyRemoval( std::move( rowIds ), m_artists );
 }
 
 void ModificationNotifier::notifyAlbumCreation( AlbumPtr album )
@@ -96,9 +96,9 @@ void ModificationNotifier::notifyAlbumModification( AlbumPtr album )
     notifyModification( std::move( album ), m_albums );
 }
 
-void ModificationNotifier::notifyAlbumRemoval( int64_t albumId )
+void ModificationNotifier::notifyAlbumRemoval( std::vector<int64_t> rowIds )
 {
-    notifyRemoval( albumId, m_albums );
+    notifyRemoval( std::move( rowIds ), m_albums );
 }
 
 void ModificationNotifier::notifyPlaylistCreation( PlaylistPtr playlist )
@@ -111,9 +111,9 @@ void ModificationNotifier::notifyPlaylistModification( PlaylistPtr playlist )
     notifyModification( std::move( playlist ), m_playlists );
 }
 
-void ModificationNotifier::notifyPlaylistRemoval( int64_t playlistId )
+void ModificationNotifier::notifyPlaylistRemoval( std::vector<int64_t> rowIds )
 {
-    notifyRemoval( playlistId, m_playlists );
+    notifyRemoval( std::move( rowIds ), m_playlists );
 }
 
 void ModificationNotifier::notifyGenreCreation( GenrePtr genre )
@@ -126,9 +126,9 @@ void ModificationNotifier::notifyGenreModification( GenrePtr genre )
     notifyModification( std::move( genre ), m_genres );
 }
 
-void ModificationNotifier::notifyGenreRemoval( int64_t genreId )
+void ModificationNotifier::notifyGenreRemoval( std::vector<int64_t> rowIds )
 {
-    notifyRemoval( genreId, m_genres );
+    notifyRemoval( std::move( rowIds ), m_genres );
 }
 
 void ModificationNotifier::flush()
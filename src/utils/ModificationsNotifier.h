@@ -45,23 +45,23 @@ public:
     void start();
     void notifyMediaCreation( MediaPtr media );
     void notifyMediaModification( MediaPtr media );
-    void notifyMediaRemoval( int64_t media );
+    void notifyMediaRemoval( std::vector<int64_t> rowIds );
 
     void notifyArtistCreation( ArtistPtr artist );
     void notifyArtistModification( ArtistPtr artist );
-    void notifyArtistRemoval( int64_t artist );
+    void notifyArtistRemoval( std::vector<int64_t> rowIds );
 
     void notifyAlbumCreation( AlbumPtr album );
     void notifyAlbumModification( AlbumPtr album );
-    void notifyAlbumRemoval( int64_t albumId );
+    void notifyAlbumRemoval( std::vector<int64_t> rowIds );
 
     void notifyPlaylistCreation( PlaylistPtr playlist );
     void notifyPlaylistModification( PlaylistPtr playlist );
-    void notifyPlaylistRemoval( int64_t playlistId );
+    void notifyPlaylistRemoval( std::vector<int64_t> rowIds );
 
     void notifyGenreCreation( GenrePtr genre );
     void notifyGenreModification( GenrePtr genre );
-    void notifyGenreRemoval( int64_t genreId );
+    void notifyGenreRemoval( std::vector<int64_t> rowIds );
 
     /**
      * @brief flush Flushes the notifications queues
@@ -115,11 +115,14 @@ private:
     }
 
     template <typename T>
-    void notifyRemoval( int64_t rowId, Queue<T>& queue )
+    void notifyRemoval( std::vector<int64_t> rowIds, Queue<T>& queue )
     {
         std::lock_guard<compat::Mutex> lock( m_lock );
-        queue.removed.push_back( rowId );
-        updateTimeout( m_media );
+        if ( queue.removed.empty() == true )
+            queue.removed = std::move( rowIds );
+        else
+            queue.removed.insert( end( queue.removed ), begin( rowIds ), end( rowIds ) );
+        updateTimeout( queue );
     }
 
     template <typename T>
@@ -0,0 +1,202 @@
+/*****************************************************************************
+ * Media Library
+ *****************************************************************************
+ * Copyright (C) 2019 Hugo Beauzée-Luyssen, Videolabs, VideoLAN
+ *
+ * Authors: Hugo Beauzée-Luyssen<hugo@beauzee.fr>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#if HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "common/MediaLibraryTester.h"
+#include "mocks/FileSystem.h"
+#include "mocks/MockDeviceLister.h"
+#include "mocks/NoopCallback.h"
+#include "Album.h"
+#include "File.h"
+#include "Media.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <unistd.h>
+
+/*
+ * Counts all the allocations made by the program, so that we can tell how
+ * many of them a listing requires.
+ */
+static std::atomic<uint64_t> nbAllocations{ 0 };
+
+void* operator new( size_t size )
+{
+    ++nbAllocations;
+    auto p = malloc( size == 0 ? 1 : size );
+    if ( p == nullptr )
+        throw std::bad_alloc{};
+    return p;
+}
+
+void* operator new[]( size_t size )
+{
+    return operator new( size );
+}
+
+/*
+ * Don't let the compiler inline the call to free() into the callers, since
+ * it would then report it as mismatching the call to operator new
+ */
+#ifdef __GNUC__
+__attribute__((noinline))
+#endif
+void operator delete( void* p ) noexcept
+{
+    free( p );
+}
+
+void operator delete( void* p, size_t ) noexcept
+{
+    operator delete( p );
+}
+
+void operator delete[]( void* p ) noexcept
+{
+    operator delete( p );
+}
+
+void operator delete[]( void* p, size_t ) noexcept
+{
+    operator delete( p );
+}
+
+namespace
+{
+
+const char* const DbPath = "benchmark.db";
+constexpr auto NbMedia = 10000u;
+constexpr auto NbTracksPerAlbum = 10u;
+
+mock::NoopCallback callback;
+
+std::unique_ptr<MediaLibraryTester> instantiate( const DatabaseTuning& tuning )
+{
+    std::unique_ptr<MediaLibraryTester> ml( new MediaLibraryTester );
+    ml->setFsFactory( std::make_shared<mock::NoopFsFactory>() );
+    ml->setDeviceLister( std::make_shared<mock::MockDeviceLister>() );
+    ml->setVerbosity( LogLevel::Error );
+    if ( ml->initialize( DbPath, "/tmp", &callback, tuning ) != InitializeResult::Success )
+        return nullptr;
+    return ml;
+}
+
+bool populate()
+{
+    unlink( DbPath );
+    unlink( ( std::string{ DbPath } + "-wal" ).c_str() );
+    unlink( ( std::string{ DbPath } + "-shm" ).c_str() );
+    DatabaseTuning tuning;
+    tuning.synchronous = SynchronousMode::Off;
+    auto ml = instantiate( tuning );
+    if ( ml == nullptr )
+        return false;
+    std::shared_ptr<Album> album;
+    for ( auto i = 0u; i < NbMedia; ++i )
+    {
+        auto media = ml->addFile( "/a/long/enough/path/to/the/media/track #" +
+                                  std::to_string( i ) + ".mp3", IMedia::Type::Audio );
+        if ( media == nullptr )
+            return false;
+        if ( i % NbTracksPerAlbum == 0 )
+            album = ml->createAlbum( "album #" + std::to_string( i / NbTracksPerAlbum ) );
+        album->addTrack( media, i % NbTracksPerAlbum + 1, 0, 0, nullptr );
+        media->save();
+    }
+    return true;
+}
+
+struct Listing
+{
+    const char* name;
+    std::function<size_t( MediaLibraryTester& )> list;
+};
+
+void run( const Listing& listing )
+{
+    std::cout << std::left << std::setw( 8 ) << listing.name;
+    for ( auto pageSize : { 0u, DatabaseTuning{}.entityPageSize } )
+    {
+        DatabaseTuning tuning;
+        tuning.entityPageSize = pageSize;
+        auto ml = instantiate( tuning );
+        // Warm up the statement cache & the sqlite page cache
+        auto nbEntities = listing.list( *ml );
+        auto before = nbAllocations.load();
+        auto chrono = std::chrono::steady_clock::now();
+        listing.list( *ml );
+        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - chrono );
+        auto allocations = nbAllocations.load() - before;
+        if ( pageSize == 0 )
+            std::cout << std::right << std::setw( 10 ) << nbEntities;
+        std::cout << std::setw( 14 ) << allocations
+                  << std::setw( 10 ) << std::fixed << std::setprecision( 2 )
+                  << static_cast<double>( allocations ) / nbEntities
+                  << std::setw( 10 ) << duration.count() << "us";
+    }
+    std::cout << std::endl;
+}
+
+}
+
+/*
+ * Compares the number of allocations required to list the entities when
+ * they're allocated one by one, and when they're allocated by pages
+ */
+int main()
+{
+    if ( populate() == false )
+    {
+        std::cerr << "Failed to populate " << DbPath << std::endl;
+        return 1;
+    }
+
+    const Listing listings[] = {
+        { "Media", []( MediaLibraryTester& ml ) {
+            return ml.audioFiles( nullptr )->all().size();
+        } },
+        { "Album", []( MediaLibraryTester& ml ) {
+            return ml.albums( nullptr )->all().size();
+        } },
+        { "File", []( MediaLibraryTester& ml ) {
+            return File::fetchAll<IFile>( &ml ).size();
+        } },
+    };
+    std::cout << std::left << std::setw( 8 ) << "Listing" << std::right
+              << std::setw( 10 ) << "Entities"
+              << std::setw( 14 ) << "Unpaged"  << std::setw( 10 ) << "/entity"
+              << std::setw( 12 ) << "Time"
+              << std::setw( 14 ) << "Paged" << std::setw( 10 ) << "/entity"
+              << std::setw( 12 ) << "Time" << std::endl;
+    for ( const auto& l : listings )
+        run( l );
+    return 0;
+}
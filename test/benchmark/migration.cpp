@@ -0,0 +1,149 @@
+/*****************************************************************************
+ * Media Library
+ *****************************************************************************
+ * Copyright (C) 2019 Hugo Beauzée-Luyssen, Videolabs, VideoLAN
+ *
+ * Authors: Hugo Beauzée-Luyssen<hugo@beauzee.fr>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#if HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "common/MediaLibraryTester.h"
+#include "mocks/FileSystem.h"
+#include "mocks/MockDeviceLister.h"
+#include "mocks/NoopCallback.h"
+#include "database/SqliteConnection.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <unistd.h>
+
+namespace
+{
+
+const char* const DbPath = "migration_benchmark.db";
+constexpr auto DefaultNbRecords = 500000u;
+// Leave the fixture records alone
+constexpr auto FirstId = 1000u;
+
+class ProgressCallback : public mock::NoopCallback
+{
+public:
+    virtual void onMigrationProgress( uint32_t modelVersion, uint32_t percent ) override
+    {
+        if ( percent == m_lastPercent )
+            return;
+        m_lastPercent = percent;
+        std::cout << "\rMigrating to model " << modelVersion << ": "
+                  << percent << "%   " << std::flush;
+        if ( percent == 100 )
+            std::cout << std::endl;
+    }
+
+private:
+    uint32_t m_lastPercent = 0;
+};
+
+void execute( medialibrary::sqlite::Connection::Handle conn, const std::string& req )
+{
+    medialibrary::sqlite::Statement stmt( conn, req );
+    stmt.execute();
+    while ( stmt.row() != nullptr )
+        ;
+}
+
+/*
+ * Creates a model 13 database containing nbRecords folders, media & files,
+ * all of them requiring a conversion during the migration
+ */
+bool populate( uint32_t nbRecords )
+{
+    unlink( DbPath );
+    unlink( ( std::string{ DbPath } + "-wal" ).c_str() );
+    unlink( ( std::string{ DbPath } + "-shm" ).c_str() );
+    std::ifstream file{ SRC_DIR "/test/unittest/db_v13.sql" };
+    if ( file.is_open() == false )
+        return false;
+    medialibrary::sqlite::Connection::Handle conn;
+    if ( sqlite3_open( DbPath, &conn ) != SQLITE_OK )
+        return false;
+    std::unique_ptr<sqlite3, int(*)(sqlite3*)> dbPtr{ conn, &sqlite3_close };
+    // The backup file already contains a transaction
+    char buff[2048];
+    while ( file.getline( buff, sizeof( buff ) ) )
+        execute( conn, buff );
+    execute( conn, "BEGIN" );
+    for ( auto i = FirstId; i < FirstId + nbRecords; ++i )
+    {
+        auto id = std::to_string( i );
+        execute( conn, "INSERT INTO Folder(id_folder, path, parent_id, device_id, "
+                 "is_removable) VALUES(" + id + ", 'file:///mock/folder%20" + id +
+                 "/', 1, 1, 0)" );
+        execute( conn, "INSERT INTO Media(id_media, type, insertion_date, title, "
+                 "filename) VALUES(" + id + ", 1, 1522231538, 'media " + id +
+                 "', 'media%20" + id + ".avi')" );
+        execute( conn, "INSERT INTO File(id_file, media_id, mrl, type, folder_id, "
+                 "is_removable, is_external) VALUES(" + id + ", " + id +
+                 ", 'media%20" + id + ".avi', 1, " + id + ", 0, 0)" );
+    }
+    execute( conn, "COMMIT" );
+    medialibrary::sqlite::Statement::FlushStatementCache();
+    return true;
+}
+
+}
+
+/*
+ * Measures the time required to migrate a large model 13 database to the
+ * current model. The number of records can be provided as the first argument.
+ */
+int main( int argc, char** argv )
+{
+    auto nbRecords = DefaultNbRecords;
+    if ( argc > 1 )
+        nbRecords = static_cast<uint32_t>( strtoul( argv[1], nullptr, 10 ) );
+    std::cout << "Populating " << DbPath << " with " << nbRecords
+              << " records" << std::endl;
+    if ( populate( nbRecords ) == false )
+    {
+        std::cerr << "Failed to populate " << DbPath << std::endl;
+        return 1;
+    }
+
+    ProgressCallback callback;
+    std::unique_ptr<MediaLibraryTester> ml( new MediaLibraryTester );
+    ml->setFsFactory( std::make_shared<mock::NoopFsFactory>() );
+    ml->setDeviceLister( std::make_shared<mock::MockDeviceLister>() );
+    ml->setVerbosity( LogLevel::Error );
+    auto chrono = std::chrono::steady_clock::now();
+    auto res = ml->initialize( DbPath, "/tmp", &callback );
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - chrono );
+    if ( res != InitializeResult::Success )
+    {
+        std::cerr << "Failed to migrate " << DbPath << std::endl;
+        return 1;
+    }
+    std::cout << "Migrated " << nbRecords << " records in " << duration.count()
+              << "ms" << std::endl;
+    return 0;
+}
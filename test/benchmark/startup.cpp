@@ -0,0 +1,125 @@
+/*****************************************************************************
+ * Media Library
+ *****************************************************************************
+ * Copyright (C) 2019 Hugo Beauzée-Luyssen, Videolabs, VideoLAN
+ *
+ * Authors: Hugo Beauzée-Luyssen<hugo@beauzee.fr>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#if HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "common/MediaLibraryTester.h"
+#include "mocks/FileSystem.h"
+#include "mocks/MockDeviceLister.h"
+#include "mocks/NoopCallback.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <unistd.h>
+
+namespace
+{
+
+const char* const DbPath = "startup_benchmark.db";
+constexpr auto DefaultNbRuns = 50u;
+
+mock::NoopCallback callback;
+
+std::unique_ptr<MediaLibraryTester> instantiate()
+{
+    std::unique_ptr<MediaLibraryTester> ml( new MediaLibraryTester );
+    ml->setFsFactory( std::make_shared<mock::NoopFsFactory>() );
+    ml->setDeviceLister( std::make_shared<mock::MockDeviceLister>() );
+    ml->setVerbosity( LogLevel::Error );
+    if ( ml->initialize( DbPath, "/tmp", &callback ) != InitializeResult::Success )
+        return nullptr;
+    return ml;
+}
+
+/*
+ * Forgets the schema fingerprint, which forces the next initialization to
+ * create the schema
+ */
+bool clearFingerprint()
+{
+    medialibrary::sqlite::Connection::Handle conn;
+    if ( sqlite3_open( DbPath, &conn ) != SQLITE_OK )
+        return false;
+    std::unique_ptr<sqlite3, int(*)(sqlite3*)> dbPtr{ conn, &sqlite3_close };
+    return sqlite3_exec( conn, "PRAGMA user_version = 0", nullptr, nullptr,
+                         nullptr ) == SQLITE_OK;
+}
+
+/*
+ * Returns the average initialization time, in microseconds
+ */
+int64_t run( uint32_t nbRuns, bool withFingerprint )
+{
+    std::chrono::microseconds total{ 0 };
+    for ( auto i = 0u; i < nbRuns; ++i )
+    {
+        if ( withFingerprint == false && clearFingerprint() == false )
+            return -1;
+        auto chrono = std::chrono::steady_clock::now();
+        auto ml = instantiate();
+        total += std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - chrono );
+        if ( ml == nullptr )
+            return -1;
+    }
+    return total.count() / nbRuns;
+}
+
+}
+
+/*
+ * Compares the time required to initialize the media library with an existing
+ * database, when the schema has to be created, and when its fingerprint
+ * matches. The number of runs can be provided as the first argument.
+ */
+int main( int argc, char** argv )
+{
+    auto nbRuns = DefaultNbRuns;
+    if ( argc > 1 )
+        nbRuns = std::max( 1u, static_cast<uint32_t>( strtoul( argv[1], nullptr, 10 ) ) );
+    unlink( DbPath );
+    unlink( ( std::string{ DbPath } + "-wal" ).c_str() );
+    unlink( ( std::string{ DbPath } + "-shm" ).c_str() );
+    if ( instantiate() == nullptr )
+    {
+        std::cerr << "Failed to create " << DbPath << std::endl;
+        return 1;
+    }
+    auto withoutFingerprint = run( nbRuns, false );
+    auto withFingerprint = run( nbRuns, true );
+    if ( withoutFingerprint < 0 || withFingerprint < 0 )
+    {
+        std::cerr << "Failed to initialize the media library" << std::endl;
+        return 1;
+    }
+    std::cout << std::left << std::setw( 24 ) << "Schema creation"
+              << std::right << std::setw( 10 ) << withoutFingerprint << "us" << std::endl
+              << std::left << std::setw( 24 ) << "Matching fingerprint"
+              << std::right << std::setw( 10 ) << withFingerprint << "us" << std::endl;
+    return 0;
+}
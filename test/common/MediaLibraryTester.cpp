@@ -180,13 +180,14 @@ std::vector<const char*> MediaLibraryTester::getSupportedExtensions() const
     return res;
 }
 
-void MediaLibraryTester::onDiscoveredFile(std::shared_ptr<fs::IFile> fileFs,
+void MediaLibraryTester::onDiscoveredFiles(std::vector<std::shared_ptr<fs::IFile>> filesFs,
                                 std::shared_ptr<Folder> parentFolder,
                                 std::shared_ptr<fs::IDirectory> parentFolderFs,
                                 IFile::Type fileType,
                                 std::pair<std::shared_ptr<Playlist>, unsigned int>)
 {
-    addFile( fileFs, parentFolder, parentFolderFs, fileType, IMedia::Type::Unknown );
+    for ( const auto& fileFs : filesFs )
+        addFile( fileFs, parentFolder, parentFolderFs, fileType, IMedia::Type::Unknown );
 }
 
 sqlite::Connection* MediaLibraryTester::getDbConn()
@@ -69,11 +69,11 @@ public:
     virtual void addLocalFsFactory() override;
     std::shared_ptr<Device> device( const std::string& uuid );
     std::vector<const char*> getSupportedExtensions() const;
-    virtual void onDiscoveredFile( std::shared_ptr<fs::IFile> fileFs,
-                                   std::shared_ptr<Folder> parentFolder,
-                                   std::shared_ptr<fs::IDirectory> parentFolderFs,
-                                   IFile::Type fileType,
-                                   std::pair<std::shared_ptr<Playlist>, unsigned int> parentPlaylist ) override;
+    virtual void onDiscoveredFiles( std::vector<std::shared_ptr<fs::IFile>> filesFs,
+                                    std::shared_ptr<Folder> parentFolder,
+                                    std::shared_ptr<fs::IDirectory> parentFolderFs,
+                                    IFile::Type fileType,
+                                    std::pair<std::shared_ptr<Playlist>, unsigned int> parentPlaylist ) override;
     sqlite::Connection* getDbConn();
     virtual void startThumbnailer() override;
     virtual void populateNetworkFsFactories() override;
@@ -113,6 +113,7 @@ private:
         m_cond.notify_all();
     }
     virtual void onMediaThumbnailReady(medialibrary::MediaPtr, bool ) override {}
+    virtual void onMigrationProgress(uint32_t, uint32_t ) override {}
 
 private:
     std::condition_variable m_cond;
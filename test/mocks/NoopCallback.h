@@ -57,6 +57,7 @@ class NoopCallback : public IMediaLibraryCb
     virtual void onEntryPointUnbanned( const std::string&, bool ) override {}
     virtual void onBackgroundTasksIdleChanged( bool ) override {}
     virtual void onMediaThumbnailReady( MediaPtr, bool ) override {}
+    virtual void onMigrationProgress( uint32_t, uint32_t ) override {}
 };
 
 }
@@ -148,6 +148,8 @@ bool MockResumeCallback::waitForParsingComplete()
 void Tests::SetUp()
 {
     unlink("test.db");
+    unlink("test.db-wal");
+    unlink("test.db-shm");
     InitializeCallback();
     InitializeMediaLibrary();
     if ( ExtraVerbose == true )
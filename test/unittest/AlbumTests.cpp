@@ -337,6 +337,25 @@ TEST_F( Albums, SearchAfterDeletion )
     ASSERT_EQ( 0u, albums.size() );
 }
 
+TEST_F( Albums, FuzzySearch )
+{
+    auto a = ml->createAlbum( "sea otters" );
+    auto m = std::static_pointer_cast<Media>( ml->addMedia( "media.mp3" ) );
+    a->addTrack( m, 1, 0, 0, nullptr );
+    m->save();
+    auto a2 = ml->createAlbum( "pangolins of fire" );
+    auto m2 = std::static_pointer_cast<Media>( ml->addMedia( "media2.mp3" ) );
+    a2->addTrack( m2, 1, 0, 0, nullptr );
+    m2->save();
+
+    auto albums = ml->fuzzySearchAlbums( "sea oters" )->all();
+    ASSERT_EQ( 1u, albums.size() );
+    ASSERT_EQ( a->id(), albums[0]->id() );
+
+    ml->deleteAlbum( a->id() );
+    ASSERT_EQ( 0u, ml->fuzzySearchAlbums( "sea oters" )->count() );
+}
+
 TEST_F( Albums, SearchAfterArtistUpdate )
 {
     auto a = ml->createAlbum( "sea otters" );
@@ -567,6 +586,35 @@ TEST_F( Albums, SortByArtist )
     ASSERT_EQ( a1->id(), albums[2]->id() );
 }
 
+TEST_F( Albums, SeekPagination )
+{
+    auto artist1 = ml->createArtist( "Artist" );
+    auto artist2 = ml->createArtist( "tsitrA" );
+    for ( auto i = 0u; i < 5u; ++i )
+    {
+        auto a = ml->createAlbum( "album " + std::to_string( ( i * 2 ) % 5 ) );
+        auto m = std::static_pointer_cast<Media>( ml->addMedia(
+                        "media" + std::to_string( i ) + ".mp3" ) );
+        a->addTrack( m, 1, 0, i % 2 == 0 ? artist1->id() : artist2->id(), nullptr );
+        a->setAlbumArtist( i % 2 == 0 ? artist1 : artist2 );
+        a->setReleaseYear( 2000 + i % 3, false );
+        m->save();
+        for ( auto j = 0u; j < ( i * 3 ) % 5; ++j )
+            ASSERT_TRUE( m->increasePlayCount() );
+    }
+
+    for ( auto sort : { SortingCriteria::Alpha, SortingCriteria::Artist,
+                        SortingCriteria::PlayCount, SortingCriteria::ReleaseDate } )
+    {
+        QueryParameters params{ sort, false };
+        checkSeekPagination( ml->albums( &params ), 2 );
+        checkSeekPagination( artist1->albums( &params ), 2 );
+        params.desc = true;
+        checkSeekPagination( ml->albums( &params ), 2 );
+        checkSeekPagination( artist1->albums( &params ), 2 );
+    }
+}
+
 TEST_F( Albums, Duration )
 {
     auto a = ml->createAlbum( "album" );
@@ -473,6 +473,21 @@ TEST_F( Artists, Sort )
     ASSERT_EQ( a2->id(), artists[0]->id() );
 }
 
+TEST_F( Artists, SeekPagination )
+{
+    for ( auto i = 0u; i < 5u; ++i )
+    {
+        auto a = ml->createArtist( "artist " + std::to_string( ( i * 2 ) % 5 ) );
+        auto alb = ml->createAlbum( "album" + std::to_string( i ) );
+        alb->setAlbumArtist( a );
+    }
+
+    QueryParameters params { SortingCriteria::Alpha, false };
+    checkSeekPagination( ml->artists( false, &params ), 2 );
+    params.desc = true;
+    checkSeekPagination( ml->artists( false, &params ), 2 );
+}
+
 TEST_F( Artists, DeleteWhenNoAlbum )
 {
     auto artist = ml->createArtist( "artist" );
@@ -581,6 +596,41 @@ TEST_F( Artists, Query )
     ASSERT_EQ( 2u, artists.size() );
 }
 
+TEST_F( Artists, FuzzySearch )
+{
+    auto a = ml->createArtist( "Metallica" );
+    auto a2 = ml->createArtist( "Megadeth" );
+    a->updateNbTrack( 1 );
+    a2->updateNbTrack( 1 );
+
+    auto artists = ml->fuzzySearchArtists( "metalica", true )->all();
+    ASSERT_EQ( 1u, artists.size() );
+    ASSERT_EQ( a->id(), artists[0]->id() );
+
+    // Artists without albums are only returned when includeAll is true
+    ASSERT_EQ( 0u, ml->fuzzySearchArtists( "metalica", false )->count() );
+}
+
+TEST_F( Artists, SearchByRelevance )
+{
+    auto a1 = ml->createArtist( "A band of otter friends" );
+    auto a2 = ml->createArtist( "Otter" );
+    a1->updateNbTrack( 1 );
+    a2->updateNbTrack( 1 );
+
+    QueryParameters params { SortingCriteria::Relevance, false };
+    auto artists = ml->searchArtists( "otter", true, &params )->all();
+    ASSERT_EQ( 2u, artists.size() );
+    ASSERT_EQ( a2->id(), artists[0]->id() );
+    ASSERT_EQ( a1->id(), artists[1]->id() );
+
+    params.desc = true;
+    artists = ml->searchArtists( "otter", true, &params )->all();
+    ASSERT_EQ( 2u, artists.size() );
+    ASSERT_EQ( a1->id(), artists[0]->id() );
+    ASSERT_EQ( a2->id(), artists[1]->id() );
+}
+
 TEST_F( Artists, SearchAlbums )
 {
     auto artist = ml->createArtist( "artist" );
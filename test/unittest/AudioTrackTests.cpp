@@ -70,6 +70,24 @@ TEST_F( AudioTracks, GetSetProperties )
     ASSERT_EQ( t->description(), "test desc" );
 }
 
+TEST_F( AudioTracks, CreateBatch )
+{
+    auto f = std::static_pointer_cast<Media>( ml->addMedia( "file.mp3" ) );
+    std::vector<AudioTrack::Record> records;
+    records.emplace_back( "PCM", 128, 44100, 2, "en", "test desc", f->id() );
+    records.emplace_back( "WMA", 128, 48000, 2, "fr", "test desc 2", f->id() );
+    ASSERT_TRUE( AudioTrack::createBatch( ml.get(), records ) );
+
+    auto ts = f->audioTracks()->all();
+    ASSERT_EQ( 2u, ts.size() );
+    ASSERT_EQ( "PCM", ts[0]->codec() );
+    ASSERT_EQ( 44100u, ts[0]->sampleRate() );
+    ASSERT_EQ( "WMA", ts[1]->codec() );
+    ASSERT_EQ( 48000u, ts[1]->sampleRate() );
+
+    ASSERT_TRUE( AudioTrack::createBatch( ml.get(), {} ) );
+}
+
 TEST_F( AudioTracks, FetchTracks )
 {
     auto f = std::static_pointer_cast<Media>( ml->addMedia( "file.mp3" ) );
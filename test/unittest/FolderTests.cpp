@@ -29,6 +29,10 @@
 #include "Media.h"
 #include "File.h"
 #include "Folder.h"
+#include "Device.h"
+#include "Label.h"
+#include "parser/Task.h"
+#include "database/SqliteTools.h"
 #include "medialibrary/IMediaLibrary.h"
 #include "utils/Filename.h"
 #include "utils/Url.h"
@@ -658,6 +662,24 @@ TEST_F( FoldersNoDiscover, ListWithMedia )
     ASSERT_EQ( 1u, mediaQuery->all().size() );
 }
 
+TEST_F( FoldersNoDiscover, SeekPagination )
+{
+    ml->discover( mock::FileSystemFactory::Root );
+    bool discovered = cbMock->waitDiscovery();
+    ASSERT_TRUE( discovered );
+
+    enforceFakeMediaTypes( ml.get() );
+
+    for ( auto sort : { SortingCriteria::Alpha, SortingCriteria::NbMedia,
+                        SortingCriteria::NbAudio, SortingCriteria::NbVideo } )
+    {
+        QueryParameters params{ sort, false };
+        checkSeekPagination( ml->folders( IMedia::Type::Unknown, &params ), 1 );
+        params.desc = true;
+        checkSeekPagination( ml->folders( IMedia::Type::Unknown, &params ), 1 );
+    }
+}
+
 TEST_F( FoldersNoDiscover, ListSubFolders )
 {
     auto newFolder = mock::FileSystemFactory::Root + "empty/";
@@ -747,3 +769,111 @@ TEST_F( FoldersNoDiscover, Name )
     ASSERT_EQ( "folder with spaces", spacesFolder->name() );
     ASSERT_EQ( newFolder, spacesFolder->mrl() );
 }
+
+TEST_F( Folders, IdentityMap )
+{
+    auto root = ml->folder( 1 );
+    ASSERT_NE( nullptr, root );
+    // A live folder is shared by all the callers
+    ASSERT_EQ( root, ml->folder( 1 ) );
+    ASSERT_EQ( root, Folder::fetch( ml.get(), 1 ) );
+
+    // Modifying its record evicts it
+    sqlite::Tools::executeUpdate( ml->getDbConn(), "UPDATE " + Folder::Table::Name +
+                                  " SET name = 'renamed' WHERE id_folder = 1" );
+    auto renamed = ml->folder( 1 );
+    ASSERT_NE( root, renamed );
+    ASSERT_EQ( "renamed", renamed->name() );
+    ASSERT_EQ( renamed, ml->folder( 1 ) );
+
+    // And so does modifying its device
+    ml->outdateAllDevices();
+    ASSERT_NE( renamed, ml->folder( 1 ) );
+
+    // Rows modified during a rolled back transaction are reloaded as well
+    auto folder = ml->folder( 1 );
+    {
+        auto t = ml->getDbConn()->newTransaction();
+        sqlite::Tools::executeUpdate( ml->getDbConn(), "UPDATE " + Folder::Table::Name +
+                                      " SET name = 'rolled back' WHERE id_folder = 1" );
+        auto f = ml->folder( 1 );
+        ASSERT_EQ( "rolled back", f->name() );
+    }
+    folder = ml->folder( 1 );
+    ASSERT_EQ( "renamed", folder->name() );
+}
+
+TEST_F( Folders, IdentityMapTransaction )
+{
+    auto root = ml->folder( 1 );
+    ASSERT_NE( nullptr, root );
+    {
+        // Entities loaded during a transaction might never be committed, so
+        // they don't go through the identity map
+        auto t = ml->getDbConn()->newTransaction();
+        auto f = ml->folder( 1 );
+        ASSERT_NE( root, f );
+        ASSERT_NE( f, ml->folder( 1 ) );
+        sqlite::Tools::executeUpdate( ml->getDbConn(), "UPDATE " + Folder::Table::Name +
+                                      " SET name = 'uncommitted' WHERE id_folder = 1" );
+        ASSERT_EQ( "uncommitted", ml->folder( 1 )->name() );
+    }
+    auto f = ml->folder( 1 );
+    ASSERT_NE( "uncommitted", f->name() );
+    ASSERT_EQ( f, ml->folder( 1 ) );
+}
+
+TEST_F( FoldersNoDiscover, TaskCreateBatch )
+{
+    auto device = ml->addDevice( "{task-batch}", false );
+    mock::NoopDevice deviceFs;
+    auto folder = Folder::create( ml.get(), "file:///media/folder/", 0, *device,
+                                  deviceFs );
+    ASSERT_NE( nullptr, folder );
+    auto dirFs = std::make_shared<mock::NoopDirectory>();
+    auto file = []( const std::string& name ) -> std::shared_ptr<fs::IFile> {
+        return std::make_shared<mock::NoopFile>( "file:///media/folder/" + name );
+    };
+    auto tasks = parser::Task::createBatch( ml.get(), { file( "c.mkv" ) }, folder,
+                                            dirFs, IFile::Type::Main,
+                                            { nullptr, 0 } );
+    ASSERT_EQ( 1u, tasks.size() );
+    auto existingId = tasks[0]->id();
+
+    // The duplicated & already existing files must be ignored, without
+    // returning a task using the previously inserted row id
+    tasks = parser::Task::createBatch( ml.get(), { file( "a.mkv" ), file( "b.mkv" ),
+                                       file( "a.mkv" ), file( "c.mkv" ) }, folder,
+                                       dirFs, IFile::Type::Main, { nullptr, 0 } );
+    ASSERT_EQ( 2u, tasks.size() );
+    ASSERT_NE( tasks[0]->id(), tasks[1]->id() );
+    for ( const auto& t : tasks )
+    {
+        ASSERT_NE( 0, t->id() );
+        ASSERT_NE( existingId, t->id() );
+        medialibrary::sqlite::Statement stmt{ ml->getDbConn()->handle(),
+                "SELECT mrl FROM " + parser::Task::Table::Name + " WHERE id_task = ?" };
+        stmt.execute( t->id() );
+        auto row = stmt.row();
+        ASSERT_TRUE( row != nullptr );
+        std::string mrl;
+        row >> mrl;
+        ASSERT_EQ( t->item().mrl(), mrl );
+    }
+
+    // The underlying batch insertion reports the ignored rows with a 0 id
+    const std::string req = "INSERT OR IGNORE INTO " + Label::Table::Name +
+            "(name) VALUES(?)";
+    std::vector<std::tuple<std::string>> records{
+        std::make_tuple( std::string{ "label" } ),
+        std::make_tuple( std::string{ "label" } ),
+        std::make_tuple( std::string{ "other label" } ),
+    };
+    auto ids = medialibrary::sqlite::Tools::executeBatchInsert( ml->getConn(), req,
+                                                               records );
+    ASSERT_EQ( 3u, ids.size() );
+    ASSERT_NE( 0, ids[0] );
+    ASSERT_EQ( 0, ids[1] );
+    ASSERT_NE( 0, ids[2] );
+    ASSERT_NE( ids[0], ids[2] );
+}
@@ -35,6 +35,8 @@
 #include "mocks/FileSystem.h"
 #include "mocks/DiscovererCbMock.h"
 #include "compat/Thread.h"
+#include "compat/ConditionVariable.h"
+#include "compat/Mutex.h"
 #include "Playlist.h"
 
 class Medias : public Tests
@@ -126,6 +128,40 @@ TEST_F( Medias, PlayCount )
     ASSERT_EQ( 1u, f->playCount() );
 }
 
+TEST_F( Medias, CoalescedWrites )
+{
+    auto f = std::static_pointer_cast<Media>( ml->addMedia( "media.avi" ) );
+    // Use a long enough delay for the writes not to be flushed automatically
+    ml->setWriteCoalescingDelay( 60000 );
+    ASSERT_TRUE( f->increasePlayCount() );
+    ASSERT_TRUE( f->setFavorite( true ) );
+    ASSERT_TRUE( f->setMetadata( Media::MetadataType::Progress, 123 ) );
+    ASSERT_EQ( 1u, f->playCount() );
+    ASSERT_TRUE( f->isFavorite() );
+
+    auto m = ml->media( f->id() );
+    ASSERT_EQ( 0u, m->playCount() );
+    ASSERT_FALSE( m->isFavorite() );
+    // Incrementing the play count from an outdated instance must not
+    // overwrite the pending increment
+    ASSERT_TRUE( m->increasePlayCount() );
+
+    ml->flushPendingWrites();
+
+    m = ml->media( f->id() );
+    ASSERT_EQ( 2u, m->playCount() );
+    ASSERT_TRUE( m->isFavorite() );
+    ASSERT_EQ( 123, m->metadata( Media::MetadataType::Progress ).integer() );
+
+    // Pending writes must be committed when the media library gets released
+    ASSERT_TRUE( f->increasePlayCount() );
+
+    Reload();
+
+    m = ml->media( f->id() );
+    ASSERT_EQ( 3u, m->playCount() );
+}
+
 TEST_F( Medias, Progress )
 {
     auto f = std::static_pointer_cast<Media>( ml->addMedia( "media.avi" ) );
@@ -232,6 +268,220 @@ TEST_F( Medias, SearchAfterDelete )
     ASSERT_EQ( 0u, media.size() );
 }
 
+TEST_F( Medias, SearchSpecialCharacters )
+{
+    auto m = ml->addMedia( "media.mp3", IMedia::Type::Audio );
+    m->setTitle( "Hélène & \"AC/DC\" - NOT OR" );
+
+    auto media = ml->searchMedia( "hele", nullptr )->all();
+    ASSERT_EQ( 1u, media.size() );
+
+    media = ml->searchMedia( "ac/dc", nullptr )->all();
+    ASSERT_EQ( 1u, media.size() );
+
+    media = ml->searchMedia( "\"AC", nullptr )->all();
+    ASSERT_EQ( 1u, media.size() );
+
+    // FTS operators must be matched as plain words
+    media = ml->searchMedia( "NOT OR", nullptr )->all();
+    ASSERT_EQ( 1u, media.size() );
+
+    media = ml->searchMedia( "hel*ne", nullptr )->all();
+    ASSERT_EQ( 0u, media.size() );
+}
+
+TEST_F( Medias, SearchByRelevance )
+{
+    auto m1 = ml->addMedia( "media1.mp3", IMedia::Type::Audio );
+    m1->setTitle( "Sea otter" );
+    auto m2 = ml->addMedia( "media2.mp3", IMedia::Type::Audio );
+    m2->setTitle( "A documentary about the otter and its friends" );
+    auto m3 = ml->addMedia( "media3.mp3", IMedia::Type::Audio );
+    m3->setTitle( "Pangolins" );
+    m3->addLabel( ml->createLabel( "documentary" ) );
+
+    QueryParameters params { SortingCriteria::Alpha, false };
+    auto media = ml->searchMedia( "otter", &params )->all();
+    ASSERT_EQ( 2u, media.size() );
+    ASSERT_EQ( m2->id(), media[0]->id() );
+    ASSERT_EQ( m1->id(), media[1]->id() );
+
+    // The shortest title ranks first
+    params.sort = SortingCriteria::Relevance;
+    auto query = ml->searchMedia( "otter", &params );
+    ASSERT_EQ( 2u, query->count() );
+    media = query->items( 1, 0 );
+    ASSERT_EQ( 1u, media.size() );
+    ASSERT_EQ( m1->id(), media[0]->id() );
+
+    params.desc = true;
+    media = ml->searchMedia( "otter", &params )->all();
+    ASSERT_EQ( 2u, media.size() );
+    ASSERT_EQ( m2->id(), media[0]->id() );
+    ASSERT_EQ( m1->id(), media[1]->id() );
+
+    // The media matched by a label are ranked along with the others
+    params.desc = false;
+    query = ml->searchMedia( "documentary", &params );
+    ASSERT_EQ( 2u, query->count() );
+    ASSERT_EQ( 2u, query->all().size() );
+}
+
+TEST_F( Medias, SearchSession )
+{
+    auto m1 = ml->addMedia( "media1.mp3", IMedia::Type::Audio );
+    m1->setTitle( "The Beatles - Help" );
+    auto m2 = ml->addMedia( "media2.mp3", IMedia::Type::Audio );
+    m2->setTitle( "Beat It" );
+    auto m3 = ml->addMedia( "media3.mp3", IMedia::Type::Audio );
+    m3->setTitle( "Beethoven" );
+    auto m4 = ml->addMedia( "media4.mp3", IMedia::Type::Audio );
+    m4->setTitle( "Café del mar" );
+    m4->addLabel( ml->createLabel( "beach" ) );
+
+    auto session = ml->createSearchSession();
+    ASSERT_EQ( nullptr, session->searchMedia( "be" ) );
+
+    QueryParameters params { SortingCriteria::Alpha, false };
+    auto media = session->searchMedia( "bea", &params )->all();
+    ASSERT_EQ( 3u, media.size() );
+    ASSERT_EQ( m2->id(), media[0]->id() );
+    ASSERT_EQ( m4->id(), media[1]->id() );
+    ASSERT_EQ( m1->id(), media[2]->id() );
+
+    // Those are found among the previous matches
+    media = session->searchMedia( "beatl", &params )->all();
+    ASSERT_EQ( 1u, media.size() );
+    ASSERT_EQ( m1->id(), media[0]->id() );
+    media = session->searchMedia( "beat", &params )->all();
+    ASSERT_EQ( 2u, media.size() );
+    media = session->searchMedia( "beat i", &params )->all();
+    ASSERT_EQ( 1u, media.size() );
+    ASSERT_EQ( m2->id(), media[0]->id() );
+
+    // This one doesn't extend the previous patterns
+    media = session->searchMedia( "beet", &params )->all();
+    ASSERT_EQ( 1u, media.size() );
+    ASSERT_EQ( m3->id(), media[0]->id() );
+
+    // The diacritics are left to the full text index
+    ASSERT_EQ( 1u, session->searchMedia( "caf", &params )->count() );
+    media = session->searchMedia( "cafe", &params )->all();
+    ASSERT_EQ( 1u, media.size() );
+    ASSERT_EQ( m4->id(), media[0]->id() );
+
+    // The matches are forgotten once the index gets modified
+    ASSERT_EQ( 2u, session->searchMedia( "beat", &params )->count() );
+    m3->setTitle( "Beat Street" );
+    media = session->searchMedia( "beat s", &params )->all();
+    ASSERT_EQ( 1u, media.size() );
+    ASSERT_EQ( m3->id(), media[0]->id() );
+
+    // The results are the same as the regular search ones
+    params.desc = true;
+    media = session->searchMedia( "beat", &params )->all();
+    auto expected = ml->searchMedia( "beat", &params )->all();
+    ASSERT_EQ( expected.size(), media.size() );
+    for ( auto i = 0u; i < media.size(); ++i )
+        ASSERT_EQ( expected[i]->id(), media[i]->id() );
+}
+
+TEST_F( Medias, FuzzySearch )
+{
+    auto m1 = ml->addMedia( "media1.mp3", IMedia::Type::Audio );
+    m1->setTitle( "The Beatles - Help" );
+    auto m2 = ml->addMedia( "media2.mp3", IMedia::Type::Audio );
+    m2->setTitle( "Beat It" );
+    auto m3 = ml->addMedia( "media3.mp3", IMedia::Type::Audio );
+    m3->setTitle( "Pangolins of fire" );
+
+    // The typo makes the regular search fail
+    ASSERT_EQ( 0u, ml->searchMedia( "beatels", nullptr )->count() );
+
+    auto query = ml->fuzzySearchMedia( "beatels" );
+    ASSERT_EQ( 2u, query->count() );
+    auto media = query->all();
+    ASSERT_EQ( 2u, media.size() );
+    // Both media share as many trigrams with the pattern, so they are sorted
+    // alphabetically
+    ASSERT_EQ( m2->id(), media[0]->id() );
+    ASSERT_EQ( m1->id(), media[1]->id() );
+
+    // The media sharing the most trigrams come first, whatever the sorting
+    QueryParameters params { SortingCriteria::Alpha, false };
+    media = ml->fuzzySearchMedia( "beatles", &params )->all();
+    ASSERT_EQ( 2u, media.size() );
+    ASSERT_EQ( m1->id(), media[0]->id() );
+    ASSERT_EQ( m2->id(), media[1]->id() );
+
+    media = ml->fuzzySearchMedia( "PANGOLIN" )->all();
+    ASSERT_EQ( 1u, media.size() );
+    ASSERT_EQ( m3->id(), media[0]->id() );
+
+    // The trigrams are updated along with the title
+    m3->setTitle( "Otters of fire" );
+    ASSERT_EQ( 0u, ml->fuzzySearchMedia( "pangolin" )->count() );
+    ml->deleteMedia( m1->id() );
+    media = ml->fuzzySearchMedia( "beatels" )->all();
+    ASSERT_EQ( 1u, media.size() );
+    ASSERT_EQ( m2->id(), media[0]->id() );
+
+    ASSERT_EQ( nullptr, ml->fuzzySearchMedia( "be" ) );
+}
+
+TEST_F( Medias, SearchBestMatches )
+{
+    auto m1 = ml->addMedia( "media1.mkv", IMedia::Type::Video );
+    m1->setTitle( "otter" );
+    auto m2 = ml->addMedia( "media2.mkv", IMedia::Type::Video );
+    m2->setTitle( "a movie about sea lions, penguins, seals and an otter" );
+    auto m3 = ml->addMedia( "media3.mkv", IMedia::Type::Video );
+    m3->setTitle( "otter otter" );
+    ml->addMedia( "pangolin.mkv", IMedia::Type::Video );
+    auto album = ml->createAlbum( "sea otters" );
+    auto track = std::static_pointer_cast<Media>( ml->addMedia( "track.mp3" ) );
+    album->addTrack( track, 1, 0, 0, nullptr );
+    track->save();
+    ml->createArtist( "otter band" )->updateNbTrack( 1 );
+    ml->createGenre( "otter rock" );
+    ml->createShow( "otter show" );
+    ml->createPlaylist( "otter playlist" );
+
+    auto res = ml->searchBestMatches( "otter", 2 );
+    ASSERT_EQ( 1u, res.albums.size() );
+    ASSERT_EQ( album->id(), res.albums[0]->id() );
+    ASSERT_EQ( 1u, res.artists.size() );
+    ASSERT_EQ( 1u, res.genres.size() );
+    ASSERT_EQ( 1u, res.shows.size() );
+    ASSERT_EQ( 1u, res.playlists.size() );
+    // The media whose title is the most relevant come first, and the long
+    // title doesn't make the cut
+    ASSERT_EQ( 2u, res.media.size() );
+    ASSERT_EQ( m3->id(), res.media[0]->id() );
+    ASSERT_EQ( m1->id(), res.media[1]->id() );
+
+    res = ml->searchBestMatches( "ot", 2 );
+    ASSERT_TRUE( res.media.empty() );
+
+    compat::Mutex lock;
+    compat::ConditionVariable cond;
+    bool done = false;
+    SearchResults asyncRes;
+    ml->searchBestMatchesAsync( "pangolin", 10,
+                                [&lock, &cond, &done, &asyncRes]( SearchResults r ) {
+        std::lock_guard<compat::Mutex> l( lock );
+        asyncRes = std::move( r );
+        done = true;
+        cond.notify_all();
+    });
+    std::unique_lock<compat::Mutex> l( lock );
+    ASSERT_TRUE( cond.wait_for( l, std::chrono::seconds{ 5 }, [&done]() {
+        return done;
+    }) );
+    ASSERT_EQ( 1u, asyncRes.media.size() );
+    ASSERT_TRUE( asyncRes.albums.empty() );
+}
+
 TEST_F( Medias, SearchByLabel )
 {
     auto m = std::static_pointer_cast<Media>( ml->addMedia( "media.mkv", IMedia::Type::Video ) );
@@ -662,6 +912,87 @@ TEST_F( Medias, Pagination )
     }
 }
 
+TEST_F( Medias, ForEach )
+{
+    for ( auto i = 1u; i <= 5u; ++i )
+        ml->addMedia( "track " + std::to_string( i ) + ".mp3", IMedia::Type::Audio );
+
+    auto query = ml->audioFiles( nullptr );
+    auto allMedia = query->all();
+    ASSERT_EQ( 5u, allMedia.size() );
+
+    auto i = 0u;
+    auto nbMedia = query->forEach( [&i, &allMedia, &query]( MediaPtr m ) {
+        // Running the same request while iterating must not disturb the iteration
+        EXPECT_EQ( 5u, query->all().size() );
+        EXPECT_EQ( allMedia[i]->id(), m->id() );
+        ++i;
+        return true;
+    });
+    ASSERT_EQ( 5u, nbMedia );
+    ASSERT_EQ( 5u, i );
+
+    // Stop the iteration early
+    nbMedia = query->forEach( []( MediaPtr m ) {
+        return m->id() < 2;
+    });
+    ASSERT_EQ( 2u, nbMedia );
+}
+
+TEST_F( Medias, SeekPagination )
+{
+    // Use titles, durations, albums & file names which don't follow the
+    // insertion order, and keep a track without album to check NULL handling
+    auto album1 = ml->createAlbum( "Z" );
+    auto album2 = ml->createAlbum( "A" );
+    auto nbAlbum1Tracks = 0u;
+    auto nbAlbum2Tracks = 0u;
+    for ( auto i = 0u; i < 7u; ++i )
+    {
+        auto m = std::static_pointer_cast<Media>( ml->addMedia(
+                        std::to_string( ( i * 2 ) % 7 ) + ".mp3", IMedia::Type::Audio ) );
+        m->setTitleBuffered( "title " + std::to_string( ( i * 3 ) % 7 ) );
+        m->setDuration( ( i * 5 ) % 7 * 100 );
+        if ( i == 2 )
+            ;
+        else if ( i % 3 == 1 )
+            album2->addTrack( m, ++nbAlbum2Tracks, 0, 0, nullptr );
+        else
+            album1->addTrack( m, ++nbAlbum1Tracks, 0, 0, nullptr );
+        m->save();
+    }
+
+    for ( auto sort : { SortingCriteria::Default, SortingCriteria::Duration,
+                        SortingCriteria::Album, SortingCriteria::Filename } )
+    {
+        QueryParameters params{ sort, false };
+        checkSeekPagination( ml->audioFiles( &params ), 3 );
+        params.desc = true;
+        checkSeekPagination( ml->audioFiles( &params ), 3 );
+    }
+
+    // Items which would otherwise be equal are sorted by their id
+    auto m1 = std::static_pointer_cast<Media>( ml->addMedia( "video.mkv", IMedia::Type::Video ) );
+    auto m2 = std::static_pointer_cast<Media>( ml->addMedia( "video2.mkv", IMedia::Type::Video ) );
+    m1->setTitle( "same title" );
+    m2->setTitle( "same title" );
+    auto query = ml->videoFiles( nullptr );
+    auto media = query->itemsAfter( 0, 0 );
+    ASSERT_EQ( 2u, media.size() );
+    ASSERT_EQ( m1->id(), media[0]->id() );
+    ASSERT_EQ( m2->id(), media[1]->id() );
+    media = query->itemsAfter( m1->id(), 0 );
+    ASSERT_EQ( 1u, media.size() );
+    ASSERT_EQ( m2->id(), media[0]->id() );
+    media = query->itemsBefore( m2->id(), 0 );
+    ASSERT_EQ( 1u, media.size() );
+    ASSERT_EQ( m1->id(), media[0]->id() );
+
+    // A cursor which isn't part of the listing doesn't yield any item
+    media = query->itemsAfter( album1->tracks( nullptr )->all()[0]->id(), 10 );
+    ASSERT_EQ( 0u, media.size() );
+}
+
 TEST_F( Medias, SortFilename )
 {
     auto m1 = std::static_pointer_cast<Media>( ml->addMedia( "AAAAB.mp3", IMedia::Type::Audio ) );
@@ -25,16 +25,27 @@
 #endif
 
 #include <fstream>
+#include <set>
 
 #include "Tests.h"
 #include "database/SqliteTools.h"
 #include "database/SqliteConnection.h"
+#include "database/SqliteTransaction.h"
+#include "database/MaintenanceWorker.h"
+#include "database/QueryExecutor.h"
 #include "utils/Strings.h"
+#include "compat/Thread.h"
+#include "compat/ConditionVariable.h"
 
+#include "Album.h"
 #include "Artist.h"
+#include "File.h"
+#include "Genre.h"
 #include "Media.h"
 #include "Metadata.h"
 #include "Playlist.h"
+#include "Show.h"
+#include "mocks/FileSystem.h"
 
 class Misc : public Tests
 {
@@ -58,6 +69,647 @@ TEST_F( Misc, TrimString )
     ASSERT_EQ( utils::str::trim( "" ), "" );
 }
 
+TEST_F( Misc, ReadDuringWriteTransaction )
+{
+    auto m = ml->addMedia( "media.mkv" );
+    auto t = ml->getDbConn()->newTransaction();
+    m->setTitle( "new title" );
+
+    // Readers don't wait for the transaction to complete, and can't see
+    // uncommitted changes
+    std::string title;
+    compat::Thread reader( [this, &m, &title]() {
+        title = ml->media( m->id() )->title();
+    });
+    reader.join();
+    ASSERT_EQ( "media.mkv", title );
+
+    t->commit();
+    auto m2 = ml->media( m->id() );
+    ASSERT_EQ( "new title", m2->title() );
+}
+
+TEST_F( Misc, NestedTransactions )
+{
+    auto nbFailures = 0u;
+    auto nbSuccesses = 0u;
+    auto onFailure = [&nbFailures]() { ++nbFailures; };
+    auto onSuccess = [&nbSuccesses]() { ++nbSuccesses; };
+    {
+        auto t = ml->getDbConn()->newTransaction();
+        ml->createGenre( "outer" );
+        sqlite::Transaction::onCurrentTransactionSuccess( onSuccess );
+        {
+            auto nested = ml->getDbConn()->newTransaction();
+            ml->createGenre( "committed" );
+            sqlite::Transaction::onCurrentTransactionSuccess( onSuccess );
+            nested->commit();
+        }
+        {
+            auto nested = ml->getDbConn()->newTransaction();
+            ml->createGenre( "rolled back" );
+            sqlite::Transaction::onCurrentTransactionFailure( onFailure );
+            sqlite::Transaction::onCurrentTransactionSuccess( onSuccess );
+        }
+        // Only the nested transaction was rolled back
+        ASSERT_TRUE( sqlite::Transaction::transactionInProgress() );
+        ASSERT_EQ( 1u, nbFailures );
+        ASSERT_EQ( 2u, ml->genres( nullptr )->count() );
+
+        // Nothing is visible outside of the outermost transaction until it
+        // gets committed
+        size_t nbGenres;
+        compat::Thread reader( [this, &nbGenres]() {
+            nbGenres = ml->genres( nullptr )->count();
+        });
+        reader.join();
+        ASSERT_EQ( 0u, nbGenres );
+        ASSERT_EQ( 0u, nbSuccesses );
+        t->commit();
+    }
+    ASSERT_FALSE( sqlite::Transaction::transactionInProgress() );
+    ASSERT_EQ( 2u, nbSuccesses );
+    ASSERT_EQ( 2u, ml->genres( nullptr )->count() );
+
+    // Committing a nested transaction doesn't prevent its changes from being
+    // rolled back along with the enclosing transaction
+    {
+        auto t = ml->getDbConn()->newTransaction();
+        {
+            auto nested = ml->getDbConn()->newTransaction();
+            ml->createGenre( "lost" );
+            sqlite::Transaction::onCurrentTransactionFailure( onFailure );
+            sqlite::Transaction::onCurrentTransactionSuccess( onSuccess );
+            nested->commit();
+        }
+    }
+    ASSERT_FALSE( sqlite::Transaction::transactionInProgress() );
+    ASSERT_EQ( 2u, nbFailures );
+    ASSERT_EQ( 2u, nbSuccesses );
+    ASSERT_EQ( 2u, ml->genres( nullptr )->count() );
+}
+
+TEST_F( Misc, NestedTransactionAfterImplicitRollback )
+{
+    auto nbFailures = 0u;
+    {
+        auto t = ml->getDbConn()->newTransaction();
+        ml->createGenre( "rolled back" );
+        sqlite::Transaction::onCurrentTransactionFailure( [&nbFailures]() {
+            ++nbFailures;
+        });
+        // Simulate SQLite rolling back the transaction after an error
+        sqlite3_exec( ml->getDbConn()->handle(), "ROLLBACK", nullptr, nullptr, nullptr );
+        // A savepoint would otherwise start & commit a transaction of its own
+        ASSERT_THROW( ml->getDbConn()->newTransaction(),
+                      sqlite::errors::TransactionRolledBack );
+    }
+    ASSERT_EQ( 1u, nbFailures );
+    ASSERT_EQ( 0u, ml->genres( nullptr )->count() );
+}
+
+TEST_F( Misc, StatementCacheEviction )
+{
+    auto h = ml->getDbConn()->handle();
+    auto previousMaxSize = sqlite::StatementCache::maxSize();
+    sqlite::Statement::FlushConnectionStatementCache( h );
+    sqlite::StatementCache::setMaxSize( 2 );
+    auto& cache = sqlite::StatementCache::forConnection( h );
+    {
+        sqlite::Statement s1( h, "SELECT 1" );
+        sqlite::Statement s2( h, "SELECT 2" );
+        // Running statements can't be evicted, so the cache must grow
+        sqlite::Statement s3( h, "SELECT 3" );
+        ASSERT_EQ( 3u, cache.size() );
+        s1.execute();
+        uint32_t res;
+        s1.row() >> res;
+        ASSERT_EQ( 1u, res );
+    }
+    {
+        sqlite::Statement s4( h, "SELECT 4" );
+        ASSERT_EQ( 2u, cache.size() );
+    }
+    {
+        // Hitting the cache doesn't change its size
+        sqlite::Statement s4( h, "SELECT 4" );
+        ASSERT_EQ( 2u, cache.size() );
+    }
+    sqlite::StatementCache::setMaxSize( previousMaxSize );
+}
+
+TEST_F( Misc, StatementCacheFlushFromOtherThread )
+{
+    auto h = ml->getDbConn()->handle();
+    sqlite::Statement::FlushConnectionStatementCache( h );
+    auto& cache = sqlite::StatementCache::forConnection( h );
+    {
+        sqlite::Statement s( h, "SELECT 1" );
+    }
+    ASSERT_EQ( 1u, cache.size() );
+
+    sqlite::Statement running( h, "SELECT 2" );
+    compat::Thread t( [h]() {
+        sqlite::Statement::FlushConnectionStatementCache( h );
+    });
+    t.join();
+    // Our cache is only dropped when we fetch a statement, and not before the
+    // running statement is done
+    ASSERT_EQ( 2u, cache.size() );
+    {
+        sqlite::Statement s( h, "SELECT 1" );
+        auto& newCache = sqlite::StatementCache::forConnection( h );
+        ASSERT_NE( &cache, &newCache );
+        ASSERT_EQ( 1u, newCache.size() );
+    }
+    running.execute();
+    uint32_t res;
+    running.row() >> res;
+    ASSERT_EQ( 2u, res );
+}
+
+TEST_F( Misc, ReadConnectionPool )
+{
+    auto m = ml->addMedia( "media.mkv" );
+    auto dbConn = ml->getDbConn();
+    {
+        auto ctx = dbConn->acquireReadContext();
+        // Nested contexts reuse the thread's pooled connection
+        auto ctx2 = dbConn->acquireReadContext();
+        ASSERT_EQ( ctx.handle(), ctx2.handle() );
+        ASSERT_NE( dbConn->handle(), ctx.handle() );
+        sqlite::Statement stmt( ctx.handle(), "UPDATE Media SET play_count = 1" );
+        stmt.execute();
+        ASSERT_THROW( stmt.row(), sqlite::errors::GenericExecution );
+    }
+    {
+        // During a transaction, the uncommitted changes must be visible
+        auto t = dbConn->newTransaction();
+        m->setTitle( "new title" );
+        ASSERT_EQ( dbConn->handle(), dbConn->acquireReadContext().handle() );
+        ASSERT_EQ( "new title", ml->media( m->id() )->title() );
+    }
+
+    compat::Mutex lock;
+    std::set<sqlite::Connection::Handle> handles;
+    std::vector<compat::Thread> threads;
+    auto poolSize = dbConn->tuning().nbReadConnections;
+    for ( auto i = 0u; i < poolSize * 2; ++i )
+    {
+        threads.emplace_back( [this, dbConn, &lock, &handles, &m]() {
+            for ( auto j = 0; j < 10; ++j )
+            {
+                auto ctx = dbConn->acquireReadContext();
+                ASSERT_EQ( "media.mkv", ml->media( m->id() )->title() );
+                std::lock_guard<compat::Mutex> l( lock );
+                handles.insert( ctx.handle() );
+            }
+        });
+    }
+    for ( auto& t : threads )
+        t.join();
+    ASSERT_GE( poolSize, handles.size() );
+}
+
+TEST_F( Misc, DatabaseTuning )
+{
+    auto pragma = []( sqlite::Connection::Handle h, const std::string& name ) {
+        sqlite::Statement stmt( h, "PRAGMA " + name );
+        stmt.execute();
+        auto row = stmt.row();
+        int64_t value;
+        row >> value;
+        return value;
+    };
+    // The per-thread connections keep SQLite's defaults
+    sqlite3* defaultConn;
+    ASSERT_EQ( SQLITE_OK, sqlite3_open( ":memory:", &defaultConn ) );
+    auto defaultCacheSize = pragma( defaultConn, "cache_size" );
+    sqlite3_close( defaultConn );
+    auto h = ml->getDbConn()->handle();
+    ASSERT_EQ( defaultCacheSize, pragma( h, "cache_size" ) );
+    ASSERT_EQ( 2, pragma( h, "synchronous" ) );
+    {
+        auto ctx = ml->getDbConn()->acquireReadContext();
+        ASSERT_EQ( -16 * 1024, pragma( ctx.handle(), "cache_size" ) );
+    }
+
+    // The page size can only be changed when creating the database
+    ml.reset();
+    unlink( "test.db" );
+    unlink( "test.db-wal" );
+    unlink( "test.db-shm" );
+    dbTuning.cacheSize = 512;
+    dbTuning.readCacheSize = 1024;
+    dbTuning.synchronous = SynchronousMode::Normal;
+    dbTuning.tempStore = TempStore::Memory;
+    dbTuning.pageSize = 8192;
+    dbTuning.nbReadConnections = 1;
+    Reload();
+
+    auto dbConn = ml->getDbConn();
+    h = dbConn->handle();
+    ASSERT_EQ( -512, pragma( h, "cache_size" ) );
+    ASSERT_EQ( 1, pragma( h, "synchronous" ) );
+    ASSERT_EQ( 2, pragma( h, "temp_store" ) );
+    ASSERT_EQ( 8192, pragma( h, "page_size" ) );
+    auto ctx = dbConn->acquireReadContext();
+    ASSERT_EQ( -1024, pragma( ctx.handle(), "cache_size" ) );
+    ASSERT_EQ( 1, pragma( ctx.handle(), "synchronous" ) );
+}
+
+TEST_F( Misc, DatabaseMaintenance )
+{
+    auto pragma = [this]( const std::string& req ) {
+        sqlite::Statement stmt( ml->getDbConn()->handle(), req );
+        stmt.execute();
+        auto row = stmt.row();
+        int64_t value;
+        row >> value;
+        while ( stmt.row() != nullptr )
+            ;
+        return value;
+    };
+    ASSERT_EQ( 2, pragma( "PRAGMA auto_vacuum" ) );
+
+    std::vector<int64_t> mediaIds;
+    for ( auto i = 0; i < 100; ++i )
+    {
+        auto m = ml->addMedia( "media" + std::to_string( i ) + ".mkv" );
+        m->setTitle( std::string( 2000, 'a' + i % 26 ) );
+        mediaIds.push_back( m->id() );
+    }
+    {
+        auto t = ml->getDbConn()->newTransaction();
+        for ( auto id : mediaIds )
+            ml->deleteMedia( id );
+        t->commit();
+    }
+    ASSERT_NE( 0, pragma( "PRAGMA freelist_count" ) );
+    ASSERT_EQ( 0, pragma( "SELECT COUNT(*) FROM sqlite_master WHERE name = 'sqlite_stat1'" ) );
+
+    MaintenanceWorker worker( ml.get() );
+    auto nbSteps = 0u;
+    while ( worker.runStep() == true )
+        ++nbSteps;
+    // Analyze, merge the FTS segments, then release the free pages
+    ASSERT_LT( 2u, nbSteps );
+    ASSERT_EQ( 0, pragma( "PRAGMA freelist_count" ) );
+    ASSERT_EQ( 1, pragma( "SELECT COUNT(*) FROM sqlite_master WHERE name = 'sqlite_stat1'" ) );
+    ASSERT_FALSE( worker.runStep() );
+}
+
+TEST_F( Misc, AsyncQueries )
+{
+    for ( auto i = 0; i < 3; ++i )
+        ml->addMedia( "media" + std::to_string( i ) + ".mkv", IMedia::Type::Video );
+    compat::Mutex lock;
+    compat::ConditionVariable cond;
+    std::vector<size_t> results;
+    {
+        // The query can be destroyed right away
+        auto query = ml->videoFiles( nullptr );
+        query->itemsAsync( 2, 0, [&lock, &cond, &results]( IQuery<IMedia>::Result res ) {
+            std::lock_guard<compat::Mutex> l( lock );
+            results.push_back( res.size() );
+            cond.notify_all();
+        });
+        query->countAsync( [&lock, &cond, &results]( size_t count ) {
+            std::lock_guard<compat::Mutex> l( lock );
+            results.push_back( count );
+            cond.notify_all();
+        });
+    }
+    {
+        std::unique_lock<compat::Mutex> l( lock );
+        auto res = cond.wait_for( l, std::chrono::seconds{ 5 }, [&results]() {
+            return results.size() == 2;
+        });
+        ASSERT_TRUE( res );
+        std::sort( begin( results ), end( results ) );
+        ASSERT_EQ( 2u, results[0] );
+        ASSERT_EQ( 3u, results[1] );
+        results.clear();
+    }
+
+    // Keep all the executor threads busy, so that the tagged requests pile up
+    bool release = false;
+    auto nbBlocked = 0u;
+    for ( auto i = 0u; i < QueryExecutor::DefaultNbThreads; ++i )
+    {
+        ml->videoFiles( nullptr )->countAsync( [&lock, &cond, &release, &nbBlocked]( size_t ) {
+            std::unique_lock<compat::Mutex> l( lock );
+            ++nbBlocked;
+            cond.notify_all();
+            cond.wait( l, [&release]() { return release; } );
+        });
+    }
+    {
+        std::unique_lock<compat::Mutex> l( lock );
+        auto res = cond.wait_for( l, std::chrono::seconds{ 5 }, [&nbBlocked]() {
+            return nbBlocked == QueryExecutor::DefaultNbThreads;
+        });
+        ASSERT_TRUE( res );
+    }
+    for ( auto i = 0u; i < 10; ++i )
+    {
+        ml->videoFiles( nullptr )->countAsync( [&lock, &cond, &results, i]( size_t ) {
+            std::lock_guard<compat::Mutex> l( lock );
+            results.push_back( i );
+            cond.notify_all();
+        }, 42 );
+    }
+    {
+        std::unique_lock<compat::Mutex> l( lock );
+        release = true;
+        cond.notify_all();
+        auto res = cond.wait_for( l, std::chrono::seconds{ 5 }, [&results]() {
+            return results.empty() == false;
+        });
+        ASSERT_TRUE( res );
+    }
+    // Only the latest request must have been run
+    ml->queryExecutor()->stop();
+    ASSERT_EQ( 1u, results.size() );
+    ASSERT_EQ( 9u, results[0] );
+}
+
+TEST_F( Misc, AsyncQueriesSupersededWhileRunning )
+{
+    compat::Mutex lock;
+    compat::ConditionVariable cond;
+    bool started = false;
+    bool release = false;
+    std::vector<int> results;
+    auto executor = ml->queryExecutor();
+    // The first request keeps running until the second one, using the same
+    // tag, has been delivered
+    executor->submit( 42, [&lock, &cond, &started, &release, &results]() {
+        std::unique_lock<compat::Mutex> l( lock );
+        started = true;
+        cond.notify_all();
+        cond.wait( l, [&release]() { return release; } );
+        return std::function<void()>{ [&lock, &cond, &results]() {
+            std::lock_guard<compat::Mutex> l( lock );
+            results.push_back( 1 );
+            cond.notify_all();
+        } };
+    });
+    {
+        std::unique_lock<compat::Mutex> l( lock );
+        auto res = cond.wait_for( l, std::chrono::seconds{ 5 }, [&started]() {
+            return started;
+        });
+        ASSERT_TRUE( res );
+    }
+    executor->submit( 42, [&lock, &cond, &results]() {
+        return std::function<void()>{ [&lock, &cond, &results]() {
+            std::lock_guard<compat::Mutex> l( lock );
+            results.push_back( 2 );
+            cond.notify_all();
+        } };
+    });
+    {
+        std::unique_lock<compat::Mutex> l( lock );
+        auto res = cond.wait_for( l, std::chrono::seconds{ 5 }, [&results]() {
+            return results.empty() == false;
+        });
+        ASSERT_TRUE( res );
+        release = true;
+        cond.notify_all();
+    }
+    // Once all the threads run another request, the superseded one has
+    // completed
+    auto nbRunning = 0u;
+    for ( auto i = 0u; i < QueryExecutor::DefaultNbThreads; ++i )
+    {
+        executor->submit( 0, [&lock, &cond, &nbRunning]() {
+            std::unique_lock<compat::Mutex> l( lock );
+            ++nbRunning;
+            cond.notify_all();
+            cond.wait( l, [&nbRunning]() {
+                return nbRunning == QueryExecutor::DefaultNbThreads;
+            });
+            return std::function<void()>{ []() {} };
+        });
+    }
+    {
+        std::unique_lock<compat::Mutex> l( lock );
+        auto res = cond.wait_for( l, std::chrono::seconds{ 5 }, [&nbRunning]() {
+            return nbRunning == QueryExecutor::DefaultNbThreads;
+        });
+        ASSERT_TRUE( res );
+    }
+    executor->stop();
+    ASSERT_EQ( 1u, results.size() );
+    ASSERT_EQ( 2, results[0] );
+}
+
+TEST_F( Misc, DatabaseStatistics )
+{
+    for ( auto i = 0; i < 3; ++i )
+        ml->addMedia( "media" + std::to_string( i ) + ".mkv" );
+    ml->resetDatabaseStatistics();
+
+    const std::string req = "SELECT * FROM Media WHERE id_media > ?";
+    for ( auto i = 0; i < 2; ++i )
+    {
+        sqlite::Statement stmt( ml->getDbConn()->handle(), req );
+        stmt.execute( 1 );
+        while ( stmt.row() != nullptr )
+            ;
+    }
+    sqlite::Tools::executeUpdate( ml->getDbConn(), "UPDATE Media SET play_count = 1" );
+
+    auto stats = ml->databaseStatistics();
+    auto it = std::find_if( begin( stats.requests ), end( stats.requests ),
+                            [&req]( const RequestStatistics& r ) {
+        return r.request == req;
+    });
+    ASSERT_NE( end( stats.requests ), it );
+    ASSERT_EQ( 2u, it->duration.count );
+    ASSERT_EQ( 4u, it->nbRows );
+    ASSERT_LE( it->duration.p50, it->duration.p99 );
+    ASSERT_LE( it->duration.p99, it->duration.max );
+    ASSERT_LE( it->duration.max, it->duration.total );
+    ASSERT_EQ( 1u, stats.writeLockWait.count );
+
+    ml->resetDatabaseStatistics();
+    stats = ml->databaseStatistics();
+    ASSERT_EQ( 0u, stats.requests.size() );
+    ASSERT_EQ( 0u, stats.writeLockWait.count );
+}
+
+TEST_F( Misc, DatabaseStatisticsBound )
+{
+    ml->resetDatabaseStatistics();
+    auto h = ml->getDbConn()->handle();
+    const auto nbRequests = sqlite::Statistics::MaxRequests + 10;
+    for ( auto i = 0u; i < nbRequests; ++i )
+    {
+        sqlite::Statement stmt( h, "SELECT " + std::to_string( i ) );
+        stmt.execute();
+        while ( stmt.row() != nullptr )
+            ;
+    }
+    // Executions recorded by another thread are merged with ours
+    compat::Thread t( [this]() {
+        sqlite::Tools::executeUpdate( ml->getDbConn(), "UPDATE Media SET play_count = 1" );
+    });
+    t.join();
+    auto stats = ml->databaseStatistics();
+    ASSERT_EQ( sqlite::Statistics::MaxRequests + 1, stats.requests.size() );
+    auto it = std::find_if( begin( stats.requests ), end( stats.requests ),
+                            []( const RequestStatistics& r ) {
+        return r.request == sqlite::Statistics::OtherRequests;
+    });
+    ASSERT_NE( end( stats.requests ), it );
+    // The other thread's requests were also recorded there
+    ASSERT_LE( 10u, it->duration.count );
+    ASSERT_LE( 10u, it->nbRows );
+}
+
+TEST_F( Misc, BusyHandler )
+{
+    dbTuning.busyTimeout = 100;
+    Reload();
+    ml->addMedia( "media.mkv" );
+    ml->resetDatabaseStatistics();
+
+    // Hold the write lock from another connection
+    sqlite3* raw;
+    ASSERT_EQ( SQLITE_OK, sqlite3_open( "test.db", &raw ) );
+    std::unique_ptr<sqlite3, int(*)(sqlite3*)> rawPtr( raw, &sqlite3_close );
+    ASSERT_EQ( SQLITE_OK, sqlite3_exec( raw, "BEGIN IMMEDIATE", nullptr, nullptr, nullptr ) );
+
+    const std::string req = "UPDATE Media SET play_count = play_count + 1";
+    ASSERT_THROW( sqlite::Tools::executeUpdate( ml->getDbConn(), req ),
+                  sqlite::errors::GenericExecution );
+    auto stats = ml->databaseStatistics();
+    // The request gave up once, after waiting for the busy timeout, instead
+    // of being retried right away
+    ASSERT_EQ( 1u, stats.contention.nbBusy );
+    ASSERT_EQ( 1u, stats.contention.nbTimeouts );
+    ASSERT_NE( 0u, stats.contention.busyWait.count );
+    ASSERT_GE( stats.contention.busyWait.total, 50000u );
+
+    // Release the lock while the request waits for it
+    compat::Thread releaser( [raw]() {
+        compat::this_thread::sleep_for( std::chrono::milliseconds{ 20 } );
+        sqlite3_exec( raw, "COMMIT", nullptr, nullptr, nullptr );
+    });
+    sqlite::Tools::executeUpdate( ml->getDbConn(), req );
+    releaser.join();
+    stats = ml->databaseStatistics();
+    ASSERT_EQ( 2u, stats.contention.nbBusy );
+    ASSERT_EQ( 1u, stats.contention.nbTimeouts );
+
+    // Groups of requests get retried as a whole
+    auto nbCalls = 0u;
+    sqlite::Tools::withRetries( ml->getDbConn(), 3, [&nbCalls]() {
+        if ( nbCalls++ == 0 )
+            throw sqlite::errors::GenericExecution( "database is locked", SQLITE_BUSY );
+    });
+    ASSERT_EQ( 2u, nbCalls );
+    stats = ml->databaseStatistics();
+    ASSERT_EQ( 1u, stats.contention.nbRetries );
+
+    ml->resetDatabaseStatistics();
+    stats = ml->databaseStatistics();
+    ASSERT_EQ( 0u, stats.contention.nbBusy );
+    ASSERT_EQ( 0u, stats.contention.busyWait.count );
+}
+
+TEST_F( Misc, EntityPages )
+{
+    for ( auto i = 0; i < 10; ++i )
+        ml->addMedia( "media" + std::to_string( i ) + ".mkv" );
+    dbTuning.entityPageSize = 4;
+    Reload();
+
+    auto media = ml->files();
+    ASSERT_EQ( 10u, media.size() );
+    for ( const auto& m : media )
+        ASSERT_EQ( ml->media( m->id() )->title(), m->title() );
+
+    // Entities are released along with all the other entities of their page
+    auto first = media[0];
+    std::weak_ptr<IMedia> samePage = media[1];
+    std::weak_ptr<IMedia> otherPage = media[4];
+    media.clear();
+    ASSERT_FALSE( samePage.expired() );
+    ASSERT_TRUE( otherPage.expired() );
+    first.reset();
+    ASSERT_TRUE( samePage.expired() );
+
+    dbTuning.entityPageSize = 0;
+    Reload();
+    media = ml->files();
+    ASSERT_EQ( 10u, media.size() );
+    first = media[0];
+    samePage = media[1];
+    media.clear();
+    ASSERT_TRUE( samePage.expired() );
+}
+
+TEST_F( Misc, ListingCounters )
+{
+    auto checkCounters = [this]() {
+        ASSERT_EQ( ml->audioFiles( nullptr )->all().size(),
+                   ml->audioFiles( nullptr )->count() );
+        ASSERT_EQ( ml->videoFiles( nullptr )->all().size(),
+                   ml->videoFiles( nullptr )->count() );
+        ASSERT_EQ( ml->albums( nullptr )->all().size(), ml->albums( nullptr )->count() );
+        ASSERT_EQ( ml->artists( false, nullptr )->all().size(),
+                   ml->artists( false, nullptr )->count() );
+        ASSERT_EQ( ml->artists( true, nullptr )->all().size(),
+                   ml->artists( true, nullptr )->count() );
+        ASSERT_EQ( ml->genres( nullptr )->all().size(), ml->genres( nullptr )->count() );
+        ASSERT_EQ( ml->shows( nullptr )->all().size(), ml->shows( nullptr )->count() );
+        ASSERT_EQ( ml->playlists( nullptr )->all().size(),
+                   ml->playlists( nullptr )->count() );
+    };
+    checkCounters();
+
+    auto track1 = ml->addFile( "track1.mp3", IMedia::Type::Audio );
+    auto track2 = ml->addFile( "track2.mp3", IMedia::Type::Audio );
+    auto movie = ml->addFile( "movie.mkv", IMedia::Type::Video );
+    ml->addMedia( "http://example.org/stream.mkv", IMedia::Type::Video );
+    auto album = ml->createAlbum( "album" );
+    auto albumArtist = ml->createArtist( "album artist" );
+    auto trackArtist = ml->createArtist( "track artist" );
+    album->setAlbumArtist( albumArtist );
+    album->addTrack( track1, 1, 0, trackArtist->id(), nullptr );
+    trackArtist->addMedia( *track1 );
+    auto genre = ml->createGenre( "genre" );
+    auto show = ml->createShow( "show" );
+    auto playlist = ml->createPlaylist( "playlist" );
+    checkCounters();
+    ASSERT_EQ( 2u, ml->audioFiles( nullptr )->count() );
+
+    ml->setMediaType( movie->id(), IMedia::Type::Audio );
+    sqlite::Tools::executeUpdate( ml->getDbConn(), "UPDATE " + Media::Table::Name +
+                                  " SET is_present = 0 WHERE id_media = ?",
+                                  track2->id() );
+    checkCounters();
+    ASSERT_EQ( 2u, ml->audioFiles( nullptr )->count() );
+    ASSERT_EQ( 1u, ml->videoFiles( nullptr )->count() );
+
+    ml->deleteMedia( movie->id() );
+    ml->deleteMedia( track2->id() );
+    auto file = std::static_pointer_cast<File>( track1->files()[0] );
+    track1->removeFile( *file );
+    ml->deleteGenre( genre->id() );
+    ml->deleteShow( show->id() );
+    ml->deletePlaylist( playlist->id() );
+    ml->deleteAlbum( album->id() );
+    checkCounters();
+    ASSERT_EQ( 0u, ml->audioFiles( nullptr )->count() );
+
+    Reload();
+    checkCounters();
+}
+
 class DbModel : public testing::Test
 {
 protected:
@@ -68,6 +720,8 @@ public:
     virtual void SetUp() override
     {
         unlink("test.db");
+        unlink("test.db-wal");
+        unlink("test.db-shm");
         ml.reset( new MediaLibraryTester );
         cbMock.reset( new mock::NoopCallback );
     }
@@ -121,6 +775,14 @@ public:
         medialibrary::sqlite::Connection::Handle conn;
         sqlite3_open( "test.db", &conn );
         std::unique_ptr<sqlite3, int(*)(sqlite3*)> dbPtr{ conn, &sqlite3_close };
+        {
+            medialibrary::sqlite::Statement stmt{ conn, "PRAGMA auto_vacuum" };
+            stmt.execute();
+            auto row = stmt.row();
+            uint32_t autoVacuum;
+            row >> autoVacuum;
+            ASSERT_EQ( 2u, autoVacuum );
+        }
         {
             medialibrary::sqlite::Statement stmt{ conn,
                     "SELECT * FROM Settings" };
@@ -184,7 +846,7 @@ TEST_F( DbModel, Upgrade12to13 )
     // We can't check for the number of albums anymore since they are deleted
     // as part of 13 -> 14 migration
 
-    CheckNbTriggers( 35 );
+    CheckNbTriggers( 63 );
 }
 
 TEST_F( DbModel, Upgrade13to14 )
@@ -231,7 +893,193 @@ TEST_F( DbModel, Upgrade13to14 )
     ASSERT_EQ( 2u, folder->media( IMedia::Type::Unknown, nullptr )->count() );
     ASSERT_EQ( "folder", folder->name() );
 
-    CheckNbTriggers( 35 );
+    // The counters must have been computed from the existing records
+    ASSERT_EQ( ml->videoFiles( nullptr )->all().size(), ml->videoFiles( nullptr )->count() );
+    ASSERT_EQ( ml->playlists( nullptr )->all().size(), ml->playlists( nullptr )->count() );
+
+    // The FTS tables must have been populated from the existing records
+    auto searchMedia = ml->searchMedia( "cool", nullptr )->all();
+    ASSERT_EQ( 1u, searchMedia.size() );
+    ASSERT_EQ( media[0]->id(), searchMedia[0]->id() );
+    ASSERT_EQ( 1u, ml->searchPlaylists( "playl", nullptr )->count() );
+
+    CheckNbTriggers( 63 );
+}
+
+TEST_F( DbModel, SchemaFingerprint )
+{
+    auto fingerprint = [this]() {
+        medialibrary::sqlite::Statement stmt{ ml->getDbConn()->handle(),
+                                              "PRAGMA user_version" };
+        stmt.execute();
+        auto row = stmt.row();
+        uint32_t res;
+        row >> res;
+        return res;
+    };
+    auto nbCreateRequests = [this]() {
+        auto stats = ml->databaseStatistics();
+        return std::count_if( begin( stats.requests ), end( stats.requests ),
+                              []( const RequestStatistics& r ) {
+            return r.request.compare( 0, 7, "CREATE " ) == 0;
+        });
+    };
+    auto res = ml->initialize( "test.db", "/tmp", cbMock.get() );
+    ASSERT_EQ( InitializeResult::Success, res );
+    auto expected = fingerprint();
+    ASSERT_NE( 0u, expected );
+
+    // The schema is up to date, it must not be created again
+    ml.reset( new MediaLibraryTester );
+    res = ml->initialize( "test.db", "/tmp", cbMock.get() );
+    ASSERT_EQ( InitializeResult::Success, res );
+    ASSERT_EQ( 0, nbCreateRequests() );
+    ASSERT_EQ( expected, fingerprint() );
+
+    // Simulate a schema created by another version of the library
+    {
+        medialibrary::sqlite::Statement stmt{ ml->getDbConn()->handle(),
+                                              "PRAGMA user_version = 1" };
+        stmt.execute();
+        while ( stmt.row() != nullptr )
+            ;
+    }
+    ml.reset( new MediaLibraryTester );
+    res = ml->initialize( "test.db", "/tmp", cbMock.get() );
+    ASSERT_EQ( InitializeResult::Success, res );
+    ASSERT_NE( 0, nbCreateRequests() );
+    ASSERT_EQ( expected, fingerprint() );
+}
+
+class MigrationInterrupter : public mock::NoopCallback
+{
+public:
+    virtual void onMigrationProgress( uint32_t modelVersion, uint32_t percent ) override
+    {
+        progress.emplace_back( modelVersion, percent );
+        // Interrupt the migration once, while converting the records by chunks
+        if ( interrupted == false && modelVersion == 14 && percent > 33 && percent < 100 )
+        {
+            interrupted = true;
+            throw std::runtime_error( "Interrupting the migration" );
+        }
+    }
+
+    std::vector<std::pair<uint32_t, uint32_t>> progress;
+    bool interrupted = false;
+};
+
+TEST_F( DbModel, ResumeMigration )
+{
+    LoadFakeDB( SRC_DIR "/test/unittest/db_v13.sql" );
+    MigrationInterrupter cb;
+    DatabaseTuning tuning;
+    tuning.migrationChunkSize = 1;
+    auto res = ml->initialize( "test.db", "/tmp", &cb, tuning );
+    ASSERT_EQ( InitializeResult::Success, res );
+    ASSERT_TRUE( cb.interrupted );
+    // The interrupted migration must resume from its last checkpoint instead
+    // of starting over
+    ASSERT_FALSE( cb.progress.empty() );
+    for ( auto i = 1u; i < cb.progress.size(); ++i )
+    {
+        ASSERT_LE( cb.progress[i - 1].first, cb.progress[i].first );
+        if ( cb.progress[i - 1].first == cb.progress[i].first )
+        {
+            ASSERT_LE( cb.progress[i - 1].second, cb.progress[i].second );
+        }
+    }
+    ASSERT_EQ( 100u, cb.progress.back().second );
+
+    auto media = ml->files();
+    ASSERT_EQ( 4u, media.size() );
+    ASSERT_EQ( "file with space.avi", media[0]->fileName() );
+    auto folder = ml->folder( 1 );
+    ASSERT_NE( nullptr, folder );
+    ASSERT_EQ( "folder", folder->name() );
+    CheckNbTriggers( 63 );
+}
+
+class MigrationSnapshot : public mock::NoopCallback
+{
+public:
+    virtual void onMigrationProgress( uint32_t modelVersion, uint32_t percent ) override
+    {
+        progress.emplace_back( modelVersion, percent );
+        // Save the database as it would be found if the process got killed
+        // while the media records are copied by chunks
+        if ( takeSnapshot == false || snapshotPercent != 0 ||
+             modelVersion != 14 || percent <= 300 / 7 || percent >= 400 / 7 )
+            return;
+        snapshotPercent = percent;
+        sqlite3* src;
+        sqlite3* dst;
+        sqlite3_open( "test.db", &src );
+        sqlite3_open( "snapshot.db", &dst );
+        auto backup = sqlite3_backup_init( dst, "main", src, "main" );
+        sqlite3_backup_step( backup, -1 );
+        sqlite3_backup_finish( backup );
+        sqlite3_close( dst );
+        sqlite3_close( src );
+    }
+
+    std::vector<std::pair<uint32_t, uint32_t>> progress;
+    bool takeSnapshot = true;
+    uint32_t snapshotPercent = 0;
+};
+
+TEST_F( DbModel, ResumeMigrationFromDisk )
+{
+    unlink( "snapshot.db" );
+    LoadFakeDB( SRC_DIR "/test/unittest/db_v13.sql" );
+    MigrationSnapshot cb;
+    DatabaseTuning tuning;
+    tuning.migrationChunkSize = 1;
+    auto res = ml->initialize( "test.db", "/tmp", &cb, tuning );
+    ASSERT_EQ( InitializeResult::Success, res );
+    ASSERT_NE( 0u, cb.snapshotPercent );
+
+    // Start over from the snapshot with a new instance, as if the previous one
+    // had been killed
+    ml.reset();
+    unlink( "test.db-wal" );
+    unlink( "test.db-shm" );
+    ASSERT_EQ( 0, rename( "snapshot.db", "test.db" ) );
+    MigrationSnapshot resumeCb;
+    resumeCb.takeSnapshot = false;
+    ml.reset( new MediaLibraryTester );
+    res = ml->initialize( "test.db", "/tmp", &resumeCb, tuning );
+    ASSERT_EQ( InitializeResult::Success, res );
+
+    // The migration must resume from the checkpoint saved on disk
+    ASSERT_FALSE( resumeCb.progress.empty() );
+    ASSERT_EQ( 14u, resumeCb.progress.front().first );
+    ASSERT_LT( cb.snapshotPercent, resumeCb.progress.front().second );
+    ASSERT_EQ( 100u, resumeCb.progress.back().second );
+
+    auto media = ml->files();
+    ASSERT_EQ( 4u, media.size() );
+    ASSERT_EQ( "file with space.avi", media[0]->fileName() );
+    ASSERT_EQ( ml->thumbnailPath() + "/path/to/thumbnail", media[0]->thumbnail() );
+    ASSERT_EQ( IMedia::Type::External, media[2]->type() );
+    ASSERT_EQ( 1u, std::static_pointer_cast<Media>( media[2] )->nbPlaylists() );
+    auto folder = ml->folder( 1 );
+    ASSERT_NE( nullptr, folder );
+    ASSERT_EQ( "folder", folder->name() );
+    ASSERT_EQ( 2u, folder->media( IMedia::Type::Unknown, nullptr )->count() );
+    // Each media must have been counted once in its folder
+    {
+        medialibrary::sqlite::Statement stmt{ ml->getDbConn()->handle(),
+                "SELECT nb_audio, nb_video FROM Folder WHERE id_folder = 1" };
+        stmt.execute();
+        auto row = stmt.row();
+        uint32_t nbAudio;
+        uint32_t nbVideo;
+        row >> nbAudio >> nbVideo;
+        ASSERT_EQ( 0u, nbAudio );
+        ASSERT_EQ( 2u, nbVideo );
+    }
+    CheckNbTriggers( 63 );
 }
 
 TEST_F( DbModel, Upgrade14to15 )
@@ -239,5 +1087,5 @@ TEST_F( DbModel, Upgrade14to15 )
     LoadFakeDB( SRC_DIR "/test/unittest/db_v14.sql" );
     auto res = ml->initialize( "test.db", "/tmp", cbMock.get() );
     ASSERT_EQ( InitializeResult::Success, res );
-    CheckNbTriggers( 35 );
+    CheckNbTriggers( 63 );
 }
@@ -161,6 +161,37 @@ TEST_F( Playlists, Insert )
     ASSERT_EQ( 3u, media[4]->id() );
 }
 
+TEST_F( Playlists, AddBatch )
+{
+    auto m1 = ml->addMedia( "media1.mkv" );
+    auto m2 = std::static_pointer_cast<Media>( ml->addMedia( "media2.mkv" ) );
+    auto m3 = ml->addMedia( "media3.mkv" );
+    auto m4 = ml->addMedia( "media4.mkv" );
+    auto res = pl->append( *m1 );
+    ASSERT_TRUE( res );
+
+    std::vector<std::pair<MediaPtr, unsigned int>> batch{
+        { m2, 1 }, { m3, 0 }, { m4, 2 }
+    };
+    res = pl->addBatch( batch );
+    ASSERT_TRUE( res );
+    // [<2,1>,<4,2>,<1,3>,<3,4>]
+    auto media = pl->media()->all();
+    ASSERT_EQ( 4u, media.size() );
+    ASSERT_EQ( m2->id(), media[0]->id() );
+    ASSERT_EQ( m4->id(), media[1]->id() );
+    ASSERT_EQ( m1->id(), media[2]->id() );
+    ASSERT_EQ( m3->id(), media[3]->id() );
+
+    ASSERT_EQ( 1u, m2->nbPlaylists() );
+    m2 = std::static_pointer_cast<Media>( ml->media( m2->id() ) );
+    ASSERT_EQ( 1u, m2->nbPlaylists() );
+
+    res = pl->addBatch( {} );
+    ASSERT_TRUE( res );
+    ASSERT_EQ( 4u, pl->media()->count() );
+}
+
 TEST_F( Playlists, Move )
 {
     for ( auto i = 1; i < 6; ++i )
@@ -183,6 +214,46 @@ TEST_F( Playlists, Move )
     ASSERT_EQ( 4u, media[4]->id() );
 }
 
+TEST_F( Playlists, CoalescedMove )
+{
+    for ( auto i = 1; i < 4; ++i )
+    {
+        auto m = ml->addMedia( "media" + std::to_string( i ) + ".mkv" );
+        ASSERT_NE( nullptr, m );
+        auto res = pl->append( *m );
+        ASSERT_TRUE( res );
+    }
+    // Use a long enough delay for the move not to be flushed automatically
+    ml->setWriteCoalescingDelay( 60000 );
+    ASSERT_TRUE( pl->move( 3, 1 ) );
+    // The move isn't committed yet
+    auto media = pl->media()->all();
+    ASSERT_EQ( 3u, media.size() );
+    ASSERT_EQ( 1u, media[0]->id() );
+    ASSERT_EQ( 3u, media[2]->id() );
+
+    ml->flushPendingWrites();
+
+    // [<3,1>,<1,2>,<2,3>]
+    media = pl->media()->all();
+    ASSERT_EQ( 3u, media.size() );
+    ASSERT_EQ( 3u, media[0]->id() );
+    ASSERT_EQ( 1u, media[1]->id() );
+    ASSERT_EQ( 2u, media[2]->id() );
+
+    // A pending move must be applied before an insertion shifts the positions
+    auto m = ml->addMedia( "media4.mkv" );
+    ASSERT_TRUE( pl->move( 2, 1 ) );
+    ASSERT_TRUE( pl->add( *m, 1 ) );
+    // [<4,1>,<2,2>,<3,3>,<1,4>]
+    media = pl->media()->all();
+    ASSERT_EQ( 4u, media.size() );
+    ASSERT_EQ( 4u, media[0]->id() );
+    ASSERT_EQ( 2u, media[1]->id() );
+    ASSERT_EQ( 3u, media[2]->id() );
+    ASSERT_EQ( 1u, media[3]->id() );
+}
+
 TEST_F( Playlists, Remove )
 {
     for ( auto i = 1; i < 6; ++i )
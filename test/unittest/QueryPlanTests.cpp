@@ -0,0 +1,474 @@
+/*****************************************************************************
+ * Media Library
+ *****************************************************************************
+ * Copyright (C) 2019 Hugo Beauzée-Luyssen, Videolabs, VideoLAN
+ *
+ * Authors: Hugo Beauzée-Luyssen<hugo@beauzee.fr>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#if HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "Tests.h"
+
+#include "Album.h"
+#include "Artist.h"
+#include "Device.h"
+#include "Folder.h"
+#include "Genre.h"
+#include "Label.h"
+#include "Media.h"
+#include "Playlist.h"
+#include "Show.h"
+#include "database/SqliteTools.h"
+#include "mocks/FileSystem.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <set>
+
+/*
+ * SQLite < 3.36 reports full scans as "SCAN TABLE <table> [AS <alias>]", while
+ * later versions report "SCAN <alias>", or "SCAN <table>" when there's no
+ * alias, possibly prefixed with the schema name. Convert them all to the later
+ * form, without the schema, so that the baseline doesn't depend on the SQLite
+ * version.
+ */
+static std::string normalizeDetail( const std::string& detail )
+{
+    if ( detail.compare( 0, 5, "SCAN " ) != 0 )
+        return detail;
+    auto target = detail.substr( 5 );
+    if ( target.compare( 0, 6, "TABLE " ) == 0 )
+    {
+        target.erase( 0, 6 );
+        auto end = target.find( ' ' );
+        if ( end != std::string::npos && target.compare( end, 4, " AS " ) == 0 )
+            target.erase( 0, end + 4 );
+    }
+    if ( target.compare( 0, 5, "main." ) == 0 )
+        target.erase( 0, 5 );
+    return "SCAN " + target;
+}
+
+/*
+ * Runs EXPLAIN QUERY PLAN over all the requests generated by the listing and
+ * search functions, for every sorting criteria, on a seeded database.
+ * Every full table scan or temporary b-tree used for sorting is compared to
+ * the ones listed in query_plans.txt, and the test fails if a new one shows up.
+ * When a change is expected, run the test with ML_UPDATE_QUERY_PLANS=1 to
+ * regenerate this file, and review the difference.
+ */
+class QueryPlans : public Tests
+{
+protected:
+    static constexpr auto BaselinePath = SRC_DIR "/test/unittest/query_plans.txt";
+
+    static const uint32_t NbFolders = 10;
+    static const uint32_t NbGenres = 10;
+    static const uint32_t NbArtists = 40;
+    static const uint32_t NbAlbums = 80;
+    static const uint32_t NbTracks = 800;
+    static const uint32_t NbShows = 5;
+    static const uint32_t NbVideos = 200;
+    static const uint32_t NbPlaylists = 5;
+
+    std::set<std::string> m_requests;
+    bool m_tracing = false;
+    std::set<std::string> m_offenders;
+
+    std::vector<std::shared_ptr<Folder>> folders;
+    std::vector<std::shared_ptr<Genre>> genres;
+    std::vector<std::shared_ptr<Artist>> artists;
+    std::vector<std::shared_ptr<Album>> albums;
+    std::vector<std::shared_ptr<Show>> shows;
+    std::vector<PlaylistPtr> playlists;
+    LabelPtr label;
+
+    // Holding a read context ensures all the queries use the same connection
+    std::unique_ptr<sqlite::Connection::ReadContext> readCtx;
+
+    virtual void SetUp() override
+    {
+        Tests::SetUp();
+        Seed();
+        readCtx.reset( new sqlite::Connection::ReadContext(
+                           ml->getDbConn()->acquireReadContext() ) );
+        sqlite3_trace_v2( readCtx->handle(), SQLITE_TRACE_STMT,
+                          &QueryPlans::onTrace, this );
+    }
+
+    virtual void TearDown() override
+    {
+        readCtx.reset();
+        Tests::TearDown();
+    }
+
+    void Seed()
+    {
+        auto t = ml->getDbConn()->newTransaction();
+        auto device = ml->addDevice( "{query-plans}", false );
+        mock::NoopDevice deviceFs;
+        auto dirFs = std::make_shared<mock::NoopDirectory>();
+        for ( auto i = 0u; i < NbFolders; ++i )
+            folders.push_back( Folder::create( ml.get(), "file:///media/folder" +
+                                               std::to_string( i ) + "/", 0,
+                                               *device, deviceFs ) );
+        for ( auto i = 0u; i < NbGenres; ++i )
+            genres.push_back( ml->createGenre( "genre " + std::to_string( i ) ) );
+        for ( auto i = 0u; i < NbArtists; ++i )
+            artists.push_back( ml->createArtist( "artist " + std::to_string( i ) ) );
+        for ( auto i = 0u; i < NbAlbums; ++i )
+        {
+            auto album = ml->createAlbum( "album " + std::to_string( i ) );
+            album->setAlbumArtist( artists[i % NbArtists] );
+            album->setReleaseYear( 1970 + i % 50, true );
+            albums.push_back( std::move( album ) );
+        }
+        for ( auto i = 0u; i < NbShows; ++i )
+            shows.push_back( ml->createShow( "show " + std::to_string( i ) ) );
+        for ( auto i = 0u; i < NbPlaylists; ++i )
+            playlists.push_back( ml->createPlaylist( "playlist " + std::to_string( i ) ) );
+
+        for ( auto i = 0u; i < NbTracks; ++i )
+        {
+            const auto& folder = folders[i % NbFolders];
+            auto m = ml->addFile( std::make_shared<mock::NoopFile>( folder->mrl() +
+                                        "track" + std::to_string( i ) + ".mp3" ),
+                                  folder, dirFs, IFile::Type::Main, IMedia::Type::Audio );
+            const auto& artist = artists[i % NbArtists];
+            artist->addMedia( *m );
+            albums[i % NbAlbums]->addTrack( m, i / NbAlbums + 1, 0, artist->id(),
+                                            genres[i % NbGenres].get() );
+            m->setDuration( 1000 * ( i % 300 ) );
+            if ( i % 7 == 0 )
+                m->increasePlayCount();
+            if ( i % 11 == 0 )
+                playlists[i % NbPlaylists]->append( *m );
+            m->save();
+        }
+        for ( auto i = 0u; i < NbVideos; ++i )
+        {
+            const auto& folder = folders[i % NbFolders];
+            auto m = ml->addFile( std::make_shared<mock::NoopFile>( folder->mrl() +
+                                        "video" + std::to_string( i ) + ".mkv" ),
+                                  folder, dirFs, IFile::Type::Main, IMedia::Type::Video );
+            if ( i % 2 == 0 )
+                shows[i % NbShows]->addEpisode( *m, i );
+            m->setDuration( 60000 * ( i % 90 ) );
+            if ( i % 5 == 0 )
+                m->increasePlayCount();
+            m->save();
+        }
+        t->commit();
+
+        // Labels are linked in their own transaction
+        label = ml->createLabel( "label" );
+        for ( auto i = 0u; i < NbVideos; i += 10 )
+        {
+            auto m = ml->media( NbTracks + i + 1 );
+            m->addLabel( label );
+            m->addLabel( ml->createLabel( "label " + std::to_string( i ) ) );
+        }
+        sqlite::Tools::executeRequest( ml->getDbConn(), "ANALYZE" );
+    }
+
+    static int onTrace( unsigned int, void* data, void* p, void* x )
+    {
+        auto self = static_cast<QueryPlans*>( data );
+        // Ignore the requests issued by triggers & virtual tables, which are
+        // reported as comments
+        if ( self->m_tracing == false ||
+             strncmp( static_cast<const char*>( x ), "--", 2 ) == 0 )
+            return 0;
+        // FTS5 loads a table configuration through its own statement the first
+        // time a connection uses it, which would make the baseline depend on
+        // the order the listings run in. Its statements address the shadow
+        // tables as 'main'.'<table>_<suffix>', which the library never does.
+        if ( strstr( static_cast<const char*>( x ), "'main'.'" ) != nullptr )
+            return 0;
+        auto req = sqlite3_expanded_sql( static_cast<sqlite3_stmt*>( p ) );
+        if ( req != nullptr )
+        {
+            self->m_requests.insert( req );
+            sqlite3_free( req );
+        }
+        return 0;
+    }
+
+    static bool isOffending( const std::string& detail )
+    {
+        if ( detail.compare( 0, 20, "USE TEMP B-TREE FOR " ) == 0 )
+            return detail.find( "ORDER BY" ) != std::string::npos;
+        if ( detail.compare( 0, 5, "SCAN " ) != 0 )
+            return false;
+        // Walking an index, a subquery result or a virtual table is fine
+        return detail.find( " USING " ) == std::string::npos &&
+               detail.find( "(subquery" ) == std::string::npos &&
+               detail.compare( 0, 14, "SCAN SUBQUERY " ) != 0 &&
+               detail.find( "VIRTUAL TABLE" ) == std::string::npos &&
+               detail != "SCAN CONSTANT ROW";
+    }
+
+    static std::string sortName( SortingCriteria sort )
+    {
+        static const char* names[] = {
+            "Default", "Alpha", "Duration", "InsertionDate", "LastModificationDate",
+            "ReleaseDate", "FileSize", "Artist", "PlayCount", "Album", "Filename",
+            "TrackNumber", "NbVideo", "NbAudio", "NbMedia", "Relevance",
+        };
+        return names[static_cast<std::underlying_type<SortingCriteria>::type>( sort )];
+    }
+
+    /*
+     * Runs all the requests a query can generate, and records the problematic
+     * steps of their query plans
+     */
+    template <typename T>
+    void Explain( const std::string& label, const Query<T>& query )
+    {
+        ASSERT_NE( nullptr, query );
+        m_requests.clear();
+        m_tracing = true;
+        query->count();
+        auto items = query->all();
+        query->items( 10, 5 );
+        query->itemsAfter( 0, 10 );
+        if ( items.empty() == false )
+            query->itemsBefore( items[items.size() / 2]->id(), 10 );
+        m_tracing = false;
+
+        for ( const auto& req : m_requests )
+        {
+            sqlite::Statement stmt( readCtx->handle(), "EXPLAIN QUERY PLAN " + req );
+            stmt.execute();
+            sqlite::Row row;
+            while ( ( row = stmt.row() ) != nullptr )
+            {
+                auto detail = normalizeDetail( row.load<std::string>( 3 ) );
+                if ( isOffending( detail ) == true )
+                    m_offenders.insert( label + '\t' + detail );
+            }
+        }
+    }
+
+    template <typename Func>
+    void ExplainAllSorts( const std::string& label, Func func )
+    {
+        for ( auto sort = SortingCriteria::Default; sort <= SortingCriteria::Relevance;
+              sort = static_cast<SortingCriteria>( static_cast<int>( sort ) + 1 ) )
+        {
+            for ( auto desc : { false, true } )
+            {
+                QueryParameters params{ sort, desc };
+                Explain( label + '/' + sortName( sort ) + ( desc ? "/desc" : "/asc" ),
+                         func( &params ) );
+            }
+        }
+    }
+
+    std::set<std::string> LoadBaseline()
+    {
+        std::set<std::string> res;
+        std::ifstream file{ BaselinePath };
+        std::string line;
+        while ( std::getline( file, line ) )
+        {
+            if ( line.empty() == false && line[0] != '#' )
+                res.insert( line );
+        }
+        return res;
+    }
+
+    void SaveBaseline()
+    {
+        std::ofstream file{ BaselinePath };
+        file << "# Full table scans & temporary b-trees used for sorting, per listing.\n"
+                "# Generated by the QueryPlans unit test, see QueryPlanTests.cpp\n";
+        for ( const auto& o : m_offenders )
+            file << o << '\n';
+    }
+};
+
+TEST( QueryPlanDetails, Normalize )
+{
+    ASSERT_EQ( "SCAN m", normalizeDetail( "SCAN TABLE Media AS m" ) );
+    ASSERT_EQ( "SCAN m", normalizeDetail( "SCAN m" ) );
+    ASSERT_EQ( "SCAN Media", normalizeDetail( "SCAN TABLE Media" ) );
+    ASSERT_EQ( "SCAN Media", normalizeDetail( "SCAN main.Media" ) );
+    ASSERT_EQ( "SCAN m USING INDEX media_types_idx",
+               normalizeDetail( "SCAN TABLE Media AS m USING INDEX media_types_idx" ) );
+    ASSERT_EQ( "USE TEMP B-TREE FOR ORDER BY",
+               normalizeDetail( "USE TEMP B-TREE FOR ORDER BY" ) );
+}
+
+TEST_F( QueryPlans, NoNewFullScans )
+{
+    const std::string pattern = "track";
+    auto album = albums[0];
+    auto artist = artists[0];
+    auto genre = genres[0];
+    auto show = shows[0];
+    auto playlist = playlists[0];
+    auto folder = folders[0];
+
+    ExplainAllSorts( "audioFiles", [this]( const QueryParameters* p ) {
+        return ml->audioFiles( p );
+    });
+    ExplainAllSorts( "videoFiles", [this]( const QueryParameters* p ) {
+        return ml->videoFiles( p );
+    });
+    ExplainAllSorts( "albums", [this]( const QueryParameters* p ) {
+        return ml->albums( p );
+    });
+    ExplainAllSorts( "shows", [this]( const QueryParameters* p ) {
+        return ml->shows( p );
+    });
+    ExplainAllSorts( "artists", [this]( const QueryParameters* p ) {
+        return ml->artists( false, p );
+    });
+    ExplainAllSorts( "artists/all", [this]( const QueryParameters* p ) {
+        return ml->artists( true, p );
+    });
+    ExplainAllSorts( "genres", [this]( const QueryParameters* p ) {
+        return ml->genres( p );
+    });
+    ExplainAllSorts( "playlists", [this]( const QueryParameters* p ) {
+        return ml->playlists( p );
+    });
+    ExplainAllSorts( "folders/audio", [this]( const QueryParameters* p ) {
+        return ml->folders( IMedia::Type::Audio, p );
+    });
+    ExplainAllSorts( "folders/unknown", [this]( const QueryParameters* p ) {
+        return ml->folders( IMedia::Type::Unknown, p );
+    });
+    ExplainAllSorts( "searchMedia", [this, &pattern]( const QueryParameters* p ) {
+        return ml->searchMedia( pattern, p );
+    });
+    ExplainAllSorts( "searchAudio", [this, &pattern]( const QueryParameters* p ) {
+        return ml->searchAudio( pattern, p );
+    });
+    ExplainAllSorts( "searchVideo", [this]( const QueryParameters* p ) {
+        return ml->searchVideo( "video", p );
+    });
+    ExplainAllSorts( "searchPlaylists", [this]( const QueryParameters* p ) {
+        return ml->searchPlaylists( "playlist", p );
+    });
+    ExplainAllSorts( "searchAlbums", [this]( const QueryParameters* p ) {
+        return ml->searchAlbums( "album", p );
+    });
+    ExplainAllSorts( "searchGenre", [this]( const QueryParameters* p ) {
+        return ml->searchGenre( "genre", p );
+    });
+    ExplainAllSorts( "searchArtists", [this]( const QueryParameters* p ) {
+        return ml->searchArtists( "artist", true, p );
+    });
+    ExplainAllSorts( "searchShows", [this]( const QueryParameters* p ) {
+        return ml->searchShows( "show", p );
+    });
+    ExplainAllSorts( "searchFolders", [this]( const QueryParameters* p ) {
+        return ml->searchFolders( "folder", IMedia::Type::Unknown, p );
+    });
+    ExplainAllSorts( "fuzzySearchMedia", [this]( const QueryParameters* p ) {
+        return ml->fuzzySearchMedia( "trakc", p );
+    });
+    ExplainAllSorts( "fuzzySearchAlbums", [this]( const QueryParameters* p ) {
+        return ml->fuzzySearchAlbums( "albmu", p );
+    });
+    ExplainAllSorts( "fuzzySearchArtists", [this]( const QueryParameters* p ) {
+        return ml->fuzzySearchArtists( "artsit", true, p );
+    });
+    ExplainAllSorts( "Album::tracks", [&album]( const QueryParameters* p ) {
+        return album->tracks( p );
+    });
+    ExplainAllSorts( "Album::tracks/genre", [&album, &genre]( const QueryParameters* p ) {
+        return album->tracks( genre, p );
+    });
+    ExplainAllSorts( "Album::artists", [&album]( const QueryParameters* p ) {
+        return album->artists( p );
+    });
+    ExplainAllSorts( "Album::searchTracks", [&album, &pattern]( const QueryParameters* p ) {
+        return album->searchTracks( pattern, p );
+    });
+    ExplainAllSorts( "Artist::albums", [&artist]( const QueryParameters* p ) {
+        return artist->albums( p );
+    });
+    ExplainAllSorts( "Artist::searchAlbums", [&artist]( const QueryParameters* p ) {
+        return artist->searchAlbums( "album", p );
+    });
+    ExplainAllSorts( "Artist::tracks", [&artist]( const QueryParameters* p ) {
+        return artist->tracks( p );
+    });
+    ExplainAllSorts( "Artist::searchTracks", [&artist, &pattern]( const QueryParameters* p ) {
+        return artist->searchTracks( pattern, p );
+    });
+    ExplainAllSorts( "Genre::artists", [&genre]( const QueryParameters* p ) {
+        return genre->artists( p );
+    });
+    ExplainAllSorts( "Genre::searchArtists", [&genre]( const QueryParameters* p ) {
+        return genre->searchArtists( "artist", p );
+    });
+    ExplainAllSorts( "Genre::tracks", [&genre]( const QueryParameters* p ) {
+        return genre->tracks( p );
+    });
+    ExplainAllSorts( "Genre::searchTracks", [&genre, &pattern]( const QueryParameters* p ) {
+        return genre->searchTracks( pattern, p );
+    });
+    ExplainAllSorts( "Genre::albums", [&genre]( const QueryParameters* p ) {
+        return genre->albums( p );
+    });
+    ExplainAllSorts( "Genre::searchAlbums", [&genre]( const QueryParameters* p ) {
+        return genre->searchAlbums( "album", p );
+    });
+    ExplainAllSorts( "Show::episodes", [&show]( const QueryParameters* p ) {
+        return show->episodes( p );
+    });
+    ExplainAllSorts( "Show::searchEpisodes", [&show]( const QueryParameters* p ) {
+        return show->searchEpisodes( "video", p );
+    });
+    ExplainAllSorts( "Playlist::searchMedia", [&playlist, &pattern]( const QueryParameters* p ) {
+        return playlist->searchMedia( pattern, p );
+    });
+    ExplainAllSorts( "Folder::media", [&folder]( const QueryParameters* p ) {
+        return folder->media( IMedia::Type::Unknown, p );
+    });
+    ExplainAllSorts( "Folder::subfolders", [&folder]( const QueryParameters* p ) {
+        return folder->subfolders( p );
+    });
+    Explain( "history", ml->history() );
+    Explain( "streamHistory", ml->streamHistory() );
+    Explain( "entryPoints", ml->entryPoints() );
+    Explain( "Playlist::media", playlist->media() );
+    Explain( "Label::media", label->media() );
+
+    if ( getenv( "ML_UPDATE_QUERY_PLANS" ) != nullptr )
+    {
+        SaveBaseline();
+        return;
+    }
+    auto baseline = LoadBaseline();
+    std::string regressions;
+    for ( const auto& o : m_offenders )
+    {
+        if ( baseline.find( o ) == end( baseline ) )
+            regressions += o + '\n';
+    }
+    ASSERT_TRUE( regressions.empty() ) << "New full scans or temporary b-trees:\n"
+                                       << regressions;
+}
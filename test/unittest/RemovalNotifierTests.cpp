@@ -27,6 +27,7 @@
 #include "Tests.h"
 #include "Media.h"
 #include "File.h"
+#include "Label.h"
 #include "mocks/NoopCallback.h"
 #include "compat/Mutex.h"
 
@@ -101,3 +102,52 @@ TEST_F( RemovalNotifierTests, DeleteBatch )
     auto res = cbMock->waitForNotif( std::move( lock ), std::chrono::seconds{ 1 } );
     ASSERT_EQ( 5u, res );
 }
+
+TEST_F( RemovalNotifierTests, DeletionHooks )
+{
+    std::vector<std::vector<int64_t>> batches;
+    ml->getDbConn()->registerDeletionHook( Label::Table::Name,
+                                           [&batches]( std::vector<int64_t> rowIds ) {
+        batches.push_back( std::move( rowIds ) );
+    });
+    auto l1 = ml->createLabel( "label 1" );
+    auto l2 = ml->createLabel( "label 2" );
+    auto l3 = ml->createLabel( "label 3" );
+    ASSERT_EQ( 0u, batches.size() );
+
+    // The rows deleted by a transaction are reported at once, when it commits
+    {
+        auto t = ml->getDbConn()->newTransaction();
+        ml->deleteLabel( l1 );
+        ml->deleteLabel( l2 );
+        ASSERT_EQ( 0u, batches.size() );
+        t->commit();
+    }
+    ASSERT_EQ( 1u, batches.size() );
+    ASSERT_EQ( ( std::vector<int64_t>{ l1->id(), l2->id() } ), batches[0] );
+
+    // Deletions which get rolled back aren't reported
+    {
+        auto t = ml->getDbConn()->newTransaction();
+        ml->deleteLabel( l3 );
+    }
+    ASSERT_EQ( 1u, batches.size() );
+
+    // Nor are the ones made by a savepoint which gets rolled back
+    auto l4 = ml->createLabel( "label 4" );
+    {
+        auto t = ml->getDbConn()->newTransaction();
+        {
+            auto nested = ml->getDbConn()->newTransaction();
+            ml->deleteLabel( l3 );
+        }
+        ml->deleteLabel( l4 );
+        t->commit();
+    }
+    ASSERT_EQ( 2u, batches.size() );
+    ASSERT_EQ( ( std::vector<int64_t>{ l4->id() } ), batches[1] );
+
+    ml->deleteLabel( l3 );
+    ASSERT_EQ( 3u, batches.size() );
+    ASSERT_EQ( ( std::vector<int64_t>{ l3->id() } ), batches[2] );
+}
@@ -53,7 +53,7 @@ void Tests::Reload()
     ml->setFsFactory( fsFactory );
     ml->setDeviceLister( mockDeviceLister );
     ml->setVerbosity( LogLevel::Error );
-    auto res = ml->initialize( "test.db", "/tmp", mlCb );
+    auto res = ml->initialize( "test.db", "/tmp", mlCb, dbTuning );
     ASSERT_EQ( InitializeResult::Success, res );
     auto startRes = ml->start();
     ASSERT_TRUE( startRes );
@@ -64,6 +64,8 @@ void Tests::Reload()
 void Tests::SetUp()
 {
     unlink("test.db");
+    unlink("test.db-wal");
+    unlink("test.db-shm");
     Reload();
 }
 
@@ -36,9 +36,46 @@ protected:
     IMediaLibraryCb* mlCb;
     std::shared_ptr<fs::IFileSystemFactory> fsFactory;
     std::shared_ptr<mock::MockDeviceLister> mockDeviceLister;
+    DatabaseTuning dbTuning;
 
     virtual void SetUp() override;
     virtual void InstantiateMediaLibrary();
     virtual void Reload();
     virtual void TearDown() override;
+
+    /*
+     * Goes through the whole query result with itemsAfter & itemsBefore, and
+     * checks that the items are the ones returned by all(), in the same order.
+     */
+    template <typename T>
+    void checkSeekPagination( const medialibrary::Query<T>& query, uint32_t pageSize )
+    {
+        std::vector<int64_t> expected;
+        for ( const auto& i : query->all() )
+            expected.push_back( i->id() );
+
+        std::vector<int64_t> ids;
+        auto items = query->itemsAfter( 0, pageSize );
+        while ( items.empty() == false )
+        {
+            ASSERT_GE( pageSize, items.size() );
+            for ( const auto& i : items )
+                ids.push_back( i->id() );
+            items = query->itemsAfter( ids.back(), pageSize );
+        }
+        ASSERT_EQ( expected, ids );
+
+        ids.clear();
+        items = query->itemsBefore( 0, pageSize );
+        while ( items.empty() == false )
+        {
+            ASSERT_GE( pageSize, items.size() );
+            std::vector<int64_t> page;
+            for ( const auto& i : items )
+                page.push_back( i->id() );
+            ids.insert( begin( ids ), begin( page ), end( page ) );
+            items = query->itemsBefore( ids.front(), pageSize );
+        }
+        ASSERT_EQ( expected, ids );
+    }
 };